@@ -0,0 +1,334 @@
+#include "precompiled.h"
+
+#include "BoundsHierarchy.h"
+#include "JobSystem.h"
+#include "FrameArena.h"
+
+namespace {
+	typedef BoundsHierarchy::Box Box;
+
+	void Grow(Box& box, const Box& other)
+	{
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			box.Min[axis] = std::min(box.Min[axis], other.Min[axis]);
+			box.Max[axis] = std::max(box.Max[axis], other.Max[axis]);
+		}
+	}
+
+	Box EmptyBox()
+	{
+		Box box;
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			box.Min[axis] = std::numeric_limits<float>::max();
+			box.Max[axis] = -std::numeric_limits<float>::max();
+		}
+		return box;
+	}
+
+	float GetCentroid(const Box& box, unsigned axis)
+	{
+		return box.Min[axis] + box.Max[axis];
+	}
+
+	// Splits [first, last) in up to 2^levels ranges by the median centroid on the longest axis
+	void SplitRange(std::vector<unsigned>& items,
+		const std::vector<Box>& boxes,
+		unsigned first,
+		unsigned last,
+		unsigned levels,
+		std::vector<std::pair<unsigned, unsigned>>& outRanges)
+	{
+		if (!levels || last - first < 2)
+		{
+			outRanges.push_back(std::make_pair(first, last));
+			return;
+		}
+
+		float minCentroid[3];
+		float maxCentroid[3];
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			minCentroid[axis] = std::numeric_limits<float>::max();
+			maxCentroid[axis] = -std::numeric_limits<float>::max();
+		}
+		for (auto i = first; i < last; ++i)
+		{
+			for (auto axis = 0u; axis < 3; ++axis)
+			{
+				const float centroid = GetCentroid(boxes[items[i]], axis);
+				minCentroid[axis] = std::min(minCentroid[axis], centroid);
+				maxCentroid[axis] = std::max(maxCentroid[axis], centroid);
+			}
+		}
+		unsigned splitAxis = 0;
+		for (auto axis = 1u; axis < 3; ++axis)
+		{
+			if (maxCentroid[axis] - minCentroid[axis] > maxCentroid[splitAxis] - minCentroid[splitAxis])
+				splitAxis = axis;
+		}
+
+		const auto middle = first + (last - first) / 2;
+		std::nth_element(items.begin() + first, items.begin() + middle, items.begin() + last,
+			[&boxes, splitAxis](unsigned lhs, unsigned rhs) {
+				return GetCentroid(boxes[lhs], splitAxis) < GetCentroid(boxes[rhs], splitAxis);
+			});
+
+		SplitRange(items, boxes, first, middle, levels - 1, outRanges);
+		SplitRange(items, boxes, middle, last, levels - 1, outRanges);
+	}
+}
+
+BoundsHierarchy::BoundsHierarchy()
+{}
+
+void BoundsHierarchy::Build(const std::vector<Box>& boxes)
+{
+	m_Nodes.clear();
+	m_Items.resize(boxes.size());
+	m_Boxes = boxes;
+	m_DirtyNodes.clear();
+
+	if (!boxes.empty())
+	{
+		std::vector<unsigned> items(boxes.size());
+		std::iota(items.begin(), items.end(), 0u);
+		BuildNode(items, 0, unsigned(items.size()), NO_PARENT, 0);
+	}
+	m_IsNodeDirty.assign(m_Nodes.size(), false);
+}
+
+unsigned BoundsHierarchy::BuildNode(std::vector<unsigned>& items, unsigned first, unsigned last, unsigned parent, unsigned parentSlot)
+{
+	const auto index = unsigned(m_Nodes.size());
+	m_Nodes.push_back(Node());
+	{
+		Node& node = m_Nodes.back();
+		::memset(&node, 0, sizeof(node));
+		node.Parent = parent;
+		node.ParentSlot = parentSlot;
+	}
+
+	// 3 levels of binary splits give the 8 children
+	std::vector<std::pair<unsigned, unsigned>> ranges;
+	if (last - first <= CullingKernel::BOXES_PER_TEST)
+	{
+		for (auto i = first; i < last; ++i)
+		{
+			ranges.push_back(std::make_pair(i, i + 1));
+		}
+	}
+	else
+	{
+		SplitRange(items, m_Boxes, first, last, 3, ranges);
+	}
+
+	for (auto slot = 0u; slot < unsigned(ranges.size()); ++slot)
+	{
+		const auto& range = ranges[slot];
+		Box bounds;
+		std::int32_t child;
+		if (range.second - range.first == 1)
+		{
+			const auto item = items[range.first];
+			m_Items[item].Node = index;
+			m_Items[item].Slot = slot;
+			bounds = m_Boxes[item];
+			child = ~std::int32_t(item);
+		}
+		else
+		{
+			// Adds nodes - no references to m_Nodes across the call
+			const auto childNode = BuildNode(items, range.first, range.second, index, slot);
+			bounds = GetNodeBounds(childNode);
+			child = std::int32_t(childNode);
+		}
+		m_Nodes[index].Children[slot] = child;
+		SetChildBounds(index, slot, bounds);
+	}
+	m_Nodes[index].ChildrenCount = unsigned(ranges.size());
+
+	return index;
+}
+
+void BoundsHierarchy::SetChildBounds(unsigned node, unsigned slot, const Box& box)
+{
+	auto& bounds = m_Nodes[node].Bounds;
+	bounds.MinX[slot] = box.Min[0];
+	bounds.MinY[slot] = box.Min[1];
+	bounds.MinZ[slot] = box.Min[2];
+	bounds.MaxX[slot] = box.Max[0];
+	bounds.MaxY[slot] = box.Max[1];
+	bounds.MaxZ[slot] = box.Max[2];
+}
+
+BoundsHierarchy::Box BoundsHierarchy::GetNodeBounds(unsigned node) const
+{
+	const Node& n = m_Nodes[node];
+	Box box = EmptyBox();
+	for (auto slot = 0u; slot < n.ChildrenCount; ++slot)
+	{
+		const Box child = {
+			{ n.Bounds.MinX[slot], n.Bounds.MinY[slot], n.Bounds.MinZ[slot] },
+			{ n.Bounds.MaxX[slot], n.Bounds.MaxY[slot], n.Bounds.MaxZ[slot] }
+		};
+		Grow(box, child);
+	}
+	return box;
+}
+
+void BoundsHierarchy::MarkDirty(unsigned node)
+{
+	if (m_IsNodeDirty[node])
+		return;
+	m_IsNodeDirty[node] = true;
+	m_DirtyNodes.push_back(node);
+	std::push_heap(m_DirtyNodes.begin(), m_DirtyNodes.end());
+}
+
+void BoundsHierarchy::UpdateItem(unsigned item, const Box& box)
+{
+	m_Boxes[item] = box;
+	const auto& ref = m_Items[item];
+	SetChildBounds(ref.Node, ref.Slot, box);
+	MarkDirty(ref.Node);
+}
+
+unsigned BoundsHierarchy::Refit()
+{
+	unsigned refitCount = 0;
+	while (!m_DirtyNodes.empty())
+	{
+		std::pop_heap(m_DirtyNodes.begin(), m_DirtyNodes.end());
+		const auto node = m_DirtyNodes.back();
+		m_DirtyNodes.pop_back();
+		m_IsNodeDirty[node] = false;
+		++refitCount;
+
+		const auto parent = m_Nodes[node].Parent;
+		if (parent == NO_PARENT)
+			continue;
+		SetChildBounds(parent, m_Nodes[node].ParentSlot, GetNodeBounds(node));
+		MarkDirty(parent);
+	}
+	return refitCount;
+}
+
+void BoundsHierarchy::CollectItems(unsigned node, std::vector<unsigned>& outItems) const
+{
+	const Node& n = m_Nodes[node];
+	for (auto slot = 0u; slot < n.ChildrenCount; ++slot)
+	{
+		const auto child = n.Children[slot];
+		if (child < 0)
+			outItems.push_back(unsigned(~child));
+		else
+			CollectItems(unsigned(child), outItems);
+	}
+}
+
+void BoundsHierarchy::CullNode(unsigned root, const CullingKernel::FrustumPlanes& planes, std::vector<unsigned>& outItems, Stats& outStats) const
+{
+	// Runs in the jobs of a parallel cull - the stack is scratch of the thread
+	static const size_t STACK_RESERVE = 256;
+	auto& arena = FrameArena::GetThreadArena();
+	ScopedRewind rewind(arena);
+	FrameVector<unsigned> stack{ FrameAllocator<unsigned>(&arena) };
+	stack.reserve(STACK_RESERVE);
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const Node& node = m_Nodes[stack.back()];
+		stack.pop_back();
+		++outStats.NodesVisited;
+		outStats.BoxesTested += node.ChildrenCount;
+
+		unsigned inside = 0;
+		const unsigned visible = CullingKernel::TestBoxes(planes, node.Bounds, node.ChildrenCount, inside);
+		for (auto slot = 0u; slot < node.ChildrenCount; ++slot)
+		{
+			if (!(visible & (1u << slot)))
+				continue;
+
+			const auto child = node.Children[slot];
+			if (child < 0)
+			{
+				outItems.push_back(unsigned(~child));
+				++outStats.ItemsVisible;
+			}
+			else if (inside & (1u << slot))
+			{
+				const auto count = outItems.size();
+				CollectItems(unsigned(child), outItems);
+				outStats.ItemsVisible += unsigned(outItems.size() - count);
+				outStats.ItemsAccepted += unsigned(outItems.size() - count);
+			}
+			else
+			{
+				stack.push_back(unsigned(child));
+			}
+		}
+	}
+}
+
+void BoundsHierarchy::Cull(const CullingKernel::FrustumPlanes& planes, bool parallel, std::vector<unsigned>& outItems, Stats& outStats) const
+{
+	outStats = Stats();
+	if (m_Nodes.empty())
+		return;
+
+	if (!parallel)
+	{
+		CullNode(0, planes, outItems, outStats);
+		return;
+	}
+
+	// The root is tested here and every visible subtree under it is a task
+	const Node& root = m_Nodes[0];
+	++outStats.NodesVisited;
+	outStats.BoxesTested += root.ChildrenCount;
+	unsigned inside = 0;
+	const unsigned visible = CullingKernel::TestBoxes(planes, root.Bounds, root.ChildrenCount, inside);
+
+	struct SubtreeResult
+	{
+		std::vector<unsigned> Items;
+		Stats SubtreeStats;
+	};
+	SubtreeResult results[CullingKernel::BOXES_PER_TEST];
+	JobSystem::Counter subtrees;
+	for (auto slot = 0u; slot < root.ChildrenCount; ++slot)
+	{
+		if (!(visible & (1u << slot)))
+			continue;
+
+		const auto child = root.Children[slot];
+		auto& result = results[slot];
+		if (child < 0)
+		{
+			result.Items.push_back(unsigned(~child));
+			++result.SubtreeStats.ItemsVisible;
+		}
+		else if (inside & (1u << slot))
+		{
+			CollectItems(unsigned(child), result.Items);
+			result.SubtreeStats.ItemsVisible += unsigned(result.Items.size());
+			result.SubtreeStats.ItemsAccepted += unsigned(result.Items.size());
+		}
+		else
+		{
+			gJobSystem->Run("Hierarchy cull", [this, child, &planes, &result]() {
+				CullNode(unsigned(child), planes, result.Items, result.SubtreeStats);
+			}, &subtrees);
+		}
+	}
+	gJobSystem->Wait(subtrees);
+
+	// Merged slot by slot - the order does not depend on the task timings
+	for (const auto& result : results)
+	{
+		outItems.insert(outItems.end(), result.Items.begin(), result.Items.end());
+		outStats += result.SubtreeStats;
+	}
+}
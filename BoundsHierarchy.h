@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "CullingKernel.h"
+
+// 8-wide bounding volume hierarchy over axis-aligned boxes for frustum
+// culling. Every node keeps the boxes of its up to 8 children SoA, so one
+// CullingKernel::TestBoxes call decides a whole node. Items that move are
+// updated in place and Refit walks only the paths from them to the root.
+class BoundsHierarchy
+{
+public:
+	struct Box
+	{
+		float Min[3];
+		float Max[3];
+	};
+
+	struct Stats
+	{
+		Stats()
+			: NodesVisited(0)
+			, BoxesTested(0)
+			, ItemsVisible(0)
+			, ItemsAccepted(0)
+		{}
+
+		Stats& operator+=(const Stats& other)
+		{
+			NodesVisited += other.NodesVisited;
+			BoxesTested += other.BoxesTested;
+			ItemsVisible += other.ItemsVisible;
+			ItemsAccepted += other.ItemsAccepted;
+			return *this;
+		}
+
+		unsigned NodesVisited;
+		unsigned BoxesTested;
+		unsigned ItemsVisible;
+		// Visible items in subtrees entirely in the frustum - not tested one by one
+		unsigned ItemsAccepted;
+	};
+
+	BoundsHierarchy();
+
+	// Item i gets boxes[i]. The children of a node are picked by median
+	// splits of the centroids on the longest axis.
+	void Build(const std::vector<Box>& boxes);
+
+	// The tree keeps its structure - call Refit before the next Cull
+	void UpdateItem(unsigned item, const Box& box);
+	// Returns the number of nodes that got new bounds
+	unsigned Refit();
+
+	// Appends the items that are in or intersect the frustum. With 'parallel'
+	// the subtrees under the root are traversed as separate jobs.
+	void Cull(const CullingKernel::FrustumPlanes& planes, bool parallel, std::vector<unsigned>& outItems, Stats& outStats) const;
+
+	const Box& GetItemBox(unsigned item) const { return m_Boxes[item]; }
+	unsigned GetItemsCount() const { return unsigned(m_Items.size()); }
+	unsigned GetNodesCount() const { return unsigned(m_Nodes.size()); }
+
+private:
+	struct Node
+	{
+		CullingKernel::Boxes8 Bounds;
+		// >= 0 - node index, < 0 - ~item index
+		std::int32_t Children[CullingKernel::BOXES_PER_TEST];
+		unsigned ChildrenCount;
+		unsigned Parent;
+		unsigned ParentSlot;
+	};
+
+	struct ItemRef
+	{
+		unsigned Node;
+		unsigned Slot;
+	};
+
+	static const unsigned NO_PARENT = ~0u;
+
+	unsigned BuildNode(std::vector<unsigned>& items, unsigned first, unsigned last, unsigned parent, unsigned parentSlot);
+	void SetChildBounds(unsigned node, unsigned slot, const Box& box);
+	Box GetNodeBounds(unsigned node) const;
+	void MarkDirty(unsigned node);
+
+	void CullNode(unsigned node, const CullingKernel::FrustumPlanes& planes, std::vector<unsigned>& outItems, Stats& outStats) const;
+	void CollectItems(unsigned node, std::vector<unsigned>& outItems) const;
+
+	std::vector<Node> m_Nodes;
+	std::vector<ItemRef> m_Items;
+	std::vector<Box> m_Boxes;
+
+	// Kept as a max-heap - children have higher indices than their parents,
+	// so popping the largest index refits a node after all its dirty children
+	std::vector<unsigned> m_DirtyNodes;
+	std::vector<bool> m_IsNodeDirty;
+};
@@ -0,0 +1,37 @@
+#include "precompiled.h"
+
+#include "BufferReadback.h"
+
+bool ReadBackBuffer(ID3D11Device* device,
+	ID3D11DeviceContext* context,
+	ID3D11Buffer* buffer,
+	std::vector<std::uint8_t>& outData)
+{
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+
+	ReleaseGuard<ID3D11Buffer> staging;
+	if (FAILED(device->CreateBuffer(&desc, nullptr, staging.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create staging buffer for readback");
+		return false;
+	}
+	context->CopyResource(staging.Get(), buffer);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+	if (FAILED(context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to map staging buffer for readback");
+		return false;
+	}
+	const auto data = static_cast<const std::uint8_t*>(mapped.pData);
+	outData.assign(data, data + desc.ByteWidth);
+	context->Unmap(staging.Get(), 0);
+
+	return true;
+}
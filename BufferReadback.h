@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Copies the contents of a GPU buffer to the CPU through a staging buffer.
+// Stalls until the copy is done so it's only meant for load time.
+bool ReadBackBuffer(ID3D11Device* device,
+	ID3D11DeviceContext* context,
+	ID3D11Buffer* buffer,
+	std::vector<std::uint8_t>& outData);
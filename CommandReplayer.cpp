@@ -0,0 +1,121 @@
+#include "precompiled.h"
+
+#include "CommandReplayer.h"
+#include "MemoryTracker.h"
+
+CommandReplayer::CommandReplayer(StateContext* context)
+	: m_Context(context)
+	, m_Cache(context)
+	, m_ReplayedCount(0)
+{}
+
+CommandReplayer::~CommandReplayer()
+{}
+
+CommandReplayer::Stats CommandReplayer::ResetStats()
+{
+	Stats stats;
+	stats.Commands = m_ReplayedCount;
+	stats.State = m_Cache.ResetStats();
+	m_ReplayedCount = 0;
+	return stats;
+}
+
+void CommandReplayer::Replay(const CommandStream& stream)
+{
+	NoAllocationScope noAllocations;
+	for (auto command = stream.GetFirst(); command; command = stream.GetNext(command))
+	{
+		ReplayCommand(command);
+	}
+	m_ReplayedCount += stream.GetCommandsCount();
+}
+
+void CommandReplayer::ReplayCommand(const CommandStream::Header* command)
+{
+	typedef CommandStream CS;
+	switch (command->Type)
+	{
+	case CS::CT_SetInputLayout:
+		m_Cache.SetInputLayout(CS::GetCommand<CS::SetInputLayout>(command).Layout);
+		break;
+	case CS::CT_SetVertexBuffer:
+	{
+		const auto& args = CS::GetCommand<CS::SetVertexBuffer>(command);
+		m_Cache.SetVertexBuffer(args.Slot, args.Buffer, args.Stride, args.Offset);
+		break;
+	}
+	case CS::CT_SetIndexBuffer:
+	{
+		const auto& args = CS::GetCommand<CS::SetIndexBuffer>(command);
+		m_Cache.SetIndexBuffer(args.Buffer, args.Format, args.Offset);
+		break;
+	}
+	case CS::CT_SetShader:
+	{
+		const auto& args = CS::GetCommand<CS::SetShader>(command);
+		m_Cache.SetShader(CS::ShaderStage(args.Stage), args.Shader);
+		break;
+	}
+	case CS::CT_SetResources:
+	{
+		const auto& args = CS::GetCommand<CS::SetResources>(command);
+		m_Cache.SetResources(CS::ShaderStage(args.Stage), args.FirstSlot, args.Count, args.Views);
+		break;
+	}
+	case CS::CT_SetSamplers:
+	{
+		const auto& args = CS::GetCommand<CS::SetSamplers>(command);
+		m_Cache.SetSamplers(CS::ShaderStage(args.Stage), args.FirstSlot, args.Count, args.Samplers);
+		break;
+	}
+	case CS::CT_SetUnorderedAccessViews:
+	{
+		const auto& args = CS::GetCommand<CS::SetUnorderedAccessViews>(command);
+		m_Cache.SetUnorderedAccessViews(args.FirstSlot, args.Count, args.Views);
+		break;
+	}
+	case CS::CT_SetConstantBuffer:
+	{
+		const auto& args = CS::GetCommand<CS::SetConstantBuffer>(command);
+		m_Cache.SetConstantBuffer(CS::ShaderStage(args.Stage), args.Slot, args.Buffer, args.FirstConstant, args.ConstantsCount);
+		break;
+	}
+	case CS::CT_SetDepthState:
+	{
+		const auto& args = CS::GetCommand<CS::SetDepthState>(command);
+		m_Cache.SetDepthState(args.State, args.StencilRef);
+		break;
+	}
+	case CS::CT_SetRasterState:
+		m_Cache.SetRasterState(CS::GetCommand<CS::SetRasterState>(command).State);
+		break;
+	case CS::CT_UpdateBuffer:
+	{
+		const auto& args = CS::GetCommand<CS::UpdateBuffer>(command);
+		m_Context->UpdateBuffer(args.Buffer, CS::GetPayload(command, sizeof(CS::UpdateBuffer)), args.DataSize);
+		break;
+	}
+	case CS::CT_DrawIndexedInstanced:
+	{
+		const auto& args = CS::GetCommand<CS::DrawIndexedInstanced>(command);
+		m_Context->DrawIndexedInstanced(args.IndicesCount, args.InstancesCount, args.FirstIndex, args.BaseVertex, args.FirstInstance);
+		break;
+	}
+	case CS::CT_DrawIndexedInstancedIndirect:
+	{
+		const auto& args = CS::GetCommand<CS::DrawIndexedInstancedIndirect>(command);
+		m_Context->DrawIndexedInstancedIndirect(args.Arguments, args.Offset);
+		break;
+	}
+	case CS::CT_Dispatch:
+	{
+		const auto& args = CS::GetCommand<CS::Dispatch>(command);
+		m_Context->Dispatch(args.X, args.Y, args.Z);
+		break;
+	}
+	default:
+		SLOG(Sev_Error, Fac_Rendering, "Unknown command in a command stream");
+		break;
+	}
+}
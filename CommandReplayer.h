@@ -0,0 +1,41 @@
+#pragma once
+
+#include "CommandStream.h"
+#include "StateCache.h"
+
+// Translates recorded command streams to calls on a StateContext - a
+// D3D11StateContext in the renderer, where the handles in the streams are
+// the D3D11 objects themselves. Replaying is single-threaded - streams
+// recorded on any thread are replayed on the thread owning the context, in
+// the order they have to execute.
+//
+// State goes through a StateCache, so a stream can set everything it needs
+// up front and only what differs from the previous stream reaches the
+// context.
+class CommandReplayer
+{
+public:
+	// The context outlives the replayer
+	explicit CommandReplayer(StateContext* context);
+	~CommandReplayer();
+
+	// State was set on the context directly since the last replay
+	void Invalidate() { m_Cache.Invalidate(); }
+
+	void Replay(const CommandStream& stream);
+
+	struct Stats
+	{
+		unsigned Commands;
+		StateCache::Stats State;
+	};
+	// Counters since the last call
+	Stats ResetStats();
+
+private:
+	void ReplayCommand(const CommandStream::Header* command);
+
+	StateContext* m_Context;
+	StateCache m_Cache;
+	unsigned m_ReplayedCount;
+};
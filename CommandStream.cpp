@@ -0,0 +1,181 @@
+#include "precompiled.h"
+
+#include "CommandStream.h"
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+namespace {
+	inline size_t AlignUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+void CommandStream::Clear()
+{
+	m_Data.clear();
+	m_CommandsCount = 0;
+	m_DrawsCount = 0;
+}
+
+void* CommandStream::Allocate(CommandType type, size_t commandSize, size_t payloadSize)
+{
+	const auto size = AlignUp(HEADER_SIZE + commandSize + payloadSize, ALIGNMENT);
+	assert(size <= MAX_COMMAND_SIZE);
+
+	const auto offset = m_Data.size();
+	m_Data.resize(offset + size, 0);
+
+	auto header = reinterpret_cast<Header*>(&m_Data[offset]);
+	header->Type = std::uint16_t(type);
+	header->Size = std::uint16_t(size);
+
+	++m_CommandsCount;
+	return &m_Data[offset + HEADER_SIZE];
+}
+
+void CommandStream::RecordSetInputLayout(Handle layout)
+{
+	auto& command = Allocate<SetInputLayout>(CT_SetInputLayout);
+	command.Layout = layout;
+}
+
+void CommandStream::RecordSetVertexBuffer(std::uint32_t slot, Handle buffer, std::uint32_t stride, std::uint32_t offset)
+{
+	auto& command = Allocate<SetVertexBuffer>(CT_SetVertexBuffer);
+	command.Buffer = buffer;
+	command.Slot = slot;
+	command.Stride = stride;
+	command.Offset = offset;
+}
+
+void CommandStream::RecordSetIndexBuffer(Handle buffer, std::uint32_t format, std::uint32_t offset)
+{
+	auto& command = Allocate<SetIndexBuffer>(CT_SetIndexBuffer);
+	command.Buffer = buffer;
+	command.Format = format;
+	command.Offset = offset;
+}
+
+void CommandStream::RecordSetShader(ShaderStage stage, Handle shader)
+{
+	auto& command = Allocate<SetShader>(CT_SetShader);
+	command.Shader = shader;
+	command.Stage = stage;
+}
+
+void CommandStream::RecordSetResources(ShaderStage stage, std::uint32_t firstSlot, std::uint32_t count, Handle const* views)
+{
+	assert(count <= MAX_VIEWS);
+	auto& command = Allocate<SetResources>(CT_SetResources);
+	command.Stage = stage;
+	command.FirstSlot = firstSlot;
+	command.Count = count;
+	std::copy(views, views + count, command.Views);
+}
+
+void CommandStream::RecordSetSamplers(ShaderStage stage, std::uint32_t firstSlot, std::uint32_t count, Handle const* samplers)
+{
+	assert(count <= MAX_VIEWS);
+	auto& command = Allocate<SetSamplers>(CT_SetSamplers);
+	command.Stage = stage;
+	command.FirstSlot = firstSlot;
+	command.Count = count;
+	std::copy(samplers, samplers + count, command.Samplers);
+}
+
+void CommandStream::RecordSetUnorderedAccessViews(std::uint32_t firstSlot, std::uint32_t count, Handle const* views)
+{
+	assert(count <= MAX_VIEWS);
+	auto& command = Allocate<SetUnorderedAccessViews>(CT_SetUnorderedAccessViews);
+	command.FirstSlot = firstSlot;
+	command.Count = count;
+	std::copy(views, views + count, command.Views);
+}
+
+void CommandStream::RecordSetConstantBuffer(ShaderStage stage, std::uint32_t slot, Handle buffer, std::uint32_t firstConstant, std::uint32_t constantsCount)
+{
+	auto& command = Allocate<SetConstantBuffer>(CT_SetConstantBuffer);
+	command.Buffer = buffer;
+	command.Stage = stage;
+	command.Slot = slot;
+	command.FirstConstant = firstConstant;
+	command.ConstantsCount = constantsCount;
+}
+
+void CommandStream::RecordSetDepthState(Handle state, std::uint32_t stencilRef)
+{
+	auto& command = Allocate<SetDepthState>(CT_SetDepthState);
+	command.State = state;
+	command.StencilRef = stencilRef;
+}
+
+void CommandStream::RecordSetRasterState(Handle state)
+{
+	auto& command = Allocate<SetRasterState>(CT_SetRasterState);
+	command.State = state;
+}
+
+bool CommandStream::RecordUpdateBuffer(Handle buffer, const void* data, std::uint32_t size)
+{
+	if (AlignUp(HEADER_SIZE + sizeof(UpdateBuffer) + size, ALIGNMENT) > MAX_COMMAND_SIZE)
+		return false;
+
+	auto command = static_cast<UpdateBuffer*>(Allocate(CT_UpdateBuffer, sizeof(UpdateBuffer), size));
+	command->Buffer = buffer;
+	command->DataSize = size;
+	std::memcpy(command + 1, data, size);
+	return true;
+}
+
+void CommandStream::RecordDrawIndexedInstanced(std::uint32_t indicesCount, std::uint32_t instancesCount, std::uint32_t firstIndex, std::int32_t baseVertex, std::uint32_t firstInstance)
+{
+	auto& command = Allocate<DrawIndexedInstanced>(CT_DrawIndexedInstanced);
+	command.IndicesCount = indicesCount;
+	command.InstancesCount = instancesCount;
+	command.FirstIndex = firstIndex;
+	command.BaseVertex = baseVertex;
+	command.FirstInstance = firstInstance;
+	++m_DrawsCount;
+}
+
+void CommandStream::RecordDrawIndexedInstancedIndirect(Handle arguments, std::uint32_t offset)
+{
+	auto& command = Allocate<DrawIndexedInstancedIndirect>(CT_DrawIndexedInstancedIndirect);
+	command.Arguments = arguments;
+	command.Offset = offset;
+	++m_DrawsCount;
+}
+
+void CommandStream::RecordDispatch(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	auto& command = Allocate<Dispatch>(CT_Dispatch);
+	command.X = x;
+	command.Y = y;
+	command.Z = z;
+}
+
+const CommandStream::Header* CommandStream::GetFirst() const
+{
+	if (m_Data.empty())
+		return nullptr;
+	return reinterpret_cast<const Header*>(m_Data.data());
+}
+
+const CommandStream::Header* CommandStream::GetNext(const Header* command) const
+{
+	auto next = reinterpret_cast<const std::uint8_t*>(command) + command->Size;
+	if (next >= m_Data.data() + m_Data.size())
+		return nullptr;
+	return reinterpret_cast<const Header*>(next);
+}
+
+bool CommandStream::operator==(const CommandStream& other) const
+{
+	// Commands are zeroed when allocated, so padding compares equal too
+	return m_CommandsCount == other.m_CommandsCount
+		&& m_Data.size() == other.m_Data.size()
+		&& (m_Data.empty() || std::memcmp(m_Data.data(), other.m_Data.data(), m_Data.size()) == 0);
+}
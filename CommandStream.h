@@ -0,0 +1,204 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// GPU commands recorded in a linear buffer, to be replayed on a device later
+// (CommandReplayer for D3D11). Every command is a small POD struct after a
+// header with its type and size; resources, views, shaders and states are
+// opaque handles the stream never looks into. Nothing here depends on the
+// API, so streams can be recorded on any thread - one stream per thread -
+// and compared or measured without a device.
+class CommandStream
+{
+public:
+	typedef void* Handle;
+
+	enum CommandType
+	{
+		CT_SetInputLayout = 0,
+		CT_SetVertexBuffer,
+		CT_SetIndexBuffer,
+		CT_SetShader,
+		CT_SetResources,
+		CT_SetSamplers,
+		CT_SetUnorderedAccessViews,
+		CT_SetConstantBuffer,
+		CT_SetDepthState,
+		CT_SetRasterState,
+		CT_UpdateBuffer,
+		CT_DrawIndexedInstanced,
+		CT_DrawIndexedInstancedIndirect,
+		CT_Dispatch,
+
+		CT_Count
+	};
+
+	enum ShaderStage
+	{
+		SS_Vertex = 0,
+		SS_Pixel,
+		SS_Compute,
+	};
+
+	// Views set by one command - the most a routine binds at once
+	static const unsigned MAX_VIEWS = 8;
+
+	struct Header
+	{
+		std::uint16_t Type;
+		// Of the command with its header and payload, aligned to 8 bytes
+		std::uint16_t Size;
+	};
+
+	struct SetInputLayout
+	{
+		Handle Layout;
+	};
+	struct SetVertexBuffer
+	{
+		Handle Buffer;
+		std::uint32_t Slot;
+		std::uint32_t Stride;
+		std::uint32_t Offset;
+	};
+	struct SetIndexBuffer
+	{
+		Handle Buffer;
+		// DXGI_FORMAT
+		std::uint32_t Format;
+		std::uint32_t Offset;
+	};
+	struct SetShader
+	{
+		Handle Shader;
+		std::uint32_t Stage;
+	};
+	struct SetResources
+	{
+		Handle Views[MAX_VIEWS];
+		std::uint32_t Stage;
+		std::uint32_t FirstSlot;
+		std::uint32_t Count;
+	};
+	struct SetSamplers
+	{
+		Handle Samplers[MAX_VIEWS];
+		std::uint32_t Stage;
+		std::uint32_t FirstSlot;
+		std::uint32_t Count;
+	};
+	struct SetUnorderedAccessViews
+	{
+		Handle Views[MAX_VIEWS];
+		std::uint32_t FirstSlot;
+		std::uint32_t Count;
+	};
+	// A range of a buffer in constants of 16 bytes - 0 constants binds all of it
+	struct SetConstantBuffer
+	{
+		Handle Buffer;
+		std::uint32_t Stage;
+		std::uint32_t Slot;
+		std::uint32_t FirstConstant;
+		std::uint32_t ConstantsCount;
+	};
+	// nullptr - the default state
+	struct SetDepthState
+	{
+		Handle State;
+		std::uint32_t StencilRef;
+	};
+	struct SetRasterState
+	{
+		Handle State;
+	};
+	// The whole buffer is discarded and DataSize bytes after the command are written to it
+	struct UpdateBuffer
+	{
+		Handle Buffer;
+		std::uint32_t DataSize;
+	};
+	struct DrawIndexedInstanced
+	{
+		std::uint32_t IndicesCount;
+		std::uint32_t InstancesCount;
+		std::uint32_t FirstIndex;
+		std::int32_t BaseVertex;
+		std::uint32_t FirstInstance;
+	};
+	struct DrawIndexedInstancedIndirect
+	{
+		Handle Arguments;
+		std::uint32_t Offset;
+	};
+	struct Dispatch
+	{
+		std::uint32_t X;
+		std::uint32_t Y;
+		std::uint32_t Z;
+	};
+
+	void Clear();
+
+	void RecordSetInputLayout(Handle layout);
+	void RecordSetVertexBuffer(std::uint32_t slot, Handle buffer, std::uint32_t stride, std::uint32_t offset);
+	void RecordSetIndexBuffer(Handle buffer, std::uint32_t format, std::uint32_t offset);
+	void RecordSetShader(ShaderStage stage, Handle shader);
+	// count is at most MAX_VIEWS
+	void RecordSetResources(ShaderStage stage, std::uint32_t firstSlot, std::uint32_t count, Handle const* views);
+	void RecordSetSamplers(ShaderStage stage, std::uint32_t firstSlot, std::uint32_t count, Handle const* samplers);
+	void RecordSetUnorderedAccessViews(std::uint32_t firstSlot, std::uint32_t count, Handle const* views);
+	void RecordSetConstantBuffer(ShaderStage stage, std::uint32_t slot, Handle buffer, std::uint32_t firstConstant = 0, std::uint32_t constantsCount = 0);
+	void RecordSetDepthState(Handle state, std::uint32_t stencilRef = 0);
+	void RecordSetRasterState(Handle state);
+	// The data is copied in the stream. False if it's too big for a command.
+	bool RecordUpdateBuffer(Handle buffer, const void* data, std::uint32_t size);
+	void RecordDrawIndexedInstanced(std::uint32_t indicesCount, std::uint32_t instancesCount, std::uint32_t firstIndex, std::int32_t baseVertex, std::uint32_t firstInstance);
+	void RecordDrawIndexedInstancedIndirect(Handle arguments, std::uint32_t offset);
+	void RecordDispatch(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+
+	// Commands in recording order - GetFirst returns nullptr for an empty
+	// stream and GetNext after the last command
+	const Header* GetFirst() const;
+	const Header* GetNext(const Header* command) const;
+
+	// The struct of a command and the payload after it
+	template<typename T>
+	static const T& GetCommand(const Header* command)
+	{
+		return *reinterpret_cast<const T*>(reinterpret_cast<const std::uint8_t*>(command) + HEADER_SIZE);
+	}
+	static const void* GetPayload(const Header* command, size_t commandSize)
+	{
+		return reinterpret_cast<const std::uint8_t*>(command) + HEADER_SIZE + commandSize;
+	}
+
+	unsigned GetCommandsCount() const { return m_CommandsCount; }
+	unsigned GetDrawsCount() const { return m_DrawsCount; }
+	size_t GetSize() const { return m_Data.size(); }
+	const std::uint8_t* GetData() const { return m_Data.data(); }
+
+	// Same commands with the same arguments
+	bool operator==(const CommandStream& other) const;
+	bool operator!=(const CommandStream& other) const { return !(*this == other); }
+
+private:
+	static const unsigned ALIGNMENT = 8;
+	static const unsigned HEADER_SIZE = ALIGNMENT;
+	static const unsigned MAX_COMMAND_SIZE = 0xFFFF & ~(ALIGNMENT - 1);
+
+	// Room for a command of the type and payloadSize more bytes, zeroed
+	void* Allocate(CommandType type, size_t commandSize, size_t payloadSize = 0);
+
+	template<typename T>
+	T& Allocate(CommandType type)
+	{
+		return *static_cast<T*>(Allocate(type, sizeof(T)));
+	}
+
+	std::vector<std::uint8_t> m_Data;
+	unsigned m_CommandsCount = 0;
+	unsigned m_DrawsCount = 0;
+};
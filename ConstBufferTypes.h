@@ -13,6 +13,13 @@ struct PerSubsetBuffer
 	DirectX::XMFLOAT4 Properties; // x - specular power
 };
 
+// Per-instance vertex data of the static draws - the world matrix without
+// its last column, stored transposed so that each row is a column of it
+struct InstanceData
+{
+	DirectX::XMFLOAT4 WorldColumns[3];
+};
+
 struct CSPointLightProperties
 {
 	DirectX::XMFLOAT4 PositionAndRadius;
@@ -24,4 +31,15 @@ struct CSCulledLight
 	unsigned LightId;
 };
 
+struct LightTilingProperties
+{
+	unsigned TileSize;
+	unsigned MaxLightsPerTile;
+	unsigned TilesCountX;
+	unsigned Encoding; // LightListEncoding
+	unsigned MaskWordsPerTile;
+	unsigned ActiveMaskWords;
+	unsigned Padding[2];
+};
+
 
@@ -0,0 +1,170 @@
+#include "precompiled.h"
+
+#include "ConstantBufferRing.h"
+#include "ResourceTracking.h"
+
+namespace {
+	// *SetConstantBuffers1 takes offsets and sizes in multiples of 16 constants
+	static const unsigned CONSTANT_SIZE = 16;
+	static const unsigned RANGE_ALIGNMENT = 16 * CONSTANT_SIZE;
+}
+
+ConstantBufferRing::ConstantBufferRing()
+	: m_Context(nullptr)
+	, m_FrameId(0)
+	, m_Mapped(nullptr)
+	, m_EverMapped(false)
+{
+	m_FrameStats.Allocations = m_FrameStats.Maps = 0;
+	m_LastFrameStats = m_FrameStats;
+}
+
+ConstantBufferRing::~ConstantBufferRing()
+{}
+
+bool ConstantBufferRing::Initialize(ID3D11Device* device, ID3D11DeviceContext* context, unsigned capacity)
+{
+	m_Context = context;
+
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options;
+	::memset(&options, 0, sizeof(options));
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options)))
+		|| !options.ConstantBufferOffsetting
+		|| !options.MapNoOverwriteOnDynamicConstantBuffer)
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Constant buffer offsetting is not supported - D3D11.1 is required");
+		return false;
+	}
+	if (FAILED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(m_Context1.Receive()))))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to get a D3D11.1 device context");
+		return false;
+	}
+
+	capacity = (capacity + RANGE_ALIGNMENT - 1) & ~(RANGE_ALIGNMENT - 1);
+
+	D3D11_BUFFER_DESC desc;
+	::memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = capacity;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(device->CreateBuffer(&desc, nullptr, m_Buffer.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create the constant buffer ring");
+		return false;
+	}
+	TrackResource(m_Buffer.Get(), MC_Rendering);
+
+	D3D11_QUERY_DESC queryDesc;
+	::memset(&queryDesc, 0, sizeof(queryDesc));
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	for (auto i = 0u; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		if (FAILED(device->CreateQuery(&queryDesc, m_Fences[i].Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create constant buffer ring fence");
+			return false;
+		}
+	}
+
+	m_Allocator.reset(new RingAllocator(capacity));
+
+	return true;
+}
+
+void ConstantBufferRing::BeginFrame()
+{
+	while (m_Allocator->GetPendingFramesCount())
+	{
+		const auto frame = m_Allocator->GetOldestPendingFrame();
+		BOOL done = FALSE;
+		if (m_Context->GetData(m_Fences[frame % FRAMES_IN_FLIGHT].Get(), &done, sizeof(done), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK || !done)
+			break;
+		m_Allocator->FrameCompleted(frame);
+	}
+}
+
+void ConstantBufferRing::EndFrame()
+{
+	// Every fence is in use - the oldest frame has to finish first
+	if (m_Allocator->GetPendingFramesCount() == FRAMES_IN_FLIGHT)
+	{
+		WaitForOldestFrame();
+	}
+
+	m_Context->End(m_Fences[m_FrameId % FRAMES_IN_FLIGHT].Get());
+	m_Allocator->EndFrame(m_FrameId++);
+
+	m_LastFrameStats = m_FrameStats;
+	m_FrameStats.Allocations = m_FrameStats.Maps = 0;
+}
+
+bool ConstantBufferRing::WaitForOldestFrame()
+{
+	if (!m_Allocator->GetPendingFramesCount())
+		return false;
+
+	const auto frame = m_Allocator->GetOldestPendingFrame();
+	BOOL done = FALSE;
+	while (m_Context->GetData(m_Fences[frame % FRAMES_IN_FLIGHT].Get(), &done, sizeof(done), 0) != S_OK || !done)
+	{
+		::Sleep(0);
+	}
+	m_Allocator->FrameCompleted(frame);
+	return true;
+}
+
+bool ConstantBufferRing::Map()
+{
+	// Allocations never overlap memory the GPU may still read
+	D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+	const auto mapType = m_EverMapped ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD;
+	if (FAILED(m_Context->Map(m_Buffer.Get(), 0, mapType, 0, &mapped)))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to map the constant buffer ring");
+		return false;
+	}
+	m_Mapped = static_cast<std::uint8_t*>(mapped.pData);
+	m_EverMapped = true;
+	++m_FrameStats.Maps;
+	return true;
+}
+
+void* ConstantBufferRing::Allocate(unsigned size, Range& outRange)
+{
+	const unsigned alignedSize = (size + RANGE_ALIGNMENT - 1) & ~(RANGE_ALIGNMENT - 1);
+	auto offset = m_Allocator->Allocate(alignedSize, RANGE_ALIGNMENT);
+	if (offset == RingAllocator::INVALID_OFFSET)
+	{
+		// The GPU is behind - the buffer stays mapped with NO_OVERWRITE so waiting is safe
+		if (!WaitForOldestFrame())
+			return nullptr;
+		offset = m_Allocator->Allocate(alignedSize, RANGE_ALIGNMENT);
+		if (offset == RingAllocator::INVALID_OFFSET)
+			return nullptr;
+	}
+
+	outRange.FirstConstant = UINT(offset / CONSTANT_SIZE);
+	outRange.ConstantsCount = alignedSize / CONSTANT_SIZE;
+	++m_FrameStats.Allocations;
+	return m_Mapped + offset;
+}
+
+void ConstantBufferRing::Unmap()
+{
+	m_Context->Unmap(m_Buffer.Get(), 0);
+	m_Mapped = nullptr;
+}
+
+void ConstantBufferRing::BindVS(UINT slot, const Range& range)
+{
+	ID3D11Buffer* buffer = m_Buffer.Get();
+	m_Context1->VSSetConstantBuffers1(slot, 1, &buffer, &range.FirstConstant, &range.ConstantsCount);
+}
+
+void ConstantBufferRing::BindPS(UINT slot, const Range& range)
+{
+	ID3D11Buffer* buffer = m_Buffer.Get();
+	m_Context1->PSSetConstantBuffers1(slot, 1, &buffer, &range.FirstConstant, &range.ConstantsCount);
+}
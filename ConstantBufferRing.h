@@ -0,0 +1,73 @@
+#pragma once
+
+#include <d3d11_1.h>
+
+#include "RingAllocator.h"
+
+// Per-draw constants of a frame suballocated from one big dynamic buffer.
+// A routine maps the ring once, writes the constants of all its draws and
+// binds each draw's range by offset (D3D11.1 constant buffer offsetting).
+// Frame fences are D3D11 event queries - memory is reused only after the GPU
+// has finished the frame that used it.
+class ConstantBufferRing
+{
+public:
+	// First constant and constants count as taken by *SetConstantBuffers1
+	struct Range
+	{
+		UINT FirstConstant;
+		UINT ConstantsCount;
+	};
+
+	struct Stats
+	{
+		unsigned Allocations;
+		unsigned Maps;
+	};
+
+	ConstantBufferRing();
+	~ConstantBufferRing();
+
+	bool Initialize(ID3D11Device* device, ID3D11DeviceContext* context, unsigned capacity);
+
+	// Retires the frames the GPU has completed
+	void BeginFrame();
+	// Fences the allocations of the frame
+	void EndFrame();
+
+	bool Map();
+	// Only valid between Map and Unmap. Returns nullptr if the ring is exhausted.
+	void* Allocate(unsigned size, Range& outRange);
+	template<typename T>
+	T* Allocate(Range& outRange)
+	{
+		return static_cast<T*>(Allocate(sizeof(T), outRange));
+	}
+	void Unmap();
+
+	void BindVS(UINT slot, const Range& range);
+	void BindPS(UINT slot, const Range& range);
+
+	ID3D11Buffer* GetBuffer() const { return m_Buffer.Get(); }
+
+	// Counters of the last completed EndFrame
+	const Stats& GetLastFrameStats() const { return m_LastFrameStats; }
+
+private:
+	bool WaitForOldestFrame();
+
+	static const unsigned FRAMES_IN_FLIGHT = 4;
+
+	ID3D11DeviceContext* m_Context;
+	ReleaseGuard<ID3D11DeviceContext1> m_Context1;
+	ReleaseGuard<ID3D11Buffer> m_Buffer;
+	ReleaseGuard<ID3D11Query> m_Fences[FRAMES_IN_FLIGHT];
+
+	std::unique_ptr<RingAllocator> m_Allocator;
+	std::uint64_t m_FrameId;
+	std::uint8_t* m_Mapped;
+	bool m_EverMapped;
+
+	Stats m_FrameStats;
+	Stats m_LastFrameStats;
+};
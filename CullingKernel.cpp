@@ -0,0 +1,163 @@
+#include "precompiled.h"
+
+#include "CullingKernel.h"
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// No FMA - a fused multiply-add would round differently from the scalar version
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace CullingKernel
+{
+
+unsigned TestBoxesScalar(const FrustumPlanes& planes, const Boxes8& boxes, unsigned count, unsigned& outInside)
+{
+	unsigned visible = 0;
+	unsigned inside = 0;
+	for (auto box = 0u; box < count; ++box)
+	{
+		bool outside = false;
+		bool partial = false;
+		for (auto i = 0u; i < 6 && !outside; ++i)
+		{
+			const float* plane = planes.Planes[i];
+			// The corner furthest along the normal decides if the box is out,
+			// the nearest one if it's all in
+			const float farDist = plane[0] * (plane[0] > 0 ? boxes.MaxX[box] : boxes.MinX[box])
+				+ plane[1] * (plane[1] > 0 ? boxes.MaxY[box] : boxes.MinY[box])
+				+ plane[2] * (plane[2] > 0 ? boxes.MaxZ[box] : boxes.MinZ[box])
+				+ plane[3];
+			const float nearDist = plane[0] * (plane[0] > 0 ? boxes.MinX[box] : boxes.MaxX[box])
+				+ plane[1] * (plane[1] > 0 ? boxes.MinY[box] : boxes.MaxY[box])
+				+ plane[2] * (plane[2] > 0 ? boxes.MinZ[box] : boxes.MaxZ[box])
+				+ plane[3];
+			outside = farDist < 0;
+			partial |= nearDist < 0;
+		}
+		if (!outside)
+		{
+			visible |= 1u << box;
+			if (!partial)
+				inside |= 1u << box;
+		}
+	}
+	outInside = inside;
+	return visible;
+}
+
+AVX2_TARGET unsigned TestBoxesAVX2(const FrustumPlanes& planes, const Boxes8& boxes, unsigned count, unsigned& outInside)
+{
+	const __m256 minX = _mm256_loadu_ps(boxes.MinX);
+	const __m256 minY = _mm256_loadu_ps(boxes.MinY);
+	const __m256 minZ = _mm256_loadu_ps(boxes.MinZ);
+	const __m256 maxX = _mm256_loadu_ps(boxes.MaxX);
+	const __m256 maxY = _mm256_loadu_ps(boxes.MaxY);
+	const __m256 maxZ = _mm256_loadu_ps(boxes.MaxZ);
+	const __m256 zero = _mm256_setzero_ps();
+
+	__m256 outside = zero;
+	__m256 partial = zero;
+	for (auto i = 0u; i < 6; ++i)
+	{
+		const float* plane = planes.Planes[i];
+		const __m256 a = _mm256_set1_ps(plane[0]);
+		const __m256 b = _mm256_set1_ps(plane[1]);
+		const __m256 c = _mm256_set1_ps(plane[2]);
+		const __m256 d = _mm256_set1_ps(plane[3]);
+
+		// The signs of the plane pick the corners for all 8 boxes at once. Summed
+		// in the order of the scalar version.
+		const __m256 farDist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(a, plane[0] > 0 ? maxX : minX),
+			_mm256_mul_ps(b, plane[1] > 0 ? maxY : minY)),
+			_mm256_mul_ps(c, plane[2] > 0 ? maxZ : minZ)), d);
+		const __m256 nearDist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(a, plane[0] > 0 ? minX : maxX),
+			_mm256_mul_ps(b, plane[1] > 0 ? minY : maxY)),
+			_mm256_mul_ps(c, plane[2] > 0 ? minZ : maxZ)), d);
+
+		outside = _mm256_or_ps(outside, _mm256_cmp_ps(farDist, zero, _CMP_LT_OQ));
+		partial = _mm256_or_ps(partial, _mm256_cmp_ps(nearDist, zero, _CMP_LT_OQ));
+	}
+
+	const unsigned valid = (1u << count) - 1;
+	const unsigned visible = ~unsigned(_mm256_movemask_ps(outside)) & valid;
+	outInside = ~unsigned(_mm256_movemask_ps(partial)) & visible;
+	return visible;
+}
+
+namespace {
+
+	bool DetectAVX2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		// The OS has to save the YMM registers too
+		if (!osxsave || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+	typedef unsigned (*TestBoxesFunc)(const FrustumPlanes&, const Boxes8&, unsigned, unsigned&);
+
+	TestBoxesFunc SelectTestBoxes()
+	{
+		static const TestBoxesFunc func = DetectAVX2() ? &TestBoxesAVX2 : &TestBoxesScalar;
+		return func;
+	}
+}
+
+void ExtractPlanes(const float* m, FrustumPlanes& outPlanes)
+{
+	// clip = (x, y, z, 1) * m, so the planes are sums of its columns
+	for (auto row = 0u; row < 4; ++row)
+	{
+		const float* r = m + row * 4;
+		outPlanes.Planes[0][row] = r[3] + r[0]; // left
+		outPlanes.Planes[1][row] = r[3] - r[0]; // right
+		outPlanes.Planes[2][row] = r[3] + r[1]; // bottom
+		outPlanes.Planes[3][row] = r[3] - r[1]; // top
+		outPlanes.Planes[4][row] = r[2];        // near
+		outPlanes.Planes[5][row] = r[3] - r[2]; // far
+	}
+
+	for (auto& plane : outPlanes.Planes)
+	{
+		const float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if (length > 0)
+		{
+			for (auto i = 0u; i < 4; ++i)
+			{
+				plane[i] /= length;
+			}
+		}
+	}
+}
+
+unsigned TestBoxes(const FrustumPlanes& planes, const Boxes8& boxes, unsigned count, unsigned& outInside)
+{
+	return SelectTestBoxes()(planes, boxes, count, outInside);
+}
+
+bool IsUsingAVX2()
+{
+	return SelectTestBoxes() == &TestBoxesAVX2;
+}
+
+}
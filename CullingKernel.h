@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// Frustum tests of 8 axis-aligned boxes at once. The boxes are stored SoA so
+// that the AVX2 version handles all 8 against a plane in a few instructions.
+// CPUs without AVX2 get a scalar version with the same results.
+namespace CullingKernel
+{
+	static const unsigned BOXES_PER_TEST = 8;
+
+	// ax + by + cz + d >= 0 inside, (a, b, c) normalized
+	struct FrustumPlanes
+	{
+		float Planes[6][4];
+	};
+
+	struct Boxes8
+	{
+		float MinX[BOXES_PER_TEST];
+		float MinY[BOXES_PER_TEST];
+		float MinZ[BOXES_PER_TEST];
+		float MaxX[BOXES_PER_TEST];
+		float MaxY[BOXES_PER_TEST];
+		float MaxZ[BOXES_PER_TEST];
+	};
+
+	// Planes of a row-vector view-projection matrix (row-major, 16 floats)
+	// with the D3D clip space - z in [0, w]
+	void ExtractPlanes(const float* viewProjection, FrustumPlanes& outPlanes);
+
+	// Bit i of the result is set if box i of the first 'count' intersects the
+	// frustum and bit i of outInside if it's entirely in it
+	unsigned TestBoxes(const FrustumPlanes& planes, const Boxes8& boxes, unsigned count, unsigned& outInside);
+
+	// The two versions TestBoxes picks from - the AVX2 one only where
+	// IsUsingAVX2
+	unsigned TestBoxesScalar(const FrustumPlanes& planes, const Boxes8& boxes, unsigned count, unsigned& outInside);
+	unsigned TestBoxesAVX2(const FrustumPlanes& planes, const Boxes8& boxes, unsigned count, unsigned& outInside);
+
+	bool IsUsingAVX2();
+}
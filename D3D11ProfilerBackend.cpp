@@ -0,0 +1,92 @@
+#include "precompiled.h"
+
+#include "D3D11ProfilerBackend.h"
+
+D3D11ProfilerBackend::D3D11ProfilerBackend(ID3D11Device* device, ID3D11DeviceContext* context)
+	: m_Device(device)
+	, m_Context(context)
+	, m_QueriesCount(0)
+{}
+
+bool D3D11ProfilerBackend::Initialize(unsigned framesCount, unsigned queriesCount)
+{
+	m_Frames.reset(new FrameQueries[framesCount]);
+	m_QueriesCount = queriesCount;
+
+	D3D11_QUERY_DESC desc;
+	::memset(&desc, 0, sizeof(desc));
+	desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	for (auto frame = 0u; frame < framesCount; ++frame)
+	{
+		if (FAILED(m_Device->CreateQuery(&desc, m_Frames[frame].Disjoint.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create timestamp disjoint query");
+			return false;
+		}
+		m_Frames[frame].Timestamps.reset(new ReleaseGuard<ID3D11Query>[queriesCount]);
+	}
+	return true;
+}
+
+void D3D11ProfilerBackend::BeginFrame(unsigned frame)
+{
+	m_Context->Begin(m_Frames[frame].Disjoint.Get());
+}
+
+void D3D11ProfilerBackend::EndFrame(unsigned frame)
+{
+	m_Context->End(m_Frames[frame].Disjoint.Get());
+}
+
+void D3D11ProfilerBackend::WriteTimestamp(unsigned frame, unsigned query)
+{
+	assert(query < m_QueriesCount && "Timestamp out of the pool");
+
+	auto& timestamp = m_Frames[frame].Timestamps[query];
+	if (!timestamp.Get())
+	{
+		D3D11_QUERY_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		desc.Query = D3D11_QUERY_TIMESTAMP;
+		if (FAILED(m_Device->CreateQuery(&desc, timestamp.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create timestamp query");
+			return;
+		}
+	}
+	m_Context->End(timestamp.Get());
+}
+
+bool D3D11ProfilerBackend::ReadFrame(unsigned frame,
+	unsigned queriesCount,
+	std::uint64_t* outTimestamps,
+	std::uint64_t& outFrequency,
+	bool& outDisjoint)
+{
+	auto& queries = m_Frames[frame];
+
+	// The disjoint query ends after the last timestamp of the frame - once it
+	// is ready all of them are
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	if (m_Context->GetData(queries.Disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+		return false;
+
+	outDisjoint = false;
+	// Even if the frame is disjoint all the data is read, otherwise
+	// D3D11 complains with a warning
+	for (auto query = 0u; query < queriesCount; ++query)
+	{
+		UINT64 ticks = 0;
+		auto timestamp = queries.Timestamps[query].Get();
+		if (!timestamp || m_Context->GetData(timestamp, &ticks, sizeof(ticks), 0) != S_OK)
+		{
+			// A query that couldn't be created or wasn't ended this frame
+			outDisjoint = true;
+		}
+		outTimestamps[query] = ticks;
+	}
+
+	outFrequency = disjoint.Frequency;
+	outDisjoint = outDisjoint || disjoint.Disjoint != FALSE;
+	return true;
+}
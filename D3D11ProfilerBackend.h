@@ -0,0 +1,38 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include "Profiler.h"
+
+// Timestamp queries on the immediate context. The timestamps of a frame
+// slot are created the first time the slot gets that many scopes, so the
+// pool grows to what the frames actually use.
+class D3D11ProfilerBackend : public ProfilerBackend
+{
+public:
+	D3D11ProfilerBackend(ID3D11Device* device, ID3D11DeviceContext* context);
+
+	virtual bool Initialize(unsigned framesCount, unsigned queriesCount) override;
+
+	virtual void BeginFrame(unsigned frame) override;
+	virtual void EndFrame(unsigned frame) override;
+	virtual void WriteTimestamp(unsigned frame, unsigned query) override;
+	virtual bool ReadFrame(unsigned frame,
+		unsigned queriesCount,
+		std::uint64_t* outTimestamps,
+		std::uint64_t& outFrequency,
+		bool& outDisjoint) override;
+
+private:
+	struct FrameQueries
+	{
+		ReleaseGuard<ID3D11Query> Disjoint;
+		// Null until first written
+		std::unique_ptr<ReleaseGuard<ID3D11Query>[]> Timestamps;
+	};
+
+	ID3D11Device* m_Device;
+	ID3D11DeviceContext* m_Context;
+	std::unique_ptr<FrameQueries[]> m_Frames;
+	unsigned m_QueriesCount;
+};
@@ -0,0 +1,178 @@
+#include "precompiled.h"
+
+#include "D3D11StateContext.h"
+
+namespace {
+	template<typename T>
+	inline T* FromHandle(StateContext::Handle handle)
+	{
+		return static_cast<T*>(handle);
+	}
+
+	// Handles of a range as the D3D11 type - at most a command's views
+	template<typename T>
+	inline void FromHandles(StateContext::Handle const* handles, unsigned count, T** objects)
+	{
+		for (auto i = 0u; i < count; ++i)
+		{
+			objects[i] = FromHandle<T>(handles[i]);
+		}
+	}
+
+	static const unsigned MAX_RANGE = 16;
+}
+
+D3D11StateContext::D3D11StateContext()
+	: m_Context(nullptr)
+{}
+
+bool D3D11StateContext::Initialize(ID3D11DeviceContext* context)
+{
+	m_Context = context;
+	if (FAILED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(m_Context1.Receive()))))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to get a D3D11.1 device context for the state cache");
+		return false;
+	}
+	return true;
+}
+
+void D3D11StateContext::SetInputLayout(Handle layout)
+{
+	m_Context->IASetInputLayout(FromHandle<ID3D11InputLayout>(layout));
+}
+
+void D3D11StateContext::SetVertexBuffer(unsigned slot, Handle buffer, unsigned stride, unsigned offset)
+{
+	ID3D11Buffer* buffers[] = { FromHandle<ID3D11Buffer>(buffer) };
+	const UINT strides[] = { stride };
+	const UINT offsets[] = { offset };
+	m_Context->IASetVertexBuffers(slot, 1, buffers, strides, offsets);
+}
+
+void D3D11StateContext::SetIndexBuffer(Handle buffer, unsigned format, unsigned offset)
+{
+	m_Context->IASetIndexBuffer(FromHandle<ID3D11Buffer>(buffer), DXGI_FORMAT(format), offset);
+}
+
+void D3D11StateContext::SetShader(ShaderStage stage, Handle shader)
+{
+	switch (stage)
+	{
+	case CommandStream::SS_Vertex:
+		m_Context->VSSetShader(FromHandle<ID3D11VertexShader>(shader), nullptr, 0);
+		break;
+	case CommandStream::SS_Pixel:
+		m_Context->PSSetShader(FromHandle<ID3D11PixelShader>(shader), nullptr, 0);
+		break;
+	case CommandStream::SS_Compute:
+		m_Context->CSSetShader(FromHandle<ID3D11ComputeShader>(shader), nullptr, 0);
+		break;
+	}
+}
+
+void D3D11StateContext::SetResources(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* views)
+{
+	ID3D11ShaderResourceView* srvs[MAX_RANGE];
+	count = std::min(count, MAX_RANGE);
+	FromHandles(views, count, srvs);
+	switch (stage)
+	{
+	case CommandStream::SS_Vertex:
+		m_Context->VSSetShaderResources(firstSlot, count, srvs);
+		break;
+	case CommandStream::SS_Pixel:
+		m_Context->PSSetShaderResources(firstSlot, count, srvs);
+		break;
+	case CommandStream::SS_Compute:
+		m_Context->CSSetShaderResources(firstSlot, count, srvs);
+		break;
+	}
+}
+
+void D3D11StateContext::SetSamplers(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* samplers)
+{
+	ID3D11SamplerState* states[MAX_RANGE];
+	count = std::min(count, MAX_RANGE);
+	FromHandles(samplers, count, states);
+	switch (stage)
+	{
+	case CommandStream::SS_Vertex:
+		m_Context->VSSetSamplers(firstSlot, count, states);
+		break;
+	case CommandStream::SS_Pixel:
+		m_Context->PSSetSamplers(firstSlot, count, states);
+		break;
+	case CommandStream::SS_Compute:
+		m_Context->CSSetSamplers(firstSlot, count, states);
+		break;
+	}
+}
+
+void D3D11StateContext::SetUnorderedAccessViews(unsigned firstSlot, unsigned count, Handle const* views)
+{
+	ID3D11UnorderedAccessView* uavs[MAX_RANGE];
+	count = std::min(count, MAX_RANGE);
+	FromHandles(views, count, uavs);
+	m_Context->CSSetUnorderedAccessViews(firstSlot, count, uavs, nullptr);
+}
+
+void D3D11StateContext::SetConstantBuffer(ShaderStage stage, unsigned slot, Handle buffer, unsigned firstConstant, unsigned constantsCount)
+{
+	ID3D11Buffer* buffers[] = { FromHandle<ID3D11Buffer>(buffer) };
+	// A whole buffer goes without a range
+	const UINT first[] = { firstConstant };
+	const UINT count[] = { constantsCount };
+	const UINT* firstPtr = constantsCount ? first : nullptr;
+	const UINT* countPtr = constantsCount ? count : nullptr;
+	switch (stage)
+	{
+	case CommandStream::SS_Vertex:
+		m_Context1->VSSetConstantBuffers1(slot, 1, buffers, firstPtr, countPtr);
+		break;
+	case CommandStream::SS_Pixel:
+		m_Context1->PSSetConstantBuffers1(slot, 1, buffers, firstPtr, countPtr);
+		break;
+	case CommandStream::SS_Compute:
+		m_Context1->CSSetConstantBuffers1(slot, 1, buffers, firstPtr, countPtr);
+		break;
+	}
+}
+
+void D3D11StateContext::SetDepthState(Handle state, unsigned stencilRef)
+{
+	m_Context->OMSetDepthStencilState(FromHandle<ID3D11DepthStencilState>(state), stencilRef);
+}
+
+void D3D11StateContext::SetRasterState(Handle state)
+{
+	m_Context->RSSetState(FromHandle<ID3D11RasterizerState>(state));
+}
+
+void D3D11StateContext::UpdateBuffer(Handle buffer, const void* data, unsigned size)
+{
+	ID3D11Buffer* d3dBuffer = FromHandle<ID3D11Buffer>(buffer);
+	D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+	if (FAILED(m_Context->Map(d3dBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to map a buffer of a command stream");
+		return;
+	}
+	::memcpy(mapped.pData, data, size);
+	m_Context->Unmap(d3dBuffer, 0);
+}
+
+void D3D11StateContext::DrawIndexedInstanced(unsigned indicesCount, unsigned instancesCount, unsigned firstIndex, int baseVertex, unsigned firstInstance)
+{
+	m_Context->DrawIndexedInstanced(indicesCount, instancesCount, firstIndex, baseVertex, firstInstance);
+}
+
+void D3D11StateContext::DrawIndexedInstancedIndirect(Handle arguments, unsigned offset)
+{
+	m_Context->DrawIndexedInstancedIndirect(FromHandle<ID3D11Buffer>(arguments), offset);
+}
+
+void D3D11StateContext::Dispatch(unsigned x, unsigned y, unsigned z)
+{
+	m_Context->Dispatch(x, y, z);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <d3d11_1.h>
+
+#include "StateCache.h"
+
+// Calls on a D3D11.1 context - the handles are the D3D11 objects
+class D3D11StateContext : public StateContext
+{
+public:
+	D3D11StateContext();
+
+	// Constant buffer ranges need a D3D11.1 context
+	bool Initialize(ID3D11DeviceContext* context);
+
+	ID3D11DeviceContext* GetContext() const { return m_Context; }
+
+	virtual void SetInputLayout(Handle layout) override;
+	virtual void SetVertexBuffer(unsigned slot, Handle buffer, unsigned stride, unsigned offset) override;
+	virtual void SetIndexBuffer(Handle buffer, unsigned format, unsigned offset) override;
+	virtual void SetShader(ShaderStage stage, Handle shader) override;
+	virtual void SetResources(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* views) override;
+	virtual void SetSamplers(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* samplers) override;
+	virtual void SetUnorderedAccessViews(unsigned firstSlot, unsigned count, Handle const* views) override;
+	virtual void SetConstantBuffer(ShaderStage stage, unsigned slot, Handle buffer, unsigned firstConstant, unsigned constantsCount) override;
+	virtual void SetDepthState(Handle state, unsigned stencilRef) override;
+	virtual void SetRasterState(Handle state) override;
+
+	virtual void UpdateBuffer(Handle buffer, const void* data, unsigned size) override;
+	virtual void DrawIndexedInstanced(unsigned indicesCount, unsigned instancesCount, unsigned firstIndex, int baseVertex, unsigned firstInstance) override;
+	virtual void DrawIndexedInstancedIndirect(Handle arguments, unsigned offset) override;
+	virtual void Dispatch(unsigned x, unsigned y, unsigned z) override;
+
+private:
+	ID3D11DeviceContext* m_Context;
+	ReleaseGuard<ID3D11DeviceContext1> m_Context1;
+};
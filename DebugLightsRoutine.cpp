@@ -75,14 +75,13 @@ bool DebugLightsRoutine::Render(float deltaTime)
 	ID3D11ShaderResourceView* srvs[] = { 
 		gSharedRenderResources->LightsCulledSRV.Get(),
 		gSharedRenderResources->LightsCulledCountSRV.Get(),
-		gSharedRenderResources->PointLightsSRV.Get() };
+		gSharedRenderResources->PointLightsSRV.Get(),
+		gSharedRenderResources->LightsCulledMaskSRV.Get() };
 	context->PSSetShaderResources(0, _countof(srvs), srvs);
+	context->PSSetConstantBuffers(1, 1, gSharedRenderResources->LightTilingBuffer.GetConstPP());
 
 	m_SQ->Draw(nullptr, 0);
 
-	ID3D11ShaderResourceView* emptySrvs[] = { nullptr, nullptr, nullptr, nullptr };
-	context->PSSetShaderResources(0, _countof(emptySrvs), emptySrvs);
-
 	context->OMSetDepthStencilState(nullptr, 0);
 
 	return true;
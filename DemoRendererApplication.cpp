@@ -5,7 +5,11 @@
 #include <Dx11/Rendering/Mesh.h>
 #include <Dx11/Rendering/FrustumCuller.h>
 
+#include <cstdarg>
+#include <cstdio>
+
 #include "Scene.h"
+#include "SceneCuller.h"
 
 #include "ClearRenderingRoutine.h"
 #include "PolygonizeRoutine.h"
@@ -15,10 +19,16 @@
 #include "DrawRoutine.h"
 #include "PresentRoutine.h"
 #include "DebugLightsRoutine.h"
+#include "UnbindRoutine.h"
 
-#include "GPUProfiling.h"
-
-GPUProfiling gGPUProfiling;
+#include "LightTiling.h"
+#include "JobSystem.h"
+#include "SimulationThread.h"
+#include "MemoryTracker.h"
+#include "FrameArena.h"
+#include "Profiler.h"
+#include "D3D11ProfilerBackend.h"
+#include "TraceRecorder.h"
 
 using namespace DirectX;
 
@@ -28,10 +38,13 @@ DemoRendererApplication::DemoRendererApplication(HINSTANCE instance)
 	: DxGraphicsApplication(instance)
 	, m_LastMouseX(0)
 	, m_LastMouseY(0)
+	, m_MouseYaw(0)
+	, m_MousePitch(0)
 	, m_IsRightButtonDown(false)
 	, m_CurrentRoutines(RS_Draw)
 	, m_Wireframe(false)
 	, m_BoostSpeed(1.f)
+	, m_FramesSinceMemoryReport(0)
 {
 	::memset(m_Keys, 0, 255);
 }
@@ -45,27 +58,47 @@ bool DemoRendererApplication::Initiate(char* className,
 	bool sRGBRT,
 	int samplesCnt)
 {
+	MemoryTracker::SetThreadName("Render");
+	TraceRecorder::SetThreadName("Render");
+
 	bool result = true;
 	result &= DxGraphicsApplication::Initiate(className, windowName, width, height, fullscreen, winProc, sRGBRT);
 
 	static const float NEAR_PLANE = 1.0f;
 	static const float FAR_PLANE = 5000.0f;
+	// 256 bytes per draw - room for 16K draws in the frames in flight
+	static const unsigned CONSTANTS_RING_SIZE = 4 * 1024 * 1024;
+	// Visible static entities per frame before the instance buffer has to grow
+	static const unsigned INSTANCE_BUFFER_CAPACITY = 16 * 1024;
 
 	SetProjection(XM_PI / 3, float(GetWidth()) / GetHeight(), NEAR_PLANE, FAR_PLANE);
 
 	GetMainCamera()->SetLookAt(XMFLOAT3(0, 0, -4)
 								, XMFLOAT3(0, 0, 5)
 								, XMFLOAT3(0, 1, 0));
+	m_SimulationCamera = *GetMainCamera();
 
 	DxRenderer* renderer = static_cast<DxRenderer*>(GetRenderer());
+
+	// A worker per hardware thread but the main one
+	m_JobSystem.reset(new JobSystem());
+	gJobSystem = m_JobSystem.get();
 	
 	m_SharedRenderResources.reset(new SharedRenderResources);
 	gSharedRenderResources = m_SharedRenderResources.get();
 
-	if (!InitializeGPUProfiling())
+	m_SharedRenderResources->ConstantsRing.reset(new ConstantBufferRing);
+	ReturnUnless(m_SharedRenderResources->ConstantsRing->Initialize(renderer->GetDevice(),
+		renderer->GetImmediateContext(),
+		CONSTANTS_RING_SIZE), false);
+
+	m_SharedRenderResources->Instances.reset(new InstanceBuffer);
+	ReturnUnless(m_SharedRenderResources->Instances->Initialize(renderer->GetDevice(), INSTANCE_BUFFER_CAPACITY), false);
+
+	if (!InitializeProfiling())
 		return false;
 
-	m_Scene.reset(new Scene(renderer, GetMainCamera(), GetProjection()));
+	m_Scene.reset(new Scene(renderer, &m_SimulationCamera, GetProjection()));
 	ReturnUnless(m_Scene->Initialize(), false);
 
 	m_ClearRoutine.reset(new ClearRenderingRoutine());
@@ -90,35 +123,133 @@ bool DemoRendererApplication::Initiate(char* className,
 	m_DebugLightsRoutine.reset(new DebugLightsRoutine());
 	ReturnUnless(m_DebugLightsRoutine->Initialize(renderer, GetMainCamera(), GetProjection()), false);
 
-	SetDrawRoutines();
+	ReturnUnless(SetRoutines(), false);
+
+	// The first frame is simulated here so there is one to render. From then
+	// on every frame renders the one simulated before it.
+	m_Scene->Update(0.f);
+	m_Simulation.reset(new SimulationThread([this](float delta) { m_Scene->Update(delta); }));
 
 	return result;
 }
 
-void DemoRendererApplication::SetDrawRoutines()
-{
-	auto renderer = GetRenderer();
-	renderer->ClearRoutines();
+namespace {
+	// The light lists are rebuilt every frame - transient for the graph
+	RenderGraph::ResourceDesc TransientBuffer(const char* name, ID3D11Buffer* buffer)
+	{
+		static const size_t PLACEMENT_ALIGNMENT = 256;
 
-	renderer->AddRoutine(m_ClearRoutine.get());
-	renderer->AddRoutine(m_PolygonizeRoutine.get());
-	renderer->AddRoutine(m_ZPrepassRoutine.get());
-	renderer->AddRoutine(m_TileLightsRoutine.get());
-	renderer->AddRoutine(m_DrawRoutine.get());
-	renderer->AddRoutine(m_PresentRoutine.get());
+		D3D11_BUFFER_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		if (buffer)
+		{
+			buffer->GetDesc(&desc);
+		}
+		RenderGraph::ResourceDesc resource = { name, RenderGraph::RK_Buffer, desc.ByteWidth, PLACEMENT_ALIGNMENT };
+		return resource;
+	}
 }
 
-void DemoRendererApplication::SetDebugRoutines()
+bool DemoRendererApplication::SetRoutines()
 {
+	typedef RenderGraph::Binding Binding;
+	auto& graph = m_FrameGraph;
+	graph.Clear();
+
+	// The routine of every pass
+	std::vector<DxRenderingRoutine*> routines;
+	auto addPass = [&graph, &routines](const char* name, DxRenderingRoutine* routine, bool hasSideEffects) {
+		routines.push_back(routine);
+		return graph.AddPass(name, hasSideEffects);
+	};
+
+	const auto backBuffer = graph.ImportResource("BackBuffer", RenderGraph::RK_Texture);
+	const auto depth = graph.ImportResource("Depth", RenderGraph::RK_Texture);
+	const auto pointLights = graph.ImportResource("PointLights", RenderGraph::RK_Buffer);
+	// Bound and unbound mesh by mesh by the routines using them
+	const auto generatedMeshes = graph.ImportResource("GeneratedMeshes", RenderGraph::RK_Buffer);
+	const auto lightsCulled = graph.CreateResource(TransientBuffer("LightsCulled", m_SharedRenderResources->LightsCulledBuffer.Get()));
+	const auto lightsCulledCount = graph.CreateResource(TransientBuffer("LightsCulledCount", m_SharedRenderResources->LightsCulledCountBuffer.Get()));
+	const auto lightsCulledMask = graph.CreateResource(TransientBuffer("LightsCulledMask", m_SharedRenderResources->LightsCulledMaskBuffer.Get()));
+
+	const auto clear = addPass("Clear", m_ClearRoutine.get(), false);
+	graph.Write(clear, backBuffer, Binding(RenderGraph::BK_RenderTarget, CommandStream::SS_Pixel, 0));
+	graph.Write(clear, depth, Binding(RenderGraph::BK_DepthStencil, CommandStream::SS_Pixel, 0));
+
+	// Reads back the bounds of the meshes for the scene
+	const auto polygonize = addPass("Polygonize", m_PolygonizeRoutine.get(), true);
+	graph.Write(polygonize, generatedMeshes);
+
+	const auto zPrepass = addPass("ZPrepass", m_ZPrepassRoutine.get(), false);
+	graph.Read(zPrepass, generatedMeshes);
+	graph.Write(zPrepass, depth, Binding(RenderGraph::BK_DepthStencil, CommandStream::SS_Pixel, 0));
+
+	const auto tileLights = addPass("TileLights", m_TileLightsRoutine.get(), false);
+	graph.Write(tileLights, pointLights);
+	graph.Read(tileLights, pointLights, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Compute, 0));
+	graph.Read(tileLights, depth, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Compute, 1));
+	graph.Write(tileLights, lightsCulled, Binding(RenderGraph::BK_UnorderedAccess, CommandStream::SS_Compute, 0));
+	graph.Write(tileLights, lightsCulledCount, Binding(RenderGraph::BK_UnorderedAccess, CommandStream::SS_Compute, 1));
+	graph.Write(tileLights, lightsCulledMask, Binding(RenderGraph::BK_UnorderedAccess, CommandStream::SS_Compute, 2));
+
+	switch (m_CurrentRoutines)
+	{
+	case RS_Draw:
+	{
+		const auto draw = addPass("Draw", m_DrawRoutine.get(), false);
+		graph.Read(draw, generatedMeshes);
+		graph.Write(draw, backBuffer, Binding(RenderGraph::BK_RenderTarget, CommandStream::SS_Pixel, 0));
+		graph.Read(draw, depth, Binding(RenderGraph::BK_DepthStencil, CommandStream::SS_Pixel, 0));
+		graph.Read(draw, lightsCulled, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 4));
+		graph.Read(draw, lightsCulledCount, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 5));
+		graph.Read(draw, pointLights, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 6));
+		graph.Read(draw, lightsCulledMask, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 7));
+		break;
+	}
+	case RS_Debug:
+	{
+		const auto debugLights = addPass("DebugLights", m_DebugLightsRoutine.get(), false);
+		graph.Write(debugLights, backBuffer, Binding(RenderGraph::BK_RenderTarget, CommandStream::SS_Pixel, 0));
+		graph.Read(debugLights, depth, Binding(RenderGraph::BK_DepthStencil, CommandStream::SS_Pixel, 0));
+		graph.Read(debugLights, lightsCulled, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 0));
+		graph.Read(debugLights, lightsCulledCount, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 1));
+		graph.Read(debugLights, pointLights, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 2));
+		graph.Read(debugLights, lightsCulledMask, Binding(RenderGraph::BK_ShaderResource, CommandStream::SS_Pixel, 3));
+		break;
+	}
+	default:
+		break;
+	}
+
+	const auto present = addPass("Present", m_PresentRoutine.get(), true);
+	graph.Read(present, backBuffer);
+
+	if (!graph.Compile())
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to compile the frame graph: ", graph.GetError());
+		return false;
+	}
+
 	auto renderer = GetRenderer();
 	renderer->ClearRoutines();
+	m_UnbindRoutines.clear();
+	for (const auto& pass : graph.GetCompiledPasses())
+	{
+		if (!pass.Unbinds.empty())
+		{
+			m_UnbindRoutines.emplace_back(new UnbindRoutine(pass.Unbinds));
+			ReturnUnless(m_UnbindRoutines.back()->Initialize(renderer), false);
+			renderer->AddRoutine(m_UnbindRoutines.back().get());
+		}
+		renderer->AddRoutine(routines[pass.Pass]);
+	}
 
-	renderer->AddRoutine(m_ClearRoutine.get());
-	renderer->AddRoutine(m_PolygonizeRoutine.get());
-	renderer->AddRoutine(m_ZPrepassRoutine.get());
-	renderer->AddRoutine(m_TileLightsRoutine.get());
-	renderer->AddRoutine(m_DebugLightsRoutine.get());
-	renderer->AddRoutine(m_PresentRoutine.get());
+	// D3D11 can't place resources in shared memory - this is what aliasing would take
+	const auto& stats = graph.GetStats();
+	SLOG(Sev_Info, Fac_Rendering, "Frame graph: ", stats.PassesCount, " passes (", stats.PassesCulled, " culled), ",
+		stats.UnbindsCount, " unbinds, transient buffers ", stats.TransientMemory[RenderGraph::RK_Buffer], " bytes aliased of ",
+		stats.TransientMemoryUnaliased[RenderGraph::RK_Buffer]);
+	return true;
 }
 
 namespace {
@@ -131,6 +262,20 @@ namespace {
 
 void DemoRendererApplication::Update(float delta)
 {
+	// Nothing of the simulation is touched from here on until the next Start
+	m_Simulation->Wait();
+
+	for (const auto& command : m_SceneCommands)
+	{
+		command();
+	}
+	m_SceneCommands.clear();
+
+	m_SimulationCamera.Yaw(-m_MouseYaw * MOUSE_SPEED);
+	m_SimulationCamera.Pitch(-m_MousePitch * MOUSE_SPEED);
+	m_MouseYaw = 0;
+	m_MousePitch = 0;
+
 	XMFLOAT3A sd;
 	for (int key = 0; key < 255; ++key)
 	{
@@ -139,34 +284,34 @@ void DemoRendererApplication::Update(float delta)
 		switch (key)
 		{
 		case VK_UP:
-			m_MainCamera.Move(MV_SPEED * delta * m_BoostSpeed);
+			m_SimulationCamera.Move(MV_SPEED * delta * m_BoostSpeed);
 			break;
 		case VK_DOWN:
-			m_MainCamera.Move(-MV_SPEED * delta * m_BoostSpeed);
+			m_SimulationCamera.Move(-MV_SPEED * delta * m_BoostSpeed);
 			break;
 		case VK_LEFT:
-			m_MainCamera.Yaw(-ROT_SPEED * delta * m_BoostSpeed);
+			m_SimulationCamera.Yaw(-ROT_SPEED * delta * m_BoostSpeed);
 			break;
 		case VK_RIGHT:
-			m_MainCamera.Yaw(ROT_SPEED * delta * m_BoostSpeed);
+			m_SimulationCamera.Yaw(ROT_SPEED * delta * m_BoostSpeed);
 			break;
 		case VK_INSERT:
-			m_MainCamera.Up(MV_SPEED * delta);
+			m_SimulationCamera.Up(MV_SPEED * delta);
 			break;
 		case VK_DELETE:
-			m_MainCamera.Up(-MV_SPEED * delta);
+			m_SimulationCamera.Up(-MV_SPEED * delta);
 			break;
 		case VK_HOME:
-			m_MainCamera.Pitch(-ROT_SPEED * delta);
+			m_SimulationCamera.Pitch(-ROT_SPEED * delta);
 			break;
 		case VK_END:
-			m_MainCamera.Pitch(ROT_SPEED * delta);
+			m_SimulationCamera.Pitch(ROT_SPEED * delta);
 			break;
 		default:
 			break;
 		}
 	}
-	m_Scene->Update(delta);
+	m_Simulation->Start(delta);
 }
 
 void DemoRendererApplication::KeyDown(unsigned int key)
@@ -178,15 +323,7 @@ void DemoRendererApplication::KeyDown(unsigned int key)
 	case VK_NUMPAD1:
 	{
 		m_CurrentRoutines = RoutineSet((m_CurrentRoutines + 1) % RS_Count);
-		switch (m_CurrentRoutines)
-		{
-		case RS_Draw:
-			SetDrawRoutines();
-			break;
-		case RS_Debug:
-			SetDebugRoutines();
-			break;
-		}
+		SetRoutines();
 	}
 		break;
 	case VK_F1:
@@ -199,26 +336,38 @@ void DemoRendererApplication::KeyDown(unsigned int key)
 	case VK_F3:
 		m_PresentRoutine->ToggleVSync();
 		break;
+	case VK_F4:
+		m_TileLightsRoutine->ToggleLightsEncoding();
+		break;
 	case VK_F5:
-		m_Scene->ReloadProcedural();
+		m_SceneCommands.push_back([this]() { m_Scene->ReloadProcedural(); });
+		break;
+	case VK_F6:
+		TuneLightTiling();
+		break;
+	case VK_F7:
+		m_DrawRoutine->ToggleMaterialBatching();
+		break;
+	case VK_F8:
+		m_SceneCommands.push_back([this]() { m_Scene->ToggleOcclusionCulling(); });
 		break;
 	case VK_SPACE:
-		m_Scene->FireLight();
+		m_SceneCommands.push_back([this]() { m_Scene->FireLight(); });
 		break;
 	case VK_NUMPAD9:
 		GetRenderer()->ReinitRoutineShading();
 		break;
 	case VK_NUMPAD8:
-		m_Scene->GetEntities()[0].Position.y += 1.0f;
+		m_SceneCommands.push_back([this]() { m_Scene->GetEntities()[0].Position.y += 1.0f; });
 		break;
 	case VK_NUMPAD2:
-		m_Scene->GetEntities()[0].Position.y -= 1.0f;
+		m_SceneCommands.push_back([this]() { m_Scene->GetEntities()[0].Position.y -= 1.0f; });
 		break;
 	case VK_NUMPAD4:
-		m_Scene->GetEntities()[0].Position.x -= 1.0f;
+		m_SceneCommands.push_back([this]() { m_Scene->GetEntities()[0].Position.x -= 1.0f; });
 		break;
 	case VK_NUMPAD6:
-		m_Scene->GetEntities()[0].Position.x += 1.0f;
+		m_SceneCommands.push_back([this]() { m_Scene->GetEntities()[0].Position.x += 1.0f; });
 		break;
 	case VK_SHIFT:
 		m_BoostSpeed = BOOST_COEFF;
@@ -268,22 +417,70 @@ void DemoRendererApplication::MouseMove(int x, int y)
 		const int dX = m_LastMouseX - x;
 		const int dY = m_LastMouseY - y;
 
-		m_MainCamera.Yaw(-dX*MOUSE_SPEED);
-		m_MainCamera.Pitch(-dY*MOUSE_SPEED);
+		m_MouseYaw += dX;
+		m_MousePitch += dY;
 	}
 
 	m_LastMouseX = x;
 	m_LastMouseY = y;
 }
 
-#define CREATE_QUERY(OBJECT) \
-	if (FAILED(device->CreateQuery(&desc, OBJECT.Receive()))) \
-	{ \
-		SLOG(Sev_Error, Fac_Rendering, "Unable to create timestamp query");	\
-		return false; \
+void DemoRendererApplication::TuneLightTiling()
+{
+	static const unsigned REPEATS = 5;
+	static const unsigned GPU_DISPATCHES = 16;
+
+	LightTilingTuner tuner;
+	auto candidates = LightTilingTuner::DefaultCandidates();
+	const auto currentConfig = m_TileLightsRoutine->GetTilingConfig();
+
+	// The CPU culler works on a capture of the last frame. It also tells us which
+	// light caps would drop lights in this scene - those are not considered at all.
+	LightTilingScene recorded;
+	if (m_TileLightsRoutine->RecordScene(recorded))
+	{
+		CpuTileLightCuller culler;
+		std::vector<std::uint32_t> lightIds;
+		std::vector<std::uint32_t> counts;
+		LightTilingTuner::ResultsVec cpuResults;
+		LightTilingTuner::Result cpuBest;
+		tuner.Tune(candidates, [&](const LightTilingConfig& config) -> double {
+			const auto start = std::chrono::high_resolution_clock::now();
+			culler.Cull(config, recorded, lightIds, counts);
+			const auto end = std::chrono::high_resolution_clock::now();
+			if (std::find(counts.cbegin(), counts.cend(), config.MaxLightsPerTile) != counts.cend())
+				return -1;
+			return std::chrono::duration<double, std::milli>(end - start).count();
+		}, REPEATS, cpuBest, &cpuResults);
+
+		candidates.clear();
+		for (const auto& result : cpuResults)
+		{
+			SLOG(Sev_Info, Fac_Rendering, "Light tiling CPU - tile ", result.Config.TileSize,
+				" max lights ", result.Config.MaxLightsPerTile, ": ", result.Milliseconds, "ms");
+			candidates.push_back(result.Config);
+		}
+	}
+
+	LightTilingTuner::Result gpuBest;
+	if (!tuner.Tune(candidates, [&](const LightTilingConfig& config) {
+			return m_TileLightsRoutine->MeasureConfig(config, GPU_DISPATCHES);
+		}, REPEATS, gpuBest))
+	{
+		SLOG(Sev_Warning, Fac_Rendering, "Unable to tune the light tiling - keeping the current config");
+		m_TileLightsRoutine->SetTilingConfig(currentConfig);
+		return;
 	}
 
-bool DemoRendererApplication::InitializeGPUProfiling()
+	m_TileLightsRoutine->SetTilingConfig(gpuBest.Config);
+	// The light lists were recreated for the tile size
+	SetRoutines();
+	SLOG(Sev_Info, Fac_Rendering, "Light tiling tuned for ", GetWidth(), "x", GetHeight(),
+		" and ", m_Scene->GetLights().size() + m_Scene->GetDynamicLights().size(), " lights - tile ",
+		gpuBest.Config.TileSize, " max lights ", gpuBest.Config.MaxLightsPerTile, ": ", gpuBest.Milliseconds, "ms");
+}
+
+bool DemoRendererApplication::InitializeProfiling()
 {
 #if defined(ENABLE_GPU_PROFILING)
 	m_ProfileFile.open("gpu_profile.log");
@@ -293,111 +490,223 @@ bool DemoRendererApplication::InitializeGPUProfiling()
 		return false;
 	}
 	
-	gGPUProfiling.FrameCounter = 0;
-	gGPUProfiling.CurrentIndex = 0;
-
-	auto device = m_Renderer->GetDevice();
-
-	for (auto i = 0; i < GPUProfiling::QUERIES_COUNT; ++i) {
-		D3D11_QUERY_DESC desc;
-		::memset(&desc, 0, sizeof(desc));
-		desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
-		CREATE_QUERY(gGPUProfiling.FrameDisjoint[i]);
-		
-		desc.Query = D3D11_QUERY_TIMESTAMP;
-		
-		CREATE_QUERY(gGPUProfiling.FrameBegin[i]);
-		CREATE_QUERY(gGPUProfiling.FrameEnd[i]);
-		CREATE_QUERY(gGPUProfiling.ZPrepassBegin[i]);
-		CREATE_QUERY(gGPUProfiling.ZPrepassEnd[i]);
-		CREATE_QUERY(gGPUProfiling.PolygonizeBegin[i]);
-		CREATE_QUERY(gGPUProfiling.PolygonizeEnd[i]);
-		CREATE_QUERY(gGPUProfiling.TileLightsBegin[i]);
-		CREATE_QUERY(gGPUProfiling.TileLightsEnd[i]);
-		CREATE_QUERY(gGPUProfiling.DrawBegin[i]);
-		CREATE_QUERY(gGPUProfiling.DrawEnd[i]);
-		CREATE_QUERY(gGPUProfiling.PresentBegin[i]);
-		CREATE_QUERY(gGPUProfiling.PresentEnd[i]);
+	// Frames the GPU can fall behind before their timings are dropped
+	static const unsigned PROFILED_FRAMES = 5;
+	m_ProfilerBackend.reset(new D3D11ProfilerBackend(m_Renderer->GetDevice(), m_Renderer->GetImmediateContext()));
+	m_Profiler.reset(new Profiler(m_ProfilerBackend.get(), PROFILED_FRAMES));
+	ReturnUnless(m_Profiler->Initialize(), false);
+	m_LastProfiledFrame = 0;
+	gProfiler = m_Profiler.get();
+
+	m_Trace.reset(new TraceRecorder);
+	if (!m_Trace->Start("frame_trace.json"))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to open file for the frame trace");
+		return false;
 	}
+	gTrace = m_Trace.get();
 #endif
 	return true;
 }
 
 void DemoRendererApplication::PreRender()
 {
+	// The frame simulated before the one started in Update, seen from its own camera
+	m_Scene->BeginRenderFrame();
+	m_MainCamera = m_Scene->GetRenderSnapshot().MainCamera;
+
+	m_SharedRenderResources->ConstantsRing->BeginFrame();
+
+	// The scene is culled in the simulation - the transforms of the visible
+	// entities are shared by all passes of the frame
+	if (!m_SharedRenderResources->Instances->Upload(m_Renderer->GetImmediateContext(), m_Scene->GetInstances()))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to upload the instance transforms");
+	}
+
 #if defined(ENABLE_GPU_PROFILING)
-	auto ctx = m_Renderer->GetImmediateContext();
-	ctx->Begin(gGPUProfiling.FrameDisjoint[gGPUProfiling.CurrentIndex].Get());
-	ctx->End(gGPUProfiling.FrameBegin[gGPUProfiling.CurrentIndex].Get());
+	m_Profiler->BeginFrame();
 #endif
 }
 
+namespace {
+	void LogMemoryReport(const MemoryTracker::FrameStats& memory)
+	{
+		if (MemoryTracker::IsHeapTracked())
+		{
+			SLOG(Sev_Info, Fac_Rendering, "Memory: ", memory.Allocations, " allocations (", memory.BytesAllocated / 1024,
+				" KB) in the last frame, ", memory.LiveBytes / 1024, " KB live, ", memory.GPUBytes / 1024, " KB on the GPU");
+		}
+		else
+		{
+			SLOG(Sev_Info, Fac_Rendering, "Memory: ", memory.GPUBytes / 1024, " KB on the GPU - the heap is tracked with ENABLE_MEMORY_TRACKING");
+		}
+
+		for (auto category = 0u; category < MC_Count; ++category)
+		{
+			const auto& stats = memory.Categories[category];
+			SLOG(Sev_Info, Fac_Rendering, "  ", GetMemoryCategoryName(MemoryCategory(category)), ": ", stats.Allocations,
+				" allocations (", stats.BytesAllocated / 1024, " KB), ", stats.LiveBytes / 1024, " KB live, ",
+				stats.GPUBytes / 1024, " KB on the GPU");
+		}
+		for (auto thread = 0u; thread < memory.ThreadsCount; ++thread)
+		{
+			const auto& stats = memory.Threads[thread];
+			if (!stats.Allocations)
+				continue;
+			SLOG(Sev_Info, Fac_Rendering, "  Thread ", thread, " (", stats.Name ? stats.Name : "unnamed", "): ",
+				stats.Allocations, " allocations (", stats.BytesAllocated / 1024, " KB)");
+		}
+	}
+
+	// printf into a buffer of fixed size - what doesn't fit is cut off
+	class LineWriter
+	{
+	public:
+		LineWriter(char* buffer, size_t capacity)
+			: m_Buffer(buffer)
+			, m_Capacity(capacity)
+			, m_Length(0)
+		{
+			m_Buffer[0] = '\0';
+		}
+
+		void Append(const char* format, ...)
+		{
+			if (m_Length + 1 >= m_Capacity)
+				return;
+			va_list args;
+			va_start(args, format);
+			const int written = vsnprintf(m_Buffer + m_Length, m_Capacity - m_Length, format, args);
+			va_end(args);
+			if (written > 0)
+			{
+				m_Length = std::min(m_Length + size_t(written), m_Capacity - 1);
+			}
+		}
+
+		const char* GetText() const { return m_Buffer; }
+		size_t GetLength() const { return m_Length; }
+
+	private:
+		char* m_Buffer;
+		size_t m_Capacity;
+		size_t m_Length;
+	};
+
+	// Room for the scopes and the stats of a frame
+	static const size_t PROFILE_LINE_CAPACITY = 16 * 1024;
+}
+
 void DemoRendererApplication::PostRender()
 {
+	m_SharedRenderResources->ConstantsRing->EndFrame();
 #if defined(ENABLE_GPU_PROFILING)
-	auto ctx = m_Renderer->GetImmediateContext();
-	ctx->End(gGPUProfiling.FrameDisjoint[gGPUProfiling.CurrentIndex].Get());
-	ctx->End(gGPUProfiling.FrameEnd[gGPUProfiling.CurrentIndex].Get());
+	const auto frameMemory = m_SharedRenderResources->FrameMemory.ResetStats();
+#endif
+	m_SharedRenderResources->FrameMemory.Reset();
 
-	const auto lastFrameIndex = (gGPUProfiling.CurrentIndex + 1) % GPUProfiling::QUERIES_COUNT;
-	gGPUProfiling.CurrentIndex = (gGPUProfiling.CurrentIndex + 1) % GPUProfiling::QUERIES_COUNT;
+	static const unsigned MEMORY_REPORT_INTERVAL = 600;
+	const auto memory = MemoryTracker::EndFrame();
+	if (++m_FramesSinceMemoryReport >= MEMORY_REPORT_INTERVAL)
+	{
+		m_FramesSinceMemoryReport = 0;
+		LogMemoryReport(memory);
+	}
 
-	// Give times to queries to end
-	if (gGPUProfiling.FrameCounter++ < GPUProfiling::QUERIES_COUNT - 1)
+#if defined(ENABLE_GPU_PROFILING)
+	// The timings come back a few frames late, or not at all for the frames
+	// the GPU fell too far behind on
+	m_Profiler->EndFrame();
+
+	const auto& snapshot = m_Scene->GetRenderSnapshot();
+	m_Trace->Counter("Static draws", double(m_DrawRoutine->GetStaticDrawsCount()));
+	m_Trace->Counter("Visible subsets", double(snapshot.CullStats.Traversal.ItemsVisible));
+	m_Trace->Counter("Dynamic lights", double(snapshot.DynamicLights.size()));
+	m_Trace->Counter("Heap allocations", double(memory.Allocations));
+	m_Trace->Counter("Frame memory KB", double(frameMemory.BytesUsed / 1024));
+
+	const auto& profiled = m_Profiler->GetLastFrame();
+	if (profiled.FrameId == m_LastProfiledFrame)
 		return;
-
-	std::ostringstream line;
-	const auto frameId = gGPUProfiling.FrameCounter - (GPUProfiling::QUERIES_COUNT - 1);
-	line << "Frame " << frameId << ": ";
-
-	while (ctx->GetData(gGPUProfiling.FrameDisjoint[lastFrameIndex].Get(), nullptr, 0, 0) == S_FALSE)
+	m_LastProfiledFrame = profiled.FrameId;
+	m_Trace->ProfiledFrame(*m_Profiler);
+
+	// Formatted in the scratch arena - the report doesn't touch the heap
+	auto& scratch = FrameArena::GetThreadArena();
+	ScopedRewind rewind(scratch);
+	LineWriter line(scratch.Allocate<char>(PROFILE_LINE_CAPACITY), PROFILE_LINE_CAPACITY);
+	line.Append("Frame %llu: ", static_cast<unsigned long long>(profiled.FrameId));
+	if (!profiled.HasGPUTimes)
 	{
-		line << "Query not ready! Sleeping!" << std::endl;
-		::Sleep(1);
+		line.Append("Disjoint frame data detected!");
 	}
+	line.Append("\n");
 
-	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
-	ctx->GetData(gGPUProfiling.FrameDisjoint[lastFrameIndex].Get(), &disjoint, sizeof(disjoint), 0);
-
-	// Even if the the query is disjoint we get all data, otherwise
-	// D3D11 complains with a warning
-	if (disjoint.Disjoint)
+	// GPU and CPU milliseconds of the scopes, nested ones indented
+	for (const auto& scope : profiled.Scopes)
 	{
-		line << "Disjoint frame data detected!";
+		line.Append("%*s%s: ", int(scope.Depth * 2), "", scope.Name);
+		if (profiled.HasGPUTimes)
+		{
+			line.Append("%f GPU, ", scope.GPUDuration);
+		}
+		line.Append("%f CPU\n", scope.CPUDuration);
 	}
 
-	line << std::endl;
-	
-	auto printTimestamp = [&](ID3D11Query* startQuery, ID3D11Query* endQuery, const char* prettyStr) {
-		UINT64 start, end;
-		ctx->GetData(startQuery, &start, sizeof(start), 0);
-		ctx->GetData(endQuery, &end, sizeof(end), 0);
-		if (!disjoint.Disjoint)
-			line << prettyStr << std::fixed << (double(end - start) / (double(disjoint.Frequency)) * 1000.0) << "; ";
-	};
+	const auto profilerStats = m_Profiler->ResetStats();
+	if (profilerStats.FramesDropped || profilerStats.ScopesDropped)
+	{
+		line.Append("Profiler: %u frames and %u scopes dropped; ", profilerStats.FramesDropped, profilerStats.ScopesDropped);
+	}
+	// Since the trace started - the ring was full when the writer fell behind
+	const auto traceStats = m_Trace->GetStats();
+	if (traceStats.EventsDropped)
+	{
+		line.Append("Trace: %llu of %llu events dropped; ", static_cast<unsigned long long>(traceStats.EventsDropped),
+			static_cast<unsigned long long>(traceStats.EventsWritten + traceStats.EventsDropped));
+	}
 
-	// Get all timestamps
-	printTimestamp(gGPUProfiling.FrameBegin[lastFrameIndex].Get(),
-		gGPUProfiling.FrameEnd[lastFrameIndex].Get(),
-		"Total frame time: ");
-	printTimestamp(gGPUProfiling.PolygonizeBegin[lastFrameIndex].Get(),
-		gGPUProfiling.PolygonizeEnd[lastFrameIndex].Get(),
-		"Polygonize: ");
-	printTimestamp(gGPUProfiling.ZPrepassBegin[lastFrameIndex].Get(),
-		gGPUProfiling.ZPrepassEnd[lastFrameIndex].Get(),
-		"Z Prepass: ");
-	printTimestamp(gGPUProfiling.TileLightsBegin[lastFrameIndex].Get(),
-		gGPUProfiling.TileLightsEnd[lastFrameIndex].Get(),
-		"Tile lights: ");
-	printTimestamp(gGPUProfiling.DrawBegin[lastFrameIndex].Get(),
-		gGPUProfiling.DrawEnd[lastFrameIndex].Get(),
-		"Draw: ");
-	printTimestamp(gGPUProfiling.PresentBegin[lastFrameIndex].Get(),
-		gGPUProfiling.PresentEnd[lastFrameIndex].Get(),
-		"Present: ");
-	
-	line << std::endl;
-	
-	m_ProfileFile << line.str() << std::endl;
+	const auto queueStats = m_Scene->GetRenderQueue().ComputeStats();
+	line.Append("Static draws: %u for %u subsets of %u instances; Shader changes: %u; Texture changes: %u; ",
+		m_DrawRoutine->GetStaticDrawsCount(), queueStats.Entries, unsigned(m_Scene->GetInstances().size()),
+		queueStats.ShaderChanges, queueStats.TextureChanges);
+
+	const auto& replayStats = m_DrawRoutine->GetReplayStats();
+	line.Append("Commands: %u replayed, %u of %u state calls and %u of %u slots filtered; ",
+		replayStats.Commands, replayStats.State.CallsFiltered, replayStats.State.Calls,
+		replayStats.State.SlotsFiltered, replayStats.State.Slots);
+
+	line.Append("Transforms: %u of %u composed; ", snapshot.TransformsComposed, snapshot.TransformsCount);
+
+	const auto& cullStats = snapshot.CullStats;
+	line.Append("Culling: %u of %u subsets visible (%u accepted whole), %u nodes visited, %u boxes tested, %u nodes refit; ",
+		cullStats.Traversal.ItemsVisible, cullStats.ItemsCount, cullStats.Traversal.ItemsAccepted,
+		cullStats.Traversal.NodesVisited, cullStats.Traversal.BoxesTested, cullStats.NodesRefit);
+	line.Append("Occlusion: %u of %u subsets occluded (%d%%), %u of %u occluder triangles rasterized; ",
+		cullStats.ItemsOccluded, cullStats.Occlusion.BoxesTested, int(cullStats.Occlusion.GetCullRate() * 100.f + 0.5f),
+		cullStats.Occlusion.TrianglesRasterized, cullStats.Occlusion.OccluderTriangles);
+	line.Append("Procedural: %u of %u visible; ", cullStats.ProceduralVisible, cullStats.ProceduralCount);
+	line.Append("Spatial index: %u objects; ", snapshot.SpatialObjectsCount);
+
+	const auto jobStats = m_JobSystem->ResetStats();
+	line.Append("Jobs: %u run (%u stolen) on %u threads; ", jobStats.JobsRun, jobStats.JobsStolen, m_JobSystem->GetThreadsCount());
+
+	// Before the ring every constants allocation was a Map or UpdateSubresource of its own
+	const auto& ringStats = m_SharedRenderResources->ConstantsRing->GetLastFrameStats();
+	line.Append("Constant buffer maps: %u for %u allocations; ", ringStats.Maps, ringStats.Allocations);
+
+	// The arenas stop taking blocks from the heap once they fit a frame
+	line.Append("Heap: %llu allocations (%llu KB); ", static_cast<unsigned long long>(memory.Allocations),
+		static_cast<unsigned long long>(memory.BytesAllocated / 1024));
+	line.Append("Frame memory: %u of %u KB simulated, %u of %u KB rendered, %u blocks allocated; ",
+		unsigned(snapshot.FrameMemory.BytesUsed / 1024), unsigned(snapshot.FrameMemory.Capacity / 1024),
+		unsigned(frameMemory.BytesUsed / 1024), unsigned(frameMemory.Capacity / 1024),
+		snapshot.FrameMemory.BlocksAllocated + frameMemory.BlocksAllocated);
+
+	line.Append("\n");
+
+	m_ProfileFile.write(line.GetText(), line.GetLength());
+	m_ProfileFile << std::endl;
 #endif
 }
\ No newline at end of file
@@ -2,7 +2,11 @@
 
 #include <Dx11/AppGraphics/DxGraphicsApplication.h>
 
+#include "RenderGraph.h"
+
 class Scene;
+class JobSystem;
+class SimulationThread;
 
 class ClearRenderingRoutine;
 class PresentRoutine;
@@ -11,9 +15,14 @@ class DrawRoutine;
 class TileLightsRoutine;
 class ZPrepassRoutine;
 class DebugLightsRoutine;
+class UnbindRoutine;
 
 struct SharedRenderResources;
 
+class Profiler;
+class D3D11ProfilerBackend;
+class TraceRecorder;
+
 class DemoRendererApplication : public DxGraphicsApplication
 {
 public:
@@ -29,15 +38,33 @@ public:
 	virtual void MouseButtonUp(MouseBtn button, int x, int y) override;
 
 private:
-	void SetDrawRoutines();
-	void SetDebugRoutines();
-	bool InitializeGPUProfiling();
+	// Builds the frame graph of the current routine set and hands the
+	// routines to the renderer in the compiled order
+	bool SetRoutines();
+	bool InitializeProfiling();
+	void TuneLightTiling();
 
 	#if defined(ENABLE_GPU_PROFILING)
 	std::ofstream m_ProfileFile;
+	std::unique_ptr<D3D11ProfilerBackend> m_ProfilerBackend;
+	std::unique_ptr<Profiler> m_Profiler;
+	// The timings are written once per frame read back
+	std::uint64_t m_LastProfiledFrame;
+	// Outlives the threads that record to it
+	std::unique_ptr<TraceRecorder> m_Trace;
 	#endif
+	// Outlives everything that runs jobs on it
+	std::unique_ptr<JobSystem> m_JobSystem;
 	std::unique_ptr<Scene> m_Scene;
 
+	// The scene is simulated a frame ahead of the rendering, with its own
+	// camera. Input is applied to it between two simulated frames.
+	std::unique_ptr<SimulationThread> m_Simulation;
+	Camera m_SimulationCamera;
+	std::vector<std::function<void()>> m_SceneCommands;
+	int m_MouseYaw;
+	int m_MousePitch;
+
 	std::unique_ptr<ClearRenderingRoutine> m_ClearRoutine;
 	std::unique_ptr<ZPrepassRoutine> m_ZPrepassRoutine;
 	std::unique_ptr<PolygonizeRoutine> m_PolygonizeRoutine;
@@ -46,6 +73,10 @@ private:
 	std::unique_ptr<PresentRoutine> m_PresentRoutine;
 	std::unique_ptr<DebugLightsRoutine> m_DebugLightsRoutine;
 
+	RenderGraph m_FrameGraph;
+	// Inserted before the passes with bindings of earlier passes in the way
+	std::vector<std::unique_ptr<UnbindRoutine>> m_UnbindRoutines;
+
 	std::unique_ptr<SharedRenderResources> m_SharedRenderResources;
 
 	bool m_Keys[255];
@@ -57,6 +88,9 @@ private:
 	bool m_Wireframe;
 	float m_BoostSpeed;
 
+	// Frames since the memory was last written to the log
+	unsigned m_FramesSinceMemoryReport;
+
 	enum RoutineSet
 	{
 		RS_Draw,
@@ -0,0 +1,108 @@
+#include "precompiled.h"
+
+#include "DepthOnlyMesh.h"
+
+namespace {
+	struct PositionKey
+	{
+		std::uint32_t Bits[3];
+
+		bool operator==(const PositionKey& other) const
+		{
+			return Bits[0] == other.Bits[0] && Bits[1] == other.Bits[1] && Bits[2] == other.Bits[2];
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(const PositionKey& key) const
+		{
+			return size_t(key.Bits[0] * 73856093u ^ key.Bits[1] * 19349663u ^ key.Bits[2] * 83492791u);
+		}
+	};
+
+	PositionKey MakeKey(const float* position)
+	{
+		PositionKey key;
+		for (auto i = 0; i < 3; ++i)
+		{
+			// -0 and 0 are the same position
+			const float value = position[i] == 0.f ? 0.f : position[i];
+			::memcpy(&key.Bits[i], &value, sizeof(float));
+		}
+		return key;
+	}
+}
+
+void DepthOnlyMeshBuilder::AddSubset(const void* vertices,
+	unsigned stride,
+	unsigned verticesCount,
+	const std::uint32_t* indices,
+	unsigned indicesCount)
+{
+	static const std::uint32_t NOT_COPIED = 0xFFFFFFFF;
+	std::vector<std::uint32_t> remap(verticesCount, NOT_COPIED);
+
+	const auto* bytes = static_cast<const std::uint8_t*>(vertices);
+	m_Data.Indices.reserve(m_Data.Indices.size() + indicesCount);
+	for (auto i = 0u; i < indicesCount; ++i)
+	{
+		const auto index = indices[i];
+		if (index >= verticesCount)
+		{
+			m_Data.Indices.push_back(0);
+			continue;
+		}
+		if (remap[index] == NOT_COPIED)
+		{
+			remap[index] = m_Data.GetVerticesCount();
+			const auto* position = reinterpret_cast<const float*>(bytes + size_t(index) * stride);
+			m_Data.Positions.insert(m_Data.Positions.end(), position, position + 3);
+		}
+		m_Data.Indices.push_back(remap[index]);
+	}
+}
+
+void DepthOnlyMeshBuilder::Weld()
+{
+	const auto verticesCount = m_Data.GetVerticesCount();
+	std::unordered_map<PositionKey, std::uint32_t, PositionKeyHash> unique;
+	unique.reserve(verticesCount);
+
+	std::vector<std::uint32_t> remap(verticesCount);
+	std::vector<float> positions;
+	positions.reserve(m_Data.Positions.size());
+	for (auto vertex = 0u; vertex < verticesCount; ++vertex)
+	{
+		const float* position = &m_Data.Positions[vertex * 3];
+		auto inserted = unique.insert(std::make_pair(MakeKey(position), std::uint32_t(positions.size() / 3)));
+		if (inserted.second)
+		{
+			positions.insert(positions.end(), position, position + 3);
+		}
+		remap[vertex] = inserted.first->second;
+	}
+
+	for (auto& index : m_Data.Indices)
+	{
+		index = remap[index];
+	}
+	m_Data.Positions.swap(positions);
+}
+
+void DepthOnlyMeshBuilder::Optimize(MeshOptimizer::CacheStats& outBefore, MeshOptimizer::CacheStats& outAfter)
+{
+	const auto verticesCount = m_Data.GetVerticesCount();
+	const auto indicesCount = unsigned(m_Data.Indices.size());
+	outBefore = MeshOptimizer::AnalyzeVertexCache(m_Data.Indices.data(), indicesCount, verticesCount);
+
+	MeshOptimizer::OptimizeTriangles(m_Data.Indices.data(), indicesCount, m_Data.Positions.data(), 3 * sizeof(float), verticesCount);
+
+	std::vector<std::uint32_t> remap;
+	const auto usedCount = MeshOptimizer::OptimizeVertexFetch(m_Data.Indices.data(), indicesCount, verticesCount, remap);
+	std::vector<float> positions(usedCount * 3);
+	MeshOptimizer::RemapVertices(m_Data.Positions.data(), 3 * sizeof(float), verticesCount, remap, positions.data());
+	m_Data.Positions.swap(positions);
+
+	outAfter = MeshOptimizer::AnalyzeVertexCache(m_Data.Indices.data(), indicesCount, m_Data.GetVerticesCount());
+}
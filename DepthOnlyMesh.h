@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "MeshOptimizer.h"
+
+// Position-only copy of the opaque subsets of a mesh - everything the depth
+// prepass needs in a single vertex stream and a single index buffer
+struct DepthOnlyMeshData
+{
+	// xyz per vertex
+	std::vector<float> Positions;
+	std::vector<std::uint32_t> Indices;
+
+	unsigned GetVerticesCount() const { return unsigned(Positions.size() / 3); }
+};
+
+class DepthOnlyMeshBuilder
+{
+public:
+	// The position is taken from the first 3 floats of every vertex.
+	// Only the vertices referenced by 'indices' are copied.
+	void AddSubset(const void* vertices,
+		unsigned stride,
+		unsigned verticesCount,
+		const std::uint32_t* indices,
+		unsigned indicesCount);
+
+	// Merges vertices with the same position - subsets of a mesh share
+	// vertices and without the other attributes most UV and normal seams
+	// collapse too
+	void Weld();
+
+	// Reorders the triangles for the vertex cache and overdraw and the
+	// vertices for fetch locality. Call after Weld.
+	void Optimize(MeshOptimizer::CacheStats& outBefore, MeshOptimizer::CacheStats& outAfter);
+
+	const DepthOnlyMeshData& GetData() const { return m_Data; }
+
+private:
+	DepthOnlyMeshData m_Data;
+};
@@ -0,0 +1,157 @@
+#include "precompiled.h"
+
+#include "DrawPacket.h"
+#include "BufferReadback.h"
+#include "VertexCompression.h"
+#include "ResourceTracking.h"
+
+#include <Dx11/Rendering/Mesh.h>
+#include <Dx11/Rendering/Material.h>
+#include <Dx11/Rendering/VertexTypes.h>
+#include <Dx11/Rendering/MaterialShaderManager.h>
+
+DrawPacketCache::DrawPacketCache(ID3D11Device* device,
+	ID3D11DeviceContext* context,
+	MaterialShaderManager* shaderManager,
+	const char* shaderName,
+	const char* vsEntry,
+	const char* psEntry,
+	float defaultSpecularPower)
+	: m_Device(device)
+	, m_Context(context)
+	, m_ShaderManager(shaderManager)
+	, m_ShaderName(shaderName)
+	, m_VSEntry(vsEntry)
+	, m_PSEntry(psEntry)
+	, m_DefaultSpecularPower(defaultSpecularPower)
+	, m_BakesCount(0)
+{}
+
+const DrawPacket& DrawPacketCache::Get(Subset* subset)
+{
+	auto it = m_Packets.find(subset);
+	if (it == m_Packets.end())
+	{
+		it = m_Packets.insert(std::make_pair(subset, DrawPacket())).first;
+		Bake(subset, it->second);
+	}
+	else if (it->second.MaterialProperties != subset->GetMaterial().GetProperties())
+	{
+		Bake(subset, it->second);
+	}
+	return it->second;
+}
+
+void DrawPacketCache::Invalidate()
+{
+	m_Packets.clear();
+}
+
+void DrawPacketCache::Invalidate(const Subset* subset)
+{
+	m_Packets.erase(subset);
+}
+
+bool DrawPacketCache::PrepareMesh(Mesh* mesh)
+{
+	std::vector<std::uint8_t> vertices;
+	if (!ReadBackBuffer(m_Device, m_Context, mesh->GetVertexBuffer(), vertices))
+		return false;
+	const auto verticesCount = unsigned(vertices.size() / sizeof(StandardVertex));
+
+	std::vector<std::uint8_t> indicesData;
+	std::vector<std::uint32_t> indices;
+	std::vector<std::uint16_t> compact;
+	for (size_t i = 0; i < mesh->GetSubsetCount(); ++i)
+	{
+		const auto& subset = mesh->GetSubset(i);
+		if (m_Indices.find(subset.get()) != m_Indices.end())
+			continue;
+
+		if (!ReadBackBuffer(m_Device, m_Context, subset->GetIndexBuffer(), indicesData))
+			return false;
+		const auto indicesCount = unsigned(subset->GetIndicesCount());
+		const auto* source = reinterpret_cast<const std::uint32_t*>(indicesData.data());
+		if (!indicesCount || indicesData.size() < indicesCount * sizeof(std::uint32_t))
+			continue;
+
+		indices.assign(source, source + indicesCount);
+		const auto statsBefore = MeshOptimizer::AnalyzeVertexCache(indices.data(), indicesCount, verticesCount);
+		// The subsets share the vertex buffer of the mesh
+		if (!MeshOptimizer::OptimizeTrianglesInRange(indices.data(), indicesCount, vertices.data(), sizeof(StandardVertex), verticesCount))
+			continue;
+		m_StatsBefore += statsBefore;
+		m_StatsAfter += MeshOptimizer::AnalyzeVertexCache(indices.data(), indicesCount, verticesCount);
+
+		std::unique_ptr<OptimizedIndices> optimized(new OptimizedIndices);
+		D3D11_BUFFER_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA initData = { 0 };
+
+		std::uint32_t baseVertex = 0;
+		if (VertexCompression::RebaseIndices16(indices.data(), indicesCount, compact, baseVertex))
+		{
+			optimized->Format = DXGI_FORMAT_R16_UINT;
+			optimized->BaseVertex = baseVertex;
+			desc.ByteWidth = UINT(compact.size() * sizeof(std::uint16_t));
+			initData.pSysMem = compact.data();
+		}
+		else
+		{
+			optimized->Format = DXGI_FORMAT_R32_UINT;
+			optimized->BaseVertex = 0;
+			desc.ByteWidth = UINT(indices.size() * sizeof(std::uint32_t));
+			initData.pSysMem = indices.data();
+		}
+
+		if (FAILED(m_Device->CreateBuffer(&desc, &initData, optimized->Buffer.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create optimized index buffer");
+			return false;
+		}
+		TrackResource(optimized->Buffer.Get(), MC_Scene);
+		m_Indices[subset.get()] = std::move(optimized);
+		m_Packets.erase(subset.get());
+	}
+	return true;
+}
+
+void DrawPacketCache::Bake(Subset* subset, DrawPacket& packet)
+{
+	const Material& material = subset->GetMaterial();
+
+	packet.MaterialProperties = material.GetProperties();
+	packet.VertexShader = m_ShaderManager->GetVertexShader(m_ShaderName, m_VSEntry, "vs_5_0", material);
+	packet.PixelShader = m_ShaderManager->GetPixelShader(m_ShaderName, m_PSEntry, "ps_5_0", material);
+
+	const TexturePtr textures[] = {
+		material.GetDiffuse(),
+		material.GetNormalMap(),
+		material.GetAlphaMask(),
+		material.GetSpecularMap()
+	};
+	for (auto i = 0u; i < _countof(textures); ++i)
+	{
+		packet.Textures[i] = textures[i].get() ? textures[i]->GetSHRV() : nullptr;
+	}
+
+	packet.IndicesCount = subset->GetIndicesCount();
+	const auto optimized = m_Indices.find(subset);
+	if (optimized != m_Indices.end())
+	{
+		packet.IndexBuffer = optimized->second->Buffer.Get();
+		packet.IndexFormat = optimized->second->Format;
+		packet.BaseVertex = optimized->second->BaseVertex;
+	}
+	else
+	{
+		packet.IndexBuffer = subset->GetIndexBuffer();
+		packet.IndexFormat = DXGI_FORMAT_R32_UINT;
+		packet.BaseVertex = 0;
+	}
+	packet.SpecularPower = material.HasProperty(MP_SpecularPower) ? material.GetSpecularPower() : m_DefaultSpecularPower;
+
+	++m_BakesCount;
+}
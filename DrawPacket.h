@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Dx11/Rendering/Subset.h>
+
+#include "MeshOptimizer.h"
+
+class MaterialShaderManager;
+class Mesh;
+
+// Everything DrawRoutine binds for a static subset, resolved once instead of
+// walking the material on every draw. The pointers are not owned - the
+// shader manager and the materials keep the objects alive.
+struct DrawPacket
+{
+	unsigned MaterialProperties;
+	ID3D11VertexShader* VertexShader;
+	ID3D11PixelShader* PixelShader;
+	// diffuse, normal map, alpha mask, specular map
+	ID3D11ShaderResourceView* Textures[4];
+	ID3D11Buffer* IndexBuffer;
+	DXGI_FORMAT IndexFormat;
+	unsigned IndicesCount;
+	unsigned BaseVertex;
+	float SpecularPower;
+};
+
+class DrawPacketCache
+{
+public:
+	DrawPacketCache(ID3D11Device* device,
+		ID3D11DeviceContext* context,
+		MaterialShaderManager* shaderManager,
+		const char* shaderName,
+		const char* vsEntry,
+		const char* psEntry,
+		float defaultSpecularPower);
+
+	// Bakes the packet the first time a subset is seen and again if its
+	// material properties changed
+	const DrawPacket& Get(Subset* subset);
+
+	// Shaders or textures were reloaded - the optimized index buffers are kept
+	void Invalidate();
+	void Invalidate(const Subset* subset);
+
+	// Reorders the triangles of every subset of the mesh for the vertex cache
+	// and overdraw and keeps the result as the subset's index buffer - 16-bit
+	// when the subset spans few enough vertices. Meant for load time; subsets
+	// that weren't prepared are drawn from their original indices.
+	bool PrepareMesh(Mesh* mesh);
+
+	// Vertex cache statistics of all prepared subsets, before and after the reordering
+	const MeshOptimizer::CacheStats& GetStatsBefore() const { return m_StatsBefore; }
+	const MeshOptimizer::CacheStats& GetStatsAfter() const { return m_StatsAfter; }
+
+	size_t GetBakesCount() const { return m_BakesCount; }
+
+private:
+	void Bake(Subset* subset, DrawPacket& packet);
+
+	struct OptimizedIndices
+	{
+		ReleaseGuard<ID3D11Buffer> Buffer;
+		DXGI_FORMAT Format;
+		unsigned BaseVertex;
+	};
+
+	ID3D11Device* m_Device;
+	ID3D11DeviceContext* m_Context;
+	MaterialShaderManager* m_ShaderManager;
+	const char* m_ShaderName;
+	const char* m_VSEntry;
+	const char* m_PSEntry;
+	float m_DefaultSpecularPower;
+
+	std::unordered_map<const Subset*, DrawPacket> m_Packets;
+	std::unordered_map<const Subset*, std::unique_ptr<OptimizedIndices>> m_Indices;
+	MeshOptimizer::CacheStats m_StatsBefore;
+	MeshOptimizer::CacheStats m_StatsAfter;
+	size_t m_BakesCount;
+};
@@ -5,7 +5,11 @@
 #include "ConstBufferTypes.h"
 
 #include "SharedRenderResources.h"
-#include "GPUProfiling.h"
+#include "Profiler.h"
+#include "DrawPacket.h"
+#include "MaterialBatches.h"
+#include "JobSystem.h"
+#include "ResourceTracking.h"
 
 #include <Dx11/Rendering/ShaderManager.h>
 #include <Dx11/Rendering/Camera.h>
@@ -24,9 +28,27 @@ namespace {
 	static const char* SHADER_NAME = "..\\Shaders\\ForwardDraw.hlsl";
 	static const char* VS_ENTRY = "VS";
 	static const char* PS_ENTRY = "PS";
+	static const char* BATCHED_SHADER_NAME = "..\\Shaders\\ForwardDrawBatched.hlsl";
 
 	static const float DEFAULT_SPECULAR_POWER = 10;
 
+	// Queue entries recorded by a job - every chunk sets its state from scratch
+	static const unsigned DRAWS_PER_STREAM = 256;
+
+#ifdef COMPACT_PROCEDURAL_VERTICES
+	static const char* VS_ENTRY_PROCEDURAL = "VS_GenCompact";
+	static const D3D11_INPUT_ELEMENT_DESC CompactProceduralVertexLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_UINT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+	#define PROCEDURAL_VERTEX_LAYOUT CompactProceduralVertexLayout
+#else
+	static const char* VS_ENTRY_PROCEDURAL = "VS_Gen";
+	#define PROCEDURAL_VERTEX_LAYOUT PositionNormalTextIndsVertexLayout
+#endif
+
 	struct GlobalPropertiesBuffer
 	{
 		XMFLOAT4 CameraPosition;
@@ -37,13 +59,18 @@ namespace {
 
 DrawRoutine::DrawRoutine()
 	: m_Wireframe(false)
-{}
+	, m_UseMaterialBatches(true)
+	, m_StaticDrawsCount(0)
+{
+	::memset(&m_ReplayStats, 0, sizeof(m_ReplayStats));
+}
 
 DrawRoutine::~DrawRoutine()
 {}
  
 bool DrawRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scene, const XMFLOAT4X4& projection)
 {
+	MemoryScope memoryScope(MC_Rendering);
 	DxRenderingRoutine::Initialize(renderer);
 
 	m_Camera = camera;
@@ -51,12 +78,58 @@ bool DrawRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scene, c
 	m_Projection = projection;
 	
 	m_ShaderManager.reset(new MaterialShaderManager(m_Renderer->GetDevice()));
+	m_DrawPackets.reset(new DrawPacketCache(m_Renderer->GetDevice(),
+		m_Renderer->GetImmediateContext(),
+		m_ShaderManager.get(), SHADER_NAME, VS_ENTRY, PS_ENTRY, DEFAULT_SPECULAR_POWER));
+	m_MaterialBatches.reset(new MaterialBatches(m_Renderer->GetDevice(),
+		m_Renderer->GetImmediateContext(),
+		m_ShaderManager.get(), BATCHED_SHADER_NAME, VS_ENTRY, PS_ENTRY, DEFAULT_SPECULAR_POWER));
+
+	m_StateContext.reset(new D3D11StateContext);
+	if (!m_StateContext->Initialize(m_Renderer->GetImmediateContext()))
+	{
+		return false;
+	}
+	m_Replayer.reset(new CommandReplayer(m_StateContext.get()));
 
 	if(!ReinitShading())
 	{
 		return false;
 	}
 
+	// Entities are instances of few meshes
+	std::vector<Mesh*> meshes;
+	for (const auto& entity : m_Scene->GetEntities())
+	{
+		if (entity.Mesh.get() && std::find(meshes.begin(), meshes.end(), entity.Mesh.get()) == meshes.end())
+			meshes.push_back(entity.Mesh.get());
+	}
+
+	for (const auto mesh : meshes)
+	{
+		if (!m_DrawPackets->PrepareMesh(mesh))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to optimize the mesh indices");
+			return false;
+		}
+	}
+	const auto& before = m_DrawPackets->GetStatsBefore();
+	const auto& after = m_DrawPackets->GetStatsAfter();
+	SLOG(Sev_Info, Fac_Rendering, "Static subsets: ", after.TrianglesCount, " triangles, ACMR ",
+		before.GetACMR(), " -> ", after.GetACMR(), ", ATVR ", before.GetATVR(), " -> ", after.GetATVR());
+
+	MemoryScope materialsScope(MC_Materials);
+	for (const auto mesh : meshes)
+	{
+		if (!m_MaterialBatches->Build(mesh))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to batch the mesh subsets");
+			return false;
+		}
+	}
+	SLOG(Sev_Info, Fac_Rendering, "Material batches: ", m_MaterialBatches->GetBatchedSubsetsCount(), " subsets in ",
+		m_MaterialBatches->GetBatchesCount(), " draws, ", m_MaterialBatches->GetTextureArraysCount(), " texture arrays");
+
 	ShaderManager shaderManager(m_Renderer->GetDevice());
 	// Create PerSubset buffer
 	if(!shaderManager.CreateEasyConstantBuffer<PerSubsetBuffer>(m_PerSubsetBuffer.Receive(), true))
@@ -69,6 +142,8 @@ bool DrawRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scene, c
 		SLOG(Sev_Error, Fac_Rendering, "Unable to create global properties buffer");
 		return false;
 	}
+	TrackResource(m_PerSubsetBuffer.Get(), MC_Rendering);
+	TrackResource(m_GlobalPropsBuffer.Get(), MC_Rendering);
 		
 	auto& texManager = m_Renderer->GetTextureManager();
 	// Create samplers
@@ -94,6 +169,10 @@ bool DrawRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scene, c
 
 bool DrawRoutine::ReinitShading()
 {
+	// Packets and batches hold raw shader pointers
+	m_DrawPackets->Invalidate();
+	m_MaterialBatches->ResolveShaders();
+
 	// Create a vs for the sake of the input layout - material variations of the shader DO NOT change the IL at this point
 	ID3DBlob* shader = nullptr;
 	if(!m_ShaderManager->GetBlob(SHADER_NAME, VS_ENTRY, "vs_5_0", Material(), &shader))
@@ -101,11 +180,12 @@ bool DrawRoutine::ReinitShading()
 		return false;
 	}
 	ReleaseGuard<ID3DBlob> shaderGuard(shader);
-	// Define the input layout
+	// Define the input layout - the vertices and the per-instance world matrices
+	std::vector<D3D11_INPUT_ELEMENT_DESC> layout(std::begin(StandardVertexLayout), std::end(StandardVertexLayout));
+	layout.insert(layout.end(), std::begin(InstanceLayoutElements), std::end(InstanceLayoutElements));
     HRESULT hr = S_OK;
     // Create the input layout
-	ID3D11InputLayout* vertexLayout = nullptr;
-	hr = m_Renderer->GetDevice()->CreateInputLayout(StandardVertexLayout, ARRAYSIZE(StandardVertexLayout), shaderGuard.Get()->GetBufferPointer(),
+	hr = m_Renderer->GetDevice()->CreateInputLayout(layout.data(), UINT(layout.size()), shaderGuard.Get()->GetBufferPointer(),
 		shaderGuard.Get()->GetBufferSize(), m_VertexLayout.Receive());
 	if(FAILED(hr))
 	{
@@ -132,12 +212,20 @@ bool DrawRoutine::ReinitShading()
 		ReleaseGuard<ID3DBlob> psGuard(compilationResult.psBlob);
 		m_VertexShaderLights.Set(compilationResult.vertexShader);
 		m_PixelShaderLights.Set(compilationResult.pixelShader);
+
+		hr = m_Renderer->GetDevice()->CreateInputLayout(StandardVertexLayout, ARRAYSIZE(StandardVertexLayout), vsGuard.Get()->GetBufferPointer(),
+			vsGuard.Get()->GetBufferSize(), m_VertexLayoutLights.Receive());
+		if (FAILED(hr))
+		{
+			STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to create input layout for lights"));
+			return false;
+		}
 	}
 	// Shaders for procedural content
 	{
 		ShaderManager::CompilationOutput compilationResult;
 		if (!shaderManager.CompileShaderDuo("../Shaders/ForwardDrawProcedural.hlsl"
-			, "VS_Gen"
+			, VS_ENTRY_PROCEDURAL
 			, "vs_5_0"
 			, "PS_Gen"
 			, "ps_5_0"
@@ -153,8 +241,8 @@ bool DrawRoutine::ReinitShading()
 		m_PixelShaderProcedural.Set(compilationResult.pixelShader);
 
 		hr = m_Renderer->GetDevice()->CreateInputLayout(
-			PositionNormalTextIndsVertexLayout,
-			ARRAYSIZE(PositionNormalTextIndsVertexLayout),
+			PROCEDURAL_VERTEX_LAYOUT,
+			ARRAYSIZE(PROCEDURAL_VERTEX_LAYOUT),
 			vsGuard.Get()->GetBufferPointer(),
 			vsGuard.Get()->GetBufferSize(),
 			m_VertexLayoutProcedural.Receive());
@@ -168,12 +256,72 @@ bool DrawRoutine::ReinitShading()
 	return true;
 }
 
+void DrawRoutine::WriteDrawConstants()
+{
+	auto& constantsRing = *gSharedRenderResources->ConstantsRing;
+	const auto& queueItems = m_Scene->GetRenderQueueItems();
+	const auto& queue = m_Scene->GetRenderQueue().GetEntries();
+	const auto& genMeshes = m_Scene->GetProceduralEntitiesForMainCamera();
+
+	m_DrawConstants.clear();
+	m_ProceduralConstants.clear();
+	m_QueuePackets.clear();
+	if (!constantsRing.Map())
+		return;
+
+	// Consecutive entries with the same specular power share a range - the
+	// world matrices come from the instance stream
+	ConstantBufferRing::Range range;
+	float lastSpecularPower = -1;
+	for (const auto& entry : queue)
+	{
+		const auto& item = queueItems[entry.Item];
+		// Batched subsets keep their slot with an empty range
+		if (m_UseMaterialBatches && m_MaterialBatches->IsBatched(item.Geometry))
+		{
+			ConstantBufferRing::Range empty = { 0, 0 };
+			m_DrawConstants.push_back(empty);
+			m_QueuePackets.push_back(nullptr);
+			continue;
+		}
+		// Baked here - the recording jobs only read the packets
+		const DrawPacket& packet = m_DrawPackets->Get(item.Geometry);
+		if (lastSpecularPower != packet.SpecularPower)
+		{
+			PerSubsetBuffer* psbuffer = constantsRing.Allocate<PerSubsetBuffer>(range);
+			if (!psbuffer)
+				break;
+			psbuffer->World = XMMatrixIdentity();
+			psbuffer->Properties.x = packet.SpecularPower;
+
+			lastSpecularPower = packet.SpecularPower;
+		}
+		m_DrawConstants.push_back(range);
+		m_QueuePackets.push_back(&packet);
+	}
+	for (const auto& entity : genMeshes)
+	{
+		const Material& material = entity.Geometry->GetMaterial();
+		PerSubsetBuffer* psbuffer = constantsRing.Allocate<PerSubsetBuffer>(range);
+		if (!psbuffer)
+			break;
+		psbuffer->World = XMMatrixTranspose(entity.WorldMatrix);
+		psbuffer->Properties.x = material.HasProperty(MP_SpecularPower) ? material.GetSpecularPower() : DEFAULT_SPECULAR_POWER;
+		m_ProceduralConstants.push_back(range);
+	}
+	constantsRing.Unmap();
+
+	if (m_DrawConstants.size() != queue.size() || m_ProceduralConstants.size() != genMeshes.size())
+	{
+		STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Constants ring exhausted - skipping draws"));
+	}
+}
+
 bool DrawRoutine::Render(float deltaTime)
 {
+	MemoryScope memoryScope(MC_Rendering);
+	ProfileScope profile(gProfiler, "Draw");
 	ID3D11DeviceContext* context = m_Renderer->GetImmediateContext();
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.DrawBegin[gGPUProfiling.CurrentIndex].Get());
-#endif
 
 	m_Renderer->SetViewport(context);
 
@@ -201,17 +349,22 @@ bool DrawRoutine::Render(float deltaTime)
 	globBuffer->GlobalLightColor = XMFLOAT4(sun.Color.x, sun.Color.y, sun.Color.z, 0.f);
 	context->Unmap(m_GlobalPropsBuffer.Get(), 0);
 
-	// Set shaders
-	ID3D11Buffer* cbs[] = { m_Renderer->GetPerFrameConstantBuffer(), m_PerSubsetBuffer.Get(), m_GlobalPropsBuffer.Get() };
+	WriteDrawConstants();
+	auto& constantsRing = *gSharedRenderResources->ConstantsRing;
+
+	// Set shaders - slot 1 is bound per draw from the constants ring
+	ID3D11Buffer* cbs[] = { m_Renderer->GetPerFrameConstantBuffer(),
+		nullptr,
+		m_GlobalPropsBuffer.Get(),
+		gSharedRenderResources->LightTilingBuffer.Get() };
 	context->VSSetConstantBuffers(0, _countof(cbs), cbs);
 	context->PSSetConstantBuffers(0, _countof(cbs), cbs);
 
-    UINT stride = sizeof(StandardVertex);
-    UINT offset = 0;
-	ID3D11ShaderResourceView* textures[7];
+	ID3D11ShaderResourceView* textures[8];
 	textures[4] = gSharedRenderResources->LightsCulledSRV.Get();
 	textures[5] = gSharedRenderResources->LightsCulledCountSRV.Get();
 	textures[6] = gSharedRenderResources->PointLightsSRV.Get();
+	textures[7] = gSharedRenderResources->LightsCulledMaskSRV.Get();
 
 	context->RSSetState(m_Renderer->GetStateHolder().GetRasterState(m_Wireframe ? StateHolder::RST_FrontCWWire : StateHolder::RST_FrontCW));
 	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
@@ -220,141 +373,241 @@ bool DrawRoutine::Render(float deltaTime)
 	context->PSSetSamplers(0, 1, m_LinearSampler.GetConstPP());
 	context->PSSetSamplers(1, 1, m_PointSampler.GetConstPP());
 
-	auto& entitiesToDraw = m_Scene->GetEntitiesForMainCamera();
-	for (auto entity = entitiesToDraw.begin(); entity != entitiesToDraw.end(); ++entity)
-	{
-		auto& toDraw = entity->Subsets;
-
-		ID3D11Buffer* buffer = entity->Geometry->GetVertexBuffer();
-		context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
+	// Every static draw is instanced - a group of visible entities sharing a
+	// mesh reads its transforms from the instance stream
+	auto& instances = *gSharedRenderResources->Instances;
+	instances.Bind(context);
 
-		unsigned lastMaterialProps = unsigned(~0);
-		ID3D11VertexShader* vs = nullptr;
-		ID3D11PixelShader* ps = nullptr;
+	m_StaticDrawsCount = 0;
+	if (m_UseMaterialBatches)
+	{
+		ProfileScope batchesProfile(gProfiler, "Material batches");
+		DrawBatches(context, textures + 4);
+	}
 
-		auto firstAlphaSubset = std::partition(toDraw.begin(), toDraw.end(), [](SubsetPtr& ptr) {
-			return !ptr->GetMaterial().HasProperty(MP_AlphaMask);
+	// The queue is sorted by alpha mode, shader variant, textures and depth -
+	// chunks of it are recorded on the job threads and replayed in order
+	const auto drawsCount = m_DrawConstants.size();
+	const auto streamsCount = unsigned((drawsCount + DRAWS_PER_STREAM - 1) / DRAWS_PER_STREAM);
+	if (m_StaticStreams.size() < streamsCount)
+	{
+		m_StaticStreams.resize(streamsCount);
+	}
+	{
+		ProfileScope recordProfile(gProfiler, "Record static draws");
+		gJobSystem->ParallelFor("Record static draws", streamsCount, 1, [this, drawsCount](unsigned first, unsigned last) {
+			for (auto i = first; i < last; ++i)
+			{
+				auto& stream = m_StaticStreams[i];
+				stream.Clear();
+				RecordStaticDraws(stream, size_t(i) * DRAWS_PER_STREAM, std::min(size_t(i + 1) * DRAWS_PER_STREAM, drawsCount));
+			}
 		});
-
-		for (auto it = toDraw.cbegin(); it != toDraw.cend(); ++it)
+	}
+	{
+		ProfileScope replayProfile(gProfiler, "Replay static draws");
+		// The material batches were drawn on the context directly
+		m_Replayer->Invalidate();
+		for (auto i = 0u; i < streamsCount; ++i)
 		{
-			if (it == firstAlphaSubset) {
-				context->OMSetDepthStencilState(nullptr, 0);
-			}
+			m_Replayer->Replay(m_StaticStreams[i]);
+			m_StaticDrawsCount += m_StaticStreams[i].GetDrawsCount();
+		}
+	}
+	instances.Unbind(context);
 
-			const SubsetPtr& subset = *it;
+	// Draw generated meshes
+	const auto& genMeshes = m_Scene->GetProceduralEntitiesForMainCamera();
+	if (m_ProceduralConstants.size()) {
+		ProfileScope proceduralProfile(gProfiler, "Procedural draws");
+		auto& stream = m_ProceduralStream;
+		stream.Clear();
+		stream.RecordSetDepthState(m_Renderer->GetStateHolder().GetDepthState(StateHolder::DSST_NoWriteLE));
+		stream.RecordSetInputLayout(m_VertexLayoutProcedural.Get());
+		stream.RecordSetShader(CommandStream::SS_Vertex, m_VertexShaderProcedural.Get());
+		stream.RecordSetShader(CommandStream::SS_Pixel, m_PixelShaderProcedural.Get());
+		stream.RecordSetRasterState(m_Renderer->GetStateHolder().GetRasterState(m_Wireframe ? StateHolder::RST_FrontCCWWire : StateHolder::RST_FrontCCW));
+
+		// set light params - the static queue may have been empty
+		CommandStream::Handle lightResources[] = { textures[4], textures[5], textures[6], textures[7] };
+		stream.RecordSetResources(CommandStream::SS_Pixel, 4, _countof(lightResources), lightResources);
+
+		// Meshes sharing textures or a constants range don't rebind them -
+		// the replayer filters what is already set
+		for (size_t i = 0; i < m_ProceduralConstants.size(); ++i)
+		{
+			GeneratedMesh* geometry = genMeshes[i].Geometry;
+			const Material& material = geometry->GetMaterial();
 
-			const Material& material = subset->GetMaterial();
-			if (lastMaterialProps != material.GetProperties())
-			{
-				vs = m_ShaderManager->GetVertexShader(SHADER_NAME, VS_ENTRY, "vs_5_0", subset->GetMaterial());
-				context->VSSetShader(vs, nullptr, 0);
-				ps = m_ShaderManager->GetPixelShader(SHADER_NAME, PS_ENTRY, "ps_5_0", subset->GetMaterial());
-				context->PSSetShader(ps, nullptr, 0);
+#ifdef COMPACT_PROCEDURAL_VERTICES
+			const auto& positionStreams = gSharedRenderResources->ProceduralPositions;
+			const auto positions = positionStreams.find(geometry);
+			if (positions == positionStreams.end())
+				continue;
+			CommandStream::Handle dequantization = positions->second->DequantizationSRV.Get();
+			stream.RecordSetResources(CommandStream::SS_Vertex, 8, 1, &dequantization);
+#endif
 
-				lastMaterialProps = material.GetProperties();
-			}
+			const auto& constants = m_ProceduralConstants[i];
+			stream.RecordSetConstantBuffer(CommandStream::SS_Vertex, 1, constantsRing.GetBuffer(), constants.FirstConstant, constants.ConstantsCount);
+			stream.RecordSetConstantBuffer(CommandStream::SS_Pixel, 1, constantsRing.GetBuffer(), constants.FirstConstant, constants.ConstantsCount);
 
 			TexturePtr texture = material.GetDiffuse();
-			textures[0] = texture.get() ? texture->GetSHRV() : nullptr;
 			TexturePtr normals = material.GetNormalMap();
-			textures[1] = normals.get() ? normals->GetSHRV() : nullptr;
-			TexturePtr alphaMask = material.GetAlphaMask();
-			textures[2] = alphaMask.get() ? alphaMask->GetSHRV() : nullptr;
-			TexturePtr specular = material.GetSpecularMap();
-			textures[3] = specular.get() ? specular->GetSHRV() : nullptr;
+			CommandStream::Handle materialTextures[] = {
+				texture.get() ? texture->GetSHRV() : nullptr,
+				normals.get() ? normals->GetSHRV() : nullptr };
+			stream.RecordSetResources(CommandStream::SS_Pixel, 0, _countof(materialTextures), materialTextures);
+
+			stream.RecordSetVertexBuffer(0, geometry->GetVertexBuffer(), PROCEDURAL_VERTEX_STRIDE, 0);
+			stream.RecordSetIndexBuffer(geometry->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
+			stream.RecordDrawIndexedInstancedIndirect(geometry->GetIndirectBuffer(), 0);
+		}
+		stream.RecordSetVertexBuffer(0, nullptr, PROCEDURAL_VERTEX_STRIDE, 0);
+		stream.RecordSetIndexBuffer(nullptr, DXGI_FORMAT_R32_UINT, 0);
+#ifdef COMPACT_PROCEDURAL_VERTICES
+		CommandStream::Handle nullSRV = nullptr;
+		stream.RecordSetResources(CommandStream::SS_Vertex, 8, 1, &nullSRV);
+#endif
+		m_Replayer->Replay(stream);
+	}
+	m_ReplayStats = m_Replayer->ResetStats();
 
-			context->PSSetShaderResources(0, _countof(textures), textures);
+	context->OMSetDepthStencilState(nullptr, 0);
+	context->OMSetBlendState(nullptr, blFactors, 0xFFFFFFFF);
+	context->RSSetState(m_Renderer->GetStateHolder().GetRasterState(StateHolder::RST_FrontCW));
 
-			if (FAILED(context->Map(m_PerSubsetBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedCB)))
-			{
-				STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to map subset constant buffer"));
-				continue;
-			}
-			PerSubsetBuffer* psbuffer = static_cast<PerSubsetBuffer*>(mappedCB.pData);
-			psbuffer->World = XMMatrixTranspose(entity->WorldMatrix);
-			psbuffer->Properties.x = DEFAULT_SPECULAR_POWER;
-			if (material.HasProperty(MP_SpecularPower)) {
-				psbuffer->Properties.x = material.GetSpecularPower();
-			}
-			context->Unmap(m_PerSubsetBuffer.Get(), 0);
+#ifdef DEBUG_LIGHTS
+	DrawLights();
+#endif
 
-			// Set index buffer
-			ID3D11Buffer* indexBuffer = subset->GetIndexBuffer();
-			context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	return true;
+}
 
-			context->DrawIndexed(subset->GetIndicesCount(), 0, 0);
-		}
-	}
-	// Draw generated meshes
-	const auto& genMeshes = m_Scene->GetProceduralEntitiesForMainCamera();
-	if (genMeshes.size()) {
-		context->OMSetDepthStencilState(m_Renderer->GetStateHolder().GetDepthState(StateHolder::DSST_NoWriteLE), 0);
+void DrawRoutine::RecordStaticDraws(CommandStream& stream, size_t first, size_t last) const
+{
+	auto& constantsRing = *gSharedRenderResources->ConstantsRing;
+	const auto& queueItems = m_Scene->GetRenderQueueItems();
+	const auto& queue = m_Scene->GetRenderQueue().GetEntries();
+
+	// State is only set when it differs from the previous draw of the chunk
+	const Mesh* lastGeometry = nullptr;
+	unsigned lastAlphaMode = ~0u;
+	ID3D11VertexShader* lastVS = nullptr;
+	ID3D11PixelShader* lastPS = nullptr;
+	ID3D11Buffer* lastIndexBuffer = nullptr;
+	UINT lastFirstConstant = UINT(~0);
+	bool texturesSet = false;
+	CommandStream::Handle textures[8];
+	for (auto i = first; i < last; ++i)
+	{
+		const auto& constants = m_DrawConstants[i];
+		if (!constants.ConstantsCount)
+			continue;
 
-		ReleaseGuard<ID3D11RasterizerState> rsState;
-		context->RSGetState(rsState.Receive());
+		const auto& entry = queue[i];
+		const auto& item = queueItems[entry.Item];
+		const DrawPacket& packet = *m_QueuePackets[i];
 
-		context->IASetInputLayout(m_VertexLayoutProcedural.Get());
-		context->VSSetShader(m_VertexShaderProcedural.Get(), nullptr, 0);
-		context->PSSetShader(m_PixelShaderProcedural.Get(), nullptr, 0);
-		context->RSSetState(m_Renderer->GetStateHolder().GetRasterState(m_Wireframe ? StateHolder::RST_FrontCCWWire : StateHolder::RST_FrontCCW));
+		const InstanceGroup& group = *item.Instances;
+		if (lastGeometry != group.Geometry)
+		{
+			stream.RecordSetVertexBuffer(0, group.Geometry->GetVertexBuffer(), sizeof(StandardVertex), 0);
+			lastGeometry = group.Geometry;
+		}
 
-		// set light params
-		context->PSSetShaderResources(4, 3, textures + 4);
+		// Alpha masked subsets are not in the Z prepass
+		const unsigned alphaMode = SortKey::GetAlphaMode(entry.Key);
+		if (alphaMode != lastAlphaMode)
+		{
+			stream.RecordSetDepthState(alphaMode == SortKey::AM_Opaque
+				? m_Renderer->GetStateHolder().GetDepthState(StateHolder::DSST_NoWriteLE)
+				: nullptr);
+			lastAlphaMode = alphaMode;
+		}
 
-		UINT stride = sizeof(PositionNormalTextIndsVertex);
-		ID3D11Buffer* vb[1];
-		for (auto it = genMeshes.cbegin(); it != genMeshes.cend(); ++it)
+		if (lastVS != packet.VertexShader)
 		{
-			GeneratedMesh* geometry = it->Geometry;
-			const Material& material = geometry->GetMaterial();
+			stream.RecordSetShader(CommandStream::SS_Vertex, packet.VertexShader);
+			lastVS = packet.VertexShader;
+		}
+		if (lastPS != packet.PixelShader)
+		{
+			stream.RecordSetShader(CommandStream::SS_Pixel, packet.PixelShader);
+			lastPS = packet.PixelShader;
+		}
 
-			if (FAILED(context->Map(m_PerSubsetBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedCB)))
-			{
-				SLOG(Sev_Error, Fac_Rendering, "Unable to map subset constant buffer");
-			}
-			PerSubsetBuffer* psbuffer = static_cast<PerSubsetBuffer*>(mappedCB.pData);
-			psbuffer->World = XMMatrixTranspose(it->WorldMatrix);
-			psbuffer->Properties.x = DEFAULT_SPECULAR_POWER;
-			if (material.HasProperty(MP_SpecularPower)) {
-				psbuffer->Properties.x = material.GetSpecularPower();
-			}
-			context->Unmap(m_PerSubsetBuffer.Get(), 0);
+		if (!texturesSet)
+		{
+			std::copy(packet.Textures, packet.Textures + 4, textures);
+			textures[4] = gSharedRenderResources->LightsCulledSRV.Get();
+			textures[5] = gSharedRenderResources->LightsCulledCountSRV.Get();
+			textures[6] = gSharedRenderResources->PointLightsSRV.Get();
+			textures[7] = gSharedRenderResources->LightsCulledMaskSRV.Get();
+			stream.RecordSetResources(CommandStream::SS_Pixel, 0, _countof(textures), textures);
+			texturesSet = true;
+		}
+		else if (!std::equal(packet.Textures, packet.Textures + 4, textures))
+		{
+			std::copy(packet.Textures, packet.Textures + 4, textures);
+			stream.RecordSetResources(CommandStream::SS_Pixel, 0, 4, textures);
+		}
 
-			TexturePtr texture = material.GetDiffuse();
-			textures[0] = texture.get() ? texture->GetSHRV() : nullptr;
-			TexturePtr normals = material.GetNormalMap();
-			textures[1] = normals.get() ? normals->GetSHRV() : nullptr;
-			context->PSSetShaderResources(0, 2, textures);
+		if (lastFirstConstant != constants.FirstConstant)
+		{
+			stream.RecordSetConstantBuffer(CommandStream::SS_Pixel, 1, constantsRing.GetBuffer(), constants.FirstConstant, constants.ConstantsCount);
+			lastFirstConstant = constants.FirstConstant;
+		}
 
-			vb[0] = geometry->GetVertexBuffer();
-			context->IASetVertexBuffers(0, 1, vb, &stride, &offset);
-			context->IASetIndexBuffer(geometry->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
-			context->DrawIndexedInstancedIndirect(geometry->GetIndirectBuffer(), 0);
+		if (lastIndexBuffer != packet.IndexBuffer)
+		{
+			stream.RecordSetIndexBuffer(packet.IndexBuffer, packet.IndexFormat, 0);
+			lastIndexBuffer = packet.IndexBuffer;
 		}
-		ID3D11Buffer* nullBuffs[] = { nullptr };
-		context->IASetVertexBuffers(0, _countof(nullBuffs), nullBuffs, &stride, &offset);
-		context->IASetIndexBuffer(nullptr, DXGI_FORMAT_R32_UINT, 0);
 
-		context->RSSetState(rsState.Get());
+		stream.RecordDrawIndexedInstanced(packet.IndicesCount, group.InstancesCount, 0, packet.BaseVertex, group.FirstInstance);
 	}
+}
 
-	::memset(textures, 0, sizeof(textures));
-	context->PSSetShaderResources(0, _countof(textures), textures);
+void DrawRoutine::DrawBatches(ID3D11DeviceContext* context, ID3D11ShaderResourceView* lightResources[4])
+{
+	context->PSSetShaderResources(4, 4, lightResources);
 
-	context->OMSetDepthStencilState(nullptr, 0);
-	context->OMSetBlendState(nullptr, blFactors, 0xFFFFFFFF);
-	context->RSSetState(m_Renderer->GetStateHolder().GetRasterState(StateHolder::RST_FrontCW));
+	// A batch has the subsets of the instances that are out of the frustum
+	// too - the clipper handles them cheaper than extra draws
+	UINT stride = sizeof(StandardVertex);
+	UINT offset = 0;
+	for (const auto& group : m_Scene->GetInstanceGroups())
+	{
+		const auto batches = m_MaterialBatches->GetBatches(group.Geometry);
+		if (!batches)
+			continue;
 
-#ifdef DEBUG_LIGHTS
-	DrawLights();
-#endif
+		ID3D11Buffer* buffer = group.Geometry->GetVertexBuffer();
+		context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
 
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.DrawEnd[gGPUProfiling.CurrentIndex].Get());
-#endif
+		for (const auto& batch : *batches)
+		{
+			// Alpha masked subsets are not in the Z prepass
+			context->OMSetDepthStencilState(batch->AlphaMasked
+				? nullptr
+				: m_Renderer->GetStateHolder().GetDepthState(StateHolder::DSST_NoWriteLE), 0);
+
+			context->VSSetShader(batch->VertexShader, nullptr, 0);
+			context->PSSetShader(batch->PixelShader, nullptr, 0);
+			context->PSSetShaderResources(0, 4, batch->TextureArrays);
+			ID3D11ShaderResourceView* materials[] = { batch->TriangleMaterialsSRV.Get(), batch->MaterialsSRV.Get() };
+			context->PSSetShaderResources(8, _countof(materials), materials);
+
+			context->IASetIndexBuffer(batch->IndexBuffer.Get(), batch->IndexFormat, 0);
+			context->DrawIndexedInstanced(batch->IndicesCount, group.InstancesCount, 0, batch->BaseVertex, group.FirstInstance);
+			++m_StaticDrawsCount;
+		}
+	}
 
-	return true;
+	ID3D11ShaderResourceView* nullSRVs[] = { nullptr, nullptr };
+	context->PSSetShaderResources(8, _countof(nullSRVs), nullSRVs);
+	context->OMSetDepthStencilState(m_Renderer->GetStateHolder().GetDepthState(StateHolder::DSST_NoWriteLE), 0);
 }
 
 #ifndef MINIMAL_SIZE
@@ -368,7 +621,7 @@ void DrawRoutine::DrawLights()
 
 	ID3D11RenderTargetView* rts[] = { m_Renderer->GetBackBufferView() };
 	context->OMSetRenderTargets(1, rts, m_Renderer->GetBackDepthStencilView());
-	context->IASetInputLayout(m_VertexLayout.Get());
+	context->IASetInputLayout(m_VertexLayoutLights.Get());
 	
 	// Set vertex buffer
 	UINT stride = sizeof(StandardVertex);
@@ -378,10 +631,16 @@ void DrawRoutine::DrawLights()
 	ID3D11Buffer* buffer = m_LightMesh->GetVertexBuffer();
 	context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
 
+	// Only the volumes in view
+	// The dynamic lights of the snapshot the ids were taken from
+	const auto& snapshot = m_Scene->GetRenderSnapshot();
 	const auto& lights = m_Scene->GetLights();
-
-	for (size_t i = 0; i < lights.size(); ++i)
+	const auto& dynamicLights = snapshot.DynamicLights;
+	for (const auto& visible : snapshot.VisibleLights)
 	{
+		const PointLight& light = visible.Type == SOT_DynamicLight
+			? dynamicLights[visible.Id]
+			: lights[visible.Id];
 		D3D11_MAPPED_SUBRESOURCE mappedCB = { 0 };
 		if (FAILED(context->Map(m_PerSubsetBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedCB)))
 		{
@@ -390,8 +649,8 @@ void DrawRoutine::DrawLights()
 		}
 		PerSubsetBuffer* psbuffer = static_cast<PerSubsetBuffer*>(mappedCB.pData);
 		XMMATRIX world = XMMatrixTranslation(-0.5f, -0.5f, -0.5f)
-			* XMMatrixScaling(lights[i].Radius * 2, lights[i].Radius * 2, lights[i].Radius * 2)
-			* XMMatrixTranslation(lights[i].Position.x, lights[i].Position.y, lights[i].Position.z);
+			* XMMatrixScaling(light.Radius * 2, light.Radius * 2, light.Radius * 2)
+			* XMMatrixTranslation(light.Position.x, light.Position.y, light.Position.z);
 		psbuffer->World = XMMatrixTranspose(world);
 		context->Unmap(m_PerSubsetBuffer.Get(), 0);
 
@@ -4,10 +4,17 @@
 #include <Dx11/Rendering/Subset.h>
 #include <Dx11/Rendering/Providers.h>
 
+#include "ConstantBufferRing.h"
+#include "CommandReplayer.h"
+#include "D3D11StateContext.h"
+
 class Camera;
 class Scene;
 class Mesh;
 class MaterialShaderManager;
+class DrawPacketCache;
+class MaterialBatches;
+struct DrawPacket;
 
 class DrawRoutine : public DxRenderingRoutine
 {
@@ -25,8 +32,20 @@ public:
 		m_Wireframe = w;
 	}
 
+	// Switches between the texture array batches and per-subset draws for the static meshes
+	void ToggleMaterialBatching() { m_UseMaterialBatches = !m_UseMaterialBatches; }
+
+	// Draw calls for the static meshes in the last frame
+	unsigned GetStaticDrawsCount() const { return m_StaticDrawsCount; }
+	// Commands replayed and state calls the cache dropped in the last frame
+	const CommandReplayer::Stats& GetReplayStats() const { return m_ReplayStats; }
+
 private:
 	bool ReinitShading();
+	void WriteDrawConstants();
+	// Records the draws of queue entries [first, last) with all the state they need
+	void RecordStaticDraws(CommandStream& stream, size_t first, size_t last) const;
+	void DrawBatches(ID3D11DeviceContext* context, ID3D11ShaderResourceView* lightResources[4]);
 	void DrawLights();
 
 	Camera* m_Camera;
@@ -34,8 +53,15 @@ private:
 	DirectX::XMFLOAT4X4 m_Projection;
 
 	bool m_Wireframe;
+	bool m_UseMaterialBatches;
+	unsigned m_StaticDrawsCount;
+	CommandReplayer::Stats m_ReplayStats;
 
 	std::unique_ptr<MaterialShaderManager> m_ShaderManager;
+	std::unique_ptr<DrawPacketCache> m_DrawPackets;
+	std::unique_ptr<MaterialBatches> m_MaterialBatches;
+	std::unique_ptr<D3D11StateContext> m_StateContext;
+	std::unique_ptr<CommandReplayer> m_Replayer;
 	
 	// Shaders
 	ReleaseGuard<ID3D11VertexShader> m_VertexShaderLights;
@@ -47,11 +73,25 @@ private:
 	ReleaseGuard<ID3D11Buffer> m_PerSubsetBuffer;
 	ReleaseGuard<ID3D11Buffer> m_GlobalPropsBuffer;
 
+	// Ranges in the constants ring - one per render queue entry and per
+	// procedural mesh. The world matrices of the static draws are in the
+	// instance stream and the batches read their materials from buffers.
+	std::vector<ConstantBufferRing::Range> m_DrawConstants;
+	std::vector<ConstantBufferRing::Range> m_ProceduralConstants;
+	// The packet of each render queue entry, nullptr for the batched ones
+	std::vector<const DrawPacket*> m_QueuePackets;
+
+	// The static queue in chunks recorded in parallel and replayed in order
+	std::vector<CommandStream> m_StaticStreams;
+	CommandStream m_ProceduralStream;
+
 	// Samplers
 	ReleaseGuard<ID3D11SamplerState> m_LinearSampler;
 	ReleaseGuard<ID3D11SamplerState> m_PointSampler;
 
+	// Static vertices in slot 0 and instance transforms in slot 1
 	ReleaseGuard<ID3D11InputLayout> m_VertexLayout;
+	ReleaseGuard<ID3D11InputLayout> m_VertexLayoutLights;
 	ReleaseGuard<ID3D11InputLayout> m_VertexLayoutProcedural;
 
 #ifndef MINIMAL_SIZE
@@ -0,0 +1,91 @@
+#include "precompiled.h"
+
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	inline size_t AlignUp(size_t offset, size_t alignment)
+	{
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+
+	// Memory from new[] is aligned for any fundamental type - the blocks
+	// take bigger alignments out of their size
+	static const size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+}
+
+FrameArena::FrameArena(size_t blockSize)
+	: m_BlockSize(blockSize)
+	, m_Current(0)
+	, m_Offset(0)
+{
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+	size = std::max<size_t>(size, 1);
+	for (; m_Current < m_Blocks.size(); ++m_Current, m_Offset = 0)
+	{
+		auto& block = m_Blocks[m_Current];
+		const auto offset = AlignUp(size_t(block.Memory.get() + m_Offset), alignment) - size_t(block.Memory.get());
+		if (offset + size <= block.Size)
+		{
+			m_Stats.BytesUsed += offset + size - m_Offset;
+			m_Stats.PeakBytesUsed = std::max(m_Stats.PeakBytesUsed, m_Stats.BytesUsed);
+			m_Offset = offset + size;
+			return block.Memory.get() + offset;
+		}
+		// The rest of the block is skipped
+		m_Stats.BytesUsed += block.Size - m_Offset;
+	}
+
+	// Out of blocks - a new one goes at the end and is kept from now on
+	Block block;
+	block.Size = std::max(m_BlockSize, size + std::max(alignment, BLOCK_ALIGNMENT));
+	block.Memory.reset(new std::uint8_t[block.Size]);
+	m_Blocks.push_back(std::move(block));
+	m_Stats.Capacity += m_Blocks.back().Size;
+	++m_Stats.BlocksAllocated;
+
+	m_Current = m_Blocks.size() - 1;
+	m_Offset = 0;
+	return Allocate(size, alignment);
+}
+
+void FrameArena::Reset()
+{
+	m_Current = 0;
+	m_Offset = 0;
+	m_Stats.BytesUsed = 0;
+}
+
+FrameArena::Marker FrameArena::GetMarker() const
+{
+	Marker marker = { m_Current, m_Offset, m_Stats.BytesUsed };
+	return marker;
+}
+
+void FrameArena::Rewind(const Marker& marker)
+{
+	m_Current = marker.Block;
+	m_Offset = marker.Offset;
+	m_Stats.BytesUsed = marker.BytesUsed;
+}
+
+FrameArena::Stats FrameArena::ResetStats()
+{
+	const auto stats = m_Stats;
+	m_Stats.PeakBytesUsed = m_Stats.BytesUsed;
+	m_Stats.BlocksAllocated = 0;
+	return stats;
+}
+
+FrameArena& FrameArena::GetThreadArena()
+{
+	static const size_t THREAD_BLOCK_SIZE = 64 * 1024;
+	static thread_local FrameArena arena(THREAD_BLOCK_SIZE);
+	return arena;
+}
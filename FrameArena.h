@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Linear allocator for data that lives for a frame. Allocating bumps an
+// offset in the current block and freeing does nothing - Reset rewinds the
+// whole arena at once. Blocks are kept when the arena is reset, so once the
+// arena has grown to a frame's needs it stops touching the heap.
+//
+// An arena is not thread-safe. Every thread has one of its own in
+// GetThreadArena for scratch memory of the function or job running on it -
+// take a ScopedRewind before allocating and everything is given back when it
+// goes out of scope.
+class FrameArena
+{
+public:
+	struct Stats
+	{
+		// In use now and at most since the last ResetStats
+		size_t BytesUsed;
+		size_t PeakBytesUsed;
+		// Of all the blocks
+		size_t Capacity;
+		// Blocks taken from the heap since the last ResetStats
+		unsigned BlocksAllocated;
+	};
+
+	// Where the arena was - to rewind to later
+	struct Marker
+	{
+		size_t Block;
+		size_t Offset;
+		size_t BytesUsed;
+	};
+
+	explicit FrameArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+	// Never nullptr - an allocation bigger than the blocks gets a block of its own
+	void* Allocate(size_t size, size_t alignment);
+	template<typename T>
+	T* Allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Nothing is destroyed in the arena");
+		return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void Reset();
+
+	Marker GetMarker() const;
+	// Everything allocated after the marker is given back
+	void Rewind(const Marker& marker);
+
+	const Stats& GetStats() const { return m_Stats; }
+	Stats ResetStats();
+
+	// The calling thread's arena for scratch memory
+	static FrameArena& GetThreadArena();
+
+	static const size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+private:
+	FrameArena(const FrameArena&);
+	FrameArena& operator=(const FrameArena&);
+
+	struct Block
+	{
+		std::unique_ptr<std::uint8_t[]> Memory;
+		size_t Size;
+	};
+
+	size_t m_BlockSize;
+	std::vector<Block> m_Blocks;
+	// Allocating from m_Blocks[m_Current] at m_Offset
+	size_t m_Current;
+	size_t m_Offset;
+	Stats m_Stats;
+};
+
+// Rewinds the arena to where it was when the scope began
+class ScopedRewind
+{
+public:
+	explicit ScopedRewind(FrameArena& arena)
+		: m_Arena(arena)
+		, m_Marker(arena.GetMarker())
+	{}
+	~ScopedRewind()
+	{
+		m_Arena.Rewind(m_Marker);
+	}
+
+private:
+	ScopedRewind(const ScopedRewind&);
+	ScopedRewind& operator=(const ScopedRewind&);
+
+	FrameArena& m_Arena;
+	FrameArena::Marker m_Marker;
+};
+
+// Standard containers in an arena. Without an arena (default constructed)
+// it takes the memory from the heap, so containers of it can be members
+// that get their arena only when they are filled.
+template<typename T>
+class FrameAllocator
+{
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef FrameAllocator<U> other;
+	};
+
+	FrameAllocator()
+		: m_Arena(nullptr)
+	{}
+	explicit FrameAllocator(FrameArena* arena)
+		: m_Arena(arena)
+	{}
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>& other)
+		: m_Arena(other.GetArena())
+	{}
+
+	T* allocate(size_t count)
+	{
+		if (!m_Arena)
+			return static_cast<T*>(::operator new(count * sizeof(T)));
+		return static_cast<T*>(m_Arena->Allocate(count * sizeof(T), alignof(T)));
+	}
+	void deallocate(T* pointer, size_t)
+	{
+		if (!m_Arena)
+		{
+			::operator delete(pointer);
+		}
+	}
+
+	FrameArena* GetArena() const { return m_Arena; }
+
+	template<typename U>
+	bool operator==(const FrameAllocator<U>& other) const { return m_Arena == other.GetArena(); }
+	template<typename U>
+	bool operator!=(const FrameAllocator<U>& other) const { return m_Arena != other.GetArena(); }
+
+private:
+	FrameArena* m_Arena;
+};
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+typedef std::basic_string<char, std::char_traits<char>, FrameAllocator<char>> FrameString;
@@ -0,0 +1,80 @@
+#include "precompiled.h"
+
+#include "InstanceBuffer.h"
+#include "ResourceTracking.h"
+
+InstanceBuffer::InstanceBuffer()
+	: m_Device(nullptr)
+	, m_Capacity(0)
+{}
+
+InstanceBuffer::~InstanceBuffer()
+{}
+
+bool InstanceBuffer::Initialize(ID3D11Device* device, unsigned capacity)
+{
+	m_Device = device;
+	return CreateBuffer(capacity);
+}
+
+bool InstanceBuffer::CreateBuffer(unsigned capacity)
+{
+	D3D11_BUFFER_DESC desc;
+	::memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = UINT(capacity * sizeof(InstanceData));
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(m_Device->CreateBuffer(&desc, nullptr, m_Buffer.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create the instance buffer");
+		m_Capacity = 0;
+		return false;
+	}
+	TrackResource(m_Buffer.Get(), MC_Rendering);
+	m_Capacity = capacity;
+	return true;
+}
+
+bool InstanceBuffer::Upload(ID3D11DeviceContext* context, const std::vector<InstanceData>& instances)
+{
+	if (instances.empty())
+		return true;
+
+	if (instances.size() > m_Capacity)
+	{
+		auto capacity = std::max(m_Capacity, 1u);
+		while (capacity < instances.size())
+		{
+			capacity *= 2;
+		}
+		if (!CreateBuffer(capacity))
+			return false;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+	if (FAILED(context->Map(m_Buffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to map the instance buffer");
+		return false;
+	}
+	::memcpy(mapped.pData, instances.data(), instances.size() * sizeof(InstanceData));
+	context->Unmap(m_Buffer.Get(), 0);
+
+	return true;
+}
+
+void InstanceBuffer::Bind(ID3D11DeviceContext* context)
+{
+	const UINT stride = sizeof(InstanceData);
+	const UINT offset = 0;
+	context->IASetVertexBuffers(INSTANCE_STREAM_SLOT, 1, m_Buffer.GetConstPP(), &stride, &offset);
+}
+
+void InstanceBuffer::Unbind(ID3D11DeviceContext* context)
+{
+	ID3D11Buffer* nullBuffer = nullptr;
+	const UINT stride = 0;
+	const UINT offset = 0;
+	context->IASetVertexBuffers(INSTANCE_STREAM_SLOT, 1, &nullBuffer, &stride, &offset);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ConstBufferTypes.h"
+
+// Elements of the per-instance stream in vertex buffer slot 1 - appended to
+// the vertex layout of every instanced static draw
+static const D3D11_INPUT_ELEMENT_DESC InstanceLayoutElements[] =
+{
+	{ "INSTANCE_WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "INSTANCE_WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "INSTANCE_WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+};
+static const UINT INSTANCE_STREAM_SLOT = 1;
+
+// Per-instance transforms of the frame in a dynamic vertex buffer. Written
+// once after culling and read by every instanced draw through the
+// StartInstanceLocation of DrawIndexedInstanced.
+class InstanceBuffer
+{
+public:
+	InstanceBuffer();
+	~InstanceBuffer();
+
+	bool Initialize(ID3D11Device* device, unsigned capacity);
+
+	// Grows the buffer if the instances don't fit
+	bool Upload(ID3D11DeviceContext* context, const std::vector<InstanceData>& instances);
+
+	void Bind(ID3D11DeviceContext* context);
+	void Unbind(ID3D11DeviceContext* context);
+
+	unsigned GetCapacity() const { return m_Capacity; }
+
+private:
+	bool CreateBuffer(unsigned capacity);
+
+	ID3D11Device* m_Device;
+	ReleaseGuard<ID3D11Buffer> m_Buffer;
+	unsigned m_Capacity;
+};
@@ -0,0 +1,248 @@
+#include "precompiled.h"
+
+#include "JobSystem.h"
+#include "TraceRecorder.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+JobSystem* gJobSystem = nullptr;
+
+namespace {
+	// Which system's worker the thread is, if any
+	thread_local const JobSystem* tls_System = nullptr;
+	thread_local unsigned tls_Thread = 0;
+}
+
+JobSystem::JobSystem(unsigned workersCount, bool pinThreads)
+	: m_Queued(0)
+	, m_Sleeping(0)
+	, m_Quit(false)
+	, m_JobsRun(0)
+	, m_JobsStolen(0)
+{
+	const auto hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	if (!workersCount)
+	{
+		workersCount = hardwareThreads - 1;
+	}
+
+	for (auto thread = 0u; thread <= workersCount; ++thread)
+	{
+		m_Queues.emplace_back(new Queue);
+	}
+	for (auto thread = 1u; thread <= workersCount; ++thread)
+	{
+		m_Workers.emplace_back(&JobSystem::WorkerLoop, this, thread);
+		if (pinThreads)
+		{
+			PinThread(m_Workers.back(), thread % hardwareThreads);
+		}
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Quit = true;
+	}
+	m_WakeUp.notify_all();
+	for (auto& worker : m_Workers)
+	{
+		worker.join();
+	}
+}
+
+void JobSystem::PinThread(std::thread& thread, unsigned hardwareThread)
+{
+#if defined(_WIN32)
+	::SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << hardwareThread);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(hardwareThread, &set);
+	::pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+unsigned JobSystem::GetCurrentThreadIndex() const
+{
+	return tls_System == this ? tls_Thread : 0;
+}
+
+JobSystem::Stats JobSystem::ResetStats()
+{
+	Stats stats;
+	stats.JobsRun = m_JobsRun.exchange(0);
+	stats.JobsStolen = m_JobsStolen.exchange(0);
+	return stats;
+}
+
+void JobSystem::Run(const char* name, JobFunc job, Counter* counter)
+{
+	if (counter)
+	{
+		++counter->m_Pending;
+	}
+	Job queued = { std::move(job), counter, MemoryTracker::GetThreadCategory(), name };
+	Push(GetCurrentThreadIndex(), std::move(queued));
+}
+
+void JobSystem::RunAfter(const char* name, Counter& dependency, JobFunc job, Counter* counter)
+{
+	if (counter)
+	{
+		++counter->m_Pending;
+	}
+	Job queued = { std::move(job), counter, MemoryTracker::GetThreadCategory(), name };
+	{
+		std::lock_guard<std::mutex> lock(dependency.m_Mutex);
+		if (dependency.m_Pending.load())
+		{
+			dependency.m_Continuations.push_back(std::move(queued));
+			return;
+		}
+	}
+	Push(GetCurrentThreadIndex(), std::move(queued));
+}
+
+void JobSystem::Wait(Counter& counter)
+{
+	const auto thread = GetCurrentThreadIndex();
+	while (counter.m_Pending.load())
+	{
+		if (!RunOne(thread))
+		{
+			std::this_thread::yield();
+		}
+	}
+	// The last job may still be releasing the continuations
+	std::lock_guard<std::mutex> lock(counter.m_Mutex);
+}
+
+void JobSystem::ParallelFor(const char* name, unsigned count, unsigned grain, const RangeFunc& func)
+{
+	grain = std::max(grain, 1u);
+	if (count <= grain || m_Workers.empty())
+	{
+		if (count)
+		{
+			func(0, count);
+		}
+		return;
+	}
+
+	Counter done;
+	for (auto first = grain; first < count; first += grain)
+	{
+		const auto last = std::min(first + grain, count);
+		Run(name, [&func, first, last]() { func(first, last); }, &done);
+	}
+	func(0, grain);
+	Wait(done);
+}
+
+void JobSystem::Push(unsigned thread, Job job)
+{
+	// Counted first so that it never drops below the jobs in the deques
+	++m_Queued;
+	{
+		auto& queue = *m_Queues[thread];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.Jobs.push_back(std::move(job));
+	}
+
+	// A worker going to sleep checks m_Queued after it counts itself sleeping
+	if (m_Sleeping.load())
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_WakeUp.notify_one();
+	}
+}
+
+bool JobSystem::RunOne(unsigned thread)
+{
+	Job job;
+	bool found = false;
+	{
+		auto& queue = *m_Queues[thread];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (!queue.Jobs.empty())
+		{
+			job = std::move(queue.Jobs.back());
+			queue.Jobs.pop_back();
+			found = true;
+		}
+	}
+
+	const auto queuesCount = unsigned(m_Queues.size());
+	for (auto offset = 1u; !found && offset < queuesCount; ++offset)
+	{
+		auto& victim = *m_Queues[(thread + offset) % queuesCount];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (!victim.Jobs.empty())
+		{
+			job = std::move(victim.Jobs.front());
+			victim.Jobs.pop_front();
+			found = true;
+			++m_JobsStolen;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	--m_Queued;
+	{
+		MemoryScope memoryScope(job.Category);
+		TraceScope trace(job.Name);
+		job.Func();
+	}
+	++m_JobsRun;
+	Finish(job);
+	return true;
+}
+
+void JobSystem::Finish(Job& job)
+{
+	if (!job.Done)
+		return;
+
+	std::vector<Job> continuations;
+	{
+		std::lock_guard<std::mutex> lock(job.Done->m_Mutex);
+		if (--job.Done->m_Pending == 0)
+		{
+			continuations.swap(job.Done->m_Continuations);
+		}
+	}
+	// The counter may be gone by now
+	const auto thread = GetCurrentThreadIndex();
+	for (auto& continuation : continuations)
+	{
+		Push(thread, std::move(continuation));
+	}
+}
+
+void JobSystem::WorkerLoop(unsigned thread)
+{
+	tls_System = this;
+	tls_Thread = thread;
+	MemoryTracker::SetThreadName("Job worker");
+	TraceRecorder::SetThreadName("Job worker");
+
+	while (!m_Quit.load())
+	{
+		if (RunOne(thread))
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_SleepMutex);
+		++m_Sleeping;
+		m_WakeUp.wait(lock, [this]() { return m_Quit.load() || m_Queued.load() > 0; });
+		--m_Sleeping;
+	}
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <memory>
+
+#include "MemoryTracker.h"
+
+// Worker threads taking jobs from per-thread deques. A thread pushes and
+// pops its own jobs at the back and, when it runs out, steals from the
+// front of the others - big ranges split first end up stolen, the small
+// recent ones stay local. Threads that aren't workers share the first
+// deque.
+//
+// A job can count down a Counter when it's done. Waiting on a counter runs
+// queued jobs on the waiting thread until it reaches zero, so jobs can fork
+// and join jobs of their own. Jobs added with RunAfter start only when
+// their dependency counter reaches zero.
+//
+// A job runs in the MemoryScope of the thread that queued it and shows in
+// the trace under the name it was queued with - a string literal.
+class JobSystem
+{
+public:
+	typedef std::function<void()> JobFunc;
+	// [first, last) of the items of a ParallelFor
+	typedef std::function<void(unsigned, unsigned)> RangeFunc;
+
+	class Counter;
+
+private:
+	struct Job
+	{
+		JobFunc Func;
+		Counter* Done;
+		MemoryCategory Category;
+		const char* Name;
+	};
+
+public:
+	// Jobs of a fork not done yet. Must outlive its jobs - Wait on it before
+	// it goes out of scope.
+	class Counter
+	{
+	public:
+		Counter()
+			: m_Pending(0)
+		{}
+
+		bool IsDone() const { return m_Pending.load() == 0; }
+
+	private:
+		friend class JobSystem;
+
+		Counter(const Counter&);
+		Counter& operator=(const Counter&);
+
+		std::atomic<unsigned> m_Pending;
+		// Guards the last decrement and the jobs waiting for it
+		std::mutex m_Mutex;
+		std::vector<Job> m_Continuations;
+	};
+
+	struct Stats
+	{
+		unsigned JobsRun;
+		unsigned JobsStolen;
+	};
+
+	// 0 workers - one less than the hardware threads, the thread that waits
+	// is the last one. Pinned workers get a hardware thread each, starting
+	// from the second.
+	explicit JobSystem(unsigned workersCount = 0, bool pinThreads = false);
+	~JobSystem();
+
+	// Fork - counter, if any, is counted down when the job is done
+	void Run(const char* name, JobFunc job, Counter* counter = nullptr);
+	// Queues the job once dependency is done. Every job of dependency must
+	// be added before this.
+	void RunAfter(const char* name, Counter& dependency, JobFunc job, Counter* counter = nullptr);
+	// Join - runs queued jobs until the counter is done
+	void Wait(Counter& counter);
+
+	// Calls func for ranges of 'grain' items of [0, count) and returns when
+	// all are done. The first range runs on the calling thread.
+	void ParallelFor(const char* name, unsigned count, unsigned grain, const RangeFunc& func);
+
+	// The workers and the thread that waits
+	unsigned GetThreadsCount() const { return unsigned(m_Workers.size()) + 1; }
+	// 0 on threads that aren't workers
+	unsigned GetCurrentThreadIndex() const;
+
+	// Counters since the last call
+	Stats ResetStats();
+
+private:
+	struct Queue
+	{
+		std::mutex Mutex;
+		std::deque<Job> Jobs;
+	};
+
+	void Push(unsigned thread, Job job);
+	// Runs a job of the thread's deque or a stolen one, false if there was none
+	bool RunOne(unsigned thread);
+	void Finish(Job& job);
+	void WorkerLoop(unsigned thread);
+	void PinThread(std::thread& thread, unsigned hardwareThread);
+
+	std::vector<std::unique_ptr<Queue>> m_Queues;
+	std::vector<std::thread> m_Workers;
+
+	// Jobs in all deques - idle workers sleep while it's 0
+	std::atomic<unsigned> m_Queued;
+	std::atomic<unsigned> m_Sleeping;
+	std::mutex m_SleepMutex;
+	std::condition_variable m_WakeUp;
+	std::atomic<bool> m_Quit;
+
+	std::atomic<unsigned> m_JobsRun;
+	std::atomic<unsigned> m_JobsStolen;
+};
+
+// Set by the application before the scene is created
+extern JobSystem* gJobSystem;
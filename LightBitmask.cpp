@@ -0,0 +1,144 @@
+#include "precompiled.h"
+
+#include "LightBitmask.h"
+
+namespace LightBitmask
+{
+
+namespace {
+	static const unsigned MORTON_BITS = 10;
+
+	// Spreads the lower 10 bits of v so that there are two zero bits between each
+	std::uint32_t SpreadBits(std::uint32_t v)
+	{
+		v &= 0x000003FF;
+		v = (v | (v << 16)) & 0xFF0000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	std::uint32_t Quantize(float value, float minValue, float invExtent)
+	{
+		static const float MAX_CELL = float((1 << MORTON_BITS) - 1);
+		const float normalized = (value - minValue) * invExtent;
+		return std::uint32_t(std::min(std::max(normalized * MAX_CELL, 0.f), MAX_CELL));
+	}
+}
+
+void BuildCoherentOrder(const float* positions,
+	unsigned strideInFloats,
+	unsigned count,
+	LightOrder& outOrder)
+{
+	outOrder.resize(count);
+	if (!count)
+		return;
+
+	float minPos[3] = { positions[0], positions[1], positions[2] };
+	float maxPos[3] = { positions[0], positions[1], positions[2] };
+	for (auto i = 1u; i < count; ++i)
+	{
+		const float* pos = positions + i * strideInFloats;
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			minPos[axis] = std::min(minPos[axis], pos[axis]);
+			maxPos[axis] = std::max(maxPos[axis], pos[axis]);
+		}
+	}
+
+	float invExtent[3];
+	for (auto axis = 0; axis < 3; ++axis)
+	{
+		const float extent = maxPos[axis] - minPos[axis];
+		invExtent[axis] = extent > 0 ? 1.f / extent : 0.f;
+	}
+
+	std::vector<std::pair<std::uint32_t, std::uint16_t>> codes;
+	codes.reserve(count);
+	for (auto i = 0u; i < count; ++i)
+	{
+		const float* pos = positions + i * strideInFloats;
+		const std::uint32_t code = SpreadBits(Quantize(pos[0], minPos[0], invExtent[0]))
+			| (SpreadBits(Quantize(pos[1], minPos[1], invExtent[1])) << 1)
+			| (SpreadBits(Quantize(pos[2], minPos[2], invExtent[2])) << 2);
+		codes.push_back(std::make_pair(code, std::uint16_t(i)));
+	}
+	// Stable so that lights in the same cell keep their relative order
+	std::stable_sort(codes.begin(), codes.end(), [](const std::pair<std::uint32_t, std::uint16_t>& lhs,
+		const std::pair<std::uint32_t, std::uint16_t>& rhs) {
+		return lhs.first < rhs.first;
+	});
+
+	for (auto i = 0u; i < count; ++i)
+	{
+		outOrder[i] = codes[i].second;
+	}
+}
+
+void InvertOrder(const LightOrder& order, LightOrder& outInverse)
+{
+	outInverse.resize(order.size());
+	for (auto slot = 0u; slot < order.size(); ++slot)
+	{
+		outInverse[order[slot]] = std::uint16_t(slot);
+	}
+}
+
+void EncodeLists(const std::uint32_t* lightIds,
+	const std::uint32_t* counts,
+	unsigned tilesCount,
+	unsigned maxLightsPerTile,
+	const LightOrder& order,
+	TileMasks& outMasks)
+{
+	LightOrder slots;
+	InvertOrder(order, slots);
+
+	outMasks.TilesCount = tilesCount;
+	outMasks.WordsPerTile = WordsForLights(unsigned(order.size()));
+	outMasks.Words.assign(tilesCount * outMasks.WordsPerTile, 0);
+
+	for (auto tile = 0u; tile < tilesCount; ++tile)
+	{
+		std::uint32_t* tileWords = &outMasks.Words[tile * outMasks.WordsPerTile];
+		const std::uint32_t* tileIds = lightIds + tile * maxLightsPerTile;
+		const auto lightsCount = std::min(counts[tile], maxLightsPerTile);
+		for (auto i = 0u; i < lightsCount; ++i)
+		{
+			if (tileIds[i] >= slots.size())
+				continue;
+			const unsigned slot = slots[tileIds[i]];
+			tileWords[slot / LIGHTS_PER_WORD] |= 1u << (slot % LIGHTS_PER_WORD);
+		}
+	}
+}
+
+void DecodeTile(const TileMasks& masks,
+	unsigned tile,
+	const LightOrder& order,
+	std::vector<std::uint16_t>& outIds)
+{
+	const std::uint32_t* tileWords = &masks.Words[tile * masks.WordsPerTile];
+	for (auto word = 0u; word < masks.WordsPerTile; ++word)
+	{
+		std::uint32_t mask = tileWords[word];
+		for (auto bit = 0u; mask; ++bit, mask >>= 1)
+		{
+			if (mask & 1)
+			{
+				outIds.push_back(order[word * LIGHTS_PER_WORD + bit]);
+			}
+		}
+	}
+}
+
+unsigned CountOccupiedWords(const TileMasks& masks)
+{
+	return unsigned(std::count_if(masks.Words.cbegin(), masks.Words.cend(), [](std::uint32_t word) {
+		return word != 0;
+	}));
+}
+
+}
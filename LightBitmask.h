@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Alternative encoding of the per-tile light lists.
+// Instead of a fixed array of 32-bit light ids every tile holds one 32-bit word
+// per 32 lights in the scene - bit N of word W is set if light (W * 32 + N) touches
+// the tile. The lights are pre-sorted spatially so that lights affecting the same
+// region of the screen land in the same few words.
+// The code here has no dependencies on D3D so it can be used to validate and
+// measure the encoding on the CPU.
+namespace LightBitmask
+{
+	static const unsigned LIGHTS_PER_WORD = 32;
+
+	inline unsigned WordsForLights(unsigned lightsCount)
+	{
+		return (lightsCount + LIGHTS_PER_WORD - 1) / LIGHTS_PER_WORD;
+	}
+
+	// Maps a slot in the sorted light buffer to the original light index
+	typedef std::vector<std::uint16_t> LightOrder;
+
+	// Orders the lights along a Morton curve through their positions.
+	// positions points to 'count' xyz triplets, each 'strideInFloats' apart.
+	void BuildCoherentOrder(const float* positions,
+		unsigned strideInFloats,
+		unsigned count,
+		LightOrder& outOrder);
+
+	// outInverse[originalIndex] = slot
+	void InvertOrder(const LightOrder& order, LightOrder& outInverse);
+
+	struct TileMasks
+	{
+		TileMasks()
+			: TilesCount(0)
+			, WordsPerTile(0)
+		{}
+
+		bool IsSet(unsigned tile, unsigned slot) const
+		{
+			return (Words[tile * WordsPerTile + slot / LIGHTS_PER_WORD] & (1u << (slot % LIGHTS_PER_WORD))) != 0;
+		}
+
+		unsigned TilesCount;
+		unsigned WordsPerTile;
+		std::vector<std::uint32_t> Words;
+	};
+
+	// Converts index lists in the layout written by CSTileLights (maxLightsPerTile ids
+	// per tile + a count per tile) to masks. Ids are original light indices and are
+	// moved to their slot in 'order'.
+	void EncodeLists(const std::uint32_t* lightIds,
+		const std::uint32_t* counts,
+		unsigned tilesCount,
+		unsigned maxLightsPerTile,
+		const LightOrder& order,
+		TileMasks& outMasks);
+
+	// Appends the original indices of all lights in a tile to outIds
+	void DecodeTile(const TileMasks& masks,
+		unsigned tile,
+		const LightOrder& order,
+		std::vector<std::uint16_t>& outIds);
+
+	// Number of non-empty words - measures how dense the sorting made the masks
+	unsigned CountOccupiedWords(const TileMasks& masks);
+}
@@ -0,0 +1,186 @@
+#include "precompiled.h"
+
+#include "LightTiling.h"
+
+namespace {
+	static const unsigned MAX_THREADS_PER_GROUP = 1024;
+
+	struct Plane
+	{
+		float Normal[3];
+	};
+
+	// Plane through the origin and two points, facing inside the tile
+	Plane MakePlane(const float v1[3], const float v2[3])
+	{
+		float n[3] = {
+			v1[1] * v2[2] - v1[2] * v2[1],
+			v1[2] * v2[0] - v1[0] * v2[2],
+			v1[0] * v2[1] - v1[1] * v2[0]
+		};
+		const float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		Plane result;
+		for (auto i = 0; i < 3; ++i)
+		{
+			result.Normal[i] = len > 0 ? -n[i] / len : 0.f;
+		}
+		return result;
+	}
+
+	void ScreenToViewDirection(const LightTilingScene& scene, float x, float y, float out[3])
+	{
+		const float ndcX = (x / scene.Width) * 2.f - 1.f;
+		const float ndcY = -((y / scene.Height) * 2.f - 1.f);
+		out[0] = ndcX / scene.ProjectionScaleX;
+		out[1] = ndcY / scene.ProjectionScaleY;
+		out[2] = 1.f;
+	}
+}
+
+bool LightTilingConfig::IsValid() const
+{
+	return TileSize >= 4
+		&& TileSize * TileSize <= MAX_THREADS_PER_GROUP
+		&& MaxLightsPerTile > 0;
+}
+
+std::string LightTilingConfig::MakeShaderDefines() const
+{
+	std::ostringstream defines;
+	defines << "#define GROUP_SIZE " << TileSize << "\n"
+		<< "#define MAX_LIGHTS_PER_TILE " << MaxLightsPerTile << "\n";
+	return defines.str();
+}
+
+void CpuTileLightCuller::Cull(const LightTilingConfig& config,
+	const LightTilingScene& scene,
+	std::vector<std::uint32_t>& outLightIds,
+	std::vector<std::uint32_t>& outCounts) const
+{
+	const auto tilesX = config.TilesCountX(scene.Width);
+	const auto tilesY = config.TilesCountY(scene.Height);
+	const auto lightsCount = unsigned(scene.Lights.size() / 4);
+
+	outLightIds.assign(tilesX * tilesY * config.MaxLightsPerTile, 0xFFFFFFFF);
+	outCounts.assign(tilesX * tilesY, 0);
+
+	for (auto ty = 0u; ty < tilesY; ++ty)
+	{
+		for (auto tx = 0u; tx < tilesX; ++tx)
+		{
+			const auto x0 = tx * config.TileSize;
+			const auto y0 = ty * config.TileSize;
+			const auto x1 = std::min(x0 + config.TileSize, scene.Width);
+			const auto y1 = std::min(y0 + config.TileSize, scene.Height);
+
+			float corners[4][3];
+			ScreenToViewDirection(scene, float(tx * config.TileSize), float(ty * config.TileSize), corners[0]);
+			ScreenToViewDirection(scene, float((tx + 1) * config.TileSize), float(ty * config.TileSize), corners[1]);
+			ScreenToViewDirection(scene, float((tx + 1) * config.TileSize), float((ty + 1) * config.TileSize), corners[2]);
+			ScreenToViewDirection(scene, float(tx * config.TileSize), float((ty + 1) * config.TileSize), corners[3]);
+			Plane sides[4];
+			for (auto pe = 0; pe < 4; ++pe)
+			{
+				sides[pe] = MakePlane(corners[pe], corners[(pe + 1) % 4]);
+			}
+
+			// Depth bounds of the tile
+			float minZ = std::numeric_limits<float>::max();
+			float maxZ = 0;
+			for (auto y = y0; y < y1; ++y)
+			{
+				const float* row = &scene.ViewDepth[y * scene.Width];
+				for (auto x = x0; x < x1; ++x)
+				{
+					if (row[x] <= 0)
+						continue;
+					minZ = std::min(minZ, row[x]);
+					maxZ = std::max(maxZ, row[x]);
+				}
+			}
+			// Like the GPU version, empty tiles are only bound by the sides
+			const bool hasDepth = minZ <= maxZ;
+
+			const auto tile = ty * tilesX + tx;
+			std::uint32_t* tileIds = &outLightIds[tile * config.MaxLightsPerTile];
+			std::uint32_t count = 0;
+			for (auto lightId = 0u; lightId < lightsCount && count < config.MaxLightsPerTile; ++lightId)
+			{
+				const float* light = &scene.Lights[lightId * 4];
+				bool inside = true;
+				for (auto pe = 0; pe < 4 && inside; ++pe)
+				{
+					const float* n = sides[pe].Normal;
+					inside = (n[0] * light[0] + n[1] * light[1] + n[2] * light[2]) >= -light[3];
+				}
+				if (inside && hasDepth)
+				{
+					inside = light[2] + light[3] >= minZ && light[2] - light[3] <= maxZ;
+				}
+				if (inside)
+				{
+					tileIds[count++] = lightId;
+				}
+			}
+			outCounts[tile] = count;
+		}
+	}
+}
+
+std::vector<LightTilingConfig> LightTilingTuner::DefaultCandidates()
+{
+	static const unsigned TILE_SIZES[] = { 8, 16, 32 };
+	static const unsigned LIGHT_CAPS[] = { 32, 64, 128 };
+
+	std::vector<LightTilingConfig> result;
+	for (auto tileSize : TILE_SIZES)
+	{
+		for (auto cap : LIGHT_CAPS)
+		{
+			result.push_back(LightTilingConfig(tileSize, cap));
+		}
+	}
+	return result;
+}
+
+bool LightTilingTuner::Tune(const std::vector<LightTilingConfig>& candidates,
+	const MeasureFunc& measure,
+	unsigned repeats,
+	Result& outBest,
+	ResultsVec* outAll) const
+{
+	bool found = false;
+	std::vector<double> samples;
+	for (const auto& config : candidates)
+	{
+		if (!config.IsValid())
+			continue;
+
+		samples.clear();
+		for (auto i = 0u; i < std::max(repeats, 1u); ++i)
+		{
+			const double ms = measure(config);
+			if (ms < 0)
+				break;
+			samples.push_back(ms);
+		}
+		if (samples.empty())
+			continue;
+
+		std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+		Result result;
+		result.Config = config;
+		result.Milliseconds = samples[samples.size() / 2];
+
+		if (outAll)
+		{
+			outAll->push_back(result);
+		}
+		if (!found || result.Milliseconds < outBest.Milliseconds)
+		{
+			outBest = result;
+			found = true;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+// Runtime description of the light tiles. TileLightsRoutine generates the
+// compute shader defines from it and sizes the culled lights buffers; the
+// pixel shaders read the same values from the LightTiling constant buffer.
+struct LightTilingConfig
+{
+	LightTilingConfig()
+		: TileSize(8)
+		, MaxLightsPerTile(32)
+	{}
+
+	LightTilingConfig(unsigned tileSize, unsigned maxLightsPerTile)
+		: TileSize(tileSize)
+		, MaxLightsPerTile(maxLightsPerTile)
+	{}
+
+	bool operator==(const LightTilingConfig& other) const
+	{
+		return TileSize == other.TileSize && MaxLightsPerTile == other.MaxLightsPerTile;
+	}
+
+	// One thread per pixel - limited by the max threads in a D3D11 group
+	bool IsValid() const;
+
+	unsigned TilesCountX(unsigned width) const
+	{
+		return (width + TileSize - 1) / TileSize;
+	}
+	unsigned TilesCountY(unsigned height) const
+	{
+		return (height + TileSize - 1) / TileSize;
+	}
+
+	// Defines for TileLights.hlsl
+	std::string MakeShaderDefines() const;
+
+	unsigned TileSize;
+	unsigned MaxLightsPerTile;
+};
+
+// A captured frame used to compare tiling configurations without a device
+struct LightTilingScene
+{
+	LightTilingScene()
+		: Width(0)
+		, Height(0)
+		, ProjectionScaleX(1)
+		, ProjectionScaleY(1)
+	{}
+
+	unsigned Width;
+	unsigned Height;
+	// _11 and _22 of the perspective projection
+	float ProjectionScaleX;
+	float ProjectionScaleY;
+	// Width * Height view space depths, 0 where nothing was drawn
+	std::vector<float> ViewDepth;
+	// xyz - view space position, w - radius
+	std::vector<float> Lights;
+};
+
+// Reference implementation of CSTileLights - same tile frusta, same caps and
+// the same output layout (MaxLightsPerTile ids per tile + a count per tile)
+class CpuTileLightCuller
+{
+public:
+	void Cull(const LightTilingConfig& config,
+		const LightTilingScene& scene,
+		std::vector<std::uint32_t>& outLightIds,
+		std::vector<std::uint32_t>& outCounts) const;
+};
+
+// Picks the fastest configuration among a set of candidates.
+// The measure function does the actual work - CPU culling of a recorded
+// scene or GPU timing of the culling shader.
+class LightTilingTuner
+{
+public:
+	// Returns the time in ms for the config or a negative value if the config can't run
+	typedef std::function<double (const LightTilingConfig&)> MeasureFunc;
+
+	struct Result
+	{
+		LightTilingConfig Config;
+		double Milliseconds;
+	};
+	typedef std::vector<Result> ResultsVec;
+
+	static std::vector<LightTilingConfig> DefaultCandidates();
+
+	// Every candidate is measured 'repeats' times and the median is used
+	bool Tune(const std::vector<LightTilingConfig>& candidates,
+		const MeasureFunc& measure,
+		unsigned repeats,
+		Result& outBest,
+		ResultsVec* outAll = nullptr) const;
+};
@@ -0,0 +1,385 @@
+#include "precompiled.h"
+
+#include "MaterialBatches.h"
+#include "BufferReadback.h"
+#include "MeshOptimizer.h"
+#include "VertexCompression.h"
+#include "ResourceTracking.h"
+
+#include <Dx11/Rendering/Mesh.h>
+#include <Dx11/Rendering/Material.h>
+#include <Dx11/Rendering/VertexTypes.h>
+#include <Dx11/Rendering/MaterialShaderManager.h>
+
+#include <map>
+#include <array>
+
+namespace {
+	static const unsigned TEXTURE_KINDS = 4;
+	static const unsigned NO_ARRAY = 0xFFFFFFFF;
+
+	void GetTextures(const Material& material, ID3D11ShaderResourceView* outTextures[TEXTURE_KINDS])
+	{
+		const TexturePtr textures[] = {
+			material.GetDiffuse(),
+			material.GetNormalMap(),
+			material.GetAlphaMask(),
+			material.GetSpecularMap()
+		};
+		for (auto i = 0u; i < TEXTURE_KINDS; ++i)
+		{
+			outTextures[i] = textures[i].get() ? textures[i]->GetSHRV() : nullptr;
+		}
+	}
+
+	bool CreateStructuredBuffer(ID3D11Device* device,
+		unsigned elementSize,
+		unsigned elementsCount,
+		const void* data,
+		ID3D11Buffer** outBuffer,
+		ID3D11ShaderResourceView** outSRV)
+	{
+		D3D11_BUFFER_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = elementSize;
+		desc.ByteWidth = elementSize * elementsCount;
+		D3D11_SUBRESOURCE_DATA initData = { 0 };
+		initData.pSysMem = data;
+		if (FAILED(device->CreateBuffer(&desc, &initData, outBuffer)))
+			return false;
+		TrackResource(*outBuffer, MC_Materials);
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		::memset(&srvDesc, 0, sizeof(srvDesc));
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.NumElements = elementsCount;
+		return SUCCEEDED(device->CreateShaderResourceView(*outBuffer, &srvDesc, outSRV));
+	}
+}
+
+MaterialBatches::MaterialBatches(ID3D11Device* device,
+	ID3D11DeviceContext* context,
+	MaterialShaderManager* shaderManager,
+	const char* shaderName,
+	const char* vsEntry,
+	const char* psEntry,
+	float defaultSpecularPower)
+	: m_Device(device)
+	, m_Context(context)
+	, m_ShaderManager(shaderManager)
+	, m_ShaderName(shaderName)
+	, m_VSEntry(vsEntry)
+	, m_PSEntry(psEntry)
+	, m_DefaultSpecularPower(defaultSpecularPower)
+{}
+
+MaterialBatches::~MaterialBatches()
+{}
+
+bool MaterialBatches::GetTextureArrayKey(ID3D11ShaderResourceView* texture, TextureArrayKey& outKey)
+{
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	texture->GetDesc(&viewDesc);
+	if (viewDesc.ViewDimension != D3D11_SRV_DIMENSION_TEXTURE2D || viewDesc.Texture2D.MostDetailedMip != 0)
+		return false;
+
+	ReleaseGuard<ID3D11Resource> resource;
+	texture->GetResource(resource.Receive());
+	ReleaseGuard<ID3D11Texture2D> texture2D;
+	if (FAILED(resource.Get()->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(texture2D.Receive()))))
+		return false;
+
+	D3D11_TEXTURE2D_DESC desc;
+	texture2D.Get()->GetDesc(&desc);
+	if (desc.ArraySize != 1 || desc.SampleDesc.Count != 1)
+		return false;
+
+	outKey.Width = desc.Width;
+	outKey.Height = desc.Height;
+	outKey.MipLevels = desc.MipLevels;
+	outKey.Format = desc.Format;
+	outKey.ViewFormat = viewDesc.Format;
+	return true;
+}
+
+MaterialBatches::SliceRef MaterialBatches::AssignSlice(ID3D11ShaderResourceView* texture, const TextureArrayKey& key)
+{
+	auto slice = m_Slices.find(texture);
+	if (slice != m_Slices.end())
+		return slice->second;
+
+	auto open = m_OpenArrays.find(key);
+	if (open == m_OpenArrays.end()
+		|| m_TextureArrays[open->second]->Sources.size() >= D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION)
+	{
+		std::unique_ptr<TextureArray> textureArray(new TextureArray);
+		textureArray->Key = key;
+		m_TextureArrays.push_back(std::move(textureArray));
+		m_OpenArrays[key] = unsigned(m_TextureArrays.size() - 1);
+		open = m_OpenArrays.find(key);
+	}
+
+	auto& textureArray = *m_TextureArrays[open->second];
+	SliceRef result;
+	result.Array = open->second;
+	result.Slice = unsigned(textureArray.Sources.size());
+	textureArray.Sources.push_back(texture);
+	m_Slices[texture] = result;
+	return result;
+}
+
+bool MaterialBatches::CreateTextureArrays()
+{
+	for (auto& textureArrayPtr : m_TextureArrays)
+	{
+		auto& textureArray = *textureArrayPtr;
+		if (textureArray.Texture.Get())
+			continue;
+		const auto& key = textureArray.Key;
+		const auto slicesCount = unsigned(textureArray.Sources.size());
+
+		D3D11_TEXTURE2D_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		desc.Width = key.Width;
+		desc.Height = key.Height;
+		desc.MipLevels = key.MipLevels;
+		desc.ArraySize = slicesCount;
+		desc.Format = key.Format;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		if (FAILED(m_Device->CreateTexture2D(&desc, nullptr, textureArray.Texture.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create material texture array");
+			return false;
+		}
+		TrackResource(textureArray.Texture.Get(), MC_Materials);
+
+		for (auto slice = 0u; slice < slicesCount; ++slice)
+		{
+			ReleaseGuard<ID3D11Resource> source;
+			textureArray.Sources[slice]->GetResource(source.Receive());
+			for (auto mip = 0u; mip < key.MipLevels; ++mip)
+			{
+				m_Context->CopySubresourceRegion(textureArray.Texture.Get(),
+					D3D11CalcSubresource(mip, slice, key.MipLevels),
+					0, 0, 0,
+					source.Get(),
+					D3D11CalcSubresource(mip, 0, key.MipLevels),
+					nullptr);
+			}
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		::memset(&srvDesc, 0, sizeof(srvDesc));
+		srvDesc.Format = key.ViewFormat;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = key.MipLevels;
+		srvDesc.Texture2DArray.ArraySize = slicesCount;
+		if (FAILED(m_Device->CreateShaderResourceView(textureArray.Texture.Get(), &srvDesc, textureArray.SRV.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create material texture array SRV");
+			return false;
+		}
+		textureArray.Sources.clear();
+	}
+	m_OpenArrays.clear();
+	return true;
+}
+
+bool MaterialBatches::Build(Mesh* mesh)
+{
+	if (m_Batches.find(mesh) != m_Batches.end())
+		return true;
+
+	// Subsets go in the same batch when they have the same shader variant and
+	// their textures are in the same arrays
+	typedef std::array<unsigned, 1 + TEXTURE_KINDS> GroupKey;
+	struct GroupSubset
+	{
+		Subset* Geometry;
+		SubsetMaterial Material;
+	};
+	std::map<GroupKey, std::vector<GroupSubset>> groups;
+
+	for (size_t i = 0; i < mesh->GetSubsetCount(); ++i)
+	{
+		const auto& subset = mesh->GetSubset(i);
+		const Material& material = subset->GetMaterial();
+
+		ID3D11ShaderResourceView* textures[TEXTURE_KINDS];
+		GetTextures(material, textures);
+		TextureArrayKey keys[TEXTURE_KINDS];
+		bool canBatch = true;
+		for (auto kind = 0u; kind < TEXTURE_KINDS && canBatch; ++kind)
+		{
+			canBatch = !textures[kind] || GetTextureArrayKey(textures[kind], keys[kind]);
+		}
+		if (!canBatch)
+			continue;
+
+		GroupKey groupKey;
+		groupKey[0] = material.GetProperties();
+		GroupSubset groupSubset;
+		groupSubset.Geometry = subset.get();
+		groupSubset.Material.SpecularPower = material.HasProperty(MP_SpecularPower) ? material.GetSpecularPower() : m_DefaultSpecularPower;
+		for (auto kind = 0u; kind < TEXTURE_KINDS; ++kind)
+		{
+			SliceRef slice = { NO_ARRAY, 0 };
+			if (textures[kind])
+			{
+				slice = AssignSlice(textures[kind], keys[kind]);
+			}
+			groupKey[1 + kind] = slice.Array;
+			groupSubset.Material.Slices[kind] = slice.Slice;
+		}
+		groups[groupKey].push_back(groupSubset);
+	}
+
+	if (!CreateTextureArrays())
+		return false;
+
+	std::vector<std::uint8_t> vertices;
+	if (!ReadBackBuffer(m_Device, m_Context, mesh->GetVertexBuffer(), vertices))
+		return false;
+	const auto verticesCount = unsigned(vertices.size() / sizeof(StandardVertex));
+
+	auto& batches = m_Batches[mesh];
+	std::vector<std::uint8_t> indicesData;
+	std::vector<std::uint32_t> subsetIndices;
+	for (const auto& group : groups)
+	{
+		std::unique_ptr<Batch> batch(new Batch);
+		batch->ShaderMaterial = &group.second.front().Geometry->GetMaterial();
+		batch->AlphaMasked = batch->ShaderMaterial->HasProperty(MP_AlphaMask);
+		batch->VertexShader = nullptr;
+		batch->PixelShader = nullptr;
+		for (auto kind = 0u; kind < TEXTURE_KINDS; ++kind)
+		{
+			const auto arrayId = group.first[1 + kind];
+			batch->TextureArrays[kind] = arrayId != NO_ARRAY ? m_TextureArrays[arrayId]->SRV.Get() : nullptr;
+		}
+
+		// Every subset keeps its own vertex cache and overdraw order, the
+		// triangles of the batch are the subsets one after the other
+		std::vector<std::uint32_t> indices;
+		std::vector<std::uint32_t> triangleMaterials;
+		std::vector<SubsetMaterial> materials;
+		for (const auto& groupSubset : group.second)
+		{
+			Subset* subset = groupSubset.Geometry;
+			if (!ReadBackBuffer(m_Device, m_Context, subset->GetIndexBuffer(), indicesData))
+				return false;
+			const auto indicesCount = unsigned(subset->GetIndicesCount()) / 3 * 3;
+			if (!indicesCount || indicesData.size() < indicesCount * sizeof(std::uint32_t))
+				continue;
+
+			const auto* source = reinterpret_cast<const std::uint32_t*>(indicesData.data());
+			subsetIndices.assign(source, source + indicesCount);
+			if (!MeshOptimizer::OptimizeTrianglesInRange(subsetIndices.data(), indicesCount, vertices.data(), sizeof(StandardVertex), verticesCount))
+				continue;
+
+			indices.insert(indices.end(), subsetIndices.begin(), subsetIndices.end());
+			triangleMaterials.insert(triangleMaterials.end(), indicesCount / 3, std::uint32_t(materials.size()));
+			materials.push_back(groupSubset.Material);
+			m_BatchedSubsets[subset] = batch.get();
+		}
+		if (indices.empty())
+			continue;
+
+		batch->IndicesCount = unsigned(indices.size());
+		batch->SubsetsCount = unsigned(materials.size());
+
+		D3D11_BUFFER_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA initData = { 0 };
+		std::vector<std::uint16_t> compact;
+		std::uint32_t baseVertex = 0;
+		if (VertexCompression::RebaseIndices16(indices.data(), batch->IndicesCount, compact, baseVertex))
+		{
+			batch->IndexFormat = DXGI_FORMAT_R16_UINT;
+			batch->BaseVertex = baseVertex;
+			desc.ByteWidth = UINT(compact.size() * sizeof(std::uint16_t));
+			initData.pSysMem = compact.data();
+		}
+		else
+		{
+			batch->IndexFormat = DXGI_FORMAT_R32_UINT;
+			batch->BaseVertex = 0;
+			desc.ByteWidth = UINT(indices.size() * sizeof(std::uint32_t));
+			initData.pSysMem = indices.data();
+		}
+		if (FAILED(m_Device->CreateBuffer(&desc, &initData, batch->IndexBuffer.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create batch index buffer");
+			return false;
+		}
+		TrackResource(batch->IndexBuffer.Get(), MC_Materials);
+
+		if (!CreateStructuredBuffer(m_Device,
+				sizeof(SubsetMaterial),
+				unsigned(materials.size()),
+				materials.data(),
+				batch->Materials.Receive(),
+				batch->MaterialsSRV.Receive())
+			|| !CreateStructuredBuffer(m_Device,
+				sizeof(std::uint32_t),
+				unsigned(triangleMaterials.size()),
+				triangleMaterials.data(),
+				batch->TriangleMaterials.Receive(),
+				batch->TriangleMaterialsSRV.Receive()))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create batch material buffers");
+			return false;
+		}
+
+		batches.push_back(std::move(batch));
+	}
+
+	// Opaque batches first - they are drawn in this order
+	std::stable_sort(batches.begin(), batches.end(), [](const std::unique_ptr<Batch>& lhs, const std::unique_ptr<Batch>& rhs) {
+		return !lhs->AlphaMasked && rhs->AlphaMasked;
+	});
+
+	ResolveShaders();
+	return true;
+}
+
+void MaterialBatches::ResolveShaders()
+{
+	for (auto& meshBatches : m_Batches)
+	{
+		for (auto& batch : meshBatches.second)
+		{
+			batch->VertexShader = m_ShaderManager->GetVertexShader(m_ShaderName, m_VSEntry, "vs_5_0", *batch->ShaderMaterial);
+			batch->PixelShader = m_ShaderManager->GetPixelShader(m_ShaderName, m_PSEntry, "ps_5_0", *batch->ShaderMaterial);
+		}
+	}
+}
+
+const MaterialBatches::BatchVec* MaterialBatches::GetBatches(const Mesh* mesh) const
+{
+	const auto it = m_Batches.find(mesh);
+	return it != m_Batches.end() ? &it->second : nullptr;
+}
+
+bool MaterialBatches::IsBatched(const Subset* subset) const
+{
+	return m_BatchedSubsets.find(subset) != m_BatchedSubsets.end();
+}
+
+unsigned MaterialBatches::GetBatchesCount() const
+{
+	unsigned result = 0;
+	for (const auto& meshBatches : m_Batches)
+	{
+		result += unsigned(meshBatches.second.size());
+	}
+	return result;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Dx11/Rendering/Subset.h>
+
+class MaterialShaderManager;
+class Material;
+class Mesh;
+
+// Subsets of the static meshes merged at load time into one draw per shader
+// variant and texture array combination. The textures of the subsets are
+// copied into Texture2DArrays - one array per texture kind, size, format and
+// mip count - and every triangle of a batch indexes a per-subset record with
+// its array slices and specular power (Shaders/ForwardDrawBatched.hlsl).
+class MaterialBatches
+{
+public:
+	// Per-subset record the pixel shader reads - BatchMaterial in ForwardDraw.hlsl
+	struct SubsetMaterial
+	{
+		// diffuse, normal map, alpha mask, specular map
+		std::uint32_t Slices[4];
+		float SpecularPower;
+	};
+
+	struct Batch
+	{
+		// All subsets of the batch share it, so it picks the shader variant
+		const Material* ShaderMaterial;
+		bool AlphaMasked;
+		ID3D11VertexShader* VertexShader;
+		ID3D11PixelShader* PixelShader;
+		// Owned by the batches, several batches can use the same arrays
+		ID3D11ShaderResourceView* TextureArrays[4];
+
+		ReleaseGuard<ID3D11Buffer> IndexBuffer;
+		DXGI_FORMAT IndexFormat;
+		unsigned IndicesCount;
+		unsigned BaseVertex;
+
+		// SubsetMaterial per subset and an index in it per triangle
+		ReleaseGuard<ID3D11Buffer> Materials;
+		ReleaseGuard<ID3D11ShaderResourceView> MaterialsSRV;
+		ReleaseGuard<ID3D11Buffer> TriangleMaterials;
+		ReleaseGuard<ID3D11ShaderResourceView> TriangleMaterialsSRV;
+
+		unsigned SubsetsCount;
+	};
+	typedef std::vector<std::unique_ptr<Batch>> BatchVec;
+
+	MaterialBatches(ID3D11Device* device,
+		ID3D11DeviceContext* context,
+		MaterialShaderManager* shaderManager,
+		const char* shaderName,
+		const char* vsEntry,
+		const char* psEntry,
+		float defaultSpecularPower);
+
+	~MaterialBatches();
+
+	// Batches the subsets of a mesh whose textures can go in arrays. The rest
+	// are left to the usual per-subset draws - see IsBatched.
+	bool Build(Mesh* mesh);
+
+	// Looks the shaders up again - they were reloaded
+	void ResolveShaders();
+
+	const BatchVec* GetBatches(const Mesh* mesh) const;
+	bool IsBatched(const Subset* subset) const;
+
+	unsigned GetBatchesCount() const;
+	unsigned GetBatchedSubsetsCount() const { return unsigned(m_BatchedSubsets.size()); }
+	unsigned GetTextureArraysCount() const { return unsigned(m_TextureArrays.size()); }
+
+private:
+	// Textures can share an array only if they match in everything but the contents
+	struct TextureArrayKey
+	{
+		bool operator==(const TextureArrayKey& other) const
+		{
+			return Width == other.Width
+				&& Height == other.Height
+				&& MipLevels == other.MipLevels
+				&& Format == other.Format
+				&& ViewFormat == other.ViewFormat;
+		}
+
+		unsigned Width;
+		unsigned Height;
+		unsigned MipLevels;
+		DXGI_FORMAT Format;
+		DXGI_FORMAT ViewFormat;
+	};
+
+	struct TextureArrayKeyHash
+	{
+		size_t operator()(const TextureArrayKey& key) const
+		{
+			return ((size_t(key.Width) * 31 + key.Height) * 31 + key.MipLevels) * 31 + key.Format * 7 + key.ViewFormat;
+		}
+	};
+
+	struct TextureArray
+	{
+		TextureArrayKey Key;
+		// Not owned - only used until the array is created
+		std::vector<ID3D11ShaderResourceView*> Sources;
+		ReleaseGuard<ID3D11Texture2D> Texture;
+		ReleaseGuard<ID3D11ShaderResourceView> SRV;
+	};
+
+	struct SliceRef
+	{
+		unsigned Array;
+		unsigned Slice;
+	};
+
+	// Plain 2D textures without MSAA can go in an array
+	static bool GetTextureArrayKey(ID3D11ShaderResourceView* texture, TextureArrayKey& outKey);
+
+	// Finds the slice of a texture or adds it to an array that's not created yet
+	SliceRef AssignSlice(ID3D11ShaderResourceView* texture, const TextureArrayKey& key);
+	// Creates the arrays that got textures since the last call
+	bool CreateTextureArrays();
+
+	ID3D11Device* m_Device;
+	ID3D11DeviceContext* m_Context;
+	MaterialShaderManager* m_ShaderManager;
+	const char* m_ShaderName;
+	const char* m_VSEntry;
+	const char* m_PSEntry;
+	float m_DefaultSpecularPower;
+
+	std::vector<std::unique_ptr<TextureArray>> m_TextureArrays;
+	std::unordered_map<const ID3D11ShaderResourceView*, SliceRef> m_Slices;
+	// Arrays still taking textures
+	std::unordered_map<TextureArrayKey, unsigned, TextureArrayKeyHash> m_OpenArrays;
+	std::unordered_map<const Mesh*, BatchVec> m_Batches;
+	std::unordered_map<const Subset*, const Batch*> m_BatchedSubsets;
+};
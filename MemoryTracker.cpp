@@ -0,0 +1,271 @@
+#include "precompiled.h"
+
+#include "MemoryTracker.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace {
+	// Every thread counts in a slot of its own, threads past the last slot
+	// share it. Slots are never given back - the threads of the application
+	// live as long as it does.
+	struct ThreadCounters
+	{
+		std::atomic<const char*> Name;
+		std::atomic<std::uint64_t> Allocations[MC_Count];
+		std::atomic<std::uint64_t> Frees[MC_Count];
+		std::atomic<std::uint64_t> BytesAllocated[MC_Count];
+		std::atomic<std::uint64_t> BytesFreed[MC_Count];
+	};
+
+	// Zero before any constructor runs - operator new can be called before main
+	ThreadCounters g_Threads[MemoryTracker::MAX_THREADS];
+	std::atomic<unsigned> g_ThreadsCount;
+	std::atomic<std::int64_t> g_GPUBytes[MC_Count];
+
+	thread_local int tls_Slot = -1;
+	thread_local MemoryCategory tls_Category = MC_General;
+	thread_local std::uint64_t tls_Allocations = 0;
+
+	// Running totals as of the last EndFrame
+	struct Totals
+	{
+		std::uint64_t Allocations[MC_Count];
+		std::uint64_t Frees[MC_Count];
+		std::uint64_t BytesAllocated[MC_Count];
+		std::uint64_t ThreadAllocations[MemoryTracker::MAX_THREADS];
+		std::uint64_t ThreadBytes[MemoryTracker::MAX_THREADS];
+	};
+	Totals g_LastTotals;
+
+	ThreadCounters& GetThreadCounters()
+	{
+		if (tls_Slot < 0)
+		{
+			tls_Slot = int(std::min(g_ThreadsCount++, unsigned(MemoryTracker::MAX_THREADS - 1)));
+		}
+		return g_Threads[tls_Slot];
+	}
+
+	const char* CATEGORY_NAMES[MC_Count] =
+	{
+		"General",
+		"Scene",
+		"Culling",
+		"Polygonizer",
+		"Lights",
+		"Materials",
+		"Rendering",
+	};
+}
+
+const char* GetMemoryCategoryName(MemoryCategory category)
+{
+	return CATEGORY_NAMES[category];
+}
+
+bool MemoryTracker::IsHeapTracked()
+{
+#if defined(ENABLE_MEMORY_TRACKING)
+	return true;
+#else
+	return false;
+#endif
+}
+
+void MemoryTracker::SetThreadName(const char* name)
+{
+	GetThreadCounters().Name.store(name, std::memory_order_relaxed);
+}
+
+MemoryCategory MemoryTracker::GetThreadCategory()
+{
+	return tls_Category;
+}
+
+void MemoryTracker::SetThreadCategory(MemoryCategory category)
+{
+	tls_Category = category;
+}
+
+std::uint64_t MemoryTracker::GetThreadAllocations()
+{
+	return tls_Allocations;
+}
+
+void MemoryTracker::OnAllocate(MemoryCategory category, size_t size)
+{
+	auto& counters = GetThreadCounters();
+	counters.Allocations[category].fetch_add(1, std::memory_order_relaxed);
+	counters.BytesAllocated[category].fetch_add(size, std::memory_order_relaxed);
+	++tls_Allocations;
+}
+
+void MemoryTracker::OnFree(MemoryCategory category, size_t size)
+{
+	auto& counters = GetThreadCounters();
+	counters.Frees[category].fetch_add(1, std::memory_order_relaxed);
+	counters.BytesFreed[category].fetch_add(size, std::memory_order_relaxed);
+}
+
+void MemoryTracker::OnGPUAllocate(MemoryCategory category, size_t size)
+{
+	g_GPUBytes[category].fetch_add(std::int64_t(size), std::memory_order_relaxed);
+}
+
+void MemoryTracker::OnGPUFree(MemoryCategory category, size_t size)
+{
+	g_GPUBytes[category].fetch_sub(std::int64_t(size), std::memory_order_relaxed);
+}
+
+MemoryTracker::FrameStats MemoryTracker::EndFrame()
+{
+	FrameStats stats;
+	::memset(&stats, 0, sizeof(stats));
+
+	Totals totals;
+	::memset(&totals, 0, sizeof(totals));
+	std::uint64_t bytesFreed[MC_Count] = {};
+
+	stats.ThreadsCount = std::min(g_ThreadsCount.load(), unsigned(MAX_THREADS));
+	for (auto thread = 0u; thread < stats.ThreadsCount; ++thread)
+	{
+		const auto& counters = g_Threads[thread];
+		for (auto category = 0u; category < MC_Count; ++category)
+		{
+			const auto allocations = counters.Allocations[category].load(std::memory_order_relaxed);
+			const auto bytes = counters.BytesAllocated[category].load(std::memory_order_relaxed);
+			totals.Allocations[category] += allocations;
+			totals.Frees[category] += counters.Frees[category].load(std::memory_order_relaxed);
+			totals.BytesAllocated[category] += bytes;
+			bytesFreed[category] += counters.BytesFreed[category].load(std::memory_order_relaxed);
+			totals.ThreadAllocations[thread] += allocations;
+			totals.ThreadBytes[thread] += bytes;
+		}
+
+		auto& threadStats = stats.Threads[thread];
+		threadStats.Name = counters.Name.load(std::memory_order_relaxed);
+		threadStats.Allocations = totals.ThreadAllocations[thread] - g_LastTotals.ThreadAllocations[thread];
+		threadStats.BytesAllocated = totals.ThreadBytes[thread] - g_LastTotals.ThreadBytes[thread];
+	}
+
+	for (auto category = 0u; category < MC_Count; ++category)
+	{
+		auto& categoryStats = stats.Categories[category];
+		categoryStats.Allocations = totals.Allocations[category] - g_LastTotals.Allocations[category];
+		categoryStats.Frees = totals.Frees[category] - g_LastTotals.Frees[category];
+		categoryStats.BytesAllocated = totals.BytesAllocated[category] - g_LastTotals.BytesAllocated[category];
+		categoryStats.LiveBytes = std::int64_t(totals.BytesAllocated[category] - bytesFreed[category]);
+		categoryStats.GPUBytes = g_GPUBytes[category].load(std::memory_order_relaxed);
+
+		stats.Allocations += categoryStats.Allocations;
+		stats.BytesAllocated += categoryStats.BytesAllocated;
+		stats.LiveBytes += categoryStats.LiveBytes;
+		stats.GPUBytes += categoryStats.GPUBytes;
+	}
+
+	g_LastTotals = totals;
+	return stats;
+}
+
+NoAllocationScope::~NoAllocationScope()
+{
+	assert(GetCount() == 0 && "Heap allocation where none is expected");
+}
+
+#if defined(ENABLE_MEMORY_TRACKING)
+namespace {
+	// In front of every allocation - keeps the alignment of malloc
+	struct AllocationHeader
+	{
+		size_t Size;
+		MemoryCategory Category;
+	};
+	static const size_t HEADER_SIZE = 16;
+	static_assert(sizeof(AllocationHeader) <= HEADER_SIZE, "The header doesn't fit");
+
+	void* TrackedAllocate(size_t size)
+	{
+		auto memory = static_cast<std::uint8_t*>(std::malloc(size + HEADER_SIZE));
+		if (!memory)
+			return nullptr;
+
+		auto header = reinterpret_cast<AllocationHeader*>(memory);
+		header->Size = size;
+		header->Category = tls_Category;
+		MemoryTracker::OnAllocate(header->Category, size);
+		return memory + HEADER_SIZE;
+	}
+
+	void TrackedFree(void* pointer)
+	{
+		if (!pointer)
+			return;
+
+		auto memory = static_cast<std::uint8_t*>(pointer) - HEADER_SIZE;
+		const auto header = reinterpret_cast<const AllocationHeader*>(memory);
+		MemoryTracker::OnFree(header->Category, header->Size);
+		std::free(memory);
+	}
+}
+
+void* operator new(size_t size)
+{
+	auto pointer = TrackedAllocate(size);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new[](size_t size)
+{
+	auto pointer = TrackedAllocate(size);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return TrackedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return TrackedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+	TrackedFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+	TrackedFree(pointer);
+}
+#endif
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What memory is for. The heap allocations of a thread go to the category
+// of the innermost MemoryScope on it, jobs take the one of the thread that
+// queued them.
+enum MemoryCategory
+{
+	MC_General = 0,
+	MC_Scene,
+	MC_Culling,
+	MC_Polygonizer,
+	MC_Lights,
+	MC_Materials,
+	MC_Rendering,
+
+	MC_Count
+};
+
+const char* GetMemoryCategoryName(MemoryCategory category);
+
+// Counts the heap allocations per thread and per category and the GPU
+// memory per category. The heap is counted only with ENABLE_MEMORY_TRACKING,
+// which replaces the global operator new and delete - without it the heap
+// counters stay 0. GPU resources are counted when they are passed to
+// TrackResource (ResourceTracking.h).
+//
+// All counters are updated with relaxed atomics by the threads that
+// allocate. EndFrame is called from one thread only.
+class MemoryTracker
+{
+public:
+	static const unsigned MAX_THREADS = 64;
+
+	struct CategoryStats
+	{
+		// During the frame
+		std::uint64_t Allocations;
+		std::uint64_t Frees;
+		std::uint64_t BytesAllocated;
+		// At its end
+		std::int64_t LiveBytes;
+		std::int64_t GPUBytes;
+	};
+
+	struct ThreadStats
+	{
+		// nullptr for threads that never called SetThreadName
+		const char* Name;
+		// During the frame
+		std::uint64_t Allocations;
+		std::uint64_t BytesAllocated;
+	};
+
+	struct FrameStats
+	{
+		CategoryStats Categories[MC_Count];
+		ThreadStats Threads[MAX_THREADS];
+		unsigned ThreadsCount;
+		// Of all categories
+		std::uint64_t Allocations;
+		std::uint64_t BytesAllocated;
+		std::int64_t LiveBytes;
+		std::int64_t GPUBytes;
+	};
+
+	static bool IsHeapTracked();
+
+	// Must outlive the thread - a string literal
+	static void SetThreadName(const char* name);
+	static MemoryCategory GetThreadCategory();
+	// Allocations of the calling thread since it started
+	static std::uint64_t GetThreadAllocations();
+
+	// Counters since the last call
+	static FrameStats EndFrame();
+
+	static void OnAllocate(MemoryCategory category, size_t size);
+	static void OnFree(MemoryCategory category, size_t size);
+	static void OnGPUAllocate(MemoryCategory category, size_t size);
+	static void OnGPUFree(MemoryCategory category, size_t size);
+
+private:
+	friend class MemoryScope;
+	static void SetThreadCategory(MemoryCategory category);
+};
+
+// Tags the heap allocations of the thread until it goes out of scope
+class MemoryScope
+{
+public:
+	explicit MemoryScope(MemoryCategory category)
+		: m_Previous(MemoryTracker::GetThreadCategory())
+	{
+		MemoryTracker::SetThreadCategory(category);
+	}
+	~MemoryScope()
+	{
+		MemoryTracker::SetThreadCategory(m_Previous);
+	}
+
+private:
+	MemoryScope(const MemoryScope&);
+	MemoryScope& operator=(const MemoryScope&);
+
+	MemoryCategory m_Previous;
+};
+
+// Asserts that the thread allocates nothing from the heap until it goes out
+// of scope - for the code that runs every frame on preallocated memory
+class NoAllocationScope
+{
+public:
+	NoAllocationScope()
+		: m_Start(MemoryTracker::GetThreadAllocations())
+	{}
+	~NoAllocationScope();
+
+	std::uint64_t GetCount() const { return MemoryTracker::GetThreadAllocations() - m_Start; }
+
+private:
+	NoAllocationScope(const NoAllocationScope&);
+	NoAllocationScope& operator=(const NoAllocationScope&);
+
+	std::uint64_t m_Start;
+};
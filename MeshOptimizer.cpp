@@ -0,0 +1,461 @@
+#include "precompiled.h"
+
+#include "MeshOptimizer.h"
+
+namespace MeshOptimizer
+{
+
+namespace {
+	static const std::uint32_t INVALID_INDEX = 0xFFFFFFFF;
+
+	// Parameters from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+	static const int FORSYTH_CACHE_SIZE = 32;
+	static const float CACHE_DECAY_POWER = 1.5f;
+	static const float LAST_TRIANGLE_SCORE = 0.75f;
+	static const float VALENCE_BOOST_SCALE = 2.0f;
+	static const float VALENCE_BOOST_POWER = 0.5f;
+	// Valence scores are tabulated up to this many live triangles
+	static const unsigned MAX_VALENCE = 64;
+
+	struct ScoreTable
+	{
+		ScoreTable()
+		{
+			for (auto i = 0; i < FORSYTH_CACHE_SIZE; ++i)
+			{
+				if (i < 3)
+				{
+					// The last triangle's vertices get a fixed score so the
+					// algorithm doesn't prefer strips
+					Cache[i] = LAST_TRIANGLE_SCORE;
+				}
+				else
+				{
+					const float scaler = 1.f / (FORSYTH_CACHE_SIZE - 3);
+					Cache[i] = std::pow(1.f - (i - 3) * scaler, CACHE_DECAY_POWER);
+				}
+			}
+			Valence[0] = 0;
+			for (auto i = 1u; i < MAX_VALENCE; ++i)
+			{
+				// Vertices with few triangles left are finished first so they stop
+				// bloating the future
+				Valence[i] = VALENCE_BOOST_SCALE * std::pow(float(i), -VALENCE_BOOST_POWER);
+			}
+		}
+
+		float Get(int cachePosition, unsigned liveTriangles) const
+		{
+			if (!liveTriangles)
+				return -1.f;
+			const float cacheScore = cachePosition >= 0 ? Cache[cachePosition] : 0.f;
+			return cacheScore + Valence[std::min(liveTriangles, MAX_VALENCE - 1)];
+		}
+
+		float Cache[FORSYTH_CACHE_SIZE];
+		float Valence[MAX_VALENCE];
+	};
+
+	// Triangles that use each vertex
+	struct Adjacency
+	{
+		Adjacency(const std::uint32_t* indices, unsigned indicesCount, unsigned verticesCount)
+			: Counts(verticesCount, 0)
+			, Offsets(verticesCount, 0)
+			, Triangles(indicesCount)
+		{
+			for (auto i = 0u; i < indicesCount; ++i)
+			{
+				++Counts[indices[i]];
+			}
+			unsigned offset = 0;
+			for (auto vertex = 0u; vertex < verticesCount; ++vertex)
+			{
+				Offsets[vertex] = offset;
+				offset += Counts[vertex];
+			}
+			std::vector<unsigned> fill(Offsets);
+			for (auto i = 0u; i < indicesCount; ++i)
+			{
+				Triangles[fill[indices[i]]++] = i / 3;
+			}
+		}
+
+		std::vector<unsigned> Counts;
+		std::vector<unsigned> Offsets;
+		std::vector<std::uint32_t> Triangles;
+	};
+
+	inline void LoadPosition(const std::uint8_t* vertices, unsigned stride, std::uint32_t index, float out[3])
+	{
+		::memcpy(out, vertices + size_t(index) * stride, 3 * sizeof(float));
+	}
+}
+
+CacheStats AnalyzeVertexCache(const std::uint32_t* indices,
+	unsigned indicesCount,
+	unsigned verticesCount,
+	unsigned cacheSize)
+{
+	CacheStats stats;
+	stats.TrianglesCount = indicesCount / 3;
+
+	// A vertex is in the FIFO if it was pushed less than cacheSize misses ago
+	std::vector<unsigned> cacheTimestamps(verticesCount, 0);
+	std::vector<bool> used(verticesCount, false);
+	unsigned timestamp = cacheSize + 1;
+	for (auto i = 0u; i < indicesCount; ++i)
+	{
+		const auto index = indices[i];
+		if (index >= verticesCount)
+			continue;
+
+		if (timestamp - cacheTimestamps[index] > cacheSize)
+		{
+			cacheTimestamps[index] = timestamp++;
+			++stats.VerticesTransformed;
+		}
+		if (!used[index])
+		{
+			used[index] = true;
+			++stats.VerticesUsed;
+		}
+	}
+	return stats;
+}
+
+void OptimizeVertexCache(const std::uint32_t* indices,
+	unsigned indicesCount,
+	unsigned verticesCount,
+	std::uint32_t* outIndices)
+{
+	static const ScoreTable scores;
+
+	const auto trianglesCount = indicesCount / 3;
+	if (!trianglesCount)
+		return;
+
+	Adjacency adjacency(indices, trianglesCount * 3, verticesCount);
+	// Counts become the live triangles of a vertex - emitted triangles are
+	// swapped past the end of the vertex's range
+	std::vector<unsigned>& liveTriangles = adjacency.Counts;
+
+	std::vector<float> vertexScores(verticesCount);
+	for (auto vertex = 0u; vertex < verticesCount; ++vertex)
+	{
+		vertexScores[vertex] = scores.Get(-1, liveTriangles[vertex]);
+	}
+
+	std::vector<float> triangleScores(trianglesCount);
+	std::vector<bool> emitted(trianglesCount, false);
+	for (auto triangle = 0u; triangle < trianglesCount; ++triangle)
+	{
+		const auto* tri = indices + triangle * 3;
+		triangleScores[triangle] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+	}
+
+	// Room for the new triangle's vertices in front of the old cache
+	std::uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	std::uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+	unsigned cacheCount = 0;
+
+	unsigned bestTriangle = 0;
+	for (auto triangle = 1u; triangle < trianglesCount; ++triangle)
+	{
+		if (triangleScores[triangle] > triangleScores[bestTriangle])
+			bestTriangle = triangle;
+	}
+
+	// Triangles before the cursor have all been emitted
+	unsigned inputCursor = 0;
+	unsigned outputTriangle = 0;
+	while (bestTriangle != INVALID_INDEX)
+	{
+		const auto* tri = indices + bestTriangle * 3;
+		std::copy(tri, tri + 3, outIndices + outputTriangle * 3);
+		++outputTriangle;
+		emitted[bestTriangle] = true;
+
+		// The new triangle's vertices go to the front, followed by the rest of the old cache
+		unsigned newCacheCount = 0;
+		for (auto k = 0; k < 3; ++k)
+		{
+			const auto vertex = tri[k];
+			// Degenerate triangles list a vertex twice
+			if (std::find(newCache, newCache + newCacheCount, vertex) == newCache + newCacheCount)
+				newCache[newCacheCount++] = vertex;
+
+			const auto begin = adjacency.Triangles.begin() + adjacency.Offsets[vertex];
+			const auto end = begin + liveTriangles[vertex];
+			const auto it = std::find(begin, end, bestTriangle);
+			std::iter_swap(it, end - 1);
+			--liveTriangles[vertex];
+		}
+		for (auto i = 0u; i < cacheCount; ++i)
+		{
+			const auto vertex = cache[i];
+			if (vertex != tri[0] && vertex != tri[1] && vertex != tri[2])
+				newCache[newCacheCount++] = vertex;
+		}
+		std::swap(cache, newCache);
+		cacheCount = newCacheCount;
+
+		// Vertices pushed out only lose their cache score, the ones in the
+		// cache need new scores and so do their triangles
+		for (auto i = 0u; i < cacheCount; ++i)
+		{
+			const auto vertex = cache[i];
+			const int position = i < unsigned(FORSYTH_CACHE_SIZE) ? int(i) : -1;
+			vertexScores[vertex] = scores.Get(position, liveTriangles[vertex]);
+		}
+
+		float bestScore = -1.f;
+		bestTriangle = INVALID_INDEX;
+		for (auto i = 0u; i < cacheCount; ++i)
+		{
+			const auto vertex = cache[i];
+			const auto begin = adjacency.Triangles.begin() + adjacency.Offsets[vertex];
+			for (auto it = begin; it != begin + liveTriangles[vertex]; ++it)
+			{
+				const auto* adjacent = indices + *it * 3;
+				const float score = vertexScores[adjacent[0]] + vertexScores[adjacent[1]] + vertexScores[adjacent[2]];
+				triangleScores[*it] = score;
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestTriangle = *it;
+				}
+			}
+		}
+		cacheCount = std::min(cacheCount, unsigned(FORSYTH_CACHE_SIZE));
+
+		// Nothing in the cache has triangles left - start over from the first
+		// triangle not emitted yet
+		if (bestTriangle == INVALID_INDEX)
+		{
+			while (inputCursor < trianglesCount && emitted[inputCursor])
+			{
+				++inputCursor;
+			}
+			if (inputCursor < trianglesCount)
+				bestTriangle = inputCursor;
+		}
+	}
+}
+
+void OptimizeOverdraw(const std::uint32_t* indices,
+	unsigned indicesCount,
+	const void* vertices,
+	unsigned stride,
+	unsigned verticesCount,
+	std::uint32_t* outIndices,
+	float threshold)
+{
+	const auto trianglesCount = indicesCount / 3;
+	if (!trianglesCount)
+		return;
+
+	const auto* bytes = static_cast<const std::uint8_t*>(vertices);
+
+	// Cluster boundaries go where the cache would have been cold anyway -
+	// at triangles that miss all of their vertices - and, inside these hard
+	// clusters, wherever the cluster so far is within the ACMR threshold
+	const float meshACMR = AnalyzeVertexCache(indices, indicesCount, verticesCount).GetACMR();
+
+	// Every cluster is simulated from a cold cache, the way it will run after reordering
+	std::vector<unsigned> clusters;
+	{
+		std::vector<unsigned> cacheTimestamps(verticesCount, 0);
+		unsigned timestamp = STATS_CACHE_SIZE + 1;
+		auto countMisses = [&](unsigned triangle) {
+			unsigned misses = 0;
+			for (auto k = 0u; k < 3; ++k)
+			{
+				const auto index = indices[triangle * 3 + k];
+				if (timestamp - cacheTimestamps[index] > STATS_CACHE_SIZE)
+				{
+					cacheTimestamps[index] = timestamp++;
+					++misses;
+				}
+			}
+			return misses;
+		};
+
+		unsigned clusterMisses = 0;
+		unsigned clusterStart = 0;
+		clusters.push_back(0);
+		for (auto triangle = 0u; triangle < trianglesCount; ++triangle)
+		{
+			unsigned misses = countMisses(triangle);
+
+			const bool hardBoundary = misses == 3;
+			const bool softBoundary = float(clusterMisses) <= meshACMR * threshold * (triangle - clusterStart);
+			if (triangle > clusterStart && (hardBoundary || softBoundary))
+			{
+				clusters.push_back(triangle);
+				clusterStart = triangle;
+				clusterMisses = 0;
+				if (!hardBoundary)
+				{
+					timestamp += STATS_CACHE_SIZE + 1;
+					misses = countMisses(triangle);
+				}
+			}
+			clusterMisses += misses;
+		}
+	}
+
+	// Mesh centroid, weighted by the triangles
+	float meshCenter[3] = { 0, 0, 0 };
+	for (auto i = 0u; i < trianglesCount * 3; ++i)
+	{
+		float position[3];
+		LoadPosition(bytes, stride, indices[i], position);
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			meshCenter[axis] += position[axis];
+		}
+	}
+	for (auto axis = 0; axis < 3; ++axis)
+	{
+		meshCenter[axis] /= float(trianglesCount * 3);
+	}
+
+	// Clusters that face away from the center are likely to occlude the others
+	struct ClusterSort
+	{
+		float Key;
+		unsigned Cluster;
+	};
+	std::vector<ClusterSort> sorted(clusters.size());
+	for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+	{
+		const auto first = clusters[cluster];
+		const auto last = cluster + 1 < clusters.size() ? clusters[cluster + 1] : trianglesCount;
+
+		float center[3] = { 0, 0, 0 };
+		float normal[3] = { 0, 0, 0 };
+		float area = 0;
+		for (auto triangle = first; triangle < last; ++triangle)
+		{
+			float p[3][3];
+			for (auto k = 0; k < 3; ++k)
+			{
+				LoadPosition(bytes, stride, indices[triangle * 3 + k], p[k]);
+			}
+			const float e1[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+			const float e2[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+			// Area weighted - the cross product length is twice the area
+			const float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]
+			};
+			const float triangleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				center[axis] += (p[0][axis] + p[1][axis] + p[2][axis]) / 3.f * triangleArea;
+				normal[axis] += n[axis];
+			}
+			area += triangleArea;
+		}
+
+		const float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float key = 0;
+		if (area > 0 && normalLength > 0)
+		{
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				key += (center[axis] / area - meshCenter[axis]) * (normal[axis] / normalLength);
+			}
+		}
+		sorted[cluster].Key = key;
+		sorted[cluster].Cluster = unsigned(cluster);
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](const ClusterSort& lhs, const ClusterSort& rhs) {
+		return lhs.Key > rhs.Key;
+	});
+
+	std::uint32_t* out = outIndices;
+	for (const auto& entry : sorted)
+	{
+		const auto first = clusters[entry.Cluster];
+		const auto last = entry.Cluster + 1 < clusters.size() ? clusters[entry.Cluster + 1] : trianglesCount;
+		out = std::copy(indices + first * 3, indices + last * 3, out);
+	}
+}
+
+void OptimizeTriangles(std::uint32_t* indices,
+	unsigned indicesCount,
+	const void* vertices,
+	unsigned stride,
+	unsigned verticesCount)
+{
+	std::vector<std::uint32_t> cacheOptimized(indicesCount);
+	OptimizeVertexCache(indices, indicesCount, verticesCount, cacheOptimized.data());
+	OptimizeOverdraw(cacheOptimized.data(), indicesCount, vertices, stride, verticesCount, indices);
+}
+
+bool OptimizeTrianglesInRange(std::uint32_t* indices,
+	unsigned indicesCount,
+	const void* vertices,
+	unsigned stride,
+	unsigned verticesCount)
+{
+	if (!indicesCount)
+		return true;
+
+	const auto range = std::minmax_element(indices, indices + indicesCount);
+	const auto firstVertex = *range.first;
+	if (*range.second >= verticesCount)
+		return false;
+
+	std::transform(indices, indices + indicesCount, indices, [firstVertex](std::uint32_t index) {
+		return index - firstVertex;
+	});
+	OptimizeTriangles(indices,
+		indicesCount,
+		static_cast<const std::uint8_t*>(vertices) + size_t(firstVertex) * stride,
+		stride,
+		*range.second - firstVertex + 1);
+	std::transform(indices, indices + indicesCount, indices, [firstVertex](std::uint32_t index) {
+		return index + firstVertex;
+	});
+	return true;
+}
+
+unsigned OptimizeVertexFetch(std::uint32_t* indices,
+	unsigned indicesCount,
+	unsigned verticesCount,
+	std::vector<std::uint32_t>& outRemap)
+{
+	outRemap.assign(verticesCount, INVALID_INDEX);
+
+	unsigned nextVertex = 0;
+	for (auto i = 0u; i < indicesCount; ++i)
+	{
+		auto& remapped = outRemap[indices[i]];
+		if (remapped == INVALID_INDEX)
+			remapped = nextVertex++;
+		indices[i] = remapped;
+	}
+	return nextVertex;
+}
+
+void RemapVertices(const void* vertices,
+	unsigned stride,
+	unsigned verticesCount,
+	const std::vector<std::uint32_t>& remap,
+	void* outVertices)
+{
+	const auto* src = static_cast<const std::uint8_t*>(vertices);
+	auto* dst = static_cast<std::uint8_t*>(outVertices);
+	for (auto vertex = 0u; vertex < verticesCount; ++vertex)
+	{
+		if (remap[vertex] != INVALID_INDEX)
+			::memcpy(dst + size_t(remap[vertex]) * stride, src + size_t(vertex) * stride, stride);
+	}
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Triangle and vertex reordering for indexed triangle lists. Meant to run once
+// when a mesh is loaded - the usual order is OptimizeVertexCache, then
+// OptimizeOverdraw on its output and finally OptimizeVertexFetch.
+namespace MeshOptimizer
+{
+	// Size of the FIFO the statistics simulate - close to what current GPUs reuse
+	static const unsigned STATS_CACHE_SIZE = 16;
+
+	struct CacheStats
+	{
+		CacheStats()
+			: TrianglesCount(0)
+			, VerticesUsed(0)
+			, VerticesTransformed(0)
+		{}
+
+		// Average cache miss ratio - transformed vertices per triangle, 0.5 at best and 3 at worst
+		float GetACMR() const { return TrianglesCount ? float(VerticesTransformed) / TrianglesCount : 0.f; }
+		// Average transform to vertex ratio - transformed vertices per referenced vertex, 1 at best
+		float GetATVR() const { return VerticesUsed ? float(VerticesTransformed) / VerticesUsed : 0.f; }
+
+		// Totals over several meshes
+		CacheStats& operator+=(const CacheStats& other)
+		{
+			TrianglesCount += other.TrianglesCount;
+			VerticesUsed += other.VerticesUsed;
+			VerticesTransformed += other.VerticesTransformed;
+			return *this;
+		}
+
+		unsigned TrianglesCount;
+		unsigned VerticesUsed;
+		unsigned VerticesTransformed;
+	};
+
+	CacheStats AnalyzeVertexCache(const std::uint32_t* indices,
+		unsigned indicesCount,
+		unsigned verticesCount,
+		unsigned cacheSize = STATS_CACHE_SIZE);
+
+	// Forsyth's linear-speed vertex cache optimization. outIndices must not alias indices.
+	void OptimizeVertexCache(const std::uint32_t* indices,
+		unsigned indicesCount,
+		unsigned verticesCount,
+		std::uint32_t* outIndices);
+
+	// Splits cache-optimized triangles in clusters wherever that costs at most
+	// 'threshold' times the ACMR and orders the clusters so that the ones facing
+	// out of the mesh are drawn first. Positions are the first 3 floats of
+	// every 'stride' bytes. outIndices must not alias indices.
+	void OptimizeOverdraw(const std::uint32_t* indices,
+		unsigned indicesCount,
+		const void* vertices,
+		unsigned stride,
+		unsigned verticesCount,
+		std::uint32_t* outIndices,
+		float threshold = 1.05f);
+
+	// OptimizeVertexCache followed by OptimizeOverdraw, in place
+	void OptimizeTriangles(std::uint32_t* indices,
+		unsigned indicesCount,
+		const void* vertices,
+		unsigned stride,
+		unsigned verticesCount);
+
+	// OptimizeTriangles for indices into a vertex buffer shared with other
+	// index lists - only the range of vertices they use is looked at. Returns
+	// false if an index is past verticesCount.
+	bool OptimizeTrianglesInRange(std::uint32_t* indices,
+		unsigned indicesCount,
+		const void* vertices,
+		unsigned stride,
+		unsigned verticesCount);
+
+	// Renumbers the vertices in the order the indices first use them and
+	// rewrites the indices in place. outRemap maps old vertices to new ones,
+	// unused vertices get ~0u. Returns the number of used vertices.
+	unsigned OptimizeVertexFetch(std::uint32_t* indices,
+		unsigned indicesCount,
+		unsigned verticesCount,
+		std::vector<std::uint32_t>& outRemap);
+
+	// Moves 'stride' byte vertices to the places given by a remap from OptimizeVertexFetch
+	void RemapVertices(const void* vertices,
+		unsigned stride,
+		unsigned verticesCount,
+		const std::vector<std::uint32_t>& remap,
+		void* outVertices);
+}
@@ -0,0 +1,491 @@
+#include "precompiled.h"
+
+#include "OcclusionBuffer.h"
+#include "CullingKernel.h"
+#include "JobSystem.h"
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// Passed by reference to std::min and the like
+const unsigned OcclusionBuffer::WIDTH;
+const unsigned OcclusionBuffer::HEIGHT;
+const unsigned OcclusionBuffer::TILE_WIDTH;
+const unsigned OcclusionBuffer::TILE_HEIGHT;
+const unsigned OcclusionBuffer::TILES_X;
+const unsigned OcclusionBuffer::TILES_Y;
+
+namespace {
+	// Occluder triangles set up per task
+	static const unsigned TRIANGLES_PER_JOB = 1024;
+	// Boxes tested per task
+	static const unsigned BOXES_PER_JOB = 512;
+	// Boxes that touch their own occluder triangles must not be culled by them
+	static const float DEPTH_BIAS = 1e-5f;
+
+	static const std::uint32_t FULL_ROW = ~0u;
+
+	// Bit i of row r is the pixel (tileX + i, tileY + r). Every edge clears
+	// the bits of the pixels whose centers are not inside it. A center right
+	// on an edge is inside only for edges with a > 0, or a == 0 and b > 0 -
+	// of two triangles sharing the edge exactly one covers it.
+	void ComputeCoverageScalar(const float* edgeA,
+		const float* edgeB,
+		const float* edgeC,
+		float tileX,
+		float tileY,
+		std::uint32_t* rows)
+	{
+		for (auto r = 0u; r < OcclusionBuffer::TILE_HEIGHT; ++r)
+		{
+			rows[r] = FULL_ROW;
+		}
+		for (auto edge = 0u; edge < 3; ++edge)
+		{
+			const float a = edgeA[edge];
+			for (auto r = 0u; r < OcclusionBuffer::TILE_HEIGHT; ++r)
+			{
+				const float side = edgeB[edge] * (tileY + (float(r) + 0.5f)) + edgeC[edge];
+				std::uint32_t mask;
+				if (a == 0)
+				{
+					mask = (edgeB[edge] > 0 ? side >= 0 : side > 0) ? FULL_ROW : 0;
+				}
+				else
+				{
+					// Where the edge crosses the row, relative to the first pixel center
+					const float crossing = std::min(std::max((0.f - side) / a - (tileX + 0.5f), -1.f), 33.f);
+					if (a > 0)
+					{
+						const int first = std::min(std::max(int(std::ceil(crossing)), 0), 32);
+						mask = first >= 32 ? 0 : FULL_ROW << first;
+					}
+					else
+					{
+						const int count = std::max(int(std::ceil(crossing)), 0);
+						mask = count >= 32 ? FULL_ROW : (count ? FULL_ROW >> (32 - count) : 0);
+					}
+				}
+				rows[r] &= mask;
+			}
+		}
+	}
+
+	AVX2_TARGET void ComputeCoverageAVX2(const float* edgeA,
+		const float* edgeB,
+		const float* edgeC,
+		float tileX,
+		float tileY,
+		std::uint32_t* rows)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 minCrossing = _mm256_set1_ps(-1.f);
+		const __m256 maxCrossing = _mm256_set1_ps(33.f);
+		const __m256i ones = _mm256_set1_epi32(-1);
+		const __m256i zeroi = _mm256_setzero_si256();
+		const __m256i bits = _mm256_set1_epi32(32);
+		const __m256 rowCenters = _mm256_add_ps(_mm256_set1_ps(tileY),
+			_mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f));
+		const __m256 firstCenter = _mm256_set1_ps(tileX + 0.5f);
+
+		__m256i coverage = ones;
+		for (auto edge = 0u; edge < 3; ++edge)
+		{
+			const float a = edgeA[edge];
+			const __m256 side = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edgeB[edge]), rowCenters), _mm256_set1_ps(edgeC[edge]));
+			__m256i mask;
+			if (a == 0)
+			{
+				mask = _mm256_castps_si256(edgeB[edge] > 0
+					? _mm256_cmp_ps(side, zero, _CMP_GE_OQ)
+					: _mm256_cmp_ps(side, zero, _CMP_GT_OQ));
+			}
+			else
+			{
+				const __m256 crossing = _mm256_min_ps(_mm256_max_ps(
+					_mm256_sub_ps(_mm256_div_ps(_mm256_sub_ps(zero, side), _mm256_set1_ps(a)), firstCenter),
+					minCrossing), maxCrossing);
+				if (a > 0)
+				{
+					// Shifts of 32 and more give 0
+					const __m256i first = _mm256_max_epi32(_mm256_cvttps_epi32(_mm256_ceil_ps(crossing)), zeroi);
+					mask = _mm256_sllv_epi32(ones, _mm256_min_epi32(first, bits));
+				}
+				else
+				{
+					const __m256i count = _mm256_max_epi32(_mm256_cvttps_epi32(_mm256_ceil_ps(crossing)), zeroi);
+					mask = _mm256_srlv_epi32(ones, _mm256_sub_epi32(bits, _mm256_min_epi32(count, bits)));
+				}
+			}
+			coverage = _mm256_and_si256(coverage, mask);
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rows), coverage);
+	}
+
+	void Multiply(const float* lhs, const float* rhs, float* out)
+	{
+		for (auto row = 0u; row < 4; ++row)
+		{
+			for (auto column = 0u; column < 4; ++column)
+			{
+				float sum = 0;
+				for (auto i = 0u; i < 4; ++i)
+				{
+					sum += lhs[row * 4 + i] * rhs[i * 4 + column];
+				}
+				out[row * 4 + column] = sum;
+			}
+		}
+	}
+
+	void TransformPoint(const float* m, float x, float y, float z, float* out)
+	{
+		for (auto column = 0u; column < 4; ++column)
+		{
+			out[column] = x * m[column] + y * m[4 + column] + z * m[8 + column] + m[12 + column];
+		}
+	}
+}
+
+OcclusionBuffer::OcclusionBuffer(unsigned threadsCount)
+	: m_ThreadsCount(threadsCount ? threadsCount : gJobSystem->GetThreadsCount())
+	, m_Tiles(TILES_X * TILES_Y)
+	, m_UseAVX2(CullingKernel::IsUsingAVX2())
+{
+	::memset(m_ViewProjection, 0, sizeof(m_ViewProjection));
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{}
+
+void OcclusionBuffer::Begin(const float* viewProjection)
+{
+	::memcpy(m_ViewProjection, viewProjection, sizeof(m_ViewProjection));
+	m_Occluders.clear();
+	m_Triangles.clear();
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+
+	for (auto& tile : m_Tiles)
+	{
+		::memset(tile.Mask, 0, sizeof(tile.Mask));
+		tile.Depth[0] = 1.f;
+		tile.Depth[1] = 0.f;
+	}
+}
+
+void OcclusionBuffer::AddOccluder(const float* positions, unsigned verticesCount, const std::uint32_t* indices, unsigned indicesCount, const float* world)
+{
+	Occluder occluder;
+	occluder.Positions = positions;
+	occluder.VerticesCount = verticesCount;
+	occluder.Indices = indices;
+	occluder.IndicesCount = indicesCount - indicesCount % 3;
+	Multiply(world, m_ViewProjection, occluder.Transform);
+	m_Occluders.push_back(occluder);
+
+	m_Stats.OccluderTriangles += occluder.IndicesCount / 3;
+}
+
+void OcclusionBuffer::SetupTriangles(SetupJob& job) const
+{
+	const Occluder& occluder = m_Occluders[job.Occluder];
+	job.Triangles.clear();
+	for (auto index = job.FirstIndex; index < job.LastIndex; index += 3)
+	{
+		float clip[3][4];
+		bool valid = true;
+		for (auto v = 0u; v < 3 && valid; ++v)
+		{
+			const auto vertex = occluder.Indices[index + v];
+			valid = vertex < occluder.VerticesCount;
+			if (valid)
+			{
+				const float* position = occluder.Positions + vertex * 3;
+				TransformPoint(occluder.Transform, position[0], position[1], position[2], clip[v]);
+				// The GPU clips what is in front of the near plane - it can't occlude
+				valid = clip[v][2] >= 0;
+			}
+		}
+		if (!valid)
+			continue;
+
+		// Entirely out of one of the planes
+		bool outside = false;
+		for (auto axis = 0u; axis < 2 && !outside; ++axis)
+		{
+			outside = (clip[0][axis] > clip[0][3] && clip[1][axis] > clip[1][3] && clip[2][axis] > clip[2][3])
+				|| (clip[0][axis] < -clip[0][3] && clip[1][axis] < -clip[1][3] && clip[2][axis] < -clip[2][3]);
+		}
+		if (outside || (clip[0][2] > clip[0][3] && clip[1][2] > clip[1][3] && clip[2][2] > clip[2][3]))
+			continue;
+
+		float x[3], y[3], z[3];
+		for (auto v = 0u; v < 3; ++v)
+		{
+			const float invW = 1.f / clip[v][3];
+			x[v] = (clip[v][0] * invW * 0.5f + 0.5f) * WIDTH;
+			y[v] = (0.5f - clip[v][1] * invW * 0.5f) * HEIGHT;
+			z[v] = clip[v][2] * invW;
+		}
+
+		// Occluders are double sided - the edges are set up for one winding
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (std::abs(area) < 1e-6f)
+			continue;
+		if (area < 0)
+		{
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+
+		Triangle triangle;
+		triangle.MinX = std::max(std::min(std::min(x[0], x[1]), x[2]), 0.f);
+		triangle.MinY = std::max(std::min(std::min(y[0], y[1]), y[2]), 0.f);
+		triangle.MaxX = std::min(std::max(std::max(x[0], x[1]), x[2]), float(WIDTH));
+		triangle.MaxY = std::min(std::max(std::max(y[0], y[1]), y[2]), float(HEIGHT));
+		if (triangle.MinX >= triangle.MaxX || triangle.MinY >= triangle.MaxY)
+			continue;
+		triangle.MinTileX = unsigned(triangle.MinX) / TILE_WIDTH;
+		triangle.MinTileY = unsigned(triangle.MinY) / TILE_HEIGHT;
+		triangle.MaxTileX = std::min(unsigned(triangle.MaxX) / TILE_WIDTH, TILES_X - 1);
+		triangle.MaxTileY = std::min(unsigned(triangle.MaxY) / TILE_HEIGHT, TILES_Y - 1);
+
+		for (auto edge = 0u; edge < 3; ++edge)
+		{
+			// Set up from the same end whichever way the edge goes, so a
+			// triangle sharing it gets the exact negation and no pixel
+			// falls between the two
+			const auto next = (edge + 1) % 3;
+			const bool forward = x[edge] < x[next] || (x[edge] == x[next] && y[edge] < y[next]);
+			const auto from = forward ? edge : next;
+			const auto to = forward ? next : edge;
+			const float a = y[from] - y[to];
+			const float b = x[to] - x[from];
+			const float c = -(a * x[from] + b * y[from]);
+			triangle.EdgeA[edge] = forward ? a : -a;
+			triangle.EdgeB[edge] = forward ? b : -b;
+			triangle.EdgeC[edge] = forward ? c : -c;
+		}
+
+		triangle.ZA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+		triangle.ZB = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+		triangle.ZC = z[0] - triangle.ZA * x[0] - triangle.ZB * y[0];
+		triangle.ZMin = std::min(std::min(z[0], z[1]), z[2]);
+		triangle.ZMax = std::max(std::max(z[0], z[1]), z[2]);
+
+		job.Triangles.push_back(triangle);
+	}
+}
+
+void OcclusionBuffer::RasterizeTile(const Triangle& triangle, unsigned tileX, unsigned tileY)
+{
+	Tile& tile = m_Tiles[tileY * TILES_X + tileX];
+	// Behind everything already in the tile
+	if (triangle.ZMin >= tile.Depth[0])
+		return;
+
+	const float left = float(tileX * TILE_WIDTH);
+	const float top = float(tileY * TILE_HEIGHT);
+	std::uint32_t coverage[TILE_HEIGHT];
+	if (m_UseAVX2)
+		ComputeCoverageAVX2(triangle.EdgeA, triangle.EdgeB, triangle.EdgeC, left, top, coverage);
+	else
+		ComputeCoverageScalar(triangle.EdgeA, triangle.EdgeB, triangle.EdgeC, left, top, coverage);
+
+	std::uint32_t any = 0;
+	for (auto r = 0u; r < TILE_HEIGHT; ++r)
+	{
+		any |= coverage[r];
+	}
+	if (!any)
+		return;
+
+	// The farthest the triangle gets in the tile - its plane at the corners
+	// of the part of the tile in its bounds, never past its farthest vertex
+	const float x0 = std::max(left, triangle.MinX);
+	const float x1 = std::min(left + TILE_WIDTH, triangle.MaxX);
+	const float y0 = std::max(top, triangle.MinY);
+	const float y1 = std::min(top + TILE_HEIGHT, triangle.MaxY);
+	const float zx0 = triangle.ZA * x0;
+	const float zx1 = triangle.ZA * x1;
+	const float zy0 = triangle.ZB * y0 + triangle.ZC;
+	const float zy1 = triangle.ZB * y1 + triangle.ZC;
+	const float depth = std::min(std::max(std::max(zx0 + zy0, zx1 + zy0), std::max(zx0 + zy1, zx1 + zy1)), triangle.ZMax);
+
+	// Much nearer than the working layer is to the reference - the working
+	// layer is dropped and the triangle starts a new one
+	if (tile.Depth[1] - depth > tile.Depth[0] - tile.Depth[1])
+	{
+		tile.Depth[1] = 0;
+		::memset(tile.Mask, 0, sizeof(tile.Mask));
+	}
+
+	tile.Depth[1] = std::max(tile.Depth[1], depth);
+	bool full = true;
+	for (auto r = 0u; r < TILE_HEIGHT; ++r)
+	{
+		tile.Mask[r] |= coverage[r];
+		full &= tile.Mask[r] == FULL_ROW;
+	}
+	if (full)
+	{
+		tile.Depth[0] = std::min(tile.Depth[0], tile.Depth[1]);
+		tile.Depth[1] = 0;
+		::memset(tile.Mask, 0, sizeof(tile.Mask));
+	}
+}
+
+void OcclusionBuffer::RasterizeBand(unsigned firstTileY, unsigned lastTileY)
+{
+	for (const auto& triangle : m_Triangles)
+	{
+		if (triangle.MaxTileY < firstTileY || triangle.MinTileY >= lastTileY)
+			continue;
+
+		const auto maxTileY = std::min(triangle.MaxTileY, lastTileY - 1);
+		for (auto tileY = std::max(triangle.MinTileY, firstTileY); tileY <= maxTileY; ++tileY)
+		{
+			for (auto tileX = triangle.MinTileX; tileX <= triangle.MaxTileX; ++tileX)
+			{
+				RasterizeTile(triangle, tileX, tileY);
+			}
+		}
+	}
+}
+
+void OcclusionBuffer::Rasterize()
+{
+	// Triangles are set up in chunks and gathered in the order they were added
+	m_SetupJobs.resize(0);
+	for (auto occluder = 0u; occluder < unsigned(m_Occluders.size()); ++occluder)
+	{
+		const auto indicesCount = m_Occluders[occluder].IndicesCount;
+		for (auto first = 0u; first < indicesCount; first += TRIANGLES_PER_JOB * 3)
+		{
+			SetupJob job;
+			job.Occluder = occluder;
+			job.FirstIndex = first;
+			job.LastIndex = std::min(first + TRIANGLES_PER_JOB * 3, indicesCount);
+			m_SetupJobs.push_back(std::move(job));
+		}
+	}
+
+	if (m_ThreadsCount > 1 && m_SetupJobs.size() > 1)
+	{
+		gJobSystem->ParallelFor("Occluder setup", unsigned(m_SetupJobs.size()), 1, [this](unsigned first, unsigned last) {
+			for (auto i = first; i < last; ++i)
+			{
+				SetupTriangles(m_SetupJobs[i]);
+			}
+		});
+	}
+	else
+	{
+		for (auto& job : m_SetupJobs)
+		{
+			SetupTriangles(job);
+		}
+	}
+
+	m_Triangles.clear();
+	for (const auto& job : m_SetupJobs)
+	{
+		m_Triangles.insert(m_Triangles.end(), job.Triangles.begin(), job.Triangles.end());
+	}
+	m_Stats.TrianglesRasterized = unsigned(m_Triangles.size());
+
+	// A band of tile rows per thread - no tile is touched by two threads
+	const auto bandsCount = std::min(m_ThreadsCount, TILES_Y);
+	if (bandsCount > 1 && m_Triangles.size() > TRIANGLES_PER_JOB)
+	{
+		const auto rowsPerBand = (TILES_Y + bandsCount - 1) / bandsCount;
+		gJobSystem->ParallelFor("Occluder rasterization", TILES_Y, rowsPerBand, [this](unsigned first, unsigned last) { RasterizeBand(first, last); });
+	}
+	else
+	{
+		RasterizeBand(0, TILES_Y);
+	}
+}
+
+bool OcclusionBuffer::IsVisible(const BoundsHierarchy::Box& box) const
+{
+	float minX = std::numeric_limits<float>::max();
+	float minY = std::numeric_limits<float>::max();
+	float maxX = -std::numeric_limits<float>::max();
+	float maxY = -std::numeric_limits<float>::max();
+	float minZ = std::numeric_limits<float>::max();
+	for (auto corner = 0u; corner < 8; ++corner)
+	{
+		float clip[4];
+		TransformPoint(m_ViewProjection,
+			(corner & 1) ? box.Max[0] : box.Min[0],
+			(corner & 2) ? box.Max[1] : box.Min[1],
+			(corner & 4) ? box.Max[2] : box.Min[2],
+			clip);
+		// Crosses the near plane - nearer than anything in the buffer
+		if (clip[2] < 0 || clip[3] <= 0)
+			return true;
+
+		const float invW = 1.f / clip[3];
+		const float x = (clip[0] * invW * 0.5f + 0.5f) * WIDTH;
+		const float y = (0.5f - clip[1] * invW * 0.5f) * HEIGHT;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, clip[2] * invW);
+	}
+
+	minX = std::max(minX, 0.f);
+	minY = std::max(minY, 0.f);
+	maxX = std::min(maxX, float(WIDTH - 1));
+	maxY = std::min(maxY, float(HEIGHT - 1));
+	// Off screen - nothing of it gets drawn anyway
+	if (minX > maxX || minY > maxY)
+		return false;
+
+	const auto maxTileX = unsigned(maxX) / TILE_WIDTH;
+	const auto maxTileY = unsigned(maxY) / TILE_HEIGHT;
+	for (auto tileY = unsigned(minY) / TILE_HEIGHT; tileY <= maxTileY; ++tileY)
+	{
+		for (auto tileX = unsigned(minX) / TILE_WIDTH; tileX <= maxTileX; ++tileX)
+		{
+			if (minZ <= m_Tiles[tileY * TILES_X + tileX].Depth[0] + DEPTH_BIAS)
+				return true;
+		}
+	}
+	return false;
+}
+
+void OcclusionBuffer::TestBoxes(const BoundsHierarchy::Box* boxes, unsigned count, std::uint8_t* outVisible)
+{
+	auto test = [this, boxes, outVisible](unsigned first, unsigned last) {
+		for (auto i = first; i < last; ++i)
+		{
+			outVisible[i] = IsVisible(boxes[i]) ? 1 : 0;
+		}
+	};
+
+	if (m_ThreadsCount > 1 && count > BOXES_PER_JOB)
+	{
+		gJobSystem->ParallelFor("Occlusion test", count, BOXES_PER_JOB, test);
+	}
+	else
+	{
+		test(0, count);
+	}
+
+	m_Stats.BoxesTested += count;
+	for (auto i = 0u; i < count; ++i)
+	{
+		m_Stats.BoxesOccluded += outVisible[i] ? 0 : 1;
+	}
+}
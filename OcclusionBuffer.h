@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "BoundsHierarchy.h"
+
+// Low resolution CPU depth buffer of a few occluders, for culling before
+// anything is submitted - in the style of masked software occlusion culling.
+// The screen is split in 32x8 pixel tiles. A tile keeps a coverage bit per
+// pixel and two depths: the farthest depth of the whole tile (the reference
+// layer) and the farthest depth of the pixels in the mask (the working
+// layer). When the mask fills up the working layer becomes the reference.
+//
+// Coverage is found 8 rows of a tile at a time with AVX2 (scalar without it,
+// with the same results). The tiles are rasterized in horizontal bands in
+// parallel and every tile sees the triangles in the order they were added,
+// so the result does not depend on the threads count.
+class OcclusionBuffer
+{
+public:
+	static const unsigned WIDTH = 320;
+	static const unsigned HEIGHT = 192;
+	static const unsigned TILE_WIDTH = 32;
+	static const unsigned TILE_HEIGHT = 8;
+	static const unsigned TILES_X = WIDTH / TILE_WIDTH;
+	static const unsigned TILES_Y = HEIGHT / TILE_HEIGHT;
+
+	struct Stats
+	{
+		float GetCullRate() const { return BoxesTested ? float(BoxesOccluded) / BoxesTested : 0.f; }
+
+		unsigned OccluderTriangles;
+		// Left after near plane, frustum and back-of-buffer rejection
+		unsigned TrianglesRasterized;
+		unsigned BoxesTested;
+		unsigned BoxesOccluded;
+	};
+
+	// 0 threads - one per thread of the job system
+	explicit OcclusionBuffer(unsigned threadsCount = 0);
+	~OcclusionBuffer();
+
+	// Clears the buffer. The matrix is a row-vector view-projection, row-major.
+	void Begin(const float* viewProjection);
+	// Positions are xyz per vertex and world a row-vector matrix, row-major.
+	// The arrays are read in Rasterize and must live until then.
+	void AddOccluder(const float* positions, unsigned verticesCount, const std::uint32_t* indices, unsigned indicesCount, const float* world);
+	void Rasterize();
+
+	// False if the box is entirely behind the occluders
+	bool IsVisible(const BoundsHierarchy::Box& box) const;
+	// outVisible[i] gets IsVisible(boxes[i])
+	void TestBoxes(const BoundsHierarchy::Box* boxes, unsigned count, std::uint8_t* outVisible);
+
+	// Farthest occluder depth in the tile - 1 where there is none
+	float GetTileDepth(unsigned tileX, unsigned tileY) const { return m_Tiles[tileY * TILES_X + tileX].Depth[0]; }
+
+	const Stats& GetStats() const { return m_Stats; }
+
+private:
+	struct Occluder
+	{
+		const float* Positions;
+		unsigned VerticesCount;
+		const std::uint32_t* Indices;
+		unsigned IndicesCount;
+		// World-view-projection
+		float Transform[16];
+	};
+
+	struct Triangle
+	{
+		// a * x + b * y + c > 0 inside, per edge
+		float EdgeA[3];
+		float EdgeB[3];
+		float EdgeC[3];
+		// z = ZA * x + ZB * y + ZC
+		float ZA;
+		float ZB;
+		float ZC;
+		float ZMin;
+		float ZMax;
+		float MinX;
+		float MinY;
+		float MaxX;
+		float MaxY;
+		unsigned MinTileX;
+		unsigned MaxTileX;
+		unsigned MinTileY;
+		unsigned MaxTileY;
+	};
+
+	struct Tile
+	{
+		std::uint32_t Mask[TILE_HEIGHT];
+		// Reference and working layer
+		float Depth[2];
+	};
+
+	struct SetupJob
+	{
+		unsigned Occluder;
+		unsigned FirstIndex;
+		unsigned LastIndex;
+		std::vector<Triangle> Triangles;
+	};
+
+	void SetupTriangles(SetupJob& job) const;
+	void RasterizeBand(unsigned firstTileY, unsigned lastTileY);
+	void RasterizeTile(const Triangle& triangle, unsigned tileX, unsigned tileY);
+
+	unsigned m_ThreadsCount;
+	float m_ViewProjection[16];
+	std::vector<Occluder> m_Occluders;
+	std::vector<SetupJob> m_SetupJobs;
+	std::vector<Triangle> m_Triangles;
+	std::vector<Tile> m_Tiles;
+	bool m_UseAVX2;
+
+	Stats m_Stats;
+};
@@ -9,21 +9,28 @@
 
 #include "Transvoxel.inl"
 #include "Scene.h"
-#include "GPUProfiling.h"
+#include "Profiler.h"
+#include "SharedRenderResources.h"
+#include "ProceduralBounds.h"
+#include "ResourceTracking.h"
 
 using namespace DirectX;
 
 struct PerFramePolygonizeBuffer
 {
 	XMFLOAT4 Time;
+	XMFLOAT4 GridExtent;
 };
 
+using ProceduralBounds::POLYGONIZER_GROUP_SIZE;
+
 PolygonizeRoutine::PolygonizeRoutine()
 	: m_TimeSinceStart(0)
 {}
 
 bool PolygonizeRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scene, const DirectX::XMFLOAT4X4& projection)
 {
+	MemoryScope memoryScope(MC_Polygonizer);
 	DxRenderingRoutine::Initialize(renderer);
 		
 	m_Camera = camera;
@@ -55,6 +62,9 @@ bool PolygonizeRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* sc
 		SLOG(Sev_Error, Fac_Rendering, "Unable to create per-frame polygonizer buffer");
 		return false;
 	}
+	TrackResource(m_CellDataBuffer.Get(), MC_Polygonizer);
+	TrackResource(m_VertexDataBuffer.Get(), MC_Polygonizer);
+	TrackResource(m_PerFramePolygonizerBuffer.Get(), MC_Polygonizer);
 
 	const char* toCompile[] = {
 		"../Shaders/PolygonizerHelpers.hlsl",
@@ -109,11 +119,16 @@ ID3D11ComputeShader* PolygonizeRoutine::GetShader(const std::string& generator)
 	// Recompile
 	ShaderManager shaderManager(m_Renderer->GetDevice());
 	ReleaseGuard<ID3DBlob> compiled;
+#ifdef COMPACT_PROCEDURAL_VERTICES
+	const std::string code = "#define COMPACT_VERTICES\n" + generator;
+#else
+	const std::string& code = generator;
+#endif
 	if (!shaderManager.CompileShaderFromFile("../Shaders/Polygonizer.hlsl",
 		"PolygonizerCS",
 		"cs_5_0",
 		compiled.Receive(),
-		generator))
+		code))
 	{
 		SLOG(Sev_Error, Fac_Rendering, "Unable to compile polygonizer shader with generator ", generator);
 		return nullptr;
@@ -128,36 +143,198 @@ ID3D11ComputeShader* PolygonizeRoutine::GetShader(const std::string& generator)
 	return shader;
 }
 
+PositionStream* PolygonizeRoutine::GetPositionStream(GeneratedMesh* mesh)
+{
+	auto& streams = gSharedRenderResources->ProceduralPositions;
+	auto found = streams.find(mesh);
+	if (found != streams.end())
+		return found->second.get();
+
+	// Room for as many vertices as the full vertex buffer
+	D3D11_BUFFER_DESC vbDesc;
+	mesh->GetVertexBuffer()->GetDesc(&vbDesc);
+	const auto verticesCount = vbDesc.ByteWidth / PROCEDURAL_VERTEX_STRIDE;
+
+	std::unique_ptr<PositionStream> stream(new PositionStream);
+	D3D11_BUFFER_DESC desc;
+	::memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = UINT(verticesCount * PROCEDURAL_POSITION_STRIDE);
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_UNORDERED_ACCESS;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+	if (FAILED(m_Renderer->GetDevice()->CreateBuffer(&desc, nullptr, stream->Buffer.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural positions buffer");
+		return nullptr;
+	}
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+	::memset(&uavDesc, 0, sizeof(uavDesc));
+	uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.NumElements = desc.ByteWidth / 4;
+	uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+	if (FAILED(m_Renderer->GetDevice()->CreateUnorderedAccessView(stream->Buffer.Get(), &uavDesc, stream->UAV.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural positions UAV");
+		return nullptr;
+	}
+
+	// float3 offset + float3 scale
+	desc.ByteWidth = 6 * sizeof(float);
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	if (FAILED(m_Renderer->GetDevice()->CreateBuffer(&desc, nullptr, stream->DequantizationBuffer.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural dequantization buffer");
+		return nullptr;
+	}
+	uavDesc.Buffer.NumElements = desc.ByteWidth / 4;
+	if (FAILED(m_Renderer->GetDevice()->CreateUnorderedAccessView(stream->DequantizationBuffer.Get(), &uavDesc, stream->DequantizationUAV.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural dequantization UAV");
+		return nullptr;
+	}
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	::memset(&srvDesc, 0, sizeof(srvDesc));
+	srvDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+	srvDesc.BufferEx.NumElements = desc.ByteWidth / 4;
+	srvDesc.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+	if (FAILED(m_Renderer->GetDevice()->CreateShaderResourceView(stream->DequantizationBuffer.Get(), &srvDesc, stream->DequantizationSRV.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural dequantization SRV");
+		return nullptr;
+	}
+	TrackResource(stream->Buffer.Get(), MC_Polygonizer);
+	TrackResource(stream->DequantizationBuffer.Get(), MC_Polygonizer);
+
+	auto result = stream.get();
+	streams[mesh] = std::move(stream);
+	return result;
+}
+
+PolygonizeRoutine::BoundsStream* PolygonizeRoutine::GetBoundsStream(GeneratedMesh* mesh)
+{
+	auto found = m_Bounds.find(mesh);
+	if (found != m_Bounds.end())
+		return found->second.get();
+
+	std::unique_ptr<BoundsStream> stream(new BoundsStream);
+	D3D11_BUFFER_DESC desc;
+	::memset(&desc, 0, sizeof(desc));
+	desc.ByteWidth = ProceduralBounds::ENCODED_BOUNDS_COUNT * sizeof(std::uint32_t);
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+	if (FAILED(m_Renderer->GetDevice()->CreateBuffer(&desc, nullptr, stream->Buffer.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural bounds buffer");
+		return nullptr;
+	}
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc;
+	::memset(&uavDesc, 0, sizeof(uavDesc));
+	uavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.NumElements = ProceduralBounds::ENCODED_BOUNDS_COUNT;
+	uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+	if (FAILED(m_Renderer->GetDevice()->CreateUnorderedAccessView(stream->Buffer.Get(), &uavDesc, stream->UAV.Receive())))
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural bounds UAV");
+		return nullptr;
+	}
+
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.MiscFlags = 0;
+	for (auto slot = 0u; slot < BoundsStream::READBACK_SLOTS; ++slot)
+	{
+		if (FAILED(m_Renderer->GetDevice()->CreateBuffer(&desc, nullptr, stream->Readback[slot].Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create procedural bounds readback buffer");
+			return nullptr;
+		}
+		stream->ReadbackGeneration[slot] = 0;
+		TrackResource(stream->Readback[slot].Get(), MC_Polygonizer);
+	}
+	TrackResource(stream->Buffer.Get(), MC_Polygonizer);
+
+	auto result = stream.get();
+	m_Bounds[mesh] = std::move(stream);
+	return result;
+}
+
+void PolygonizeRoutine::ReadGeneratedBounds()
+{
+	ID3D11DeviceContext* context = m_Renderer->GetImmediateContext();
+	for (auto& bounds : m_Bounds)
+	{
+		auto& stream = *bounds.second;
+		for (auto slot = 0u; slot < BoundsStream::READBACK_SLOTS; ++slot)
+		{
+			if (!stream.ReadbackGeneration[slot])
+				continue;
+
+			D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+			// DXGI_ERROR_WAS_STILL_DRAWING until the GPU gets to the copy
+			if (FAILED(context->Map(stream.Readback[slot].Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+				continue;
+
+			BoundsHierarchy::Box box;
+			const bool emitted = ProceduralBounds::DecodeGeneratedBounds(static_cast<const std::uint32_t*>(mapped.pData), box);
+			context->Unmap(stream.Readback[slot].Get(), 0);
+
+			m_Scene->ReportGeneratedBounds(bounds.first, stream.ReadbackGeneration[slot], emitted ? &box : nullptr);
+			stream.ReadbackGeneration[slot] = 0;
+		}
+	}
+}
+
 bool PolygonizeRoutine::Render(float deltaTime)
 {
+	MemoryScope memoryScope(MC_Polygonizer);
+	ProfileScope profile(gProfiler, "Polygonize");
 	m_TimeSinceStart += deltaTime;
 
 	ID3D11DeviceContext* context = m_Renderer->GetImmediateContext();
 
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.PolygonizeBegin[gGPUProfiling.CurrentIndex].Get());
-#endif
+	ReadGeneratedBounds();
 
 	const auto& genMeshes = m_Scene->GetMeshesToGenerate();
 	if (genMeshes.size()) {
 		PerFramePolygonizeBuffer pfb;
 		pfb.Time.x = m_TimeSinceStart;
 		pfb.Time.y = deltaTime;
-		context->UpdateSubresource(m_PerFramePolygonizerBuffer.Get(), 0, nullptr, &pfb, 0, 0);
 
 		context->CSSetConstantBuffers(1, 1, m_PerFramePolygonizerBuffer.GetConstPP());
 		context->CSSetSamplers(0, 1, m_LinearSampler.GetConstPP());
 
 		for (auto it = genMeshes.cbegin(); it != genMeshes.cend(); ++it)
 		{
-			auto& mesh = (*it);
+			auto& mesh = it->Mesh;
 			auto shader = GetShader(mesh->GetGeneratingFunction());
+			auto positions = GetPositionStream(mesh.get());
+			auto bounds = GetBoundsStream(mesh.get());
 
-			if (!shader)
+			if (!shader || !positions || !bounds)
 				continue;
 
+			const auto& dispatch = mesh->GetDispatch();
+			pfb.GridExtent = XMFLOAT4(float(dispatch.x * POLYGONIZER_GROUP_SIZE),
+				float(dispatch.y * POLYGONIZER_GROUP_SIZE),
+				float(dispatch.z * POLYGONIZER_GROUP_SIZE),
+				0);
+			context->UpdateSubresource(m_PerFramePolygonizerBuffer.Get(), 0, nullptr, &pfb, 0, 0);
+
 			{
-				ID3D11UnorderedAccessView* uavs[] = { mesh->GetVertexBufferUAV(), mesh->GetIndexBufferUAV(), mesh->GetIndirectBufferUAV(), mesh->GetCountersBufferUAV() };
+				ID3D11UnorderedAccessView* uavs[] = { mesh->GetVertexBufferUAV(),
+					mesh->GetIndexBufferUAV(),
+					mesh->GetIndirectBufferUAV(),
+					mesh->GetCountersBufferUAV(),
+					positions->UAV.Get(),
+					positions->DequantizationUAV.Get(),
+					bounds->UAV.Get() };
 				ID3D11ShaderResourceView* cellSRV[] = { m_CellDataSRV.Get(), m_VertexDataSRV.Get(), m_RandomTexture->GetSHRV() };
 				context->CSSetUnorderedAccessViews(0, _countof(uavs), uavs, nullptr);
 				context->CSSetShaderResources(0, _countof(cellSRV), cellSRV);
@@ -168,27 +345,31 @@ bool PolygonizeRoutine::Render(float deltaTime)
 
 			// Execute
 			context->CSSetShader(shader, nullptr, 0);
-			const auto& dispatch = mesh->GetDispatch();
 			context->Dispatch(dispatch.x, dispatch.y, dispatch.z);
 
 			// Finalize
 			{
-				ID3D11UnorderedAccessView* uavs[] = { mesh->GetIndirectBufferUAV(), nullptr, nullptr, nullptr };
+				ID3D11UnorderedAccessView* uavs[] = { mesh->GetIndirectBufferUAV(), nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
 				ID3D11ShaderResourceView* cellSRV[] = { mesh->GetCountersSRV(), nullptr, nullptr, nullptr };
 				context->CSSetUnorderedAccessViews(0, _countof(uavs), uavs, nullptr);
 				context->CSSetShaderResources(0, _countof(cellSRV), cellSRV);
 			}
 			context->CSSetShader(m_FinalizeCS.Get(), nullptr, 0);
 			context->Dispatch(1, 1, 1);
+
+			// A generation without a free slot is culled by its grid until the next one
+			for (auto slot = 0u; slot < BoundsStream::READBACK_SLOTS; ++slot)
+			{
+				if (bounds->ReadbackGeneration[slot])
+					continue;
+				context->CopyResource(bounds->Readback[slot].Get(), bounds->Buffer.Get());
+				bounds->ReadbackGeneration[slot] = it->BoundsGeneration;
+				break;
+			}
 		}
-		ID3D11UnorderedAccessView* emptyUAV[] = { nullptr, nullptr, nullptr, nullptr };
+		ID3D11UnorderedAccessView* emptyUAV[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
 		context->CSSetUnorderedAccessViews(0, _countof(emptyUAV), emptyUAV, nullptr);
-
-		m_Scene->DidRegenerateAllMeshes();
 	}
 
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.PolygonizeEnd[gGPUProfiling.CurrentIndex].Get());
-#endif
 	return true;
 }
@@ -3,6 +3,8 @@
 #include <Dx11/Rendering/DxRenderingRoutine.h>
 
 class Scene;
+class GeneratedMesh;
+struct PositionStream;
 
 class PolygonizeRoutine : public DxRenderingRoutine
 {
@@ -14,12 +16,30 @@ public:
 	virtual bool Render(float deltaTime) override;
 
 private:
+	// Box of the vertices a mesh emitted and staging copies of it, read a few
+	// frames later without waiting for the GPU
+	struct BoundsStream
+	{
+		static const unsigned READBACK_SLOTS = 3;
+
+		ReleaseGuard<ID3D11Buffer> Buffer;
+		ReleaseGuard<ID3D11UnorderedAccessView> UAV;
+		ReleaseGuard<ID3D11Buffer> Readback[READBACK_SLOTS];
+		// Scene::GetBoundsGeneration of the copy in the slot, 0 for a free slot
+		unsigned ReadbackGeneration[READBACK_SLOTS];
+	};
+
 	ID3D11ComputeShader* GetShader(const std::string& generator);
+	PositionStream* GetPositionStream(GeneratedMesh* mesh);
+	BoundsStream* GetBoundsStream(GeneratedMesh* mesh);
+	// Hands the copies the GPU is done with to the scene
+	void ReadGeneratedBounds();
 
 	ReleaseGuard<ID3D11ComputeShader> m_InitCS;
 	ReleaseGuard<ID3D11ComputeShader> m_FinalizeCS;
 
 	std::unordered_map<std::string, ReleaseGuard<ID3D11ComputeShader>> m_Shaders;
+	std::unordered_map<const GeneratedMesh*, std::unique_ptr<BoundsStream>> m_Bounds;
 
 	ReleaseGuard<ID3D11Buffer> m_CellDataBuffer;
 	ReleaseGuard<ID3D11ShaderResourceView> m_CellDataSRV;
@@ -1,14 +1,11 @@
 #include "precompiled.h"
 
 #include "PresentRoutine.h"
-#include "GPUProfiling.h"
+#include "Profiler.h"
 
 bool PresentRoutine::Render(float deltaTime)
 {
-	auto context = m_Renderer->GetImmediateContext();
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.PresentBegin[gGPUProfiling.CurrentIndex].Get());
-#endif
+	ProfileScope profile(gProfiler, "Present");
 
 	if(FAILED(m_Renderer->GetSwapChain()->Present(m_VSync, 0)))
 	{
@@ -16,8 +13,5 @@ bool PresentRoutine::Render(float deltaTime)
 		return false;
 	}
 
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.PresentEnd[gGPUProfiling.CurrentIndex].Get());
-#endif
 	return true;
 }
@@ -0,0 +1,105 @@
+#include "precompiled.h"
+
+#include "ProceduralBounds.h"
+
+#include <cstdlib>
+
+namespace ProceduralBounds
+{
+
+namespace {
+	// Finds "declaration = " and returns what follows
+	const char* FindInitializer(const std::string& code, const char* declaration)
+	{
+		const auto position = code.find(declaration);
+		if (position == std::string::npos)
+			return nullptr;
+		const auto assignment = code.find('=', position);
+		if (assignment == std::string::npos)
+			return nullptr;
+		return code.c_str() + assignment + 1;
+	}
+
+	bool ParseFloat(const char*& text, float& outValue)
+	{
+		char* end = nullptr;
+		outValue = std::strtof(text, &end);
+		if (end == text)
+			return false;
+		text = end;
+		return true;
+	}
+
+	// Skips white space and the expected character
+	bool Expect(const char*& text, char expected)
+	{
+		while (*text == ' ' || *text == '\t')
+			++text;
+		if (*text != expected)
+			return false;
+		++text;
+		return true;
+	}
+
+	float DecodeFloat(std::uint32_t encoded)
+	{
+		const std::uint32_t bits = (encoded & 0x80000000u) ? (encoded & 0x7FFFFFFFu) : ~encoded;
+		float value;
+		::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+}
+
+bool ComputeGridBounds(const std::string& generator,
+	unsigned dispatchX,
+	unsigned dispatchY,
+	unsigned dispatchZ,
+	BoundsHierarchy::Box& outBox)
+{
+	// static const float3 InitialCoords = float3(x, y, z);
+	const char* coords = FindInitializer(generator, "float3 InitialCoords");
+	if (!coords)
+		return false;
+	while (*coords == ' ' || *coords == '\t')
+		++coords;
+	if (generator.compare(coords - generator.c_str(), 6, "float3") != 0)
+		return false;
+	coords += 6;
+
+	float initial[3];
+	if (!Expect(coords, '(')
+		|| !ParseFloat(coords, initial[0]) || !Expect(coords, ',')
+		|| !ParseFloat(coords, initial[1]) || !Expect(coords, ',')
+		|| !ParseFloat(coords, initial[2]))
+		return false;
+
+	// static const float Step = s;
+	const char* stepText = FindInitializer(generator, "float Step");
+	float step;
+	if (!stepText || !ParseFloat(stepText, step) || step <= 0)
+		return false;
+
+	// The last cell of a dispatch ends a step after the origin of its last thread
+	const unsigned cells[3] = { dispatchX, dispatchY, dispatchZ };
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		outBox.Min[axis] = initial[axis];
+		outBox.Max[axis] = initial[axis] + float(cells[axis] * POLYGONIZER_GROUP_SIZE) * step;
+	}
+	return true;
+}
+
+bool DecodeGeneratedBounds(const std::uint32_t* encoded, BoundsHierarchy::Box& outBox)
+{
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		outBox.Min[axis] = DecodeFloat(encoded[axis]);
+		outBox.Max[axis] = DecodeFloat(encoded[3 + axis]);
+		// Still the cleared values - min at the largest uint, max at 0
+		if (encoded[axis] > encoded[3 + axis])
+			return false;
+	}
+	return true;
+}
+
+}
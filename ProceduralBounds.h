@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "BoundsHierarchy.h"
+
+// Boxes of the generated meshes in the space of their generator. Before a
+// mesh is generated its box is the grid the polygonizer samples the SDF in -
+// every vertex is on an edge of a cell of it. After the first generation
+// Shaders/Polygonizer.hlsl writes the box of the vertices it emitted.
+namespace ProceduralBounds
+{
+	// numthreads of PolygonizerCS - every thread handles a cell
+	static const unsigned POLYGONIZER_GROUP_SIZE = 8;
+
+	// Min xyz and max xyz, as written by the polygonizer
+	static const unsigned ENCODED_BOUNDS_COUNT = 6;
+
+	// The grid of a dispatch of the generator - InitialCoords and Step are
+	// read from its code. False if the code doesn't declare them.
+	bool ComputeGridBounds(const std::string& generator,
+		unsigned dispatchX,
+		unsigned dispatchY,
+		unsigned dispatchZ,
+		BoundsHierarchy::Box& outBox);
+
+	// The floats are stored as uints that sort like them, so that the
+	// polygonizer can use atomic min and max. False if no vertex was emitted.
+	bool DecodeGeneratedBounds(const std::uint32_t* encoded, BoundsHierarchy::Box& outBox);
+}
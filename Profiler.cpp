@@ -0,0 +1,217 @@
+#include "precompiled.h"
+
+#include "Profiler.h"
+
+#include <cassert>
+
+Profiler* gProfiler = nullptr;
+
+namespace {
+	// Every scope has a timestamp at its beginning and one at its end
+	inline unsigned BeginQuery(unsigned scope) { return scope * 2; }
+	inline unsigned EndQuery(unsigned scope) { return scope * 2 + 1; }
+}
+
+Profiler::Profiler(ProfilerBackend* backend, unsigned framesCount)
+	: m_Backend(backend)
+	, m_Frames(framesCount)
+	, m_NextFrameId(1)
+	, m_NextCollectedId(1)
+	, m_Current(framesCount)
+	, m_Epoch(Clock::now())
+	, m_Timestamps(EndQuery(MAX_SCOPES - 1) + 1)
+{
+	assert(framesCount && "The profiler needs at least one frame");
+
+	for (auto& frame : m_Frames)
+	{
+		frame.Id = 0;
+		frame.Pending = false;
+		frame.Scopes.reserve(MAX_SCOPES);
+	}
+	m_Open.reserve(MAX_SCOPES);
+
+	m_LastFrame.FrameId = 0;
+	m_LastFrame.HasGPUTimes = false;
+	m_LastFrame.Scopes.reserve(MAX_SCOPES);
+
+	m_Stats = Stats();
+}
+
+bool Profiler::Initialize()
+{
+	if (!m_Backend)
+		return true;
+
+	return m_Backend->Initialize(unsigned(m_Frames.size()), unsigned(m_Timestamps.size()));
+}
+
+void Profiler::BeginFrame()
+{
+	assert(m_Current == m_Frames.size() && "The last frame wasn't ended");
+
+	m_Current = unsigned(m_NextFrameId % m_Frames.size());
+	auto& frame = m_Frames[m_Current];
+	if (frame.Pending)
+	{
+		// The GPU is more than a whole ring behind - waiting for it would
+		// stall the frame being profiled
+		++m_Stats.FramesDropped;
+	}
+	frame.Id = m_NextFrameId++;
+	frame.Pending = false;
+	frame.Scopes.clear();
+
+	if (m_Backend)
+	{
+		m_Backend->BeginFrame(m_Current);
+	}
+	BeginScope("Frame");
+}
+
+void Profiler::EndFrame()
+{
+	assert(m_Current != m_Frames.size() && "No frame to end");
+	assert(m_Open.size() == 1 && "Scopes left open at the end of the frame");
+
+	while (!m_Open.empty())
+	{
+		EndScope();
+	}
+	if (m_Backend)
+	{
+		m_Backend->EndFrame(m_Current);
+	}
+	m_Frames[m_Current].Pending = true;
+	m_Current = unsigned(m_Frames.size());
+
+	Collect();
+}
+
+void Profiler::BeginScope(const char* name)
+{
+	if (m_Current == m_Frames.size())
+	{
+		m_Open.push_back(unsigned(NO_PARENT));
+		return;
+	}
+
+	auto& scopes = m_Frames[m_Current].Scopes;
+	if (scopes.size() == MAX_SCOPES)
+	{
+		++m_Stats.ScopesDropped;
+		m_Open.push_back(unsigned(NO_PARENT));
+		return;
+	}
+
+	// Scopes inside one that isn't timed hang from its closest timed parent
+	auto parent = NO_PARENT;
+	for (auto open = m_Open.rbegin(); open != m_Open.rend(); ++open)
+	{
+		if (*open != NO_PARENT)
+		{
+			parent = *open;
+			break;
+		}
+	}
+
+	const auto index = unsigned(scopes.size());
+	Scope scope;
+	scope.Name = name;
+	scope.Parent = parent;
+	scope.Depth = parent == NO_PARENT ? 0 : scopes[parent].Depth + 1;
+	scope.CPUBegin = Clock::now();
+	scope.CPUEnd = scope.CPUBegin;
+	scopes.push_back(scope);
+	m_Open.push_back(index);
+
+	if (m_Backend)
+	{
+		m_Backend->WriteTimestamp(m_Current, BeginQuery(index));
+	}
+}
+
+void Profiler::EndScope()
+{
+	assert(!m_Open.empty() && "No scope to end");
+
+	const auto index = m_Open.back();
+	m_Open.pop_back();
+	if (index == NO_PARENT || m_Current == m_Frames.size())
+		return;
+
+	if (m_Backend)
+	{
+		m_Backend->WriteTimestamp(m_Current, EndQuery(index));
+	}
+	m_Frames[m_Current].Scopes[index].CPUEnd = Clock::now();
+}
+
+void Profiler::Collect()
+{
+	while (m_NextCollectedId < m_NextFrameId)
+	{
+		const auto slot = unsigned(m_NextCollectedId % m_Frames.size());
+		const auto& frame = m_Frames[slot];
+		// Dropped when its slot was reused
+		const auto dropped = frame.Id != m_NextCollectedId || !frame.Pending;
+		if (!dropped && !Resolve(slot))
+			break;
+
+		++m_NextCollectedId;
+	}
+}
+
+bool Profiler::Resolve(unsigned slot)
+{
+	auto& frame = m_Frames[slot];
+	const auto queriesCount = EndQuery(unsigned(frame.Scopes.size()) - 1) + 1;
+
+	std::uint64_t frequency = 0;
+	bool disjoint = false;
+	if (m_Backend && !m_Backend->ReadFrame(slot, queriesCount, m_Timestamps.data(), frequency, disjoint))
+		return false;
+
+	m_LastFrame.FrameId = frame.Id;
+	m_LastFrame.HasGPUTimes = m_Backend && !disjoint && frequency;
+	m_LastFrame.Scopes.clear();
+
+	const auto ticksToMs = m_LastFrame.HasGPUTimes ? 1000.0 / double(frequency) : 0.0;
+	const auto frameBegin = m_Timestamps[BeginQuery(0)];
+	for (auto index = 0u; index < frame.Scopes.size(); ++index)
+	{
+		const auto& scope = frame.Scopes[index];
+		ScopeResult result;
+		result.Name = scope.Name;
+		result.Parent = scope.Parent;
+		result.Depth = scope.Depth;
+		result.CPUBegin = ToMilliseconds(scope.CPUBegin);
+		result.CPUDuration = ToMilliseconds(scope.CPUEnd) - result.CPUBegin;
+		result.GPUBegin = 0.0;
+		result.GPUDuration = 0.0;
+		if (m_LastFrame.HasGPUTimes)
+		{
+			const auto begin = m_Timestamps[BeginQuery(index)];
+			const auto end = m_Timestamps[EndQuery(index)];
+			result.GPUBegin = double(std::int64_t(begin - frameBegin)) * ticksToMs;
+			result.GPUDuration = double(end - begin) * ticksToMs;
+		}
+		m_LastFrame.Scopes.push_back(result);
+	}
+
+	frame.Pending = false;
+	++m_Stats.FramesCollected;
+	return true;
+}
+
+double Profiler::ToMilliseconds(Clock::time_point time) const
+{
+	return std::chrono::duration<double, std::milli>(time - m_Epoch).count();
+}
+
+Profiler::Stats Profiler::ResetStats()
+{
+	const auto stats = m_Stats;
+	m_Stats = Stats();
+	return stats;
+}
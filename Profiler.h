@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+// GPU timestamps of the profiler. Each frame in flight has its own queries,
+// so writing the next frames doesn't wait for the GPU to finish the last
+// ones.
+class ProfilerBackend
+{
+public:
+	virtual ~ProfilerBackend() {}
+
+	// Room for framesCount frames in flight of queriesCount timestamps each
+	virtual bool Initialize(unsigned framesCount, unsigned queriesCount) = 0;
+
+	virtual void BeginFrame(unsigned frame) = 0;
+	virtual void EndFrame(unsigned frame) = 0;
+	virtual void WriteTimestamp(unsigned frame, unsigned query) = 0;
+	// Never waits - false while the GPU hasn't reached the end of the frame.
+	// Ticks of the first queriesCount timestamps of the frame, frequency in
+	// ticks per second.
+	virtual bool ReadFrame(unsigned frame,
+		unsigned queriesCount,
+		std::uint64_t* outTimestamps,
+		std::uint64_t& outFrequency,
+		bool& outDisjoint) = 0;
+};
+
+// Nested named scopes timed on the CPU and, with a backend, on the GPU. The
+// timings of a frame are read back framesCount frames later at the latest -
+// if the GPU falls further behind the frame is dropped rather than waited
+// for. The frame itself is the first scope.
+//
+// Scopes are opened and closed on the thread that begins and ends the
+// frames. Scope names must outlive the profiler - string literals.
+class Profiler
+{
+public:
+	// Per frame, including the frame itself - the rest are not timed
+	static const unsigned MAX_SCOPES = 64;
+	static const unsigned NO_PARENT = ~0u;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct ScopeResult
+	{
+		const char* Name;
+		unsigned Parent;
+		unsigned Depth;
+		// Milliseconds since GetEpoch
+		double CPUBegin;
+		double CPUDuration;
+		// Milliseconds since the beginning of the frame on the GPU
+		double GPUBegin;
+		double GPUDuration;
+	};
+
+	struct FrameResult
+	{
+		// 0 before the timings of the first frame come back
+		std::uint64_t FrameId;
+		// False without a backend and for disjoint timestamps
+		bool HasGPUTimes;
+		// In the order they were opened
+		std::vector<ScopeResult> Scopes;
+	};
+
+	struct Stats
+	{
+		unsigned FramesCollected;
+		// The GPU didn't get to them in time
+		unsigned FramesDropped;
+		unsigned ScopesDropped;
+	};
+
+	// backend can be nullptr - the CPU times only
+	Profiler(ProfilerBackend* backend, unsigned framesCount);
+
+	bool Initialize();
+
+	void BeginFrame();
+	void EndFrame();
+
+	// Outside of a frame the scope isn't timed
+	void BeginScope(const char* name);
+	void EndScope();
+
+	const FrameResult& GetLastFrame() const { return m_LastFrame; }
+	// When the profiler was created
+	Clock::time_point GetEpoch() const { return m_Epoch; }
+	// Counters since the last call
+	Stats ResetStats();
+
+private:
+	struct Scope
+	{
+		const char* Name;
+		unsigned Parent;
+		unsigned Depth;
+		Clock::time_point CPUBegin;
+		Clock::time_point CPUEnd;
+	};
+	struct Frame
+	{
+		std::uint64_t Id;
+		// Ended and not read back yet
+		bool Pending;
+		std::vector<Scope> Scopes;
+	};
+
+	// Reads back the ended frames, oldest first, until one isn't ready
+	void Collect();
+	bool Resolve(unsigned slot);
+	double ToMilliseconds(Clock::time_point time) const;
+
+	ProfilerBackend* m_Backend;
+	std::vector<Frame> m_Frames;
+	std::uint64_t m_NextFrameId;
+	// Oldest frame not read back or dropped yet
+	std::uint64_t m_NextCollectedId;
+	// Of the frame being written, m_Frames.size() between frames
+	unsigned m_Current;
+	// Scopes open, NO_PARENT for the ones not timed
+	std::vector<unsigned> m_Open;
+
+	Clock::time_point m_Epoch;
+	std::vector<std::uint64_t> m_Timestamps;
+	FrameResult m_LastFrame;
+	Stats m_Stats;
+};
+
+// Times a scope of the profiler, which can be nullptr
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler* profiler, const char* name)
+		: m_Profiler(profiler)
+	{
+		if (m_Profiler)
+		{
+			m_Profiler->BeginScope(name);
+		}
+	}
+	~ProfileScope()
+	{
+		if (m_Profiler)
+		{
+			m_Profiler->EndScope();
+		}
+	}
+
+private:
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator=(const ProfileScope&);
+
+	Profiler* m_Profiler;
+};
+
+// Set by the application - the profiler of the rendering thread
+extern Profiler* gProfiler;
@@ -0,0 +1,400 @@
+#include "precompiled.h"
+
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <cstring>
+
+namespace {
+	inline size_t AlignUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	// Bindings the device treats as outputs - they can't coexist with any
+	// other binding of the same resource
+	inline bool IsOutput(RenderGraph::BindKind kind)
+	{
+		return kind == RenderGraph::BK_UnorderedAccess
+			|| kind == RenderGraph::BK_RenderTarget
+			|| kind == RenderGraph::BK_DepthStencil;
+	}
+
+	inline bool IsOutputMerger(RenderGraph::BindKind kind)
+	{
+		return kind == RenderGraph::BK_RenderTarget || kind == RenderGraph::BK_DepthStencil;
+	}
+
+	// Same slot - binding one replaces the other
+	inline bool IsSameSlot(const RenderGraph::Binding& lhs, const RenderGraph::Binding& rhs)
+	{
+		if (lhs.Kind != rhs.Kind)
+			return false;
+		if (IsOutputMerger(lhs.Kind))
+			return lhs.Kind == RenderGraph::BK_DepthStencil || lhs.Slot == rhs.Slot;
+		return lhs.Stage == rhs.Stage && lhs.Slot == rhs.Slot;
+	}
+}
+
+void RenderGraph::Clear()
+{
+	m_Resources.clear();
+	m_Passes.clear();
+	m_Compiled.clear();
+	m_Error.clear();
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+RenderGraph::ResourceId RenderGraph::CreateResource(const ResourceDesc& desc)
+{
+	Resource resource = { desc, false, 0 };
+	resource.Desc.Alignment = std::max<size_t>(desc.Alignment, 1);
+	m_Resources.push_back(resource);
+	return ResourceId(m_Resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::ImportResource(const std::string& name, ResourceKind kind)
+{
+	ResourceDesc desc = { name, kind, 0, 1 };
+	Resource resource = { desc, true, 0 };
+	m_Resources.push_back(resource);
+	return ResourceId(m_Resources.size() - 1);
+}
+
+RenderGraph::PassId RenderGraph::AddPass(const std::string& name, bool hasSideEffects)
+{
+	Pass pass;
+	pass.Name = name;
+	pass.HasSideEffects = hasSideEffects;
+	m_Passes.push_back(pass);
+	return PassId(m_Passes.size() - 1);
+}
+
+void RenderGraph::Read(PassId pass, ResourceId resource, const Binding& binding)
+{
+	AddUsage(pass, resource, binding, false);
+}
+
+void RenderGraph::Write(PassId pass, ResourceId resource, const Binding& binding)
+{
+	AddUsage(pass, resource, binding, true);
+}
+
+void RenderGraph::AddUsage(PassId pass, ResourceId resource, const Binding& binding, bool write)
+{
+	Usage usage = { resource, binding, write };
+	m_Passes[pass].Usages.push_back(usage);
+}
+
+bool RenderGraph::Compile()
+{
+	m_Compiled.clear();
+	m_Error.clear();
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+
+	std::vector<std::vector<PassId>> dependencies;
+	std::vector<PassId> order;
+	if (!SortPasses(dependencies, order))
+		return false;
+
+	CullPasses(dependencies, order);
+	FindUnbinds();
+	PlaceTransients();
+	return true;
+}
+
+bool RenderGraph::SortPasses(std::vector<std::vector<PassId>>& outDependencies, std::vector<PassId>& outOrder)
+{
+	const auto passesCount = PassId(m_Passes.size());
+
+	// Writers of every resource in the order they were added
+	std::vector<std::vector<PassId>> writers(m_Resources.size());
+	std::vector<std::vector<PassId>> readers(m_Resources.size());
+	for (auto pass = 0u; pass < passesCount; ++pass)
+	{
+		for (const auto& usage : m_Passes[pass].Usages)
+		{
+			auto& users = usage.Write ? writers[usage.Resource] : readers[usage.Resource];
+			if (users.empty() || users.back() != pass)
+			{
+				users.push_back(pass);
+			}
+		}
+	}
+
+	// A writer waits for the previous writer, a reader for the last one
+	outDependencies.assign(passesCount, std::vector<PassId>());
+	for (auto resource = 0u; resource < m_Resources.size(); ++resource)
+	{
+		const auto& resourceWriters = writers[resource];
+		if (resourceWriters.empty())
+			continue;
+
+		for (auto i = 1u; i < resourceWriters.size(); ++i)
+		{
+			outDependencies[resourceWriters[i]].push_back(resourceWriters[i - 1]);
+		}
+		for (const auto reader : readers[resource])
+		{
+			if (std::find(resourceWriters.begin(), resourceWriters.end(), reader) == resourceWriters.end())
+			{
+				outDependencies[reader].push_back(resourceWriters.back());
+			}
+		}
+	}
+
+	std::vector<unsigned> pendingCount(passesCount);
+	std::vector<std::vector<PassId>> dependents(passesCount);
+	for (auto pass = 0u; pass < passesCount; ++pass)
+	{
+		auto& passDependencies = outDependencies[pass];
+		std::sort(passDependencies.begin(), passDependencies.end());
+		passDependencies.erase(std::unique(passDependencies.begin(), passDependencies.end()), passDependencies.end());
+
+		pendingCount[pass] = unsigned(passDependencies.size());
+		for (const auto dependency : passDependencies)
+		{
+			dependents[dependency].push_back(pass);
+		}
+	}
+
+	// Of the passes that can run, the one added first goes first
+	std::priority_queue<PassId, std::vector<PassId>, std::greater<PassId>> ready;
+	for (auto pass = 0u; pass < passesCount; ++pass)
+	{
+		if (!pendingCount[pass])
+		{
+			ready.push(pass);
+		}
+	}
+
+	outOrder.clear();
+	while (!ready.empty())
+	{
+		const auto pass = ready.top();
+		ready.pop();
+		outOrder.push_back(pass);
+		for (const auto dependent : dependents[pass])
+		{
+			if (!--pendingCount[dependent])
+			{
+				ready.push(dependent);
+			}
+		}
+	}
+
+	if (outOrder.size() != passesCount)
+	{
+		m_Error = "Passes depend on each other in a cycle:";
+		for (auto pass = 0u; pass < passesCount; ++pass)
+		{
+			if (pendingCount[pass])
+			{
+				m_Error += " " + m_Passes[pass].Name;
+			}
+		}
+		return false;
+	}
+	return true;
+}
+
+void RenderGraph::CullPasses(const std::vector<std::vector<PassId>>& dependencies, const std::vector<PassId>& order)
+{
+	std::vector<bool> live(m_Passes.size(), false);
+	for (auto pass = 0u; pass < m_Passes.size(); ++pass)
+	{
+		live[pass] = m_Passes[pass].HasSideEffects;
+		for (const auto& usage : m_Passes[pass].Usages)
+		{
+			if (usage.Write && m_Resources[usage.Resource].Imported)
+			{
+				live[pass] = true;
+			}
+		}
+	}
+
+	// Dependencies come earlier in the order - one sweep back reaches them all
+	for (auto it = order.rbegin(); it != order.rend(); ++it)
+	{
+		if (!live[*it])
+			continue;
+		for (const auto dependency : dependencies[*it])
+		{
+			live[dependency] = true;
+		}
+	}
+
+	for (const auto pass : order)
+	{
+		if (!live[pass])
+			continue;
+		CompiledPass compiled;
+		compiled.Pass = pass;
+		m_Compiled.push_back(compiled);
+	}
+	m_Stats.PassesCount = unsigned(m_Compiled.size());
+	m_Stats.PassesCulled = unsigned(m_Passes.size() - m_Compiled.size());
+}
+
+void RenderGraph::FindUnbinds()
+{
+	// The frame repeats - whatever the last passes leave bound is there when
+	// the first ones run, so the second time through is the steady state
+	std::vector<Bound> bound;
+	for (auto frame = 0u; frame < 2; ++frame)
+	{
+		const bool record = frame == 1;
+		for (auto& compiled : m_Compiled)
+		{
+			const auto& pass = m_Passes[compiled.Pass];
+
+			// Setting the render targets replaces all of them
+			const bool setsOutputMerger = std::any_of(pass.Usages.begin(), pass.Usages.end(),
+				[](const Usage& usage) { return IsOutputMerger(usage.Bind.Kind); });
+			if (setsOutputMerger)
+			{
+				bound.erase(std::remove_if(bound.begin(), bound.end(),
+					[](const Bound& entry) { return IsOutputMerger(entry.Bind.Kind); }), bound.end());
+			}
+
+			for (const auto& usage : pass.Usages)
+			{
+				if (usage.Bind.Kind == BK_None)
+					continue;
+
+				for (auto it = bound.begin(); it != bound.end();)
+				{
+					const bool clashes = it->Resource == usage.Resource
+						&& !IsSameSlot(it->Bind, usage.Bind)
+						&& (IsOutput(it->Bind.Kind) || IsOutput(usage.Bind.Kind));
+					if (!clashes)
+					{
+						++it;
+						continue;
+					}
+
+					if (record)
+					{
+						Unbind unbind = { it->Bind, it->Resource };
+						compiled.Unbinds.push_back(unbind);
+					}
+					// Render targets and depth are unbound together
+					if (IsOutputMerger(it->Bind.Kind))
+					{
+						bound.erase(std::remove_if(bound.begin(), bound.end(),
+							[](const Bound& entry) { return IsOutputMerger(entry.Bind.Kind); }), bound.end());
+						it = bound.begin();
+					}
+					else
+					{
+						it = bound.erase(it);
+					}
+				}
+			}
+
+			// The pass's bindings replace whatever was in their slots and stay
+			// after it - passes don't clean up
+			for (const auto& usage : pass.Usages)
+			{
+				if (usage.Bind.Kind == BK_None)
+					continue;
+
+				bound.erase(std::remove_if(bound.begin(), bound.end(),
+					[&usage](const Bound& entry) { return IsSameSlot(entry.Bind, usage.Bind); }), bound.end());
+				Bound entry = { usage.Bind, usage.Resource, usage.Write };
+				bound.push_back(entry);
+			}
+		}
+	}
+
+	for (const auto& compiled : m_Compiled)
+	{
+		m_Stats.UnbindsCount += unsigned(compiled.Unbinds.size());
+	}
+}
+
+void RenderGraph::PlaceTransients()
+{
+	struct Lifetime
+	{
+		ResourceId Resource;
+		unsigned First;
+		unsigned Last;
+	};
+
+	// First and last compiled pass using each transient
+	std::vector<Lifetime> lifetimes;
+	std::vector<unsigned> lifetimeOf(m_Resources.size(), ~0u);
+	for (auto index = 0u; index < m_Compiled.size(); ++index)
+	{
+		for (const auto& usage : m_Passes[m_Compiled[index].Pass].Usages)
+		{
+			if (m_Resources[usage.Resource].Imported)
+				continue;
+
+			auto& lifetime = lifetimeOf[usage.Resource];
+			if (lifetime == ~0u)
+			{
+				lifetime = unsigned(lifetimes.size());
+				Lifetime added = { usage.Resource, index, index };
+				lifetimes.push_back(added);
+			}
+			lifetimes[lifetime].Last = index;
+		}
+	}
+
+	// Biggest first, each at the lowest offset clear of the placed ones
+	// alive at the same time
+	std::sort(lifetimes.begin(), lifetimes.end(), [this](const Lifetime& lhs, const Lifetime& rhs) {
+		const auto lhsSize = m_Resources[lhs.Resource].Desc.Size;
+		const auto rhsSize = m_Resources[rhs.Resource].Desc.Size;
+		return lhsSize != rhsSize ? lhsSize > rhsSize : lhs.Resource < rhs.Resource;
+	});
+
+	for (auto& resource : m_Resources)
+	{
+		resource.Offset = 0;
+	}
+
+	std::vector<const Lifetime*> placed;
+	std::vector<const Lifetime*> overlapping;
+	std::vector<size_t> candidates;
+	for (const auto& lifetime : lifetimes)
+	{
+		auto& resource = m_Resources[lifetime.Resource];
+		const auto& desc = resource.Desc;
+
+		overlapping.clear();
+		candidates.assign(1, 0);
+		for (const auto other : placed)
+		{
+			if (m_Resources[other->Resource].Desc.Kind != desc.Kind
+				|| other->Last < lifetime.First || other->First > lifetime.Last)
+				continue;
+			overlapping.push_back(other);
+			const auto& otherResource = m_Resources[other->Resource];
+			candidates.push_back(AlignUp(otherResource.Offset + otherResource.Desc.Size, desc.Alignment));
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		for (const auto offset : candidates)
+		{
+			const bool fits = std::none_of(overlapping.begin(), overlapping.end(), [this, offset, &desc](const Lifetime* other) {
+				const auto& otherResource = m_Resources[other->Resource];
+				return offset < otherResource.Offset + otherResource.Desc.Size
+					&& otherResource.Offset < offset + desc.Size;
+			});
+			if (fits)
+			{
+				resource.Offset = offset;
+				break;
+			}
+		}
+		placed.push_back(&lifetime);
+
+		m_Stats.TransientMemory[desc.Kind] = std::max(m_Stats.TransientMemory[desc.Kind], resource.Offset + desc.Size);
+		m_Stats.TransientMemoryUnaliased[desc.Kind] += desc.Size;
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#include "CommandStream.h"
+
+// The passes of a frame and the resources they read and write. Compile
+// orders the passes, drops the ones nothing visible depends on, works out
+// which bindings have to be removed before a pass can bind its resources and
+// places the transient resources in shared memory where their lifetimes
+// don't overlap. Nothing here touches a device - the application turns the
+// compiled passes into routines and unbind calls.
+//
+// Every writer of a resource runs before its readers, writers in the order
+// they were added. Passes with side effects and passes writing imported
+// resources are kept, and so is every pass they depend on.
+class RenderGraph
+{
+public:
+	typedef unsigned ResourceId;
+	typedef unsigned PassId;
+
+	enum ResourceKind
+	{
+		RK_Buffer = 0,
+		RK_Texture,
+
+		RK_Count
+	};
+
+	// How a pass binds a resource. BK_None only orders the passes - the pass
+	// binds and unbinds the resource itself.
+	enum BindKind
+	{
+		BK_None = 0,
+		BK_ShaderResource,
+		BK_UnorderedAccess,
+		BK_RenderTarget,
+		BK_DepthStencil,
+	};
+
+	struct Binding
+	{
+		Binding()
+			: Kind(BK_None)
+			, Stage(CommandStream::SS_Pixel)
+			, Slot(0)
+		{}
+		Binding(BindKind kind, CommandStream::ShaderStage stage, unsigned slot)
+			: Kind(kind)
+			, Stage(stage)
+			, Slot(slot)
+		{}
+
+		BindKind Kind;
+		// Ignored for render targets and depth
+		CommandStream::ShaderStage Stage;
+		unsigned Slot;
+	};
+
+	struct ResourceDesc
+	{
+		std::string Name;
+		ResourceKind Kind;
+		size_t Size;
+		size_t Alignment;
+	};
+
+	// A binding left by an earlier pass that clashes with one of the pass
+	struct Unbind
+	{
+		Binding Bound;
+		ResourceId Resource;
+	};
+
+	struct CompiledPass
+	{
+		PassId Pass;
+		// To remove before the pass runs
+		std::vector<Unbind> Unbinds;
+	};
+
+	struct Stats
+	{
+		unsigned PassesCount;
+		unsigned PassesCulled;
+		unsigned UnbindsCount;
+		// Memory of the transient resources placed with aliasing and without
+		size_t TransientMemory[RK_Count];
+		size_t TransientMemoryUnaliased[RK_Count];
+	};
+
+	void Clear();
+
+	// Created for the frame - aliased with other transients
+	ResourceId CreateResource(const ResourceDesc& desc);
+	// Lives outside the graph - never aliased, writing it is an output
+	ResourceId ImportResource(const std::string& name, ResourceKind kind);
+
+	PassId AddPass(const std::string& name, bool hasSideEffects = false);
+	void Read(PassId pass, ResourceId resource, const Binding& binding = Binding());
+	void Write(PassId pass, ResourceId resource, const Binding& binding = Binding());
+
+	// False if the passes depend on each other in a cycle
+	bool Compile();
+
+	// Live passes in execution order
+	const std::vector<CompiledPass>& GetCompiledPasses() const { return m_Compiled; }
+	// Offset of a transient resource in the memory of its kind, 0 for the rest
+	size_t GetPlacement(ResourceId resource) const { return m_Resources[resource].Offset; }
+	const std::string& GetPassName(PassId pass) const { return m_Passes[pass].Name; }
+	const std::string& GetResourceName(ResourceId resource) const { return m_Resources[resource].Desc.Name; }
+	const std::string& GetError() const { return m_Error; }
+	const Stats& GetStats() const { return m_Stats; }
+
+private:
+	struct Resource
+	{
+		ResourceDesc Desc;
+		bool Imported;
+		size_t Offset;
+	};
+	struct Usage
+	{
+		ResourceId Resource;
+		Binding Bind;
+		bool Write;
+	};
+	struct Pass
+	{
+		std::string Name;
+		bool HasSideEffects;
+		std::vector<Usage> Usages;
+	};
+	// A binding the device holds between passes
+	struct Bound
+	{
+		Binding Bind;
+		ResourceId Resource;
+		bool Write;
+	};
+
+	void AddUsage(PassId pass, ResourceId resource, const Binding& binding, bool write);
+	bool SortPasses(std::vector<std::vector<PassId>>& outDependencies, std::vector<PassId>& outOrder);
+	void CullPasses(const std::vector<std::vector<PassId>>& dependencies, const std::vector<PassId>& order);
+	void FindUnbinds();
+	void PlaceTransients();
+
+	std::vector<Resource> m_Resources;
+	std::vector<Pass> m_Passes;
+
+	std::vector<CompiledPass> m_Compiled;
+	std::string m_Error;
+	Stats m_Stats;
+};
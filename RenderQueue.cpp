@@ -0,0 +1,112 @@
+#include "precompiled.h"
+
+#include "RenderQueue.h"
+#include "JobSystem.h"
+#include "FrameArena.h"
+
+namespace SortKey
+{
+
+unsigned QuantizeDepth(float viewDepth, float farPlane)
+{
+	static const float MAX_DEPTH = float((1u << DEPTH_BITS) - 1);
+	const float normalized = farPlane > 0 ? viewDepth / farPlane : 0.f;
+	return unsigned(std::min(std::max(normalized, 0.f), 1.f) * MAX_DEPTH);
+}
+
+}
+
+void RadixSort(std::vector<RenderQueueEntry>& entries, std::vector<RenderQueueEntry>& scratch)
+{
+	static const unsigned RADIX_BITS = 8;
+	static const unsigned BUCKETS = 1 << RADIX_BITS;
+	static const unsigned PASSES = 64 / RADIX_BITS;
+
+	const auto count = entries.size();
+	if (count < 2)
+		return;
+
+	// All histograms are gathered in a single read of the keys
+	auto& arena = FrameArena::GetThreadArena();
+	ScopedRewind rewind(arena);
+	std::uint32_t* histograms = arena.Allocate<std::uint32_t>(PASSES * BUCKETS);
+	std::fill(histograms, histograms + PASSES * BUCKETS, 0u);
+	for (const auto& entry : entries)
+	{
+		for (auto pass = 0u; pass < PASSES; ++pass)
+		{
+			++histograms[pass * BUCKETS + ((entry.Key >> (pass * RADIX_BITS)) & (BUCKETS - 1))];
+		}
+	}
+
+	scratch.resize(count);
+	RenderQueueEntry* src = entries.data();
+	RenderQueueEntry* dst = scratch.data();
+	for (auto pass = 0u; pass < PASSES; ++pass)
+	{
+		std::uint32_t* histogram = &histograms[pass * BUCKETS];
+		const auto shift = pass * RADIX_BITS;
+		// Every key has the same byte here - nothing to reorder
+		if (histogram[(src[0].Key >> shift) & (BUCKETS - 1)] == count)
+			continue;
+
+		std::uint32_t offset = 0;
+		for (auto bucket = 0u; bucket < BUCKETS; ++bucket)
+		{
+			const auto bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			dst[histogram[(src[i].Key >> shift) & (BUCKETS - 1)]++] = src[i];
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != entries.data())
+	{
+		std::copy(src, src + count, entries.data());
+	}
+}
+
+void RenderQueue::Clear()
+{
+	m_Entries.clear();
+}
+
+void RenderQueue::Build(std::uint32_t itemsCount, const KeyFunc& makeKey)
+{
+	static const std::uint32_t ITEMS_PER_TASK = 2048;
+
+	m_Entries.resize(itemsCount);
+
+	gJobSystem->ParallelFor("Render queue keys", itemsCount, ITEMS_PER_TASK, [this, &makeKey](unsigned first, unsigned last) {
+		for (auto item = first; item < last; ++item)
+		{
+			m_Entries[item].Key = makeKey(item);
+			m_Entries[item].Item = item;
+		}
+	});
+
+	RadixSort(m_Entries, m_Scratch);
+}
+
+RenderQueue::Stats RenderQueue::ComputeStats() const
+{
+	Stats stats;
+	stats.Entries = unsigned(m_Entries.size());
+	stats.ShaderChanges = 0;
+	stats.TextureChanges = 0;
+
+	std::uint64_t lastKey = ~std::uint64_t(0);
+	for (const auto& entry : m_Entries)
+	{
+		if (lastKey == ~std::uint64_t(0) || SortKey::GetShaderVariant(entry.Key) != SortKey::GetShaderVariant(lastKey))
+			++stats.ShaderChanges;
+		if (lastKey == ~std::uint64_t(0) || SortKey::GetTextureSet(entry.Key) != SortKey::GetTextureSet(lastKey))
+			++stats.TextureChanges;
+		lastKey = entry.Key;
+	}
+	return stats;
+}
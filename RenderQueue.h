@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+// Draws are ordered by a packed 64-bit key. From the most significant bits down:
+// | pass (4) | alpha mode (2) | shader variant (12) | texture set (16) | depth (24) | unused (6) |
+// so a sorted queue has all draws of a pass together, opaque before alpha masked,
+// then as few shader and texture changes as possible and finally front to back.
+namespace SortKey
+{
+	enum AlphaMode
+	{
+		AM_Opaque = 0,
+		AM_AlphaMasked = 1,
+	};
+
+	static const unsigned PASS_BITS = 4;
+	static const unsigned ALPHA_BITS = 2;
+	static const unsigned SHADER_BITS = 12;
+	static const unsigned TEXTURES_BITS = 16;
+	static const unsigned DEPTH_BITS = 24;
+
+	static const unsigned DEPTH_SHIFT = 6;
+	static const unsigned TEXTURES_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+	static const unsigned SHADER_SHIFT = TEXTURES_SHIFT + TEXTURES_BITS;
+	static const unsigned ALPHA_SHIFT = SHADER_SHIFT + SHADER_BITS;
+	static const unsigned PASS_SHIFT = ALPHA_SHIFT + ALPHA_BITS;
+
+	static_assert(PASS_SHIFT + PASS_BITS == 64, "The sort key fields must fill 64 bits");
+
+	inline std::uint64_t Field(unsigned value, unsigned bits, unsigned shift)
+	{
+		return (std::uint64_t(value) & ((std::uint64_t(1) << bits) - 1)) << shift;
+	}
+	inline unsigned GetField(std::uint64_t key, unsigned bits, unsigned shift)
+	{
+		return unsigned((key >> shift) & ((std::uint64_t(1) << bits) - 1));
+	}
+
+	inline std::uint64_t Make(unsigned pass, unsigned alphaMode, unsigned shaderVariant, unsigned textureSet, unsigned depth)
+	{
+		return Field(pass, PASS_BITS, PASS_SHIFT)
+			| Field(alphaMode, ALPHA_BITS, ALPHA_SHIFT)
+			| Field(shaderVariant, SHADER_BITS, SHADER_SHIFT)
+			| Field(textureSet, TEXTURES_BITS, TEXTURES_SHIFT)
+			| Field(depth, DEPTH_BITS, DEPTH_SHIFT);
+	}
+
+	inline unsigned GetPass(std::uint64_t key) { return GetField(key, PASS_BITS, PASS_SHIFT); }
+	inline unsigned GetAlphaMode(std::uint64_t key) { return GetField(key, ALPHA_BITS, ALPHA_SHIFT); }
+	inline unsigned GetShaderVariant(std::uint64_t key) { return GetField(key, SHADER_BITS, SHADER_SHIFT); }
+	inline unsigned GetTextureSet(std::uint64_t key) { return GetField(key, TEXTURES_BITS, TEXTURES_SHIFT); }
+	inline unsigned GetDepth(std::uint64_t key) { return GetField(key, DEPTH_BITS, DEPTH_SHIFT); }
+
+	// Maps a view space depth in [0, farPlane] to DEPTH_BITS - nearer is smaller
+	unsigned QuantizeDepth(float viewDepth, float farPlane);
+}
+
+// Hands out small dense ids for the sort key fields
+template<typename T, typename Hash = std::hash<T>>
+class SortKeyIds
+{
+public:
+	explicit SortKeyIds(unsigned bits)
+		: m_MaxId((1u << bits) - 1)
+	{}
+
+	// Ids past the field range share the last one - draws still come out
+	// correct, only the batching for them gets worse
+	unsigned Get(const T& value)
+	{
+		auto it = m_Ids.find(value);
+		if (it != m_Ids.end())
+			return it->second;
+
+		const unsigned id = unsigned(std::min<size_t>(m_Ids.size(), m_MaxId));
+		m_Ids.insert(std::make_pair(value, id));
+		return id;
+	}
+
+private:
+	unsigned m_MaxId;
+	std::unordered_map<T, unsigned, Hash> m_Ids;
+};
+
+// The textures a draw binds - only used as an identity
+struct TextureSetKey
+{
+	bool operator==(const TextureSetKey& other) const
+	{
+		return std::equal(Textures, Textures + 4, other.Textures);
+	}
+
+	const void* Textures[4];
+};
+
+struct TextureSetKeyHash
+{
+	size_t operator()(const TextureSetKey& key) const
+	{
+		size_t result = 0;
+		for (auto texture : key.Textures)
+		{
+			result = result * 31 + std::hash<const void*>()(texture);
+		}
+		return result;
+	}
+};
+
+struct RenderQueueEntry
+{
+	std::uint64_t Key;
+	std::uint32_t Item;
+};
+
+// LSD radix sort on the keys, 8 bits per pass. Passes in which all keys have the
+// same byte are skipped, so unused and constant fields cost only the histogram.
+void RadixSort(std::vector<RenderQueueEntry>& entries, std::vector<RenderQueueEntry>& scratch);
+
+class RenderQueue
+{
+public:
+	typedef std::function<std::uint64_t (std::uint32_t item)> KeyFunc;
+
+	struct Stats
+	{
+		unsigned Entries;
+		unsigned ShaderChanges;
+		unsigned TextureChanges;
+	};
+
+	void Clear();
+
+	// Computes the keys of items [0, itemsCount) - on several threads for big
+	// queues - and sorts them. makeKey must be safe to call concurrently.
+	void Build(std::uint32_t itemsCount, const KeyFunc& makeKey);
+
+	const std::vector<RenderQueueEntry>& GetEntries() const
+	{
+		return m_Entries;
+	}
+
+	// State changes a consumer walking the queue in order will make
+	Stats ComputeStats() const;
+
+private:
+	std::vector<RenderQueueEntry> m_Entries;
+	std::vector<RenderQueueEntry> m_Scratch;
+};
@@ -0,0 +1,134 @@
+#include "precompiled.h"
+
+#include "ResourceTracking.h"
+
+#include <atomic>
+
+namespace {
+	// {6C3A2F5E-8E41-4B7D-9A0C-2D5B7F1E4C93}
+	static const GUID TRACKED_MEMORY_GUID = { 0x6c3a2f5e, 0x8e41, 0x4b7d, { 0x9a, 0x0c, 0x2d, 0x5b, 0x7f, 0x1e, 0x4c, 0x93 } };
+
+	// Held in the private data of the resource - D3D releases it when the
+	// resource is destroyed and the memory is taken out of the counters
+	class TrackedMemory : public IUnknown
+	{
+	public:
+		TrackedMemory(MemoryCategory category, size_t size)
+			: m_References(1)
+			, m_Category(category)
+			, m_Size(size)
+		{
+			MemoryTracker::OnGPUAllocate(m_Category, m_Size);
+		}
+
+		virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+		{
+			if (!object)
+				return E_POINTER;
+			if (riid != __uuidof(IUnknown))
+			{
+				*object = nullptr;
+				return E_NOINTERFACE;
+			}
+			AddRef();
+			*object = static_cast<IUnknown*>(this);
+			return S_OK;
+		}
+
+		virtual ULONG STDMETHODCALLTYPE AddRef() override
+		{
+			return ++m_References;
+		}
+
+		virtual ULONG STDMETHODCALLTYPE Release() override
+		{
+			const auto references = --m_References;
+			if (!references)
+			{
+				MemoryTracker::OnGPUFree(m_Category, m_Size);
+				delete this;
+			}
+			return references;
+		}
+
+	private:
+		std::atomic<ULONG> m_References;
+		MemoryCategory m_Category;
+		size_t m_Size;
+	};
+
+	size_t GetSurfaceSize(DXGI_FORMAT format, unsigned width, unsigned height)
+	{
+		const auto bitsPerPixel = DirectX::BitsPerPixel(format);
+		if (DirectX::IsCompressed(format))
+		{
+			// Blocks of 4x4 pixels
+			return size_t(std::max((width + 3) / 4, 1u)) * std::max((height + 3) / 4, 1u) * 16 * bitsPerPixel / 8;
+		}
+		return (size_t(width) * height * bitsPerPixel + 7) / 8;
+	}
+
+	size_t GetResourceSize(ID3D11Resource* resource)
+	{
+		D3D11_RESOURCE_DIMENSION dimension;
+		resource->GetType(&dimension);
+
+		size_t size = 0;
+		switch (dimension)
+		{
+		case D3D11_RESOURCE_DIMENSION_BUFFER:
+		{
+			D3D11_BUFFER_DESC desc;
+			static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+			size = desc.ByteWidth;
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+		{
+			D3D11_TEXTURE1D_DESC desc;
+			static_cast<ID3D11Texture1D*>(resource)->GetDesc(&desc);
+			for (auto mip = 0u; mip < desc.MipLevels; ++mip)
+			{
+				size += GetSurfaceSize(desc.Format, std::max(desc.Width >> mip, 1u), 1) * desc.ArraySize;
+			}
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+		{
+			D3D11_TEXTURE2D_DESC desc;
+			static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+			for (auto mip = 0u; mip < desc.MipLevels; ++mip)
+			{
+				size += GetSurfaceSize(desc.Format, std::max(desc.Width >> mip, 1u), std::max(desc.Height >> mip, 1u))
+					* desc.ArraySize * desc.SampleDesc.Count;
+			}
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+		{
+			D3D11_TEXTURE3D_DESC desc;
+			static_cast<ID3D11Texture3D*>(resource)->GetDesc(&desc);
+			for (auto mip = 0u; mip < desc.MipLevels; ++mip)
+			{
+				size += GetSurfaceSize(desc.Format, std::max(desc.Width >> mip, 1u), std::max(desc.Height >> mip, 1u))
+					* std::max(desc.Depth >> mip, 1u);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return size;
+	}
+}
+
+void TrackResource(ID3D11Resource* resource, MemoryCategory category)
+{
+	if (!resource)
+		return;
+
+	// A resource tracked again replaces its old entry, which is released here
+	auto tracked = new TrackedMemory(category, GetResourceSize(resource));
+	resource->SetPrivateDataInterface(TRACKED_MEMORY_GUID, tracked);
+	tracked->Release();
+}
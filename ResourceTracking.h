@@ -0,0 +1,9 @@
+#pragma once
+
+#include "MemoryTracker.h"
+
+// Counts the memory of a GPU resource in its category of MemoryTracker
+// until the resource is destroyed. The size is worked out from the
+// description of the resource - padding and the driver's own memory are not
+// included. nullptr is ignored.
+void TrackResource(ID3D11Resource* resource, MemoryCategory category);
@@ -0,0 +1,93 @@
+#include "precompiled.h"
+
+#include "RingAllocator.h"
+
+namespace {
+	inline size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+RingAllocator::RingAllocator(size_t capacity)
+	: m_Capacity(capacity)
+	, m_Head(0)
+	, m_Tail(0)
+	, m_Used(0)
+	, m_CurrentFrameSize(0)
+{}
+
+size_t RingAllocator::Allocate(size_t size, size_t alignment)
+{
+	if (size == 0 || size > m_Capacity)
+		return INVALID_OFFSET;
+
+	// Nothing is in flight - start over for the biggest contiguous space.
+	// Pending frames can only be empty here and have to end at the new head.
+	if (m_Used == 0)
+	{
+		m_Head = m_Tail = 0;
+		for (auto& frame : m_Frames)
+		{
+			frame.End = 0;
+		}
+	}
+
+	size_t offset = INVALID_OFFSET;
+	size_t consumed = 0;
+	if (m_Head >= m_Tail && (m_Used == 0 || m_Head != m_Tail))
+	{
+		// Free space is [head, capacity) and [0, tail)
+		const auto aligned = AlignUp(m_Head, alignment);
+		if (aligned + size <= m_Capacity)
+		{
+			offset = aligned;
+			consumed = aligned + size - m_Head;
+		}
+		else if (size <= m_Tail)
+		{
+			// The end of the buffer is wasted until this frame completes
+			offset = 0;
+			consumed = m_Capacity - m_Head + size;
+		}
+	}
+	else if (m_Head < m_Tail)
+	{
+		// Free space is [head, tail)
+		const auto aligned = AlignUp(m_Head, alignment);
+		if (aligned + size <= m_Tail)
+		{
+			offset = aligned;
+			consumed = aligned + size - m_Head;
+		}
+	}
+
+	if (offset == INVALID_OFFSET)
+		return INVALID_OFFSET;
+
+	m_Head = offset + size;
+	m_Used += consumed;
+	m_CurrentFrameSize += consumed;
+	return offset;
+}
+
+void RingAllocator::EndFrame(std::uint64_t frameId)
+{
+	FrameRecord record;
+	record.Id = frameId;
+	record.End = m_Head;
+	record.Size = m_CurrentFrameSize;
+	m_Frames.push_back(record);
+
+	m_CurrentFrameSize = 0;
+}
+
+void RingAllocator::FrameCompleted(std::uint64_t frameId)
+{
+	while (!m_Frames.empty() && m_Frames.front().Id <= frameId)
+	{
+		m_Tail = m_Frames.front().End;
+		m_Used -= m_Frames.front().Size;
+		m_Frames.pop_front();
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+
+// Hands out ranges of a fixed size buffer in FIFO order. Everything allocated
+// between two EndFrame calls belongs to that frame and is only given back when
+// the frame is reported as completed - i.e. when the GPU is done reading it.
+// The allocator knows nothing about the memory itself, only offsets.
+class RingAllocator
+{
+public:
+	static const size_t INVALID_OFFSET = ~size_t(0);
+
+	explicit RingAllocator(size_t capacity);
+
+	// Returns the offset of 'size' bytes aligned to 'alignment' (a power of 2)
+	// or INVALID_OFFSET if the ring has no room until older frames complete
+	size_t Allocate(size_t size, size_t alignment);
+
+	// Closes the allocations of the current frame under 'frameId'
+	void EndFrame(std::uint64_t frameId);
+
+	// Frees all frames up to and including 'frameId'
+	void FrameCompleted(std::uint64_t frameId);
+
+	size_t GetCapacity() const { return m_Capacity; }
+	size_t GetUsed() const { return m_Used; }
+	size_t GetPendingFramesCount() const { return m_Frames.size(); }
+
+	// The oldest frame not completed yet - only valid if GetPendingFramesCount() > 0
+	std::uint64_t GetOldestPendingFrame() const { return m_Frames.front().Id; }
+
+private:
+	struct FrameRecord
+	{
+		std::uint64_t Id;
+		size_t End;
+		size_t Size;
+	};
+
+	size_t m_Capacity;
+	size_t m_Head;
+	size_t m_Tail;
+	size_t m_Used;
+	size_t m_CurrentFrameSize;
+	std::deque<FrameRecord> m_Frames;
+};
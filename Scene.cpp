@@ -1,13 +1,19 @@
 #include "precompiled.h"
 
 #include "Scene.h"
+#include "SceneCuller.h"
+#include "ProceduralBounds.h"
+#include "JobSystem.h"
+#include "ResourceTracking.h"
+#include "TraceRecorder.h"
 
 #include <Dx11/Rendering/Mesh.h>
 #include <Dx11/Rendering/DxRenderer.h>
 #include <Dx11/Rendering/Camera.h>
 #include <Dx11/Rendering/MeshLoader.h>
-#include <Dx11/Rendering/FrustumCuller.h>
 #include <Dx11/Rendering/MeshSDF.h>
+#include <Dx11/Rendering/Subset.h>
+#include <Dx11/Rendering/Material.h>
 
 #include <Utilities/Random.h>
 
@@ -18,16 +24,49 @@ using namespace DirectX;
 #define SURFACE_GENERATOR_EXTENT 10
 #define SURFACE_BUFF_SIZE 250000
 
+// Scatters copies of a small prop around the scene to stress the instancing
+//#define STRESS_PROPS
+#define STRESS_PROPS_COUNT 10000
+
+namespace {
+	// Root cell of the spatial index - sponza and the lights around it fit well inside
+	static const float SPATIAL_INDEX_EXTENT = 4096;
+
+	BoundsHierarchy::Box LightBox(const PointLight& light)
+	{
+		BoundsHierarchy::Box box = {
+			{ light.Position.x - light.Radius, light.Position.y - light.Radius, light.Position.z - light.Radius },
+			{ light.Position.x + light.Radius, light.Position.y + light.Radius, light.Position.z + light.Radius }
+		};
+		return box;
+	}
+}
+
 Scene::Scene(DxRenderer* renderer, Camera* camera, const XMFLOAT4X4& projection)
-	: m_Renderer(renderer)
+	: m_ShaderVariantIds(SortKey::SHADER_BITS)
+	, m_TextureSetIds(SortKey::TEXTURES_BITS)
+	, m_Renderer(renderer)
 	, m_Camera(camera)
 	, m_Sun(XMFLOAT4(-1, -1, 1, 0.3f), XMFLOAT3(0.77f, 0.901f, 0.929f))
+	, m_RenderSnapshot(nullptr)
+	, m_CurrentFrameArena(0)
 {
-	m_FrustumCuller.reset(new FrustumCuller(camera->GetViewMatrix(), projection));
+	m_Projection = projection;
+	m_Culler.reset(new SceneCuller);
+
+	const BoundsHierarchy::Box sceneBounds = {
+		{ -SPATIAL_INDEX_EXTENT * 0.5f, -SPATIAL_INDEX_EXTENT * 0.5f, -SPATIAL_INDEX_EXTENT * 0.5f },
+		{ SPATIAL_INDEX_EXTENT * 0.5f, SPATIAL_INDEX_EXTENT * 0.5f, SPATIAL_INDEX_EXTENT * 0.5f }
+	};
+	m_SpatialIndex.reset(new SpatialIndex(sceneBounds));
+
+	// Far plane of the perspective projection, used to quantize the sort depth
+	m_FarPlane = projection._43 / (1.f - projection._33);
 }
 
 bool Scene::Initialize()
 {
+	MemoryScope memoryScope(MC_Scene);
 	std::string errors;
 
 	MeshSDF sponzaSDF(glm::u32vec3(512u));
@@ -50,8 +89,36 @@ bool Scene::Initialize()
 
 	//MeshSaver::SaveMesh(static_cast<DxRenderer*>(m_Renderer), m_Sponza.get(), "..\\..\\media\\saves\\sponza.rmesh", errors);
 	
+	TrackResource(sponza.Mesh->GetVertexBuffer(), MC_Scene);
 	m_Entities.push_back(std::move(sponza));
 
+#ifdef STRESS_PROPS
+	{
+		std::shared_ptr<Mesh> prop(MeshLoader::LoadMesh(static_cast<DxRenderer*>(m_Renderer), "..\\..\\media\\cube.obj", errors));
+		if (!prop.get())
+		{
+			STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::tie("Unable to load prop mesh: ", errors));
+			return false;
+		}
+		Random::Seed(0);
+		m_Entities.reserve(m_Entities.size() + STRESS_PROPS_COUNT);
+		for (int i = 0; i < STRESS_PROPS_COUNT; ++i)
+		{
+			Entity entity;
+			entity.Position = XMFLOAT3A(Random::RandomBetween(-1400, 1400),
+				Random::RandomBetween(0, 1000),
+				Random::RandomBetween(-200, 200));
+			entity.Scale = Random::RandomBetween(5, 20);
+			entity.Rotation = XMQuaternionRotationRollPitchYaw(Random::RandomNumber() * XM_2PI, Random::RandomNumber() * XM_2PI, 0);
+			entity.Mesh = prop;
+			m_Entities.push_back(std::move(entity));
+		}
+	}
+#endif
+
+	// Read back here - the culler runs on the simulation thread
+	m_Culler->PrepareMeshes(m_Renderer->GetDevice(), m_Renderer->GetImmediateContext(), m_Entities);
+
 	// Set camera
 	m_Camera->SetLookAt(XMFLOAT3(0.f, 0.f, -5.f)
 						, XMFLOAT3(0.f, 0.f, 1.f)
@@ -96,17 +163,27 @@ bool Scene::Initialize()
 						, Random::RandomNumber(), Random::RandomNumber(), Random::RandomNumber()));
 	}
 
+	for (size_t i = 0; i < m_Lights.size(); ++i)
+	{
+		m_LightHandles.push_back(m_SpatialIndex->Insert(SOT_Light, std::uint32_t(i), LightBox(m_Lights[i])));
+	}
+
 	// Generated stuff
 	std::vector<std::string> code;
 	if (!ReloadProceduralFiles(code))
 		return false;
 
 	ProceduralEntity procedural;
-	procedural.Mesh = GeneratedMesh::Create(m_Renderer->GetDevice(), SURFACE_BUFF_SIZE, code[0], XMINT3(SURFACE_GENERATOR_EXTENT, SURFACE_GENERATOR_EXTENT, SURFACE_GENERATOR_EXTENT));
+	{
+		MemoryScope polygonizerScope(MC_Polygonizer);
+		procedural.Mesh = GeneratedMesh::Create(m_Renderer->GetDevice(), SURFACE_BUFF_SIZE, code[0], XMINT3(SURFACE_GENERATOR_EXTENT, SURFACE_GENERATOR_EXTENT, SURFACE_GENERATOR_EXTENT));
+	}
+	TrackResource(procedural.Mesh->GetVertexBuffer(), MC_Polygonizer);
 	procedural.Position = XMFLOAT3A(0, 100, 0);
 	procedural.Scale = 15.0f;
 	procedural.Rotation = XMQuaternionIdentity();
 
+	MemoryScope materialsScope(MC_Materials);
 #ifndef MINIMAL_SIZE
 	if (!m_ProceduralMeshesMaterials.Load("../media/materials.json"))
 	{
@@ -150,8 +227,9 @@ bool Scene::Initialize()
 	procedural.Mesh->SetMaterial(proceduralMeshMaterial);
 	procedural.Mesh->SetDynamic(true);
 
+	UpdateGridBounds(procedural.Mesh.get());
 	if (!procedural.Mesh->IsDynamic())
-		m_MeshesToRegenerate.push_back(procedural.Mesh);
+		EnqueueRegeneration(procedural.Mesh);
 	m_GeneratedMeshes.push_back(procedural);
 	
 	return true;
@@ -180,41 +258,300 @@ void Scene::ReloadProcedural()
 	if (!ReloadProceduralFiles(code))
 		return;
 
+	if (gTrace)
+	{
+		gTrace->Marker("Generator reloaded");
+	}
 	auto& mesh = m_GeneratedMeshes[0].Mesh;
 	mesh->SetGenerator(code[0], XMINT3(SURFACE_GENERATOR_EXTENT, SURFACE_GENERATOR_EXTENT, SURFACE_GENERATOR_EXTENT));
+	UpdateGridBounds(mesh.get());
 	if (!mesh->IsDynamic())
-		m_MeshesToRegenerate.push_back(mesh);
+		EnqueueRegeneration(mesh);
+}
+
+void Scene::UpdateGridBounds(const GeneratedMesh* mesh)
+{
+	auto& bounds = m_ProceduralBounds[mesh];
+	const auto& dispatch = mesh->GetDispatch();
+	if (!ProceduralBounds::ComputeGridBounds(mesh->GetGeneratingFunction(), dispatch.x, dispatch.y, dispatch.z, bounds.Grid))
+	{
+		SLOG(Sev_Warning, Fac_Rendering, "Unable to find the grid of the procedural generator - the mesh won't be culled before it's generated");
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			bounds.Grid.Min[axis] = -std::numeric_limits<float>::max();
+			bounds.Grid.Max[axis] = std::numeric_limits<float>::max();
+		}
+	}
+}
+
+void Scene::EnqueueRegeneration(const GeneratedMeshPtr& mesh)
+{
+	auto& bounds = m_ProceduralBounds[mesh.get()];
+	++bounds.Generation;
+	bounds.GeneratedKnown = false;
+	m_MeshesToRegenerate.push_back(mesh);
+}
+
+unsigned Scene::GetBoundsGeneration(const GeneratedMesh* mesh) const
+{
+	auto bounds = m_ProceduralBounds.find(mesh);
+	return bounds != m_ProceduralBounds.end() ? bounds->second.Generation : 0;
+}
+
+void Scene::ReportGeneratedBounds(const GeneratedMesh* mesh, unsigned generation, const BoundsHierarchy::Box* box)
+{
+	GeneratedBoundsReport report;
+	report.Mesh = mesh;
+	report.Generation = generation;
+	report.Emitted = box != nullptr;
+	if (box)
+	{
+		report.Box = *box;
+	}
+	std::lock_guard<std::mutex> lock(m_ReportsMutex);
+	m_BoundsReports.push_back(report);
+}
+
+void Scene::ApplyGeneratedBounds()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_ReportsMutex);
+		m_BoundsReportsApplied.swap(m_BoundsReports);
+	}
+	for (const auto& report : m_BoundsReportsApplied)
+	{
+		SetGeneratedBounds(report.Mesh, report.Generation, report.Emitted ? &report.Box : nullptr);
+	}
+	m_BoundsReportsApplied.clear();
+}
+
+void Scene::SetGeneratedBounds(const GeneratedMesh* mesh, unsigned generation, const BoundsHierarchy::Box* box)
+{
+	auto bounds = m_ProceduralBounds.find(mesh);
+	// A generation queued since then is not in the box
+	if (bounds == m_ProceduralBounds.end() || bounds->second.Generation != generation)
+		return;
+
+	auto& state = bounds->second;
+	state.GeneratedKnown = true;
+	if (!box)
+	{
+		state.Generated.Min[0] = 1.f;
+		state.Generated.Max[0] = -1.f;
+		return;
+	}
+	state.Generated = *box;
+#ifdef COMPACT_PROCEDURAL_VERTICES
+	// The vertices are quantized to 16 bits in the grid and can round out of the box
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		const auto quantum = (state.Grid.Max[axis] - state.Grid.Min[axis]) / 65535.f;
+		state.Generated.Min[axis] -= quantum;
+		state.Generated.Max[axis] += quantum;
+	}
+#endif
+}
+
+void Scene::UpdateTransforms()
+{
+	const auto count = unsigned(m_Entities.size() + m_GeneratedMeshes.size());
+	const bool rebuild = count != m_Transforms.GetCount();
+	if (rebuild)
+	{
+		m_Transforms.Clear();
+	}
+
+	// The entities are changed in place - only the ones that differ from the
+	// store get their matrices composed again
+	auto sync = [this, rebuild](unsigned index, const XMFLOAT3A& position, FXMVECTOR rotation, float scale) {
+		XMFLOAT4 rotationStored;
+		XMStoreFloat4(&rotationStored, rotation);
+		if (rebuild) {
+			m_Transforms.Add(&position.x, &rotationStored.x, scale);
+		}
+		else {
+			m_Transforms.Set(index, &position.x, &rotationStored.x, scale);
+		}
+	};
+	auto index = 0u;
+	for (const auto& entity : m_Entities)
+	{
+		sync(index++, entity.Position, entity.Rotation, entity.Scale);
+	}
+	for (const auto& entity : m_GeneratedMeshes)
+	{
+		sync(index++, entity.Position, entity.Rotation, entity.Scale);
+	}
+
+	m_Transforms.Update();
 }
 
 void Scene::PopulateSubsetsToDraw()
 {
-	m_FrustumCuller->SetView(m_Camera->GetViewMatrix());
+	UpdateTransforms();
 
-	m_MainCameraEntities.clear();
-	m_FrustumCuller->Cull(m_Entities, m_MainCameraEntities);
+	{
+		MemoryScope cullingScope(MC_Culling);
+		TraceScope trace("Cull");
+		m_Culler->Cull(m_Entities, m_Transforms, m_Camera->GetViewMatrix(), m_Projection, m_MainCameraEntities);
+	}
+
+	// The generated meshes don't touch what the static draws are built from -
+	// they are culled in parallel with them
+	JobSystem::Counter procedural;
+	gJobSystem->Run("Cull generated meshes", [this]() { CullGeneratedMeshes(); }, &procedural);
+
+	{
+		TraceScope trace("Build render queue");
+		GroupInstances();
+		BuildRenderQueue();
+	}
+
+	gJobSystem->Wait(procedural);
+}
 
+void Scene::CullGeneratedMeshes()
+{
+	MemoryScope memoryScope(MC_Culling);
 	m_MainCameraProceduralEntities.clear();
-	for (auto entity : m_GeneratedMeshes)
+	m_ProceduralCullBounds.clear();
+	for (const auto& entity : m_GeneratedMeshes)
 	{
-		ProceduralEntityToDraw toDraw;
-		toDraw.WorldMatrix = XMMatrixAffineTransformation(
-			XMVectorReplicate(entity.Scale),
-			XMVectorZero(),
-			entity.Rotation,
-			XMLoadFloat3A(&entity.Position));
-		toDraw.Geometry = entity.Mesh.get();
-		m_MainCameraProceduralEntities.emplace_back(toDraw);
+		// A dynamic surface moves on after it was generated and is only generated
+		// again while visible - a box of an older generation, or an empty one,
+		// could hide it for good, so it is culled by its whole grid
+		const auto& bounds = m_ProceduralBounds[entity.Mesh.get()];
+		const bool useGenerated = bounds.GeneratedKnown && !entity.Mesh->IsDynamic();
+		m_ProceduralCullBounds.push_back(useGenerated ? bounds.Generated : bounds.Grid);
 	}
+	m_Culler->CullProcedural(m_GeneratedMeshes,
+		m_Transforms,
+		unsigned(m_Entities.size()),
+		m_ProceduralCullBounds,
+		m_MainCameraProceduralEntities);
 }
 
-const std::vector<PointLight>& Scene::GetLights() const
+void Scene::GroupInstances()
 {
-	return m_Lights;
+	m_MainCameraGroups.clear();
+	auto& frameArena = m_FrameArenas[m_CurrentFrameArena];
+
+	// Count the instances of every mesh first so that the transforms of a
+	// group end up next to each other
+	auto& scratch = FrameArena::GetThreadArena();
+	ScopedRewind rewind(scratch);
+	typedef std::unordered_map<const Mesh*, unsigned, std::hash<const Mesh*>, std::equal_to<const Mesh*>,
+		FrameAllocator<std::pair<const Mesh* const, unsigned>>> GroupIdMap;
+	GroupIdMap groupIds(m_MainCameraEntities.size(), GroupIdMap::hasher(), GroupIdMap::key_equal(), GroupIdMap::allocator_type(&scratch));
+	FrameVector<unsigned> groupOfEntity{ FrameAllocator<unsigned>(&scratch) };
+	groupOfEntity.reserve(m_MainCameraEntities.size());
+	for (const auto& entity : m_MainCameraEntities)
+	{
+		auto id = groupIds.find(entity.Geometry);
+		if (id == groupIds.end())
+		{
+			id = groupIds.insert(std::make_pair(entity.Geometry, unsigned(m_MainCameraGroups.size()))).first;
+			InstanceGroup group;
+			group.Subsets = FrameVector<Subset*>(FrameAllocator<Subset*>(&frameArena));
+			group.Geometry = entity.Geometry;
+			group.FirstInstance = 0;
+			group.InstancesCount = 0;
+			group.ViewDepth = std::numeric_limits<float>::max();
+			m_MainCameraGroups.push_back(std::move(group));
+		}
+		++m_MainCameraGroups[id->second].InstancesCount;
+		groupOfEntity.push_back(id->second);
+	}
+
+	unsigned offset = 0;
+	for (auto& group : m_MainCameraGroups)
+	{
+		group.FirstInstance = offset;
+		offset += group.InstancesCount;
+		group.InstancesCount = 0;
+	}
+
+	const XMMATRIX view = m_Camera->GetViewMatrix();
+	m_MainCameraInstances.resize(offset);
+	for (size_t i = 0; i < m_MainCameraEntities.size(); ++i)
+	{
+		const auto& entity = m_MainCameraEntities[i];
+		auto& group = m_MainCameraGroups[groupOfEntity[i]];
+
+		const XMMATRIX columns = XMMatrixTranspose(entity.WorldMatrix);
+		InstanceData& instance = m_MainCameraInstances[group.FirstInstance + group.InstancesCount++];
+		XMStoreFloat4(&instance.WorldColumns[0], columns.r[0]);
+		XMStoreFloat4(&instance.WorldColumns[1], columns.r[1]);
+		XMStoreFloat4(&instance.WorldColumns[2], columns.r[2]);
+
+		const float depth = XMVectorGetZ(XMVector3TransformCoord(entity.WorldMatrix.r[3], view));
+		group.ViewDepth = std::min(group.ViewDepth, depth);
+
+		for (const auto& subset : entity.Subsets)
+		{
+			group.Subsets.push_back(subset.get());
+		}
+	}
+
+	// A subset visible in several instances is drawn once for all of them
+	for (auto& group : m_MainCameraGroups)
+	{
+		if (group.InstancesCount < 2)
+			continue;
+		std::sort(group.Subsets.begin(), group.Subsets.end());
+		group.Subsets.erase(std::unique(group.Subsets.begin(), group.Subsets.end()), group.Subsets.end());
+	}
+}
+
+std::uint64_t Scene::GetSubsetSortKey(Subset* subset)
+{
+	const Material& material = subset->GetMaterial();
+	auto cached = m_SubsetSortKeys.find(subset);
+	if (cached != m_SubsetSortKeys.end() && cached->second.MaterialProperties == material.GetProperties())
+		return cached->second.Key;
+
+	TextureSetKey textures;
+	textures.Textures[0] = material.GetDiffuse().get();
+	textures.Textures[1] = material.GetNormalMap().get();
+	textures.Textures[2] = material.GetAlphaMask().get();
+	textures.Textures[3] = material.GetSpecularMap().get();
+
+	SubsetSortInfo info;
+	info.MaterialProperties = material.GetProperties();
+	info.Key = SortKey::Make(RQP_Static,
+		material.HasProperty(MP_AlphaMask) ? SortKey::AM_AlphaMasked : SortKey::AM_Opaque,
+		m_ShaderVariantIds.Get(material.GetProperties()),
+		m_TextureSetIds.Get(textures),
+		0);
+	m_SubsetSortKeys[subset] = info;
+
+	return info.Key;
 }
 
-const std::vector<MovingLight>& Scene::GetDynamicLights() const
+void Scene::BuildRenderQueue()
 {
-	return m_DynamicLights;
+	m_MainCameraItems.clear();
+	for (const auto& group : m_MainCameraGroups)
+	{
+		for (const auto subset : group.Subsets)
+		{
+			RenderQueueItem item;
+			item.Instances = &group;
+			item.Geometry = subset;
+			item.StaticKey = GetSubsetSortKey(subset);
+			m_MainCameraItems.push_back(item);
+		}
+	}
+
+	m_MainCameraQueue.Build(std::uint32_t(m_MainCameraItems.size()), [&](std::uint32_t id) {
+		const auto& item = m_MainCameraItems[id];
+		return item.StaticKey | SortKey::Make(0, 0, 0, 0, SortKey::QuantizeDepth(item.Instances->ViewDepth, m_FarPlane));
+	});
+}
+
+const std::vector<PointLight>& Scene::GetLights() const
+{
+	return m_Lights;
 }
 
 const DirectionalLight& Scene::GetSun() const
@@ -231,27 +568,62 @@ void Scene::FireLight()
 
 	light.Direction = m_Camera->GetAxisZ();
 
+	m_DynamicLightHandles.push_back(m_SpatialIndex->Insert(SOT_DynamicLight, std::uint32_t(m_DynamicLights.size()), LightBox(light)));
 	m_DynamicLights.push_back(light);
+
+	if (gTrace)
+	{
+		gTrace->Marker("Light fired");
+	}
 }
  
 void Scene::Update(float dt)
 {
-	std::for_each(m_DynamicLights.begin(), m_DynamicLights.end(), std::bind(&MovingLight::Update, std::placeholders::_1, dt));
+	MemoryScope memoryScope(MC_Scene);
+	TraceScope trace("Simulate");
+	m_CurrentFrameArena = (m_CurrentFrameArena + 1) % (SNAPSHOTS_COUNT + 1);
+	m_FrameArenas[m_CurrentFrameArena].Reset();
+
+	ApplyGeneratedBounds();
 
-	m_DynamicLights.erase(std::remove_if(m_DynamicLights.begin(), m_DynamicLights.end(), [](const MovingLight& l) -> bool 
-		{ 
-			static const float LIFETIME = 15;
-			return l.LifeTime >= LIFETIME; 
-		} ), m_DynamicLights.end());
+	static const unsigned LIGHTS_PER_JOB = 256;
+	gJobSystem->ParallelFor("Move dynamic lights", unsigned(m_DynamicLights.size()), LIGHTS_PER_JOB, [this, dt](unsigned first, unsigned last) {
+		std::for_each(m_DynamicLights.begin() + first, m_DynamicLights.begin() + last, std::bind(&MovingLight::Update, std::placeholders::_1, dt));
+	});
+
+	// Expired lights leave the index and the others keep their order
+	static const float LIFETIME = 15;
+	size_t kept = 0;
+	for (size_t i = 0; i < m_DynamicLights.size(); ++i)
+	{
+		if (m_DynamicLights[i].LifeTime >= LIFETIME)
+		{
+			m_SpatialIndex->Remove(m_DynamicLightHandles[i]);
+			continue;
+		}
+		m_DynamicLights[kept] = m_DynamicLights[i];
+		m_DynamicLightHandles[kept] = m_DynamicLightHandles[i];
+		m_SpatialIndex->SetId(m_DynamicLightHandles[kept], std::uint32_t(kept));
+		m_SpatialIndex->Move(m_DynamicLightHandles[kept], LightBox(m_DynamicLights[kept]));
+		++kept;
+	}
+	m_DynamicLights.erase(m_DynamicLights.begin() + kept, m_DynamicLights.end());
+	m_DynamicLightHandles.resize(kept);
 
 	PopulateSubsetsToDraw();
 
-	// Enqueue all dynamic procedural meshes for re-calculation
+	// Enqueue the visible dynamic procedural meshes for re-calculation - the
+	// culled ones are generated again when they come into view
 	std::for_each(m_GeneratedMeshes.cbegin(), 
 		m_GeneratedMeshes.cend(), [&](const ProceduralEntity& entity)
 	{
-		if (entity.Mesh->IsDynamic())
-			m_MeshesToRegenerate.push_back(entity.Mesh);
+		const bool visible = std::any_of(m_MainCameraProceduralEntities.cbegin(),
+			m_MainCameraProceduralEntities.cend(), [&](const ProceduralEntityToDraw& toDraw)
+		{
+			return toDraw.Geometry == entity.Mesh.get();
+		});
+		if (entity.Mesh->IsDynamic() && visible)
+			EnqueueRegeneration(entity.Mesh);
 	});
 
 	// TEST - rotating procedural
@@ -259,9 +631,58 @@ void Scene::Update(float dt)
 	time += dt;
 	m_GeneratedMeshes[0].Rotation = XMQuaternionRotationRollPitchYaw(time, 0, 0);
 	*/
+
+	WriteSnapshot();
 }
 
-void Scene::DidRegenerateAllMeshes()
+void Scene::WriteSnapshot()
 {
+	auto& frame = *m_Snapshots.BeginWrite();
+	frame.MainCamera = *m_Camera;
+
+	// Swapped rather than copied - the lists are built from scratch every
+	// frame and the queue items point in the groups they came with
+	frame.InstanceGroups.swap(m_MainCameraGroups);
+	frame.Instances.swap(m_MainCameraInstances);
+	frame.RenderQueueItems.swap(m_MainCameraItems);
+	std::swap(frame.MainCameraQueue, m_MainCameraQueue);
+	frame.ProceduralEntities.swap(m_MainCameraProceduralEntities);
+
+	frame.GeneratedMeshes.clear();
+	for (const auto& entity : m_GeneratedMeshes)
+	{
+		frame.GeneratedMeshes.push_back(entity.Mesh);
+	}
+	frame.MeshesToGenerate.clear();
+	for (const auto& mesh : m_MeshesToRegenerate)
+	{
+		MeshToGenerate toGenerate = { mesh, GetBoundsGeneration(mesh.get()) };
+		frame.MeshesToGenerate.push_back(std::move(toGenerate));
+	}
 	m_MeshesToRegenerate.clear();
+
+	frame.DynamicLights = m_DynamicLights;
+	frame.VisibleLights.resize(m_Lights.size() + m_DynamicLights.size());
+	SpatialIndex::ResultArena visible(frame.VisibleLights.data(), unsigned(frame.VisibleLights.size()));
+	m_SpatialIndex->QueryFrustum(m_Culler->GetFrustum(),
+		SpatialIndex::TypeBit(SOT_Light) | SpatialIndex::TypeBit(SOT_DynamicLight),
+		visible);
+	frame.VisibleLights.resize(std::min(visible.Count, visible.Capacity));
+
+	frame.CullStats = m_Culler->GetLastStats();
+	frame.TransformsComposed = unsigned(m_Transforms.GetChanged().size());
+	frame.TransformsCount = m_Transforms.GetCount();
+	frame.SpatialObjectsCount = m_SpatialIndex->GetObjectsCount();
+	frame.FrameMemory = m_FrameArenas[m_CurrentFrameArena].ResetStats();
+
+	m_Snapshots.EndWrite();
+}
+
+void Scene::BeginRenderFrame()
+{
+	if (m_RenderSnapshot)
+	{
+		m_Snapshots.EndRead();
+	}
+	m_RenderSnapshot = m_Snapshots.BeginRead();
 }
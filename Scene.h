@@ -1,22 +1,116 @@
 #pragma once
 
+#include <mutex>
+
 #include "PointLight.h"
 #include "DirectionalLight.h"
 #include "SharedRenderResources.h"
 #include "MaterialTable.h"
+#include "RenderQueue.h"
+#include "BoundsHierarchy.h"
+#include "TransformStore.h"
+#include "SpatialIndex.h"
+#include "SceneCuller.h"
+#include "SnapshotQueue.h"
+#include "FrameArena.h"
 #include <Dx11/Rendering/Entity.h>
+#include <Dx11/Rendering/Camera.h>
 
 class DxRenderer;
-class Camera;
-class FrustumCuller;
+class Subset;
+class Mesh;
+
+enum RenderQueuePass
+{
+	RQP_Static = 0,
+};
+
+// Types of the objects in Scene::GetSpatialIndex() - the id of an object is
+// its index in the matching array of the scene. The lights in the view the
+// index finds are all the tile light culling gets. Entities and generated
+// meshes are not indexed: the SceneCuller culls them per subset against its
+// own hierarchy, refit in place, and the occlusion buffer, which a box per
+// object in the index can't replace.
+enum SpatialObjectType
+{
+	SOT_Light = 0,			// GetLights()
+	SOT_DynamicLight,		// GetDynamicLights()
+};
+
+// Visible entities of the main camera that share a mesh. Their transforms
+// are consecutive in Scene::GetInstances() and every subset visible in any
+// of them is drawn for all of them with one instanced draw.
+struct InstanceGroup
+{
+	Mesh* Geometry;
+	unsigned FirstInstance;
+	unsigned InstancesCount;
+	// In the frame arena of the snapshot
+	FrameVector<Subset*> Subsets;
+	float ViewDepth; // of the nearest instance
+};
+typedef std::vector<InstanceGroup> InstanceGroupVec;
+
+// What an entry in the main camera render queue points to
+struct RenderQueueItem
+{
+	const InstanceGroup* Instances;
+	Subset* Geometry;
+	std::uint64_t StaticKey; // all the key fields except the depth
+};
+typedef std::vector<RenderQueueItem> RenderQueueItemVec;
+
+// A generated mesh queued for the polygonizer and the generation its bounds
+// will belong to
+struct MeshToGenerate
+{
+	GeneratedMeshPtr Mesh;
+	unsigned BoundsGeneration;
+};
+
+// Everything the rendering reads of a simulated frame. The simulation fills
+// one in every Scene::Update and doesn't touch it again until the rendering
+// is done with it.
+struct SceneSnapshot
+{
+	// The camera the frame was culled with
+	Camera MainCamera;
+
+	InstanceGroupVec InstanceGroups;
+	std::vector<InstanceData> Instances;
+	RenderQueueItemVec RenderQueueItems;
+	RenderQueue MainCameraQueue;
+
+	ProceduralEntityToDrawVec ProceduralEntities;
+	// Keep the drawn generated meshes alive while the frame is in flight
+	std::vector<GeneratedMeshPtr> GeneratedMeshes;
+	std::vector<MeshToGenerate> MeshesToGenerate;
+
+	std::vector<MovingLight> DynamicLights;
+	// Static and dynamic lights in the frustum of MainCamera - the ones the
+	// tile light culling gets
+	std::vector<SpatialIndex::Object> VisibleLights;
+
+	SceneCuller::Stats CullStats;
+	unsigned TransformsComposed;
+	unsigned TransformsCount;
+	unsigned SpatialObjectsCount;
+	// Of the frame arena the snapshot lives in
+	FrameArena::Stats FrameMemory;
+};
 
 class Scene
 {
 public:
+	// The camera is the one the scene is simulated with - the rendering uses
+	// the copy in the snapshot of the frame
 	Scene(DxRenderer* renderer, Camera* camera, const DirectX::XMFLOAT4X4& projection);
 
 	bool Initialize();
 
+	// Simulation - called from one thread, with nothing below the render
+	// section called at the same time from any other
+
 	EntityVec& GetEntities()
 	{
 		return m_Entities;
@@ -25,42 +119,171 @@ public:
 	{
 		return m_MainCameraEntities;
 	}
-	ProceduralEntityToDrawVec& GetProceduralEntitiesForMainCamera()
+
+	// World matrices of the entities and then the generated meshes
+	const TransformStore& GetTransforms() const
 	{
-		return m_MainCameraProceduralEntities;
+		return m_Transforms;
 	}
 
-	const std::vector<PointLight>& GetLights() const;
-	const std::vector<MovingLight>& Scene::GetDynamicLights() const;
-	const DirectionalLight& GetSun() const;
+	// The lights by their boxes, as of the last Update. Entities and generated
+	// meshes are culled by the SceneCuller instead.
+	const SpatialIndex& GetSpatialIndex() const
+	{
+		return *m_SpatialIndex;
+	}
 
-	const std::vector<GeneratedMeshPtr>& GetMeshesToGenerate() const
+	// Subsets tested and culled for the main camera in the last Update
+	const SceneCuller& GetCuller() const
+	{
+		return *m_Culler;
+	}
+	void ToggleOcclusionCulling()
 	{
-		return m_MeshesToRegenerate;
+		m_Culler->SetOcclusionCulling(!m_Culler->IsOcclusionCulling());
 	}
-	void DidRegenerateAllMeshes();
+
+	// Generated meshes are culled by the box the polygonizer reports for their
+	// last generation and by the grid of their generator until it arrives
+	unsigned GetBoundsGeneration(const GeneratedMesh* mesh) const;
 
 	const ProceduralEntityVec& GetGeneratedMeshes() const
 	{
 		return m_GeneratedMeshes;
 	}
 
+	// Simulates a frame and queues its snapshot for the rendering
 	void Update(float dt);
 	void ReloadProcedural();
 
 	void FireLight();
 
+	// Never change after Initialize - safe from any thread
+	const std::vector<PointLight>& GetLights() const;
+	const DirectionalLight& GetSun() const;
+
+	// Rendering - the snapshot taken by the last BeginRenderFrame
+
+	// Gives the previous snapshot back and waits for the next one
+	void BeginRenderFrame();
+	const SceneSnapshot& GetRenderSnapshot() const
+	{
+		return *m_RenderSnapshot;
+	}
+
+	// Visible static entities grouped by mesh and their world matrices in group order
+	const InstanceGroupVec& GetInstanceGroups() const
+	{
+		return m_RenderSnapshot->InstanceGroups;
+	}
+	const std::vector<InstanceData>& GetInstances() const
+	{
+		return m_RenderSnapshot->Instances;
+	}
+
+	// Visible static subsets sorted for drawing - entries index GetRenderQueueItems()
+	const RenderQueue& GetRenderQueue() const
+	{
+		return m_RenderSnapshot->MainCameraQueue;
+	}
+	const RenderQueueItemVec& GetRenderQueueItems() const
+	{
+		return m_RenderSnapshot->RenderQueueItems;
+	}
+
+	const ProceduralEntityToDrawVec& GetProceduralEntitiesForMainCamera() const
+	{
+		return m_RenderSnapshot->ProceduralEntities;
+	}
+	const std::vector<MeshToGenerate>& GetMeshesToGenerate() const
+	{
+		return m_RenderSnapshot->MeshesToGenerate;
+	}
+
+	const std::vector<MovingLight>& GetDynamicLights() const
+	{
+		return m_RenderSnapshot->DynamicLights;
+	}
+
+	// Queued for the next Update - nullptr if the generation emitted no vertices
+	void ReportGeneratedBounds(const GeneratedMesh* mesh, unsigned generation, const BoundsHierarchy::Box* box);
+
 private:
 	bool ReloadProceduralFiles(std::vector<std::string>& code);
+	void UpdateGridBounds(const GeneratedMesh* mesh);
+	void EnqueueRegeneration(const GeneratedMeshPtr& mesh);
+	void UpdateTransforms();
 	void PopulateSubsetsToDraw();
+	void CullGeneratedMeshes();
+	void GroupInstances();
+	void BuildRenderQueue();
+	std::uint64_t GetSubsetSortKey(Subset* subset);
+	void SetGeneratedBounds(const GeneratedMesh* mesh, unsigned generation, const BoundsHierarchy::Box* box);
+	void ApplyGeneratedBounds();
+	void WriteSnapshot();
 	
 	EntityVec m_Entities;
+	// The static entities first, then the generated meshes
+	TransformStore m_Transforms;
 	EntityToDrawVec m_MainCameraEntities;
 	ProceduralEntityToDrawVec m_MainCameraProceduralEntities;
 
+	InstanceGroupVec m_MainCameraGroups;
+	std::vector<InstanceData> m_MainCameraInstances;
+
+	RenderQueueItemVec m_MainCameraItems;
+	RenderQueue m_MainCameraQueue;
+
+	struct SubsetSortInfo
+	{
+		unsigned MaterialProperties;
+		std::uint64_t Key;
+	};
+	std::unordered_map<const Subset*, SubsetSortInfo> m_SubsetSortKeys;
+	SortKeyIds<unsigned> m_ShaderVariantIds;
+	SortKeyIds<TextureSetKey, TextureSetKeyHash> m_TextureSetIds;
+	float m_FarPlane;
+
 	std::vector<GeneratedMeshPtr> m_MeshesToRegenerate;
 	ProceduralEntityVec m_GeneratedMeshes;
 
+	struct ProceduralBoundsState
+	{
+		BoundsHierarchy::Box Grid;
+		BoundsHierarchy::Box Generated;
+		// Bumped every time the mesh is queued for generation
+		unsigned Generation;
+		// Generated holds the box of the last generation - only static meshes
+		// are culled by it
+		bool GeneratedKnown;
+	};
+	std::unordered_map<const GeneratedMesh*, ProceduralBoundsState> m_ProceduralBounds;
+	std::vector<BoundsHierarchy::Box> m_ProceduralCullBounds;
+
+	// Reported by the rendering while the simulation runs
+	struct GeneratedBoundsReport
+	{
+		const GeneratedMesh* Mesh;
+		unsigned Generation;
+		bool Emitted;
+		BoundsHierarchy::Box Box;
+	};
+	std::mutex m_ReportsMutex;
+	std::vector<GeneratedBoundsReport> m_BoundsReports;
+	std::vector<GeneratedBoundsReport> m_BoundsReportsApplied;
+
+	// The simulation gets a frame ahead - one snapshot is rendered, one is
+	// queued and one is written
+	static const unsigned SNAPSHOTS_COUNT = 3;
+	SnapshotQueue<SceneSnapshot, SNAPSHOTS_COUNT> m_Snapshots;
+	const SceneSnapshot* m_RenderSnapshot;
+	// Per-frame memory of the snapshots, reset when the simulation starts the
+	// frame. The frame that used an arena last was released by the rendering
+	// when the next frame got its snapshot - one more arena than snapshots
+	// covers the frame being simulated before that.
+	FrameArena m_FrameArenas[SNAPSHOTS_COUNT + 1];
+	unsigned m_CurrentFrameArena;
+
 #ifndef MINIMAL_SIZE
 	MaterialTable m_ProceduralMeshesMaterials;
 #endif
@@ -69,7 +292,12 @@ private:
 
 	Camera* m_Camera;
 
-	std::unique_ptr<FrustumCuller> m_FrustumCuller;
+	DirectX::XMFLOAT4X4 m_Projection;
+	std::unique_ptr<SceneCuller> m_Culler;
+
+	std::unique_ptr<SpatialIndex> m_SpatialIndex;
+	std::vector<SpatialIndex::Handle> m_LightHandles;
+	std::vector<SpatialIndex::Handle> m_DynamicLightHandles;
 
 	std::vector<PointLight>		m_Lights;
 	std::vector<MovingLight>	m_DynamicLights;
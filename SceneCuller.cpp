@@ -0,0 +1,414 @@
+#include "precompiled.h"
+
+#include "SceneCuller.h"
+#include "BufferReadback.h"
+
+#include <Dx11/Rendering/Mesh.h>
+#include <Dx11/Rendering/Subset.h>
+#include <Dx11/Rendering/Material.h>
+#include <Dx11/Rendering/VertexTypes.h>
+
+using namespace DirectX;
+
+namespace {
+	// Below this many subsets a single thread is faster than spawning tasks
+	static const unsigned PARALLEL_CULL_THRESHOLD = 4096;
+	// The largest triangles of a mesh kept as occluders
+	static const unsigned MESH_OCCLUDER_TRIANGLES = 2048;
+	// Occluder triangles rasterized per frame, from the nearest entities on
+	static const unsigned FRAME_OCCLUDER_TRIANGLES = 16384;
+
+	XMMATRIX LoadWorld(const float* world)
+	{
+		return XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(world));
+	}
+
+	// The box around the transformed box - center and extents, the extents
+	// through the absolute values of the matrix (row-major, 16 floats)
+	BoundsHierarchy::Box TransformBox(const BoundsHierarchy::Box& box, const float* world)
+	{
+		float center[3];
+		float extents[3];
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			center[axis] = (box.Min[axis] + box.Max[axis]) * 0.5f;
+			extents[axis] = (box.Max[axis] - box.Min[axis]) * 0.5f;
+		}
+
+		BoundsHierarchy::Box result;
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			float c = world[3 * 4 + axis];
+			float e = 0;
+			for (auto i = 0u; i < 3; ++i)
+			{
+				c += center[i] * world[i * 4 + axis];
+				e += extents[i] * std::abs(world[i * 4 + axis]);
+			}
+			result.Min[axis] = c - e;
+			result.Max[axis] = c + e;
+		}
+		return result;
+	}
+
+	float TriangleArea(const float* a, const float* b, const float* c)
+	{
+		const float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		const float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		const float x = u[1] * v[2] - u[2] * v[1];
+		const float y = u[2] * v[0] - u[0] * v[2];
+		const float z = u[0] * v[1] - u[1] * v[0];
+		return std::sqrt(x * x + y * y + z * z) * 0.5f;
+	}
+
+	// Never culled - for subsets whose vertices couldn't be read
+	BoundsHierarchy::Box InfiniteBox()
+	{
+		BoundsHierarchy::Box box;
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			box.Min[axis] = -std::numeric_limits<float>::max();
+			box.Max[axis] = std::numeric_limits<float>::max();
+		}
+		return box;
+	}
+}
+
+SceneCuller::SceneCuller()
+	: m_UseOcclusion(true)
+	, m_OcclusionReady(false)
+{
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+SceneCuller::~SceneCuller()
+{}
+
+void SceneCuller::PrepareMeshes(ID3D11Device* device, ID3D11DeviceContext* context, const EntityVec& entities)
+{
+	for (const auto& entity : entities)
+	{
+		Mesh* mesh = entity.Mesh.get();
+		if (!mesh || m_Meshes.find(mesh) != m_Meshes.end())
+			continue;
+		ReadMeshData(device, context, mesh, m_Meshes[mesh]);
+	}
+}
+
+const SceneCuller::MeshData& SceneCuller::GetMeshData(Mesh* mesh)
+{
+	auto cached = m_Meshes.find(mesh);
+	if (cached != m_Meshes.end())
+		return cached->second;
+
+	// Not prepared - never culled and no occluders, nothing is read back here
+	SLOG(Sev_Warning, Fac_Rendering, "Mesh culled before it was prepared - its subsets won't be culled");
+	auto& data = m_Meshes[mesh];
+	data.SubsetBounds.assign(mesh->GetSubsetCount(), InfiniteBox());
+	return data;
+}
+
+void SceneCuller::ReadMeshData(ID3D11Device* device, ID3D11DeviceContext* context, Mesh* mesh, MeshData& data)
+{
+	auto& bounds = data.SubsetBounds;
+	bounds.assign(mesh->GetSubsetCount(), InfiniteBox());
+
+	std::vector<std::uint8_t> vertices;
+	if (!ReadBackBuffer(device, context, mesh->GetVertexBuffer(), vertices))
+	{
+		SLOG(Sev_Warning, Fac_Rendering, "Unable to read the mesh vertices - its subsets won't be culled");
+		return;
+	}
+	const auto verticesCount = unsigned(vertices.size() / sizeof(StandardVertex));
+	auto getPosition = [&vertices](std::uint32_t index) {
+		return reinterpret_cast<const float*>(vertices.data() + index * sizeof(StandardVertex));
+	};
+
+	// Occluder candidates - area and the 3 indices of every opaque triangle
+	struct Candidate
+	{
+		float Area;
+		std::uint32_t Indices[3];
+	};
+	std::vector<Candidate> candidates;
+
+	std::vector<std::uint8_t> indicesData;
+	for (size_t i = 0; i < mesh->GetSubsetCount(); ++i)
+	{
+		const auto& subset = mesh->GetSubset(i);
+		const auto indicesCount = unsigned(subset->GetIndicesCount());
+		if (!ReadBackBuffer(device, context, subset->GetIndexBuffer(), indicesData)
+			|| indicesData.size() < indicesCount * sizeof(std::uint32_t))
+		{
+			SLOG(Sev_Warning, Fac_Rendering, "Unable to read the subset indices - it won't be culled");
+			continue;
+		}
+
+		// Only the vertices the subset uses - they share the buffer of the mesh
+		BoundsHierarchy::Box box = {
+			{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() },
+			{ -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() }
+		};
+		const auto* indices = reinterpret_cast<const std::uint32_t*>(indicesData.data());
+		bool valid = indicesCount > 0;
+		for (auto index = 0u; index < indicesCount; ++index)
+		{
+			if (indices[index] >= verticesCount)
+			{
+				valid = false;
+				break;
+			}
+			const auto* position = getPosition(indices[index]);
+			for (auto axis = 0u; axis < 3; ++axis)
+			{
+				box.Min[axis] = std::min(box.Min[axis], position[axis]);
+				box.Max[axis] = std::max(box.Max[axis], position[axis]);
+			}
+		}
+		if (!valid)
+			continue;
+		bounds[i] = box;
+
+		// Alpha tested triangles have holes
+		if (subset->GetMaterial().HasProperty(MP_AlphaMask))
+			continue;
+		for (auto index = 0u; index + 2 < indicesCount; index += 3)
+		{
+			Candidate candidate = { 0, { indices[index], indices[index + 1], indices[index + 2] } };
+			candidate.Area = TriangleArea(getPosition(candidate.Indices[0]), getPosition(candidate.Indices[1]), getPosition(candidate.Indices[2]));
+			candidates.push_back(candidate);
+		}
+	}
+
+	// The largest triangles hide the most - ties go to the earlier triangle,
+	// so the occluders are the same on every run
+	if (candidates.size() > MESH_OCCLUDER_TRIANGLES)
+	{
+		std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& lhs, const Candidate& rhs) {
+			return lhs.Area > rhs.Area;
+		});
+		candidates.resize(MESH_OCCLUDER_TRIANGLES);
+	}
+
+	// Only the vertices the occluders use are kept
+	std::unordered_map<std::uint32_t, std::uint32_t> remap;
+	for (const auto& candidate : candidates)
+	{
+		for (const auto index : candidate.Indices)
+		{
+			auto inserted = remap.insert(std::make_pair(index, std::uint32_t(remap.size())));
+			if (inserted.second)
+			{
+				const auto* position = getPosition(index);
+				data.OccluderPositions.insert(data.OccluderPositions.end(), position, position + 3);
+			}
+			data.OccluderIndices.push_back(inserted.first->second);
+		}
+	}
+}
+
+void SceneCuller::Rebuild(const EntityVec& entities, const TransformStore& transforms)
+{
+	m_Entities.clear();
+	m_Items.clear();
+	std::vector<BoundsHierarchy::Box> boxes;
+	for (size_t i = 0; i < entities.size(); ++i)
+	{
+		EntityState state;
+		state.Geometry = entities[i].Mesh.get();
+		state.FirstItem = unsigned(m_Items.size());
+		m_Entities.push_back(state);
+		if (!state.Geometry)
+			continue;
+
+		const auto& subsetBounds = GetMeshData(state.Geometry).SubsetBounds;
+		for (size_t subset = 0; subset < subsetBounds.size(); ++subset)
+		{
+			Item item;
+			item.Entity = unsigned(i);
+			item.Subset = unsigned(subset);
+			m_Items.push_back(item);
+			boxes.push_back(TransformBox(subsetBounds[subset], transforms.GetWorld(unsigned(i))));
+		}
+	}
+	m_Hierarchy.Build(boxes);
+
+	SLOG(Sev_Info, Fac_Rendering, "Culling hierarchy: ", m_Items.size(), " subsets of ", entities.size(),
+		" entities in ", m_Hierarchy.GetNodesCount(), " nodes, AVX2 ", CullingKernel::IsUsingAVX2() ? "on" : "off");
+}
+
+void SceneCuller::Cull(const EntityVec& entities,
+	const TransformStore& transforms,
+	const XMMATRIX& view,
+	const XMFLOAT4X4& projection,
+	EntityToDrawVec& outEntities)
+{
+	bool rebuild = entities.size() != m_Entities.size();
+	for (size_t i = 0; i < entities.size() && !rebuild; ++i)
+	{
+		rebuild = entities[i].Mesh.get() != m_Entities[i].Geometry;
+	}
+
+	m_Stats.NodesRefit = 0;
+	if (rebuild)
+	{
+		Rebuild(entities, transforms);
+	}
+	else
+	{
+		// Moved entities update the boxes of their subsets in place
+		for (const auto index : transforms.GetChanged())
+		{
+			if (index >= m_Entities.size())
+				break;
+			const auto& state = m_Entities[index];
+			if (!state.Geometry)
+				continue;
+
+			const auto* world = transforms.GetWorld(index);
+			const auto& subsetBounds = GetMeshData(state.Geometry).SubsetBounds;
+			for (size_t subset = 0; subset < subsetBounds.size(); ++subset)
+			{
+				m_Hierarchy.UpdateItem(state.FirstItem + unsigned(subset), TransformBox(subsetBounds[subset], world));
+			}
+		}
+		m_Stats.NodesRefit = m_Hierarchy.Refit();
+	}
+
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(view, XMLoadFloat4x4(&projection)));
+	CullingKernel::ExtractPlanes(&viewProjection.m[0][0], m_Planes);
+
+	m_VisibleItems.clear();
+	m_Stats.ItemsCount = m_Hierarchy.GetItemsCount();
+	m_Stats.Parallel = m_Stats.ItemsCount >= PARALLEL_CULL_THRESHOLD;
+	m_Hierarchy.Cull(m_Planes, m_Stats.Parallel, m_VisibleItems, m_Stats.Traversal);
+
+	m_Stats.ItemsOccluded = 0;
+	::memset(&m_Stats.Occlusion, 0, sizeof(m_Stats.Occlusion));
+	m_OcclusionReady = m_UseOcclusion && !m_VisibleItems.empty();
+	if (m_OcclusionReady)
+	{
+		CullOccluded(transforms, view, viewProjection);
+	}
+
+	// The visible subsets come in tree order - gather them per entity
+	m_OutputSlots.assign(m_Entities.size(), -1);
+	size_t outCount = 0;
+	for (const auto itemIndex : m_VisibleItems)
+	{
+		const auto& item = m_Items[itemIndex];
+		int& slot = m_OutputSlots[item.Entity];
+		if (slot < 0)
+		{
+			slot = int(outCount++);
+			if (size_t(slot) == outEntities.size())
+			{
+				outEntities.push_back(EntityToDraw());
+			}
+			auto& toDraw = outEntities[slot];
+			toDraw.Geometry = m_Entities[item.Entity].Geometry;
+			toDraw.WorldMatrix = LoadWorld(transforms.GetWorld(item.Entity));
+			toDraw.Subsets.clear();
+		}
+		outEntities[slot].Subsets.push_back(outEntities[slot].Geometry->GetSubset(item.Subset));
+	}
+	outEntities.erase(outEntities.begin() + outCount, outEntities.end());
+	m_Stats.EntitiesVisible = unsigned(std::count_if(m_OutputSlots.begin(), m_OutputSlots.end(), [](int slot) { return slot >= 0; }));
+}
+
+void SceneCuller::CullOccluded(const TransformStore& transforms, const XMMATRIX& view, const XMFLOAT4X4& viewProjection)
+{
+	// The entities with visible subsets, nearest first
+	m_OccluderEntities.clear();
+	int lastEntity = -1;
+	for (const auto itemIndex : m_VisibleItems)
+	{
+		const auto entity = m_Items[itemIndex].Entity;
+		if (int(entity) == lastEntity)
+			continue;
+		lastEntity = int(entity);
+		const auto* world = transforms.GetWorld(entity);
+		const auto position = XMVector3TransformCoord(XMVectorSet(world[12], world[13], world[14], 1.f), view);
+		m_OccluderEntities.push_back(std::make_pair(XMVectorGetZ(position), entity));
+	}
+	// Subsets of one entity can come apart in tree order
+	std::sort(m_OccluderEntities.begin(), m_OccluderEntities.end());
+	m_OccluderEntities.erase(std::unique(m_OccluderEntities.begin(), m_OccluderEntities.end()), m_OccluderEntities.end());
+
+	m_Occlusion.Begin(&viewProjection.m[0][0]);
+	auto trianglesLeft = FRAME_OCCLUDER_TRIANGLES;
+	for (const auto& occluder : m_OccluderEntities)
+	{
+		const auto& state = m_Entities[occluder.second];
+		const auto& data = GetMeshData(state.Geometry);
+		const auto trianglesCount = unsigned(data.OccluderIndices.size() / 3);
+		if (!trianglesCount || trianglesCount > trianglesLeft)
+			continue;
+		m_Occlusion.AddOccluder(data.OccluderPositions.data(),
+			unsigned(data.OccluderPositions.size() / 3),
+			data.OccluderIndices.data(),
+			unsigned(data.OccluderIndices.size()),
+			transforms.GetWorld(occluder.second));
+		trianglesLeft -= trianglesCount;
+	}
+	m_Occlusion.Rasterize();
+
+	// An occluder is never hidden by itself - its triangles are inside its boxes
+	m_OccludeeBoxes.resize(m_VisibleItems.size());
+	for (size_t i = 0; i < m_VisibleItems.size(); ++i)
+	{
+		m_OccludeeBoxes[i] = m_Hierarchy.GetItemBox(m_VisibleItems[i]);
+	}
+	m_OccludeeVisible.resize(m_VisibleItems.size());
+	m_Occlusion.TestBoxes(m_OccludeeBoxes.data(), unsigned(m_OccludeeBoxes.size()), m_OccludeeVisible.data());
+
+	size_t kept = 0;
+	for (size_t i = 0; i < m_VisibleItems.size(); ++i)
+	{
+		if (m_OccludeeVisible[i])
+			m_VisibleItems[kept++] = m_VisibleItems[i];
+	}
+	m_Stats.ItemsOccluded = unsigned(m_VisibleItems.size() - kept);
+	m_VisibleItems.resize(kept);
+	m_Stats.Occlusion = m_Occlusion.GetStats();
+}
+
+void SceneCuller::CullProcedural(const ProceduralEntityVec& entities,
+	const TransformStore& transforms,
+	unsigned firstTransform,
+	const std::vector<BoundsHierarchy::Box>& localBounds,
+	ProceduralEntityToDrawVec& outEntities)
+{
+	m_Stats.ProceduralCount = unsigned(entities.size());
+	m_Stats.ProceduralVisible = 0;
+	for (size_t i = 0; i < entities.size() && i < localBounds.size(); ++i)
+	{
+		const auto& bounds = localBounds[i];
+		if (bounds.Min[0] > bounds.Max[0])
+			continue;
+
+		const auto& entity = entities[i];
+		const auto* world = transforms.GetWorld(firstTransform + unsigned(i));
+		const auto box = TransformBox(bounds, world);
+
+		CullingKernel::Boxes8 boxes;
+		boxes.MinX[0] = box.Min[0];
+		boxes.MinY[0] = box.Min[1];
+		boxes.MinZ[0] = box.Min[2];
+		boxes.MaxX[0] = box.Max[0];
+		boxes.MaxY[0] = box.Max[1];
+		boxes.MaxZ[0] = box.Max[2];
+		unsigned inside = 0;
+		if (!CullingKernel::TestBoxes(m_Planes, boxes, 1, inside))
+			continue;
+		if (m_OcclusionReady && !m_Occlusion.IsVisible(box))
+			continue;
+
+		ProceduralEntityToDraw toDraw;
+		toDraw.WorldMatrix = LoadWorld(world);
+		toDraw.Geometry = entity.Mesh.get();
+		outEntities.emplace_back(toDraw);
+		++m_Stats.ProceduralVisible;
+	}
+}
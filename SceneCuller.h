@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Dx11/Rendering/Entity.h>
+
+#include "BoundsHierarchy.h"
+#include "OcclusionBuffer.h"
+#include "TransformStore.h"
+
+class Mesh;
+
+// Frustum culling of the static entities per subset. Every subset of every
+// entity is an item of a BoundsHierarchy with its world-space box - a single
+// big mesh like sponza gets its parts culled too. Entity i has transform i of
+// the TransformStore and the ones it changed in its last Update refit their
+// items instead of rebuilding the tree.
+// The subsets left after the frustum test are tested against a CPU depth
+// buffer of the largest triangles of the nearest visible meshes.
+// Generated meshes have a single box each and go through the same tests in
+// CullProcedural.
+class SceneCuller
+{
+public:
+	struct Stats
+	{
+		BoundsHierarchy::Stats Traversal;
+		unsigned ItemsCount;
+		unsigned EntitiesVisible;
+		unsigned NodesRefit;
+		bool Parallel;
+		// Of Traversal.ItemsVisible - hidden behind the occluders
+		unsigned ItemsOccluded;
+		OcclusionBuffer::Stats Occlusion;
+		unsigned ProceduralCount;
+		unsigned ProceduralVisible;
+	};
+
+	SceneCuller();
+	~SceneCuller();
+
+	// Reads the boxes and occluders of every mesh of the entities back from
+	// the GPU. At load time, on the thread that owns the context - Cull runs
+	// on the simulation thread and never touches the device.
+	void PrepareMeshes(ID3D11Device* device, ID3D11DeviceContext* context, const EntityVec& entities);
+
+	// outEntities is overwritten - pass the one of the last cull so that its
+	// entries and their subset lists are reused
+	void Cull(const EntityVec& entities,
+		const TransformStore& transforms,
+		const DirectX::XMMATRIX& view,
+		const DirectX::XMFLOAT4X4& projection,
+		EntityToDrawVec& outEntities);
+
+	// After Cull, with the camera of Cull. Entity i has transform
+	// firstTransform + i. localBounds has the box of every entity in the space
+	// of its generator - an empty one (min above max) for a mesh that
+	// generated nothing.
+	void CullProcedural(const ProceduralEntityVec& entities,
+		const TransformStore& transforms,
+		unsigned firstTransform,
+		const std::vector<BoundsHierarchy::Box>& localBounds,
+		ProceduralEntityToDrawVec& outEntities);
+
+	void SetOcclusionCulling(bool enabled) { m_UseOcclusion = enabled; }
+	bool IsOcclusionCulling() const { return m_UseOcclusion; }
+
+	const Stats& GetLastStats() const { return m_Stats; }
+	// Of the camera of the last Cull
+	const CullingKernel::FrustumPlanes& GetFrustum() const { return m_Planes; }
+
+private:
+	// Read back from the GPU in PrepareMeshes
+	struct MeshData
+	{
+		// Local box per subset
+		std::vector<BoundsHierarchy::Box> SubsetBounds;
+		// The largest opaque triangles of the mesh - xyz per vertex
+		std::vector<float> OccluderPositions;
+		std::vector<std::uint32_t> OccluderIndices;
+	};
+
+	static void ReadMeshData(ID3D11Device* device, ID3D11DeviceContext* context, Mesh* mesh, MeshData& data);
+	const MeshData& GetMeshData(Mesh* mesh);
+	void Rebuild(const EntityVec& entities, const TransformStore& transforms);
+	void CullOccluded(const TransformStore& transforms, const DirectX::XMMATRIX& view, const DirectX::XMFLOAT4X4& viewProjection);
+
+	struct EntityState
+	{
+		Mesh* Geometry;
+		unsigned FirstItem;
+	};
+
+	struct Item
+	{
+		unsigned Entity;
+		unsigned Subset;
+	};
+
+	std::unordered_map<const Mesh*, MeshData> m_Meshes;
+	std::vector<EntityState> m_Entities;
+	std::vector<Item> m_Items;
+	BoundsHierarchy m_Hierarchy;
+
+	std::vector<unsigned> m_VisibleItems;
+	CullingKernel::FrustumPlanes m_Planes;
+
+	bool m_UseOcclusion;
+	// Rasterized for the camera of the last Cull
+	bool m_OcclusionReady;
+	OcclusionBuffer m_Occlusion;
+	std::vector<BoundsHierarchy::Box> m_OccludeeBoxes;
+	std::vector<std::uint8_t> m_OccludeeVisible;
+	std::vector<std::pair<float, unsigned>> m_OccluderEntities;
+	// Index of the entity in the output of the frame, -1 if not visible
+	std::vector<int> m_OutputSlots;
+
+	Stats m_Stats;
+};
@@ -1,12 +1,10 @@
-#define TILE_SIZE 8
-#define MAX_LIGHTS_PER_TILE 32
-
 struct LightNode {
 	uint LightId;
 };
 
 StructuredBuffer<LightNode> Lights : register(t0);
 StructuredBuffer<uint> LightsCountBuffer : register(t1);
+StructuredBuffer<uint> LightsMask : register(t3);
 
 cbuffer PerFrame : register(b0)
 {
@@ -15,6 +13,35 @@ cbuffer PerFrame : register(b0)
 	vector Globals;
 };
 
+// Filled from LightTilingConfig by TileLightsRoutine
+cbuffer LightTiling : register(b1)
+{
+	uint LightTileSize;
+	uint MaxLightsPerTile;
+	uint LightTilesCountX;
+	uint LightsEncoding;
+	uint LightsMaskWordsPerTile;
+	uint ActiveLightsMaskWords;
+};
+
+#define LIGHT_ENCODING_BITMASK 1
+
+// The lights of the list the forward pass reads - the count buffer alone
+// in bitmask mode has no cap
+uint TileLightsCount(uint tile)
+{
+	if (LightsEncoding == LIGHT_ENCODING_BITMASK)
+	{
+		uint count = 0;
+		for (uint word = 0; word < ActiveLightsMaskWords; ++word)
+		{
+			count += countbits(LightsMask[tile * LightsMaskWordsPerTile + word]);
+		}
+		return count;
+	}
+	return LightsCountBuffer[tile];
+}
+
 struct VS_INPUT
 {
     float4 Pos : POSITION;
@@ -38,9 +65,9 @@ PS_INPUT VS(VS_INPUT input)
 
 float4 PS(PS_INPUT input) : SV_Target
 {
-	float2 groupId = floor(input.Pos.xy / float2(TILE_SIZE, TILE_SIZE));
+	const uint2 groupId = uint2(input.Pos.xy) / LightTileSize;
 
-	const uint lightsCount = LightsCountBuffer[(uint(groupId.y) * (Globals.x / TILE_SIZE)) + uint(groupId.x)];
+	const uint lightsCount = TileLightsCount(groupId.y * LightTilesCountX + groupId.x);
 
 	float3 color;
 	if (lightsCount <= 12) {
@@ -50,9 +77,9 @@ float4 PS(PS_INPUT input) : SV_Target
 	{
 		color = float3(0, 0, float(lightsCount) / 24);
 	}
-	else if (lightsCount > 24 && lightsCount < MAX_LIGHTS_PER_TILE)
+	else if (lightsCount > 24 && lightsCount < MaxLightsPerTile)
 	{
-		color = float3(float(lightsCount) / MAX_LIGHTS_PER_TILE, 0, 0);
+		color = float3(float(lightsCount) / MaxLightsPerTile, 0, 0);
 	}
 	else
 	{
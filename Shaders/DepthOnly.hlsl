@@ -0,0 +1,59 @@
+#include "VertexCompression.hlsl"
+#include "Instancing.hlsl"
+
+cbuffer PerFrame : register(b0)
+{
+	matrix View;
+	matrix Projection;
+	vector Globals;
+};
+
+cbuffer PerSubset : register(b1)
+{
+	matrix World;
+	vector MaterialProperties;
+};
+
+float4 TransformPosition(float3 pos, matrix world)
+{
+	float4 position = mul(float4(pos, 1), world);
+	position = mul(position, View);
+	return mul(position, Projection);
+}
+
+// Static meshes - drawn instanced
+struct VS_INPUT
+{
+	float3 Pos : POSITION;
+	INSTANCE_INPUT
+};
+
+float4 VS(VS_INPUT input) : SV_POSITION
+{
+	return TransformPosition(input.Pos, GET_INSTANCE_WORLD(input));
+}
+
+// Generated meshes - one draw each, the world matrix in PerSubset
+struct VS_INPUT_PROCEDURAL
+{
+	float3 Pos : POSITION;
+};
+
+float4 VS_Procedural(VS_INPUT_PROCEDURAL input) : SV_POSITION
+{
+	return TransformPosition(input.Pos, World);
+}
+
+// Positions quantized by the polygonizer in compact vertex mode
+struct VS_INPUT_COMPACT
+{
+	float4 Pos : POSITION;
+};
+
+ByteAddressBuffer PositionDequantizationIn : register(t8);
+
+float4 VS_Compact(VS_INPUT_COMPACT input) : SV_POSITION
+{
+	const float3 position = dequantizePosition(input.Pos.xyz, loadDequantization(PositionDequantizationIn));
+	return TransformPosition(position, World);
+}
@@ -1,7 +1,34 @@
 #include "ForwardDrawDefs.hlsl"
+#include "Instancing.hlsl"
+
+#ifdef BATCHED_MATERIALS
+// Subsets merged by MaterialBatches - the textures of all of them are in
+// arrays and every triangle points to the slices of its subset
+Texture2DArray txDiffuse : register(t0);
+Texture2DArray txNormal : register(t1);
+Texture2DArray txAlphaMask : register(t2);
+Texture2DArray txSpecularMap : register(t3);
+
+// MaterialBatches::SubsetMaterial
+struct BatchMaterial
+{
+	uint4 Slices; // diffuse, normal map, alpha mask, specular map
+	float SpecularPower;
+};
+StructuredBuffer<uint> TriangleMaterials : register(t8);
+StructuredBuffer<BatchMaterial> BatchMaterials : register(t9);
 
+#define SAMPLE_MATERIAL(texture, slot, uv) texture.Sample(samLinear, float3(uv, material.Slices[slot]))
+#define SPECULAR_POWER material.SpecularPower
+#else
 Texture2D txDiffuse : register(t0);
 Texture2D txNormal : register(t1);
+Texture2D txAlphaMask : register(t2);
+Texture2D txSpecularMap : register(t3);
+
+#define SAMPLE_MATERIAL(texture, slot, uv) texture.Sample(samLinear, uv)
+#define SPECULAR_POWER MaterialProperties.x
+#endif
 
 struct VS_INPUT
 {
@@ -10,6 +37,7 @@ struct VS_INPUT
 	float3 Normal : NORMAL;
 	float3 Tangent : TANGENT;
 	float3 Bitangent : BITANGENT;
+	INSTANCE_INPUT
 };
 
 struct PS_INPUT
@@ -29,7 +57,8 @@ PS_INPUT VS(VS_INPUT input)
 {
 	PS_INPUT output = (PS_INPUT)0;
 
-	output.Pos = mul(input.Pos, World);
+	const matrix world = GET_INSTANCE_WORLD(input);
+	output.Pos = mul(input.Pos, world);
 	output.WorldPosition = output.Pos / output.Pos.w;
 
     output.Pos = mul(output.Pos, View);
@@ -39,9 +68,9 @@ PS_INPUT VS(VS_INPUT input)
 
 	// We only allow uniform scaling, so it's ok to transform by the World
 	// instead of the inverse-transpose
-	output.Normal = mul(float4(input.Normal, 0), World).xyz;
-	output.Tangent = mul(float4(input.Tangent, 0), World).xyz;
-	output.Bitangent = mul(float4(input.Bitangent, 0), World).xyz;
+	output.Normal = mul(float4(input.Normal, 0), world).xyz;
+	output.Tangent = mul(float4(input.Tangent, 0), world).xyz;
+	output.Bitangent = mul(float4(input.Bitangent, 0), world).xyz;
 
     return output;
 }
@@ -49,19 +78,25 @@ PS_INPUT VS(VS_INPUT input)
 //--------------------------------------------------------------------------------------
 // Pixel Shader
 //--------------------------------------------------------------------------------------
+#ifdef BATCHED_MATERIALS
+float4 PS(PS_INPUT input, uint primitiveId : SV_PrimitiveID) : SV_Target
+{
+	const BatchMaterial material = BatchMaterials[TriangleMaterials[primitiveId]];
+#else
 float4 PS(PS_INPUT input) : SV_Target
 {
+#endif
 	static const float3 ambient = float3(0.0f, 0.0f, 0.0f);
 	static const float specularIntensity = 1;
 
 	float alpha = 1;
     if(g_HasAlphaMask)
 	{
-		alpha = txAlphaMask.Sample(samLinear, input.Tex);
+		alpha = SAMPLE_MATERIAL(txAlphaMask, 2, input.Tex).x;
 	}
 
 	float2 uv = input.Pos.xy / Globals.xy;
-	float3 albedo = txDiffuse.Sample(samLinear, input.Tex).xyz;
+	float3 albedo = SAMPLE_MATERIAL(txDiffuse, 0, input.Tex).xyz;
 
 	float3 normal = normalize(input.Normal);
 	float3 tangent = normalize(input.Tangent);
@@ -70,14 +105,14 @@ float4 PS(PS_INPUT input) : SV_Target
 
 	if (g_HasNormal)
 	{
-		normal = normalize(txNormal.Sample(samLinear, input.Tex).xyz * 2.0f - 1.0f);
+		normal = normalize(SAMPLE_MATERIAL(txNormal, 1, input.Tex).xyz * 2.0f - 1.0f);
 		normal = mul(normal, tbn);
 	}
 	// I don't have specular colors for all subsets, so settle with this
 	float3 specColor = float3(0.02f, 0.02f, 0.02f);
 	if (g_HasSpecularMap)
 	{
-		specColor = txSpecularMap.Sample(samLinear, input.Tex).xyz;
+		specColor = SAMPLE_MATERIAL(txSpecularMap, 3, input.Tex).xyz;
 	}
 
 	const float3 toEye = normalize(CameraPosition.xyz - input.WorldPosition.xyz);
@@ -92,15 +127,14 @@ float4 PS(PS_INPUT input) : SV_Target
 			GlobalLightColor.xyz,
 			albedo,
 			specColor,
-			MaterialProperties.x);
+			SPECULAR_POWER);
 	}
 
 	// Point Lights
-	const float2 groupCoord = floor(input.Pos.xy / float2(TILE_SIZE, TILE_SIZE));
-	const uint groupId = (uint(groupCoord.y) * (Globals.x / TILE_SIZE)) + uint(groupCoord.x);
-	const uint lightsCount = LightsCountBuffer[groupId];
-	for (int lid = 0; lid < lightsCount; ++lid) {
-		PointLightProperties light = PointLightsIn[Lights[groupId*MAX_LIGHTS_PER_TILE + lid].LightId];
+	TileLightsIterator tileLights = BeginTileLights(input.Pos.xy);
+	uint lightId;
+	while (NextTileLight(tileLights, lightId)) {
+		PointLightProperties light = PointLightsIn[lightId];
 		float3 toLight = light.PositionAndRadius.xyz - input.WorldPosition.xyz;
 		const float toLightLen = length(toLight);
 		const float attenuation = saturate(1 - toLightLen / light.PositionAndRadius.w);
@@ -113,7 +147,7 @@ float4 PS(PS_INPUT input) : SV_Target
 				light.Color.xyz,
 				albedo,
 				specColor,
-				MaterialProperties.x);
+				SPECULAR_POWER);
 		}
 	}
 	finalColor += ambient;
@@ -0,0 +1,5 @@
+// ForwardDraw.hlsl for the subsets MaterialBatches merged in texture array
+// draws. The material shader manager compiles files without extra defines,
+// so the variant is a file of its own.
+#define BATCHED_MATERIALS
+#include "ForwardDraw.hlsl"
@@ -1,9 +1,3 @@
-#define TILE_SIZE 8
-#define MAX_LIGHTS_PER_TILE 32
-
-Texture2D txAlphaMask : register(t2);
-Texture2D txSpecularMap : register(t3);
-
 SamplerState samLinear : register(s0);
 SamplerState samPoint : register(s1);
 
@@ -13,6 +7,7 @@ struct LightNode {
 
 StructuredBuffer<LightNode> Lights : register(t4);
 StructuredBuffer<uint> LightsCountBuffer : register(t5);
+StructuredBuffer<uint> LightsMask : register(t7);
 
 struct PointLightProperties {
 	float4 PositionAndRadius;
@@ -40,6 +35,66 @@ cbuffer GlobalProperties : register(b2)
 	vector GlobalLightColor;
 };
 
+// Filled from LightTilingConfig by TileLightsRoutine
+cbuffer LightTiling : register(b3)
+{
+	uint LightTileSize;
+	uint MaxLightsPerTile;
+	uint LightTilesCountX;
+	uint LightsEncoding;
+	uint LightsMaskWordsPerTile;
+	uint ActiveLightsMaskWords;
+};
+
+#define LIGHT_ENCODING_INDEX_LIST 0
+#define LIGHT_ENCODING_BITMASK 1
+
+// Walks the lights of a tile regardless of how the tile lists are encoded
+struct TileLightsIterator
+{
+	uint Tile;
+	uint Index;
+	uint Count;
+	uint Word;
+	uint Mask;
+};
+
+TileLightsIterator BeginTileLights(float2 screenPosition)
+{
+	const uint2 groupCoord = uint2(screenPosition) / LightTileSize;
+
+	TileLightsIterator it;
+	it.Tile = groupCoord.y * LightTilesCountX + groupCoord.x;
+	it.Index = 0;
+	it.Count = LightsCountBuffer[it.Tile];
+	it.Word = 0xFFFFFFFF;
+	it.Mask = 0;
+	return it;
+}
+
+bool NextTileLight(inout TileLightsIterator it, out uint lightId)
+{
+	lightId = 0;
+	if (LightsEncoding == LIGHT_ENCODING_BITMASK)
+	{
+		while (it.Mask == 0)
+		{
+			if (++it.Word >= ActiveLightsMaskWords)
+				return false;
+			it.Mask = LightsMask[it.Tile * LightsMaskWordsPerTile + it.Word];
+		}
+		lightId = it.Word * 32 + firstbitlow(it.Mask);
+		it.Mask &= it.Mask - 1;
+		return true;
+	}
+
+	if (it.Index >= it.Count)
+		return false;
+	lightId = Lights[it.Tile * MaxLightsPerTile + it.Index].LightId;
+	++it.Index;
+	return true;
+}
+
 #define PI 3.14159265f
 
 float3 CalcLight(float3 toEye,
@@ -1,4 +1,5 @@
 #include "ForwardDrawDefs.hlsl"
+#include "VertexCompression.hlsl"
 
 Texture2DArray txDiffuse : register(t0);
 Texture2DArray txNormal : register(t1);
@@ -57,6 +58,26 @@ PS_INPUT_GEN VS_Gen(VS_INPUT_GEN input)
 	return output;
 }
 
+// Compact vertices of the polygonizer - see COMPACT_VERTICES in Polygonizer.hlsl
+struct VS_INPUT_GEN_COMPACT
+{
+	float4 Pos : POSITION;
+	float2 Normal : NORMAL;
+	uint2 TextureIndices : TEXCOORD0;
+};
+
+ByteAddressBuffer PositionDequantizationIn : register(t8);
+
+PS_INPUT_GEN VS_GenCompact(VS_INPUT_GEN_COMPACT input)
+{
+	VS_INPUT_GEN decoded;
+	decoded.Pos = float4(dequantizePosition(input.Pos.xyz, loadDequantization(PositionDequantizationIn)), 1);
+	decoded.Normal = octDecode(input.Normal);
+	decoded.TextureIndices = input.TextureIndices;
+
+	return VS_Gen(decoded);
+}
+
 float4 PS_Gen(PS_INPUT_GEN input) : SV_Target
 {
 	static const float3 ambient = float3(0.0f, 0.0f, 0.0f);
@@ -146,11 +167,10 @@ float4 PS_Gen(PS_INPUT_GEN input) : SV_Target
 	}
 
 	// Point Lights
-	const float2 groupCoord = floor(input.Pos.xy / float2(TILE_SIZE, TILE_SIZE));
-	const uint groupId = (uint(groupCoord.y) * (Globals.x / TILE_SIZE)) + uint(groupCoord.x);
-	const uint lightsCount = LightsCountBuffer[groupId];
-	for (int lid = 0; lid < lightsCount; ++lid) {
-		PointLightProperties light = PointLightsIn[Lights[groupId*MAX_LIGHTS_PER_TILE + lid].LightId];
+	TileLightsIterator tileLights = BeginTileLights(input.Pos.xy);
+	uint lightId;
+	while (NextTileLight(tileLights, lightId)) {
+		PointLightProperties light = PointLightsIn[lightId];
 		float3 toLight = light.PositionAndRadius.xyz - input.WorldPosition.xyz;
 		const float toLightLen = length(toLight);
 		const float attenuation = saturate(1 - toLightLen / light.PositionAndRadius.w);
@@ -0,0 +1,11 @@
+// Per-instance stream of the static draws - InstanceLayoutElements and
+// InstanceData on the CPU side. Each element is a column of the world matrix
+// without the last one, which is always (0, 0, 0, 1).
+#define INSTANCE_INPUT \
+	float4 InstanceWorld0 : INSTANCE_WORLD0; \
+	float4 InstanceWorld1 : INSTANCE_WORLD1; \
+	float4 InstanceWorld2 : INSTANCE_WORLD2;
+
+// The world matrix in the row-vector convention the PerSubset World has
+#define GET_INSTANCE_WORLD(input) \
+	transpose(matrix(input.InstanceWorld0, input.InstanceWorld1, input.InstanceWorld2, float4(0, 0, 0, 1)))
@@ -1,4 +1,5 @@
 #include "MCTables.hlsl"
+#include "VertexCompression.hlsl"
 
 struct GenerateCounters
 {
@@ -10,6 +11,22 @@ RWByteAddressBuffer BufferOut : register(u0);
 RWByteAddressBuffer IndexBufferOut : register(u1);
 RWByteAddressBuffer IndirectInfo : register(u2);
 RWStructuredBuffer<GenerateCounters> Counters : register(u3);
+// Positions only - read by the depth passes
+RWByteAddressBuffer PositionsOut : register(u4);
+
+#ifdef COMPACT_VERTICES
+// 20 bytes per vertex - R16G16B16A16_UNORM position, R16G16_SNORM octahedral normal, uint2 texture indices.
+// Positions are quantized in the box of the dispatch, described in DequantizationOut.
+#define VERTEX_STRIDE 20
+#define POSITION_STRIDE 8
+RWByteAddressBuffer DequantizationOut : register(u5);
+#else
+#define VERTEX_STRIDE 32
+#define POSITION_STRIDE 12
+#endif
+// Box of the emitted vertices for culling - min xyz, max xyz as orderedUint,
+// cleared in InitCounters and decoded in ProceduralBounds.cpp
+RWByteAddressBuffer BoundsOut : register(u6);
 
 StructuredBuffer<RegularCellData> CellData : register(t0);
 StructuredBuffer<uint> VertexData : register(t1);
@@ -23,9 +40,17 @@ float3 calcNormal(float3 position)
 		));
 }
 
+// Unsigned ints that sort like the floats - atomic min and max work on them
+uint orderedUint(float value)
+{
+	const uint bits = asuint(value);
+	return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
 #define SHARED_DIST_SIZE 512
 
 groupshared float groupDists[SHARED_DIST_SIZE];
+groupshared uint groupBounds[6];
 
 [numthreads(8, 8, 8)]
 void PolygonizerCS(uint3 DTid : SV_DispatchThreadID,
@@ -35,8 +60,21 @@ void PolygonizerCS(uint3 DTid : SV_DispatchThreadID,
 	const uint3 groupDims = float3(8, 8, 8);
 	float3 origin = DTid * Step + InitialCoords;
 
+#ifdef COMPACT_VERTICES
+	const float3 quantizationScale = GridExtent.xyz * Step;
+	if (all(DTid == 0))
+	{
+		DequantizationOut.Store3(0, asuint(InitialCoords));
+		DequantizationOut.Store3(12, asuint(quantizationScale));
+	}
+#endif
+
 	// eash thread computes its dist
 	groupDists[gtid] = sceneDistance(origin);
+	if (gtid < 6)
+	{
+		groupBounds[gtid] = gtid < 3 ? 0xFFFFFFFF : 0;
+	}
 
 	GroupMemoryBarrierWithGroupSync();
 	uint3 offsets[8];
@@ -92,6 +130,8 @@ void PolygonizerCS(uint3 DTid : SV_DispatchThreadID,
 		uint myIndexSlot = 0;
 		InterlockedAdd(Counters[0].IndicesCount, triangleCount * 3, myIndexSlot);
 		
+		float3 boundsMin = positions[7];
+		float3 boundsMax = positions[0];
 		for (int vertexIndex = 0; vertexIndex < vertexCount; ++vertexIndex)
 		{
 			uint edgeIndex = VertexData[caseCode * 12 + vertexIndex] & 0xFF;
@@ -103,26 +143,59 @@ void PolygonizerCS(uint3 DTid : SV_DispatchThreadID,
 			float t = (abs(diff) > 0.0) ? (distances[v1] / (diff)) : 0.0;
 
 			float3 vertexPosition = lerp(positions[v1], positions[v0], t);
+			boundsMin = min(boundsMin, vertexPosition);
+			boundsMax = max(boundsMax, vertexPosition);
 
-			uint address = (myVertexSlot + vertexIndex) * 32;
-			BufferOut.Store3(address,
-				uint3(asuint(vertexPosition.x),
+			const uint address = (myVertexSlot + vertexIndex) * VERTEX_STRIDE;
+			const uint positionAddress = (myVertexSlot + vertexIndex) * POSITION_STRIDE;
+			const float3 normal = calcNormal(vertexPosition);
+			uint2 textureInds = textureIndices(vertexPosition, lerp(distances[v1], distances[v0], t));
+#ifdef COMPACT_VERTICES
+			const uint2 positionBits = packPositionUnorm16((vertexPosition - InitialCoords) / quantizationScale);
+			BufferOut.Store2(address, positionBits);
+			PositionsOut.Store2(positionAddress, positionBits);
+			BufferOut.Store(address + 8, packSnorm16x2(octEncode(normal)));
+			BufferOut.Store2(address + 12, textureInds);
+#else
+			const uint3 positionBits = uint3(asuint(vertexPosition.x),
 				asuint(vertexPosition.y),
-				asuint(vertexPosition.z)));
+				asuint(vertexPosition.z));
+			BufferOut.Store3(address, positionBits);
+			PositionsOut.Store3(positionAddress, positionBits);
 
-			const float3 normal = calcNormal(vertexPosition);
 			BufferOut.Store3(address + 12,
 				uint3(asuint(normal.x),
 				asuint(normal.y),
 				asuint(normal.z)));
 
-			uint2 textureInds = textureIndices(vertexPosition, lerp(distances[v1], distances[v0], t));
 			BufferOut.Store2(address + 24, textureInds);
+#endif
 		}
 
 		for (int index = 0; index < triangleCount * 3; ++index)
 		{
 			IndexBufferOut.Store((myIndexSlot + index) * 4, myVertexSlot + cellData.vertexIndex[index]);
 		}
+
+		// Merged in the group first - one set of global atomics per group
+		InterlockedMin(groupBounds[0], orderedUint(boundsMin.x));
+		InterlockedMin(groupBounds[1], orderedUint(boundsMin.y));
+		InterlockedMin(groupBounds[2], orderedUint(boundsMin.z));
+		InterlockedMax(groupBounds[3], orderedUint(boundsMax.x));
+		InterlockedMax(groupBounds[4], orderedUint(boundsMax.y));
+		InterlockedMax(groupBounds[5], orderedUint(boundsMax.z));
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+	// Nothing emitted in the group if the min is still cleared
+	if (gtid < 6 && groupBounds[0] != 0xFFFFFFFF)
+	{
+		uint previous;
+		if (gtid < 3) {
+			BoundsOut.InterlockedMin(gtid * 4, groupBounds[gtid], previous);
+		}
+		else {
+			BoundsOut.InterlockedMax(gtid * 4, groupBounds[gtid], previous);
+		}
 	}
 }
@@ -1,6 +1,7 @@
 cbuffer PerFramePolygonizer : register(b1) // Use 1 as 0 is always the global per-frame buffer
 {
 	vector Time; //x - time since start in secs, y - time since last frames
+	vector GridExtent; // xyz - cells covered by the dispatch
 };
 
 Texture2D randomTexture : register(t2);
@@ -6,10 +6,14 @@ struct GenerateCounters
 
 RWByteAddressBuffer IndirectInfo : register(u2);
 RWStructuredBuffer<GenerateCounters> Counters : register(u3);
+RWByteAddressBuffer BoundsOut : register(u6);
 
 [numthreads(1, 1, 1)]
 void InitCounters()
 {
 	Counters[0].VerticesCount = 0;
 	Counters[0].IndicesCount = 0;
+	// Empty box - min at the largest and max at the smallest orderedUint
+	BoundsOut.Store3(0, uint3(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF));
+	BoundsOut.Store3(12, uint3(0, 0, 0));
 }
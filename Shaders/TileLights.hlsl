@@ -1,5 +1,5 @@
-#define MAX_LIGHTS_PER_TILE 32
-#define GROUP_SIZE 8
+// GROUP_SIZE (the tile size) and MAX_LIGHTS_PER_TILE are generated
+// from LightTilingConfig by TileLightsRoutine
 
 struct PointLightProperties {
 	float4 PositionAndRadius;
@@ -21,6 +21,7 @@ cbuffer TilingData : register(b1)
 {
 	matrix InvProjection;
 	uint LightsCount;
+	uint TilesCountX;
 };
 
 // Input
@@ -34,10 +35,19 @@ Texture2D txDepth : register(t1);
 // Output
 RWStructuredBuffer<LightNode> LightsBufferOut : register(u0);
 RWStructuredBuffer<uint> LightsCountBufferOut : register(u1);
+#ifdef LIGHTS_BITMASK
+// One bit per light in the scene - the lights are pre-sorted on the CPU
+#define LIGHT_MASK_WORDS ((MAX_LIGHTS_IN_SCENE + 31) / 32)
+RWStructuredBuffer<uint> LightsMaskBufferOut : register(u2);
+#endif
 
 // Shared
 groupshared uint LightsCountGroup;
+#ifdef LIGHTS_BITMASK
+groupshared uint LightMaskGroup[LIGHT_MASK_WORDS];
+#else
 groupshared uint LightIdsGroup[MAX_LIGHTS_PER_TILE];
+#endif
 groupshared uint zMinInt;
 groupshared uint zMaxInt;
 
@@ -93,20 +103,26 @@ void CSTileLights(
 	uint3 dtid : SV_DispatchThreadID,
 	uint localTid : SV_GroupIndex) {
 
-	uint groupIndex = gid.y * (Globals.x / GROUP_SIZE) + gid.x;
+	uint groupIndex = gid.y * TilesCountX + gid.x;
 
 	// Init shared variables
-	int myTidMinusOne = (tid.y * GROUP_SIZE + tid.x) - 1;
 	if (tid.x == 0 && tid.y == 0)
 	{
 		LightsCountGroup = 0;
 		zMinInt = 0xFFFFFFFF;
 		zMaxInt = 0;
 	}
-	else if ((tid.y * GROUP_SIZE + tid.x) < 33)
+#ifdef LIGHTS_BITMASK
+	for (uint word = localTid; word < LIGHT_MASK_WORDS; word += GROUP_SIZE*GROUP_SIZE)
+	{
+		LightMaskGroup[word] = 0;
+	}
+#else
+	for (uint initSlot = localTid; initSlot < MAX_LIGHTS_PER_TILE; initSlot += GROUP_SIZE*GROUP_SIZE)
 	{
-		LightIdsGroup[myTidMinusOne] = 0xFFFFFFFF;
+		LightIdsGroup[initSlot] = 0xFFFFFFFF;
 	}
+#endif
 	GroupMemoryBarrierWithGroupSync();
 
 #ifdef DEBUG_SPHERES
@@ -145,7 +161,8 @@ void CSTileLights(
 		float3 viewPosition = projectionToView(float3(dtid.x, dtid.y, depth));
 		uint zInt = asuint(viewPosition.z);
 
-		if (depth != 1.0f)
+		// The last row and column of tiles can extend past the screen
+		if (depth != 1.0f && all(dtid.xy < uint2(Globals.xy)))
 		{
 			InterlockedMin(zMinInt, zInt);
 			InterlockedMax(zMaxInt, zInt);
@@ -180,10 +197,15 @@ void CSTileLights(
 			uint slot;
 			InterlockedAdd(LightsCountGroup, 1, slot);
 
+#ifdef LIGHTS_BITMASK
+			// The mask has room for every light so there is no cap
+			InterlockedOr(LightMaskGroup[lightId >> 5], 1u << (lightId & 31));
+#else
 			if (slot >= MAX_LIGHTS_PER_TILE)
 				break;
 
 			LightIdsGroup[slot] = lightId;
+#endif
 		}
 		lightId += GROUP_SIZE*GROUP_SIZE;
 	}
@@ -191,13 +213,24 @@ void CSTileLights(
 	GroupMemoryBarrierWithGroupSync();
 	
 	// Update global memory
+#ifdef LIGHTS_BITMASK
+	if (tid.x == 0 && tid.y == 0)
+	{
+		LightsCountBufferOut[groupIndex] = LightsCountGroup;
+	}
+	for (uint outWord = localTid; outWord < LIGHT_MASK_WORDS; outWord += GROUP_SIZE*GROUP_SIZE)
+	{
+		LightsMaskBufferOut[groupIndex * LIGHT_MASK_WORDS + outWord] = LightMaskGroup[outWord];
+	}
+#else
 	if (tid.x == 0 && tid.y == 0)
 	{
 		LightsCountBufferOut[groupIndex] = min(LightsCountGroup, MAX_LIGHTS_PER_TILE);
 	}
-	else if ((tid.y * GROUP_SIZE + tid.x) < 33)
+	for (uint outSlot = localTid; outSlot < MAX_LIGHTS_PER_TILE; outSlot += GROUP_SIZE*GROUP_SIZE)
 	{
-		LightsBufferOut[(groupIndex * MAX_LIGHTS_PER_TILE) + myTidMinusOne].LightId = LightIdsGroup[myTidMinusOne];
+		LightsBufferOut[(groupIndex * MAX_LIGHTS_PER_TILE) + outSlot].LightId = LightIdsGroup[outSlot];
 	}
+#endif
 	AllMemoryBarrierWithGroupSync();
 }
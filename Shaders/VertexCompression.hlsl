@@ -0,0 +1,57 @@
+// GPU side of VertexCompression.h - keep the two in sync
+
+// Offset and scale of the quantized positions of a mesh, written by the polygonizer
+struct PositionDequantization
+{
+	float3 Offset;
+	float3 Scale;
+};
+
+PositionDequantization loadDequantization(ByteAddressBuffer buffer)
+{
+	PositionDequantization result;
+	result.Offset = asfloat(buffer.Load3(0));
+	result.Scale = asfloat(buffer.Load3(12));
+	return result;
+}
+
+float3 dequantizePosition(float3 unorm, PositionDequantization dequantization)
+{
+	return dequantization.Offset + unorm * dequantization.Scale;
+}
+
+// Two 16-bit UNORMs per uint, x in the low half - the layout of R16G16B16A16_UNORM
+uint2 packPositionUnorm16(float3 normalized)
+{
+	const uint3 q = uint3(saturate(normalized) * 65535.0 + 0.5);
+	// w = 1 so the input assembler gives a ready to transform position
+	return uint2(q.x | (q.y << 16), q.z | (0xFFFF << 16));
+}
+
+float2 signNotZero(float2 v)
+{
+	return float2(v.x >= 0 ? 1.0 : -1.0, v.y >= 0 ? 1.0 : -1.0);
+}
+
+float2 octEncode(float3 n)
+{
+	float2 p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+	return (n.z < 0) ? (1.0 - abs(p.yx)) * signNotZero(p) : p;
+}
+
+float3 octDecode(float2 e)
+{
+	float3 n = float3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0)
+	{
+		n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+	}
+	return normalize(n);
+}
+
+// Layout of R16G16_SNORM
+uint packSnorm16x2(float2 v)
+{
+	const int2 q = int2(round(clamp(v, -1.0, 1.0) * 32767.0));
+	return (uint(q.x) & 0xFFFF) | (uint(q.y) << 16);
+}
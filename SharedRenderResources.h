@@ -1,9 +1,45 @@
 #pragma once
 
-#define MAX_LIGHTS_PER_TILE 32
-#define LIGHTS_TILE_SIZE 8
+#include "ConstantBufferRing.h"
+#include "InstanceBuffer.h"
+#include "FrameArena.h"
+
+class GeneratedMesh;
+
+// The tile size and the max lights per tile are set at runtime through LightTilingConfig
 #define MAX_LIGHTS_IN_SCENE 1000
 
+// Generated meshes use the compact vertices of Shaders/Polygonizer.hlsl - quantized
+// positions and octahedral normals - instead of PositionNormalTextIndsVertex
+#define COMPACT_PROCEDURAL_VERTICES
+
+#ifdef COMPACT_PROCEDURAL_VERTICES
+static const unsigned PROCEDURAL_VERTEX_STRIDE = 20;
+static const unsigned PROCEDURAL_POSITION_STRIDE = 8;
+#else
+static const unsigned PROCEDURAL_VERTEX_STRIDE = 32;
+static const unsigned PROCEDURAL_POSITION_STRIDE = 12;
+#endif
+
+enum LightListEncoding
+{
+	LLE_IndexList,
+	LLE_Bitmask,
+};
+
+// Tightly packed positions of a generated mesh, written by the polygonizer
+// next to the full vertices for the depth-only passes
+struct PositionStream
+{
+	ReleaseGuard<ID3D11Buffer> Buffer;
+	ReleaseGuard<ID3D11UnorderedAccessView> UAV;
+
+	// Offset and scale of the quantized positions with COMPACT_PROCEDURAL_VERTICES
+	ReleaseGuard<ID3D11Buffer> DequantizationBuffer;
+	ReleaseGuard<ID3D11UnorderedAccessView> DequantizationUAV;
+	ReleaseGuard<ID3D11ShaderResourceView> DequantizationSRV;
+};
+
 struct SharedRenderResources
 {
 	ReleaseGuard<ID3D11UnorderedAccessView> LightsCulledUAV;
@@ -14,8 +50,27 @@ struct SharedRenderResources
 	ReleaseGuard<ID3D11ShaderResourceView> LightsCulledCountSRV;
 	ReleaseGuard<ID3D11Buffer> LightsCulledCountBuffer;
 
+	// Used when LightsEncoding is LLE_Bitmask - one word per 32 lights per tile
+	ReleaseGuard<ID3D11UnorderedAccessView> LightsCulledMaskUAV;
+	ReleaseGuard<ID3D11ShaderResourceView> LightsCulledMaskSRV;
+	ReleaseGuard<ID3D11Buffer> LightsCulledMaskBuffer;
+
+	// LightTilingProperties describing the buffers above
+	ReleaseGuard<ID3D11Buffer> LightTilingBuffer;
+
 	ReleaseGuard<ID3D11Buffer> PointLightsBuffer;
 	ReleaseGuard<ID3D11ShaderResourceView> PointLightsSRV;
+
+	// Per-draw constants of the frame
+	std::unique_ptr<ConstantBufferRing> ConstantsRing;
+
+	// World matrices of the visible static entities, Scene::GetInstances()
+	std::unique_ptr<InstanceBuffer> Instances;
+
+	// Memory of the render thread for the frame, reset at its end
+	FrameArena FrameMemory;
+
+	std::unordered_map<const GeneratedMesh*, std::unique_ptr<PositionStream>> ProceduralPositions;
 };
 
 extern SharedRenderResources* gSharedRenderResources;
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "precompiled.h"
+
+#include "SimulationThread.h"
+#include "MemoryTracker.h"
+#include "TraceRecorder.h"
+
+SimulationThread::SimulationThread(StepFunc step)
+	: m_Step(std::move(step))
+	, m_Delta(0)
+	, m_Started(false)
+	, m_Quit(false)
+	, m_Thread(&SimulationThread::Loop, this)
+{}
+
+SimulationThread::~SimulationThread()
+{
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Quit = true;
+	}
+	m_Signal.notify_all();
+	m_Thread.join();
+}
+
+void SimulationThread::Start(float delta)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Delta = delta;
+		m_Started = true;
+	}
+	m_Signal.notify_all();
+}
+
+void SimulationThread::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Signal.wait(lock, [this]() { return !m_Started; });
+}
+
+void SimulationThread::Loop()
+{
+	MemoryTracker::SetThreadName("Simulation");
+	TraceRecorder::SetThreadName("Simulation");
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	for (;;)
+	{
+		m_Signal.wait(lock, [this]() { return m_Started || m_Quit; });
+		if (m_Quit)
+			return;
+
+		const auto delta = m_Delta;
+		lock.unlock();
+		m_Step(delta);
+		lock.lock();
+
+		m_Started = false;
+		m_Signal.notify_all();
+	}
+}
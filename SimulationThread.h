@@ -0,0 +1,37 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// A thread that runs one simulation step at a time, in parallel with the
+// thread that started it. Start and Wait are called from one thread, which
+// can touch what the step uses only between Wait and the next Start.
+class SimulationThread
+{
+public:
+	typedef std::function<void(float)> StepFunc;
+
+	explicit SimulationThread(StepFunc step);
+	// Finishes the running step
+	~SimulationThread();
+
+	// Runs a step of delta seconds - the previous one must have been waited for
+	void Start(float delta);
+	// Returns when the last started step is done
+	void Wait();
+
+private:
+	void Loop();
+
+	StepFunc m_Step;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Signal;
+	float m_Delta;
+	bool m_Started;
+	bool m_Quit;
+
+	std::thread m_Thread;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+// Hands frames from one producer thread to one consumer thread through a
+// fixed ring of slots without locks. The producer fills the slot it gets from
+// BeginWrite and publishes it with EndWrite; the consumer gets the published
+// slots in order from BeginRead and gives each back with EndRead. A slot is
+// reused only after it's given back, so the contents (and the capacity of
+// any vectors in them) live on from frame to frame.
+//
+// The producer can't get more than SLOTS frames ahead of the consumer - with
+// the slot being read that's SLOTS - 1 frames queued at most.
+template<typename T, unsigned SLOTS>
+class SnapshotQueue
+{
+public:
+	static_assert(SLOTS >= 2, "A slot to write and one to read at least");
+
+	SnapshotQueue()
+		: m_Written(0)
+		, m_Read(0)
+	{}
+
+	// Producer - nullptr while every slot is queued or being read
+	T* TryBeginWrite()
+	{
+		const auto written = m_Written.load(std::memory_order_relaxed);
+		if (written - m_Read.load(std::memory_order_acquire) == SLOTS)
+			return nullptr;
+		return &m_Slots[written % SLOTS];
+	}
+	T* BeginWrite()
+	{
+		T* slot;
+		while (!(slot = TryBeginWrite()))
+		{
+			std::this_thread::yield();
+		}
+		return slot;
+	}
+	void EndWrite()
+	{
+		m_Written.store(m_Written.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer - nullptr while nothing is queued
+	const T* TryBeginRead()
+	{
+		const auto read = m_Read.load(std::memory_order_relaxed);
+		if (read == m_Written.load(std::memory_order_acquire))
+			return nullptr;
+		return &m_Slots[read % SLOTS];
+	}
+	const T* BeginRead()
+	{
+		const T* slot;
+		while (!(slot = TryBeginRead()))
+		{
+			std::this_thread::yield();
+		}
+		return slot;
+	}
+	void EndRead()
+	{
+		m_Read.store(m_Read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Published and not given back yet, the slot being read included
+	unsigned GetQueuedCount() const
+	{
+		return m_Written.load(std::memory_order_acquire) - m_Read.load(std::memory_order_acquire);
+	}
+
+private:
+	T m_Slots[SLOTS];
+
+	// Slots ever published and given back - they only grow and wrap together
+	std::atomic<unsigned> m_Written;
+	std::atomic<unsigned> m_Read;
+};
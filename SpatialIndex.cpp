@@ -0,0 +1,398 @@
+#include "precompiled.h"
+
+#include "SpatialIndex.h"
+
+namespace {
+	typedef BoundsHierarchy::Box Box;
+
+	// All testers tell how up to 8 boxes relate to the query at once - 0 out
+	// of it, 1 intersecting it and 2 in it, like SpatialIndex::Overlap
+	struct FrustumTester
+	{
+		explicit FrustumTester(const CullingKernel::FrustumPlanes& planes)
+			: Planes(planes)
+		{}
+
+		void operator()(const Box* boxes, unsigned count, unsigned* outOverlaps) const
+		{
+			CullingKernel::Boxes8 packed;
+			for (auto i = 0u; i < count; ++i)
+			{
+				packed.MinX[i] = boxes[i].Min[0];
+				packed.MinY[i] = boxes[i].Min[1];
+				packed.MinZ[i] = boxes[i].Min[2];
+				packed.MaxX[i] = boxes[i].Max[0];
+				packed.MaxY[i] = boxes[i].Max[1];
+				packed.MaxZ[i] = boxes[i].Max[2];
+			}
+			unsigned inside = 0;
+			const auto visible = CullingKernel::TestBoxes(Planes, packed, count, inside);
+			for (auto i = 0u; i < count; ++i)
+			{
+				outOverlaps[i] = (inside & (1u << i)) ? 2 : (visible & (1u << i)) ? 1 : 0;
+			}
+		}
+
+		const CullingKernel::FrustumPlanes& Planes;
+	};
+
+	struct SphereTester
+	{
+		SphereTester(const float* center, float radius)
+			: Center(center)
+			, RadiusSq(radius * radius)
+		{}
+
+		void operator()(const Box* boxes, unsigned count, unsigned* outOverlaps) const
+		{
+			for (auto i = 0u; i < count; ++i)
+			{
+				// Nearest point of the box for the intersection, farthest corner for containment
+				float nearSq = 0;
+				float farSq = 0;
+				for (auto axis = 0u; axis < 3; ++axis)
+				{
+					const float toMin = Center[axis] - boxes[i].Min[axis];
+					const float toMax = boxes[i].Max[axis] - Center[axis];
+					const float outside = std::max(0.f, std::max(-toMin, -toMax));
+					const float farthest = std::max(std::abs(toMin), std::abs(toMax));
+					nearSq += outside * outside;
+					farSq += farthest * farthest;
+				}
+				outOverlaps[i] = nearSq > RadiusSq ? 0 : farSq <= RadiusSq ? 2 : 1;
+			}
+		}
+
+		const float* Center;
+		float RadiusSq;
+	};
+
+	struct BoxTester
+	{
+		explicit BoxTester(const Box& box)
+			: Query(box)
+		{}
+
+		void operator()(const Box* boxes, unsigned count, unsigned* outOverlaps) const
+		{
+			for (auto i = 0u; i < count; ++i)
+			{
+				bool disjoint = false;
+				bool contained = true;
+				for (auto axis = 0u; axis < 3; ++axis)
+				{
+					disjoint |= boxes[i].Min[axis] > Query.Max[axis] || boxes[i].Max[axis] < Query.Min[axis];
+					contained &= boxes[i].Min[axis] >= Query.Min[axis] && boxes[i].Max[axis] <= Query.Max[axis];
+				}
+				outOverlaps[i] = disjoint ? 0 : contained ? 2 : 1;
+			}
+		}
+
+		const Box& Query;
+	};
+}
+
+SpatialIndex::SpatialIndex(const Box& bounds, unsigned depth)
+	: m_Depth(std::max(depth, 1u))
+	, m_FreeObjects(NONE)
+	, m_ObjectsCount(0)
+{
+	m_Size = 0;
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		m_Size = std::max(m_Size, bounds.Max[axis] - bounds.Min[axis]);
+	}
+	m_Size = std::max(m_Size, std::numeric_limits<float>::min());
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		m_Origin[axis] = (bounds.Min[axis] + bounds.Max[axis] - m_Size) * 0.5f;
+	}
+
+	unsigned cellsCount = 0;
+	for (auto level = 0u; level < m_Depth; ++level)
+	{
+		m_LevelOffsets.push_back(cellsCount);
+		cellsCount += 1u << (3 * level);
+	}
+	Cell empty = { NONE, 0 };
+	m_Cells.assign(cellsCount, empty);
+}
+
+void SpatialIndex::Clear()
+{
+	Cell empty = { NONE, 0 };
+	std::fill(m_Cells.begin(), m_Cells.end(), empty);
+	m_Objects.clear();
+	m_FreeObjects = NONE;
+	m_ObjectsCount = 0;
+}
+
+unsigned SpatialIndex::GetCellIndex(unsigned level, unsigned x, unsigned y, unsigned z) const
+{
+	return m_LevelOffsets[level] + (((z << level) + y) << level) + x;
+}
+
+Box SpatialIndex::GetLooseBox(unsigned level, unsigned x, unsigned y, unsigned z) const
+{
+	const float cellSize = m_Size / float(1u << level);
+	const unsigned coords[3] = { x, y, z };
+	Box box;
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		box.Min[axis] = m_Origin[axis] + (float(coords[axis]) - 0.5f) * cellSize;
+		box.Max[axis] = m_Origin[axis] + (float(coords[axis]) + 1.5f) * cellSize;
+	}
+	return box;
+}
+
+std::uint32_t SpatialIndex::PickCell(const Box& box) const
+{
+	float extent = 0;
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		extent = std::max(extent, box.Max[axis] - box.Min[axis]);
+	}
+
+	// The deepest level whose cells are at least as big as the object - with
+	// the center in the cell the object is then in the doubled box
+	auto level = m_Depth - 1;
+	while (level > 0 && m_Size / float(1u << level) < extent)
+	{
+		--level;
+	}
+
+	const auto cellsPerAxis = 1u << level;
+	const float cellSize = m_Size / float(cellsPerAxis);
+	unsigned coords[3];
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		const float cell = std::floor(((box.Min[axis] + box.Max[axis]) * 0.5f - m_Origin[axis]) / cellSize);
+		// Out of the root cube - the root takes it
+		if (!(cell >= 0 && cell < float(cellsPerAxis)))
+			return GetCellIndex(0, 0, 0, 0);
+		coords[axis] = unsigned(cell);
+	}
+	return GetCellIndex(level, coords[0], coords[1], coords[2]);
+}
+
+void SpatialIndex::UpdateSubtreeCounts(std::uint32_t cell, int delta)
+{
+	auto level = m_Depth - 1;
+	while (cell < m_LevelOffsets[level])
+		--level;
+	const auto mask = (1u << level) - 1;
+	const auto local = cell - m_LevelOffsets[level];
+	auto x = local & mask;
+	auto y = (local >> level) & mask;
+	auto z = local >> (2 * level);
+	for (;;)
+	{
+		m_Cells[GetCellIndex(level, x, y, z)].SubtreeCount += delta;
+		if (!level)
+			break;
+		--level;
+		x >>= 1;
+		y >>= 1;
+		z >>= 1;
+	}
+}
+
+void SpatialIndex::Link(Handle handle, std::uint32_t cell)
+{
+	auto& object = m_Objects[handle];
+	object.Cell = cell;
+	object.Prev = NONE;
+	object.Next = m_Cells[cell].FirstObject;
+	if (object.Next != NONE)
+		m_Objects[object.Next].Prev = handle;
+	m_Cells[cell].FirstObject = handle;
+
+	UpdateSubtreeCounts(cell, 1);
+}
+
+void SpatialIndex::Unlink(Handle handle)
+{
+	auto& object = m_Objects[handle];
+	const auto cell = object.Cell;
+	if (object.Prev != NONE)
+		m_Objects[object.Prev].Next = object.Next;
+	else
+		m_Cells[cell].FirstObject = object.Next;
+	if (object.Next != NONE)
+		m_Objects[object.Next].Prev = object.Prev;
+
+	UpdateSubtreeCounts(cell, -1);
+	object.Cell = NONE;
+}
+
+SpatialIndex::Handle SpatialIndex::Insert(std::uint32_t type, std::uint32_t id, const Box& box)
+{
+	Handle handle;
+	if (m_FreeObjects != NONE)
+	{
+		handle = m_FreeObjects;
+		m_FreeObjects = m_Objects[handle].Next;
+	}
+	else
+	{
+		handle = Handle(m_Objects.size());
+		m_Objects.emplace_back();
+	}
+
+	auto& object = m_Objects[handle];
+	object.Box = box;
+	object.Type = type;
+	object.Id = id;
+	Link(handle, PickCell(box));
+	++m_ObjectsCount;
+	return handle;
+}
+
+void SpatialIndex::Move(Handle handle, const Box& box)
+{
+	auto& object = m_Objects[handle];
+	object.Box = box;
+	const auto cell = PickCell(box);
+	if (cell == object.Cell)
+		return;
+	Unlink(handle);
+	Link(handle, cell);
+}
+
+void SpatialIndex::Remove(Handle handle)
+{
+	Unlink(handle);
+	m_Objects[handle].Next = m_FreeObjects;
+	m_FreeObjects = handle;
+	--m_ObjectsCount;
+}
+
+void SpatialIndex::AddResult(const ObjectSlot& object, ResultArena& results)
+{
+	if (results.Count < results.Capacity)
+	{
+		results.Objects[results.Count].Type = object.Type;
+		results.Objects[results.Count].Id = object.Id;
+	}
+	++results.Count;
+}
+
+void SpatialIndex::CollectSubtree(unsigned level, unsigned x, unsigned y, unsigned z, unsigned typeMask, ResultArena& results) const
+{
+	const auto& cell = m_Cells[GetCellIndex(level, x, y, z)];
+	if (!cell.SubtreeCount)
+		return;
+	++results.CellsVisited;
+
+	for (auto handle = cell.FirstObject; handle != NONE; handle = m_Objects[handle].Next)
+	{
+		if (typeMask & TypeBit(m_Objects[handle].Type))
+			AddResult(m_Objects[handle], results);
+	}
+	if (level + 1 == m_Depth)
+		return;
+	for (auto child = 0u; child < 8; ++child)
+	{
+		CollectSubtree(level + 1, x * 2 + (child & 1), y * 2 + ((child >> 1) & 1), z * 2 + (child >> 2), typeMask, results);
+	}
+}
+
+template<typename Tester>
+void SpatialIndex::QueryCell(const Tester& tester,
+	unsigned level,
+	unsigned x,
+	unsigned y,
+	unsigned z,
+	Overlap overlap,
+	unsigned typeMask,
+	ResultArena& results) const
+{
+	if (overlap == O_Inside)
+	{
+		CollectSubtree(level, x, y, z, typeMask, results);
+		return;
+	}
+
+	const auto& cell = m_Cells[GetCellIndex(level, x, y, z)];
+	if (!cell.SubtreeCount)
+		return;
+	++results.CellsVisited;
+
+	// The objects of the cell 8 at a time
+	Box boxes[CullingKernel::BOXES_PER_TEST];
+	const ObjectSlot* objects[CullingKernel::BOXES_PER_TEST];
+	unsigned overlaps[CullingKernel::BOXES_PER_TEST];
+	unsigned count = 0;
+	auto flush = [&]() {
+		tester(boxes, count, overlaps);
+		results.ObjectsTested += count;
+		for (auto i = 0u; i < count; ++i)
+		{
+			if (overlaps[i] != O_Outside)
+				AddResult(*objects[i], results);
+		}
+		count = 0;
+	};
+	for (auto handle = cell.FirstObject; handle != NONE; handle = m_Objects[handle].Next)
+	{
+		const auto& object = m_Objects[handle];
+		if (!(typeMask & TypeBit(object.Type)))
+			continue;
+		boxes[count] = object.Box;
+		objects[count] = &object;
+		if (++count == CullingKernel::BOXES_PER_TEST)
+			flush();
+	}
+	if (count)
+		flush();
+
+	if (level + 1 == m_Depth)
+		return;
+
+	// The non-empty children in one test
+	unsigned childCoords[CullingKernel::BOXES_PER_TEST][3];
+	for (auto child = 0u; child < 8; ++child)
+	{
+		const unsigned cx = x * 2 + (child & 1);
+		const unsigned cy = y * 2 + ((child >> 1) & 1);
+		const unsigned cz = z * 2 + (child >> 2);
+		if (!m_Cells[GetCellIndex(level + 1, cx, cy, cz)].SubtreeCount)
+			continue;
+		boxes[count] = GetLooseBox(level + 1, cx, cy, cz);
+		childCoords[count][0] = cx;
+		childCoords[count][1] = cy;
+		childCoords[count][2] = cz;
+		++count;
+	}
+	if (!count)
+		return;
+	tester(boxes, count, overlaps);
+	const auto childrenCount = count;
+	for (auto i = 0u; i < childrenCount; ++i)
+	{
+		if (overlaps[i] != O_Outside)
+			QueryCell(tester, level + 1, childCoords[i][0], childCoords[i][1], childCoords[i][2], Overlap(overlaps[i]), typeMask, results);
+	}
+}
+
+template<typename Tester>
+void SpatialIndex::Query(const Tester& tester, unsigned typeMask, ResultArena& results) const
+{
+	// Objects out of the root cube are in the root - it's never accepted whole
+	QueryCell(tester, 0, 0, 0, 0, O_Partial, typeMask, results);
+}
+
+void SpatialIndex::QueryFrustum(const CullingKernel::FrustumPlanes& planes, unsigned typeMask, ResultArena& results) const
+{
+	Query(FrustumTester(planes), typeMask, results);
+}
+
+void SpatialIndex::QuerySphere(const float* center, float radius, unsigned typeMask, ResultArena& results) const
+{
+	Query(SphereTester(center, radius), typeMask, results);
+}
+
+void SpatialIndex::QueryBox(const Box& box, unsigned typeMask, ResultArena& results) const
+{
+	Query(BoxTester(box), typeMask, results);
+}
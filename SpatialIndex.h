@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "BoundsHierarchy.h"
+
+// Loose octree over objects of any kind - an object is a type, an id the
+// owner picks (usually its index in the owner's array) and a box. The cells
+// of every level are preallocated and a cell's box is doubled around it, so
+// an object goes in the cell of its center on the level that matches its
+// size. Insert, Move and Remove don't depend on the objects count.
+//
+// Queries walk the cells from the root, skip empty subtrees and report the
+// objects of cells entirely in the query without testing them. Results go
+// to storage the caller owns.
+class SpatialIndex
+{
+public:
+	typedef std::uint32_t Handle;
+	static const Handle INVALID_HANDLE = ~0u;
+
+	// Levels under the root by default - 8^5 cells on the deepest
+	static const unsigned DEFAULT_DEPTH = 6;
+
+	struct Object
+	{
+		std::uint32_t Type;
+		std::uint32_t Id;
+	};
+
+	// Caller-owned storage for the results of a query. Count goes on past
+	// Capacity - only the first Capacity objects are written.
+	struct ResultArena
+	{
+		ResultArena(Object* objects, unsigned capacity)
+			: Objects(objects)
+			, Capacity(capacity)
+			, Count(0)
+			, CellsVisited(0)
+			, ObjectsTested(0)
+		{}
+
+		bool Overflowed() const { return Count > Capacity; }
+
+		Object* Objects;
+		unsigned Capacity;
+		unsigned Count;
+		unsigned CellsVisited;
+		unsigned ObjectsTested;
+	};
+
+	// Bit of a type in the masks of the queries
+	static unsigned TypeBit(std::uint32_t type) { return 1u << type; }
+	static const unsigned ALL_TYPES = ~0u;
+
+	// The root cell is the cube around 'bounds'. Objects that stick out of it
+	// stay in the root and are tested by every query.
+	explicit SpatialIndex(const BoundsHierarchy::Box& bounds, unsigned depth = DEFAULT_DEPTH);
+
+	void Clear();
+
+	// type < 32
+	Handle Insert(std::uint32_t type, std::uint32_t id, const BoundsHierarchy::Box& box);
+	void Move(Handle handle, const BoundsHierarchy::Box& box);
+	void Remove(Handle handle);
+	// For owners that compact their arrays
+	void SetId(Handle handle, std::uint32_t id) { m_Objects[handle].Id = id; }
+
+	void QueryFrustum(const CullingKernel::FrustumPlanes& planes, unsigned typeMask, ResultArena& results) const;
+	void QuerySphere(const float* center, float radius, unsigned typeMask, ResultArena& results) const;
+	void QueryBox(const BoundsHierarchy::Box& box, unsigned typeMask, ResultArena& results) const;
+
+	unsigned GetObjectsCount() const { return m_ObjectsCount; }
+	unsigned GetCellsCount() const { return unsigned(m_Cells.size()); }
+
+private:
+	static const std::uint32_t NONE = ~0u;
+
+	struct Cell
+	{
+		std::uint32_t FirstObject;
+		// Objects in the cell and all cells under it
+		std::uint32_t SubtreeCount;
+	};
+
+	struct ObjectSlot
+	{
+		BoundsHierarchy::Box Box;
+		std::uint32_t Type;
+		std::uint32_t Id;
+		// NONE for a free slot
+		std::uint32_t Cell;
+		// In the cell's list or the free list
+		std::uint32_t Next;
+		std::uint32_t Prev;
+	};
+
+	// How a cell or object relates to the query
+	enum Overlap
+	{
+		O_Outside = 0,
+		O_Partial = 1,
+		O_Inside = 2,
+	};
+
+	unsigned GetCellIndex(unsigned level, unsigned x, unsigned y, unsigned z) const;
+	BoundsHierarchy::Box GetLooseBox(unsigned level, unsigned x, unsigned y, unsigned z) const;
+	std::uint32_t PickCell(const BoundsHierarchy::Box& box) const;
+	void UpdateSubtreeCounts(std::uint32_t cell, int delta);
+	void Link(Handle handle, std::uint32_t cell);
+	void Unlink(Handle handle);
+
+	// 'tester' gives the Overlap of up to 8 boxes with the query
+	template<typename Tester>
+	void Query(const Tester& tester, unsigned typeMask, ResultArena& results) const;
+	template<typename Tester>
+	void QueryCell(const Tester& tester, unsigned level, unsigned x, unsigned y, unsigned z, Overlap overlap, unsigned typeMask, ResultArena& results) const;
+	void CollectSubtree(unsigned level, unsigned x, unsigned y, unsigned z, unsigned typeMask, ResultArena& results) const;
+	static void AddResult(const ObjectSlot& object, ResultArena& results);
+
+	float m_Origin[3];
+	float m_Size;
+	unsigned m_Depth;
+	// Index of the first cell of every level
+	std::vector<unsigned> m_LevelOffsets;
+	std::vector<Cell> m_Cells;
+
+	std::vector<ObjectSlot> m_Objects;
+	std::uint32_t m_FreeObjects;
+	unsigned m_ObjectsCount;
+};
@@ -0,0 +1,207 @@
+#include "precompiled.h"
+
+#include "StateCache.h"
+
+#include <cstring>
+#include <algorithm>
+
+StateCache::StateCache(StateContext* context)
+	: m_Context(context)
+{
+	ResetStats();
+	Invalidate();
+}
+
+void StateCache::Invalidate()
+{
+	// Known is false in all of them
+	::memset(&m_InputLayout, 0, sizeof(m_InputLayout));
+	::memset(m_VertexBuffers, 0, sizeof(m_VertexBuffers));
+	::memset(&m_IndexBuffer, 0, sizeof(m_IndexBuffer));
+	::memset(m_Shaders, 0, sizeof(m_Shaders));
+	::memset(m_Resources, 0, sizeof(m_Resources));
+	::memset(m_Samplers, 0, sizeof(m_Samplers));
+	::memset(m_UAVs, 0, sizeof(m_UAVs));
+	::memset(m_ConstantBuffers, 0, sizeof(m_ConstantBuffers));
+	::memset(&m_DepthState, 0, sizeof(m_DepthState));
+	m_StencilRef = 0;
+	::memset(&m_RasterState, 0, sizeof(m_RasterState));
+}
+
+StateCache::Stats StateCache::ResetStats()
+{
+	const auto stats = m_Stats;
+	::memset(&m_Stats, 0, sizeof(m_Stats));
+	return stats;
+}
+
+bool StateCache::Filter(Slot& slot, Handle value)
+{
+	++m_Stats.Calls;
+	if (slot.Known && slot.Value == value)
+	{
+		++m_Stats.CallsFiltered;
+		return false;
+	}
+	slot.Value = value;
+	slot.Known = true;
+	return true;
+}
+
+bool StateCache::FilterRange(Slot* shadow, unsigned shadowCount, unsigned& first, unsigned& count, Handle const*& values)
+{
+	++m_Stats.Calls;
+	m_Stats.Slots += count;
+
+	// Slots past the shadow are never filtered
+	auto changedFirst = count;
+	auto changedLast = 0u;
+	for (auto i = 0u; i < count; ++i)
+	{
+		const auto slot = first + i;
+		if (slot < shadowCount)
+		{
+			if (shadow[slot].Known && shadow[slot].Value == values[i])
+				continue;
+			shadow[slot].Value = values[i];
+			shadow[slot].Known = true;
+		}
+		changedFirst = std::min(changedFirst, i);
+		changedLast = i;
+	}
+
+	if (changedFirst == count)
+	{
+		++m_Stats.CallsFiltered;
+		m_Stats.SlotsFiltered += count;
+		return false;
+	}
+
+	// One call for the changed span - unchanged slots inside it go again
+	const auto changedCount = changedLast - changedFirst + 1;
+	m_Stats.SlotsFiltered += count - changedCount;
+	first += changedFirst;
+	values += changedFirst;
+	count = changedCount;
+	return true;
+}
+
+void StateCache::SetInputLayout(Handle layout)
+{
+	if (Filter(m_InputLayout, layout))
+	{
+		m_Context->SetInputLayout(layout);
+	}
+}
+
+void StateCache::SetVertexBuffer(unsigned slot, Handle buffer, unsigned stride, unsigned offset)
+{
+	++m_Stats.Calls;
+	++m_Stats.Slots;
+	if (slot < VERTEX_BUFFERS_COUNT)
+	{
+		auto& shadow = m_VertexBuffers[slot];
+		if (shadow.Known && shadow.Buffer == buffer && shadow.Stride == stride && shadow.Offset == offset)
+		{
+			++m_Stats.CallsFiltered;
+			++m_Stats.SlotsFiltered;
+			return;
+		}
+		shadow.Buffer = buffer;
+		shadow.Stride = stride;
+		shadow.Offset = offset;
+		shadow.Known = true;
+	}
+	m_Context->SetVertexBuffer(slot, buffer, stride, offset);
+}
+
+void StateCache::SetIndexBuffer(Handle buffer, unsigned format, unsigned offset)
+{
+	++m_Stats.Calls;
+	auto& shadow = m_IndexBuffer;
+	if (shadow.Known && shadow.Buffer == buffer && shadow.Format == format && shadow.Offset == offset)
+	{
+		++m_Stats.CallsFiltered;
+		return;
+	}
+	shadow.Buffer = buffer;
+	shadow.Format = format;
+	shadow.Offset = offset;
+	shadow.Known = true;
+	m_Context->SetIndexBuffer(buffer, format, offset);
+}
+
+void StateCache::SetShader(ShaderStage stage, Handle shader)
+{
+	if (Filter(m_Shaders[stage], shader))
+	{
+		m_Context->SetShader(stage, shader);
+	}
+}
+
+void StateCache::SetResources(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* views)
+{
+	if (FilterRange(m_Resources[stage], RESOURCES_COUNT, firstSlot, count, views))
+	{
+		m_Context->SetResources(stage, firstSlot, count, views);
+	}
+}
+
+void StateCache::SetSamplers(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* samplers)
+{
+	if (FilterRange(m_Samplers[stage], SAMPLERS_COUNT, firstSlot, count, samplers))
+	{
+		m_Context->SetSamplers(stage, firstSlot, count, samplers);
+	}
+}
+
+void StateCache::SetUnorderedAccessViews(unsigned firstSlot, unsigned count, Handle const* views)
+{
+	if (FilterRange(m_UAVs, UAVS_COUNT, firstSlot, count, views))
+	{
+		m_Context->SetUnorderedAccessViews(firstSlot, count, views);
+	}
+}
+
+void StateCache::SetConstantBuffer(ShaderStage stage, unsigned slot, Handle buffer, unsigned firstConstant, unsigned constantsCount)
+{
+	++m_Stats.Calls;
+	++m_Stats.Slots;
+	if (slot < CONSTANT_BUFFERS_COUNT)
+	{
+		auto& shadow = m_ConstantBuffers[stage][slot];
+		if (shadow.Known && shadow.Buffer == buffer && shadow.FirstConstant == firstConstant && shadow.ConstantsCount == constantsCount)
+		{
+			++m_Stats.CallsFiltered;
+			++m_Stats.SlotsFiltered;
+			return;
+		}
+		shadow.Buffer = buffer;
+		shadow.FirstConstant = firstConstant;
+		shadow.ConstantsCount = constantsCount;
+		shadow.Known = true;
+	}
+	m_Context->SetConstantBuffer(stage, slot, buffer, firstConstant, constantsCount);
+}
+
+void StateCache::SetDepthState(Handle state, unsigned stencilRef)
+{
+	++m_Stats.Calls;
+	if (m_DepthState.Known && m_DepthState.Value == state && m_StencilRef == stencilRef)
+	{
+		++m_Stats.CallsFiltered;
+		return;
+	}
+	m_DepthState.Value = state;
+	m_DepthState.Known = true;
+	m_StencilRef = stencilRef;
+	m_Context->SetDepthState(state, stencilRef);
+}
+
+void StateCache::SetRasterState(Handle state)
+{
+	if (Filter(m_RasterState, state))
+	{
+		m_Context->SetRasterState(state);
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "CommandStream.h"
+
+// Where the state that got through the cache goes, along with the commands
+// that aren't state - the D3D11 context in the renderer (D3D11StateContext),
+// anything recording the calls elsewhere. Handles are the same opaque handles
+// the command streams carry.
+class StateContext
+{
+public:
+	typedef CommandStream::Handle Handle;
+	typedef CommandStream::ShaderStage ShaderStage;
+
+	virtual ~StateContext() {}
+
+	virtual void SetInputLayout(Handle layout) = 0;
+	virtual void SetVertexBuffer(unsigned slot, Handle buffer, unsigned stride, unsigned offset) = 0;
+	virtual void SetIndexBuffer(Handle buffer, unsigned format, unsigned offset) = 0;
+	virtual void SetShader(ShaderStage stage, Handle shader) = 0;
+	virtual void SetResources(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* views) = 0;
+	virtual void SetSamplers(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* samplers) = 0;
+	virtual void SetUnorderedAccessViews(unsigned firstSlot, unsigned count, Handle const* views) = 0;
+	// 0 constants - the whole buffer
+	virtual void SetConstantBuffer(ShaderStage stage, unsigned slot, Handle buffer, unsigned firstConstant, unsigned constantsCount) = 0;
+	virtual void SetDepthState(Handle state, unsigned stencilRef) = 0;
+	virtual void SetRasterState(Handle state) = 0;
+
+	// Never filtered - CommandReplayer passes them straight on
+	virtual void UpdateBuffer(Handle buffer, const void* data, unsigned size) = 0;
+	virtual void DrawIndexedInstanced(unsigned indicesCount, unsigned instancesCount, unsigned firstIndex, int baseVertex, unsigned firstInstance) = 0;
+	virtual void DrawIndexedInstancedIndirect(Handle arguments, unsigned offset) = 0;
+	virtual void Dispatch(unsigned x, unsigned y, unsigned z) = 0;
+};
+
+// Shadows the state bound on a context and passes on only what changes. A
+// range of views or samplers is trimmed to the slots that differ, so
+// rebinding eight textures where one changed submits that one. Anything
+// that sets state on the context behind the cache's back must be followed
+// by Invalidate - the cache then assumes nothing is known to be bound.
+class StateCache
+{
+public:
+	typedef CommandStream::Handle Handle;
+	typedef CommandStream::ShaderStage ShaderStage;
+
+	static const unsigned STAGES_COUNT = CommandStream::SS_Compute + 1;
+	// Slots shadowed per stage - binds past them always go through
+	static const unsigned VERTEX_BUFFERS_COUNT = 4;
+	static const unsigned RESOURCES_COUNT = 16;
+	static const unsigned SAMPLERS_COUNT = 8;
+	static const unsigned UAVS_COUNT = 8;
+	static const unsigned CONSTANT_BUFFERS_COUNT = 8;
+
+	struct Stats
+	{
+		// Set calls made on the cache and how many of them changed nothing
+		unsigned Calls;
+		unsigned CallsFiltered;
+		// View, sampler and buffer slots passed in and how many were already bound
+		unsigned Slots;
+		unsigned SlotsFiltered;
+	};
+
+	explicit StateCache(StateContext* context);
+
+	void Invalidate();
+
+	void SetInputLayout(Handle layout);
+	void SetVertexBuffer(unsigned slot, Handle buffer, unsigned stride, unsigned offset);
+	void SetIndexBuffer(Handle buffer, unsigned format, unsigned offset);
+	void SetShader(ShaderStage stage, Handle shader);
+	void SetResources(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* views);
+	void SetSamplers(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* samplers);
+	void SetUnorderedAccessViews(unsigned firstSlot, unsigned count, Handle const* views);
+	void SetConstantBuffer(ShaderStage stage, unsigned slot, Handle buffer, unsigned firstConstant, unsigned constantsCount);
+	void SetDepthState(Handle state, unsigned stencilRef);
+	void SetRasterState(Handle state);
+
+	// Counters since the last call
+	Stats ResetStats();
+
+private:
+	// A slot's value and whether it's known at all since the last Invalidate
+	struct Slot
+	{
+		Handle Value;
+		bool Known;
+	};
+	struct VertexBuffer
+	{
+		Handle Buffer;
+		unsigned Stride;
+		unsigned Offset;
+		bool Known;
+	};
+	struct IndexBuffer
+	{
+		Handle Buffer;
+		unsigned Format;
+		unsigned Offset;
+		bool Known;
+	};
+	struct ConstantBuffer
+	{
+		Handle Buffer;
+		unsigned FirstConstant;
+		unsigned ConstantsCount;
+		bool Known;
+	};
+
+	// Counts the call and updates the shadow - false if nothing changed
+	bool Filter(Slot& slot, Handle value);
+	// Updates the shadow of the slots and narrows [first, first + count) to
+	// the ones that changed - false if none did
+	bool FilterRange(Slot* shadow, unsigned shadowCount, unsigned& first, unsigned& count, Handle const*& values);
+
+	StateContext* m_Context;
+	Stats m_Stats;
+
+	Slot m_InputLayout;
+	VertexBuffer m_VertexBuffers[VERTEX_BUFFERS_COUNT];
+	IndexBuffer m_IndexBuffer;
+	Slot m_Shaders[STAGES_COUNT];
+	Slot m_Resources[STAGES_COUNT][RESOURCES_COUNT];
+	Slot m_Samplers[STAGES_COUNT][SAMPLERS_COUNT];
+	Slot m_UAVs[UAVS_COUNT];
+	ConstantBuffer m_ConstantBuffers[STAGES_COUNT][CONSTANT_BUFFERS_COUNT];
+	Slot m_DepthState;
+	unsigned m_StencilRef;
+	Slot m_RasterState;
+};
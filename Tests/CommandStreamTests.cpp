@@ -0,0 +1,249 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "RecordingContext.h"
+#include "CommandStream.h"
+#include "CommandReplayer.h"
+
+#include <cstring>
+
+namespace {
+	typedef CommandStream CS;
+
+	CS::Handle H(unsigned id)
+	{
+		return RecordingContext::MakeHandle(id);
+	}
+
+	const std::uint8_t CONSTANTS[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+
+	// One command of every type
+	void RecordSequence(CommandStream& stream)
+	{
+		const CS::Handle views[] = { H(5), H(6) };
+		const CS::Handle samplers[] = { H(7) };
+		const CS::Handle uavs[] = { H(8), H(9), H(10) };
+		stream.RecordSetInputLayout(H(1));
+		stream.RecordSetVertexBuffer(1, H(2), 32, 64);
+		stream.RecordSetIndexBuffer(H(3), 57, 128);
+		stream.RecordSetShader(CS::SS_Pixel, H(4));
+		stream.RecordSetResources(CS::SS_Pixel, 2, 2, views);
+		stream.RecordSetSamplers(CS::SS_Pixel, 0, 1, samplers);
+		stream.RecordSetUnorderedAccessViews(1, 3, uavs);
+		stream.RecordSetConstantBuffer(CS::SS_Vertex, 3, H(11), 16, 4);
+		stream.RecordSetDepthState(H(12), 5);
+		stream.RecordSetRasterState(H(13));
+		stream.RecordUpdateBuffer(H(14), CONSTANTS, sizeof(CONSTANTS));
+		stream.RecordDrawIndexedInstanced(36, 2, 6, -4, 1);
+		stream.RecordDrawIndexedInstancedIndirect(H(15), 20);
+		stream.RecordDispatch(4, 2, 1);
+	}
+
+	// The headers of RecordSequence - the sizes for 64 and 32 bit handles
+	struct GoldenHeader
+	{
+		CS::CommandType Type;
+		std::uint16_t Size64;
+		std::uint16_t Size32;
+	};
+	const GoldenHeader GOLDEN_HEADERS[] = {
+		{ CS::CT_SetInputLayout, 16, 16 },
+		{ CS::CT_SetVertexBuffer, 32, 24 },
+		{ CS::CT_SetIndexBuffer, 24, 24 },
+		{ CS::CT_SetShader, 24, 16 },
+		{ CS::CT_SetResources, 88, 56 },
+		{ CS::CT_SetSamplers, 88, 56 },
+		{ CS::CT_SetUnorderedAccessViews, 80, 48 },
+		{ CS::CT_SetConstantBuffer, 32, 32 },
+		{ CS::CT_SetDepthState, 24, 16 },
+		{ CS::CT_SetRasterState, 16, 16 },
+		{ CS::CT_UpdateBuffer, 40, 32 },
+		{ CS::CT_DrawIndexedInstanced, 32, 32 },
+		{ CS::CT_DrawIndexedInstancedIndirect, 24, 16 },
+		{ CS::CT_Dispatch, 24, 24 },
+	};
+	const unsigned GOLDEN_COUNT = sizeof(GOLDEN_HEADERS) / sizeof(GOLDEN_HEADERS[0]);
+
+	// What the sequence does on a context that has nothing bound
+	const char* const GOLDEN_CALLS[] = {
+		"SetInputLayout #1",
+		"SetVertexBuffer 1 #2 32 64",
+		"SetIndexBuffer #3 57 128",
+		"SetShader 1 #4",
+		"SetResources 1 2 #5 #6",
+		"SetSamplers 1 0 #7",
+		"SetUnorderedAccessViews 1 #8 #9 #10",
+		"SetConstantBuffer 0 3 #11 16 4",
+		"SetDepthState #12 5",
+		"SetRasterState #13",
+		"UpdateBuffer #14 0102030405060708090a0b0c",
+		"DrawIndexedInstanced 36 2 6 -4 1",
+		"DrawIndexedInstancedIndirect #15 20",
+		"Dispatch 4 2 1",
+	};
+
+	// Takes the calls and counts them - for the benchmark
+	class NullContext : public StateContext
+	{
+	public:
+		NullContext()
+			: Calls(0)
+		{}
+
+		unsigned Calls;
+
+		virtual void SetInputLayout(Handle) override { ++Calls; }
+		virtual void SetVertexBuffer(unsigned, Handle, unsigned, unsigned) override { ++Calls; }
+		virtual void SetIndexBuffer(Handle, unsigned, unsigned) override { ++Calls; }
+		virtual void SetShader(ShaderStage, Handle) override { ++Calls; }
+		virtual void SetResources(ShaderStage, unsigned, unsigned, Handle const*) override { ++Calls; }
+		virtual void SetSamplers(ShaderStage, unsigned, unsigned, Handle const*) override { ++Calls; }
+		virtual void SetUnorderedAccessViews(unsigned, unsigned, Handle const*) override { ++Calls; }
+		virtual void SetConstantBuffer(ShaderStage, unsigned, Handle, unsigned, unsigned) override { ++Calls; }
+		virtual void SetDepthState(Handle, unsigned) override { ++Calls; }
+		virtual void SetRasterState(Handle) override { ++Calls; }
+		virtual void UpdateBuffer(Handle, const void*, unsigned) override { ++Calls; }
+		virtual void DrawIndexedInstanced(unsigned, unsigned, unsigned, int, unsigned) override { ++Calls; }
+		virtual void DrawIndexedInstancedIndirect(Handle, unsigned) override { ++Calls; }
+		virtual void Dispatch(unsigned, unsigned, unsigned) override { ++Calls; }
+	};
+}
+
+TEST_CASE(CommandStreamGolden)
+{
+	CommandStream stream;
+	CHECK(stream.GetFirst() == nullptr);
+	RecordSequence(stream);
+	CHECK(stream.GetCommandsCount() == GOLDEN_COUNT);
+	CHECK(stream.GetDrawsCount() == 2);
+
+	size_t size = 0;
+	auto command = stream.GetFirst();
+	for (auto i = 0u; i < GOLDEN_COUNT; ++i)
+	{
+		CHECK(command != nullptr);
+		if (!command)
+			return;
+		const auto& golden = GOLDEN_HEADERS[i];
+		CHECK(command->Type == golden.Type);
+		CHECK(command->Size == (sizeof(CS::Handle) == 8 ? golden.Size64 : golden.Size32));
+		size += command->Size;
+		command = stream.GetNext(command);
+	}
+	CHECK(command == nullptr);
+	CHECK(stream.GetSize() == size);
+
+	// The arguments, a command of each layout
+	command = stream.GetFirst();
+	command = stream.GetNext(command);
+	const auto& vertexBuffer = CS::GetCommand<CS::SetVertexBuffer>(command);
+	CHECK(vertexBuffer.Buffer == H(2) && vertexBuffer.Slot == 1 && vertexBuffer.Stride == 32 && vertexBuffer.Offset == 64);
+	command = stream.GetNext(stream.GetNext(stream.GetNext(command)));
+	const auto& resources = CS::GetCommand<CS::SetResources>(command);
+	CHECK(resources.Stage == CS::SS_Pixel && resources.FirstSlot == 2 && resources.Count == 2);
+	CHECK(resources.Views[0] == H(5) && resources.Views[1] == H(6) && resources.Views[2] == nullptr);
+	for (auto i = 0u; i < 6; ++i)
+	{
+		command = stream.GetNext(command);
+	}
+	const auto& update = CS::GetCommand<CS::UpdateBuffer>(command);
+	CHECK(update.Buffer == H(14) && update.DataSize == sizeof(CONSTANTS));
+	CHECK(std::memcmp(CS::GetPayload(command, sizeof(CS::UpdateBuffer)), CONSTANTS, sizeof(CONSTANTS)) == 0);
+	command = stream.GetNext(command);
+	const auto& draw = CS::GetCommand<CS::DrawIndexedInstanced>(command);
+	CHECK(draw.IndicesCount == 36 && draw.InstancesCount == 2 && draw.FirstIndex == 6 && draw.BaseVertex == -4 && draw.FirstInstance == 1);
+
+	// Same commands compare equal, padding included
+	CommandStream same;
+	RecordSequence(same);
+	CHECK(same == stream);
+	same.RecordDispatch(1, 1, 1);
+	CHECK(same != stream);
+	same.Clear();
+	CHECK(same.GetFirst() == nullptr && same.GetCommandsCount() == 0 && same.GetDrawsCount() == 0);
+
+	// Too big for a command - nothing is recorded
+	std::vector<std::uint8_t> big(0x10000);
+	CHECK(!same.RecordUpdateBuffer(H(1), big.data(), unsigned(big.size())));
+	CHECK(same.GetSize() == 0);
+}
+
+TEST_CASE(CommandReplayerCalls)
+{
+	CommandStream stream;
+	RecordSequence(stream);
+
+	RecordingContext context;
+	CommandReplayer replayer(&context);
+	replayer.Replay(stream);
+	CHECK(context.Calls.size() == GOLDEN_COUNT);
+	for (auto i = 0u; i < std::min(GOLDEN_COUNT, unsigned(context.Calls.size())); ++i)
+	{
+		CHECK(context.Calls[i] == GOLDEN_CALLS[i]);
+	}
+
+	// Again - the state is bound already, the rest goes through
+	context.Calls.clear();
+	replayer.Replay(stream);
+	const std::vector<std::string> repeated(GOLDEN_CALLS + 10, GOLDEN_CALLS + GOLDEN_COUNT);
+	CHECK(context.Calls == repeated);
+
+	// Unless the state may have changed behind the replayer's back
+	context.Calls.clear();
+	replayer.Invalidate();
+	replayer.Replay(stream);
+	const std::vector<std::string> all(GOLDEN_CALLS, GOLDEN_CALLS + GOLDEN_COUNT);
+	CHECK(context.Calls == all);
+
+	const auto stats = replayer.ResetStats();
+	CHECK(stats.Commands == 3 * GOLDEN_COUNT);
+	CHECK(stats.State.Calls == 3 * 10);
+	CHECK(stats.State.CallsFiltered == 10);
+	CHECK(replayer.ResetStats().Commands == 0);
+}
+
+// Recording and replaying the static draws of a frame - the state of every
+// draw recorded in full as DrawRoutine does, 64 materials over 16 meshes
+BENCHMARK(CommandStreamSubmission)
+{
+	static const unsigned DRAWS_COUNT = 20000;
+	static const unsigned MATERIALS_COUNT = 64;
+	static const unsigned MESHES_COUNT = 16;
+
+	CommandStream stream;
+	auto record = [&stream]() {
+		stream.Clear();
+		stream.RecordSetInputLayout(H(1));
+		stream.RecordSetShader(CS::SS_Vertex, H(2));
+		stream.RecordSetShader(CS::SS_Pixel, H(3));
+		for (auto draw = 0u; draw < DRAWS_COUNT; ++draw)
+		{
+			// Sorted by material, the meshes cycle under it
+			const auto material = draw * MATERIALS_COUNT / DRAWS_COUNT;
+			const auto mesh = draw % MESHES_COUNT;
+			const CS::Handle textures[] = { H(100 + material * 4), H(101 + material * 4), H(102 + material * 4), H(103 + material * 4) };
+			stream.RecordSetVertexBuffer(0, H(1000 + mesh), 32, 0);
+			stream.RecordSetIndexBuffer(H(2000 + mesh), 42, 0);
+			stream.RecordSetResources(CS::SS_Pixel, 0, 4, textures);
+			stream.RecordSetConstantBuffer(CS::SS_Vertex, 1, H(3000), draw * 16, 16);
+			stream.RecordDrawIndexedInstanced(300, 1, 0, 0, 0);
+		}
+	};
+	const auto recording = Test::Measure(21, record);
+
+	NullContext context;
+	CommandReplayer replayer(&context);
+	const auto replaying = Test::Measure(21, [&]() {
+		replayer.Invalidate();
+		replayer.Replay(stream);
+	});
+	const auto stats = replayer.ResetStats();
+	CHECK(stream.GetDrawsCount() == DRAWS_COUNT);
+
+	char name[96];
+	std::snprintf(name, sizeof(name), "Record %u draws (%u KB)", DRAWS_COUNT, unsigned(stream.GetSize() / 1024));
+	Test::ReportTime(name, recording);
+	std::snprintf(name, sizeof(name), "Replay %u draws (%u of %u state calls filtered)", DRAWS_COUNT,
+		stats.State.CallsFiltered / 21, stats.State.Calls / 21);
+	Test::ReportTime(name, replaying);
+}
@@ -0,0 +1,154 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "CullingKernel.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace {
+	// A row-vector perspective projection looking down +z from 'eye', D3D
+	// clip space
+	void MakeViewProjection(float eyeX, float eyeY, float eyeZ, float* outMatrix)
+	{
+		const float nearPlane = 0.5f;
+		const float farPlane = 300.f;
+		const float yScale = 1.f / std::tan(0.5f);
+		const float xScale = yScale * 9.f / 16.f;
+		const float zScale = farPlane / (farPlane - nearPlane);
+		const float matrix[16] = {
+			xScale, 0, 0, 0,
+			0, yScale, 0, 0,
+			0, 0, zScale, 1,
+			-eyeX * xScale, -eyeY * yScale, -eyeZ * zScale - nearPlane * zScale, -eyeZ,
+		};
+		std::copy(matrix, matrix + 16, outMatrix);
+	}
+
+	void RandomBoxes(std::mt19937& random, float extent, CullingKernel::Boxes8& outBoxes)
+	{
+		std::uniform_real_distribution<float> center(-extent, extent);
+		std::uniform_real_distribution<float> size(0.f, extent * 0.1f);
+		for (auto box = 0u; box < CullingKernel::BOXES_PER_TEST; ++box)
+		{
+			const float x = center(random), y = center(random), z = center(random) + extent;
+			outBoxes.MinX[box] = x - size(random);
+			outBoxes.MinY[box] = y - size(random);
+			outBoxes.MinZ[box] = z - size(random);
+			outBoxes.MaxX[box] = x + size(random);
+			outBoxes.MaxY[box] = y + size(random);
+			outBoxes.MaxZ[box] = z + size(random);
+		}
+	}
+
+	unsigned CompareVersions(const CullingKernel::FrustumPlanes& planes, const CullingKernel::Boxes8& boxes, unsigned count)
+	{
+		unsigned scalarInside = 0;
+		unsigned avx2Inside = 0;
+		const auto scalar = CullingKernel::TestBoxesScalar(planes, boxes, count, scalarInside);
+		const auto avx2 = CullingKernel::TestBoxesAVX2(planes, boxes, count, avx2Inside);
+		CHECK(scalar == avx2);
+		CHECK(scalarInside == avx2Inside);
+		CHECK((scalarInside & ~scalar) == 0);
+		CHECK(scalar < (1u << count));
+		return scalar;
+	}
+}
+
+TEST_CASE(CullingKernelFrustum)
+{
+	float viewProjection[16];
+	MakeViewProjection(0, 0, 0, viewProjection);
+	CullingKernel::FrustumPlanes planes;
+	CullingKernel::ExtractPlanes(viewProjection, planes);
+
+	CullingKernel::Boxes8 boxes;
+	const float box[][6] = {
+		{ -1, -1, 10, 1, 1, 12 },       // in front - inside
+		{ -1, -1, -12, 1, 1, -10 },     // behind
+		{ -1, -1, 0, 1, 1, 1 },         // across the near plane
+		{ -1, -1, 299, 1, 1, 301 },     // across the far plane
+		{ 500, -1, 10, 502, 1, 12 },    // far to the right
+		{ -1, -1, 400, 1, 1, 401 },     // past the far plane
+		{ -100, -100, 50, 100, 100, 60 }, // around the view
+		{ 9, -1, 10, 11, 1, 12 },       // across the right plane
+	};
+	for (auto i = 0u; i < CullingKernel::BOXES_PER_TEST; ++i)
+	{
+		boxes.MinX[i] = box[i][0]; boxes.MinY[i] = box[i][1]; boxes.MinZ[i] = box[i][2];
+		boxes.MaxX[i] = box[i][3]; boxes.MaxY[i] = box[i][4]; boxes.MaxZ[i] = box[i][5];
+	}
+
+	unsigned inside = 0;
+	const auto visible = CullingKernel::TestBoxesScalar(planes, boxes, 8, inside);
+	CHECK(visible == ((1u << 0) | (1u << 2) | (1u << 3) | (1u << 6) | (1u << 7)));
+	CHECK(inside == (1u << 0));
+
+	// Boxes past count are never reported
+	CHECK(CullingKernel::TestBoxesScalar(planes, boxes, 1, inside) == 1u);
+
+	if (CullingKernel::IsUsingAVX2())
+	{
+		CompareVersions(planes, boxes, 8);
+	}
+}
+
+// The AVX2 version has to pick exactly the boxes the scalar one does, also
+// those that only touch a plane
+TEST_CASE(CullingKernelAVX2MatchesScalar)
+{
+	if (!CullingKernel::IsUsingAVX2())
+	{
+		std::printf("  no AVX2 - skipped\n");
+		return;
+	}
+
+	std::mt19937 random(29);
+	std::uniform_real_distribution<float> eye(-20.f, 20.f);
+	std::uniform_int_distribution<unsigned> counts(1, CullingKernel::BOXES_PER_TEST);
+	CullingKernel::FrustumPlanes planes;
+	CullingKernel::Boxes8 boxes;
+	auto visibleTests = 0u;
+	auto culledTests = 0u;
+	for (auto test = 0u; test < 200000; ++test)
+	{
+		if (test % 64 == 0)
+		{
+			float viewProjection[16];
+			MakeViewProjection(eye(random), eye(random), eye(random), viewProjection);
+			CullingKernel::ExtractPlanes(viewProjection, planes);
+		}
+		RandomBoxes(random, 100.f, boxes);
+		const auto count = counts(random);
+		const auto visible = CompareVersions(planes, boxes, count);
+		visibleTests += visible != 0;
+		culledTests += visible != (1u << count) - 1;
+	}
+
+	// Random planes through a corner of a box - the distances are a rounding
+	// error away from 0 and any other order of the operations flips them
+	std::normal_distribution<float> gaussian;
+	std::uniform_int_distribution<unsigned> boxIndex(0, CullingKernel::BOXES_PER_TEST - 1);
+	for (auto test = 0u; test < 100000; ++test)
+	{
+		RandomBoxes(random, 2.f, boxes);
+		for (auto& plane : planes.Planes)
+		{
+			const float a = gaussian(random), b = gaussian(random), c = gaussian(random);
+			const float length = std::sqrt(a * a + b * b + c * c);
+			plane[0] = a / length;
+			plane[1] = b / length;
+			plane[2] = c / length;
+			const auto box = boxIndex(random);
+			const bool farCorner = test % 2 == 0;
+			const float x = (plane[0] > 0) == farCorner ? boxes.MaxX[box] : boxes.MinX[box];
+			const float y = (plane[1] > 0) == farCorner ? boxes.MaxY[box] : boxes.MinY[box];
+			const float z = (plane[2] > 0) == farCorner ? boxes.MaxZ[box] : boxes.MinZ[box];
+			plane[3] = -float(double(plane[0]) * x + double(plane[1]) * y + double(plane[2]) * z);
+		}
+		CompareVersions(planes, boxes, CullingKernel::BOXES_PER_TEST);
+	}
+	// Both outcomes were seen
+	CHECK(visibleTests > 1000 && culledTests > 1000);
+}
@@ -0,0 +1,257 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "FrameArena.h"
+
+#include <atomic>
+#include <thread>
+
+namespace {
+	bool IsAligned(const void* pointer, size_t alignment)
+	{
+		return reinterpret_cast<std::uintptr_t>(pointer) % alignment == 0;
+	}
+
+	// The allocation is written whole and read back - overlapping ones or ones
+	// past their block show up here or under ASan
+	bool FillAndCheck(void* pointer, size_t size, std::uint8_t value)
+	{
+		auto* bytes = static_cast<std::uint8_t*>(pointer);
+		std::fill(bytes, bytes + size, value);
+		return std::all_of(bytes, bytes + size, [value](std::uint8_t byte) { return byte == value; });
+	}
+
+	struct Allocation
+	{
+		std::uint8_t* Pointer;
+		size_t Size;
+	};
+}
+
+TEST_CASE(FrameArenaAlignment)
+{
+	FrameArena arena(4096);
+	std::vector<Allocation> allocations;
+	const size_t alignments[] = { 1, 2, 4, 8, 16, 64, 256, 1024 };
+	auto used = 0u;
+	for (auto round = 0u; round < 8; ++round)
+	{
+		for (const auto alignment : alignments)
+		{
+			const size_t size = 1 + (round * 37 + alignment) % 200;
+			auto* pointer = static_cast<std::uint8_t*>(arena.Allocate(size, alignment));
+			CHECK(IsAligned(pointer, alignment));
+			allocations.push_back(Allocation{ pointer, size });
+			used += unsigned(size);
+		}
+	}
+	for (size_t i = 0; i < allocations.size(); ++i)
+	{
+		CHECK(FillAndCheck(allocations[i].Pointer, allocations[i].Size, std::uint8_t(i)));
+	}
+	for (size_t i = 0; i < allocations.size(); ++i)
+	{
+		CHECK(allocations[i].Pointer[0] == std::uint8_t(i));
+		CHECK(allocations[i].Pointer[allocations[i].Size - 1] == std::uint8_t(i));
+	}
+	// Padding and the skipped ends of blocks count as used
+	CHECK(arena.GetStats().BytesUsed >= used);
+
+	// Typed and empty allocations
+	auto* doubles = arena.Allocate<double>(3);
+	CHECK(IsAligned(doubles, alignof(double)));
+	CHECK(arena.Allocate(0, 1) != nullptr);
+}
+
+TEST_CASE(FrameArenaGrowsPastBlock)
+{
+	FrameArena arena(1024);
+	auto* first = static_cast<std::uint8_t*>(arena.Allocate(400, 8));
+	auto* second = static_cast<std::uint8_t*>(arena.Allocate(400, 8));
+	CHECK(second == first + 400);
+	CHECK(FillAndCheck(first, 800, 1));
+	CHECK(arena.GetStats().BlocksAllocated == 1);
+	CHECK(arena.GetStats().Capacity == 1024);
+
+	// Doesn't fit the rest of the block - the next one starts
+	auto* third = static_cast<std::uint8_t*>(arena.Allocate(400, 8));
+	CHECK(arena.GetStats().BlocksAllocated == 2);
+	CHECK(arena.GetStats().BytesUsed == 1024 + 400);
+	CHECK(FillAndCheck(third, 400, 3));
+
+	// Bigger than a block - a block of its own, aligned
+	auto* big = arena.Allocate(5000, 256);
+	CHECK(IsAligned(big, 256));
+	CHECK(FillAndCheck(big, 5000, 4));
+	CHECK(arena.GetStats().BlocksAllocated == 3);
+	CHECK(arena.GetStats().Capacity >= 1024 * 2 + 5000);
+	// The earlier blocks are untouched
+	CHECK(std::all_of(first, first + 800, [](std::uint8_t byte) { return byte == 1; }));
+	CHECK(std::all_of(third, third + 400, [](std::uint8_t byte) { return byte == 3; }));
+}
+
+TEST_CASE(FrameArenaRewind)
+{
+	FrameArena arena(1024);
+	arena.Allocate(100, 4);
+	const auto marker = arena.GetMarker();
+	const auto usedAtMarker = arena.GetStats().BytesUsed;
+	auto* afterMarker = arena.Allocate(64, 16);
+	arena.Allocate(2000, 16);
+
+	arena.Rewind(marker);
+	CHECK(arena.GetStats().BytesUsed == usedAtMarker);
+	CHECK(arena.Allocate(64, 16) == afterMarker);
+
+	// Scopes inside scopes, the inner one spilling into new blocks
+	void* outerPointer = nullptr;
+	{
+		ScopedRewind outer(arena);
+		outerPointer = arena.Allocate(32, 8);
+		{
+			ScopedRewind inner(arena);
+			for (auto i = 0u; i < 10; ++i)
+			{
+				arena.Allocate(700, 8);
+			}
+		}
+		// Back to the block of the outer scope
+		CHECK(arena.Allocate(32, 8) == static_cast<std::uint8_t*>(outerPointer) + 32);
+	}
+	CHECK(arena.Allocate(32, 8) == outerPointer);
+
+	// The peak stays until the stats are reset
+	CHECK(arena.GetStats().PeakBytesUsed > 10 * 700);
+	const auto stats = arena.ResetStats();
+	CHECK(stats.PeakBytesUsed > 10 * 700);
+	CHECK(arena.GetStats().PeakBytesUsed == arena.GetStats().BytesUsed);
+}
+
+TEST_CASE(FrameArenaResetReusesBlocks)
+{
+	FrameArena arena(1024);
+	std::vector<void*> firstFrame;
+	for (auto i = 0u; i < 20; ++i)
+	{
+		firstFrame.push_back(arena.Allocate(150 + i * 10, 8));
+	}
+	const auto firstStats = arena.ResetStats();
+	CHECK(firstStats.BlocksAllocated > 1);
+
+	// The same frame again gets the same memory and nothing from the heap
+	for (auto frame = 0u; frame < 3; ++frame)
+	{
+		arena.Reset();
+		CHECK(arena.GetStats().BytesUsed == 0);
+		for (auto i = 0u; i < 20; ++i)
+		{
+			CHECK(arena.Allocate(150 + i * 10, 8) == firstFrame[i]);
+		}
+		const auto stats = arena.ResetStats();
+		CHECK(stats.BlocksAllocated == 0);
+		CHECK(stats.Capacity == firstStats.Capacity);
+		CHECK(stats.BytesUsed == firstStats.BytesUsed);
+	}
+}
+
+TEST_CASE(FrameVectorFallback)
+{
+	// Without an arena the heap - it can grow, shrink and free as usual
+	FrameVector<int> heap;
+	CHECK(heap.get_allocator().GetArena() == nullptr);
+	for (auto i = 0; i < 10000; ++i)
+	{
+		heap.push_back(i);
+	}
+	heap.shrink_to_fit();
+	CHECK(heap.size() == 10000 && heap[9999] == 9999);
+
+	FrameArena arena(4096);
+	FrameVector<int> inArena{ FrameAllocator<int>(&arena) };
+	for (auto i = 0; i < 1000; ++i)
+	{
+		inArena.push_back(i);
+	}
+	CHECK(inArena[999] == 999);
+	// Every reallocation stays in the arena
+	CHECK(arena.GetStats().BytesUsed >= 1000 * sizeof(int));
+	CHECK(inArena.get_allocator().GetArena() == &arena);
+
+	// Assigning and swapping take the allocator along
+	FrameVector<int> assigned;
+	assigned = inArena;
+	CHECK(assigned.get_allocator().GetArena() == &arena);
+	CHECK(assigned == inArena);
+	FrameVector<int> swapped;
+	swapped.swap(heap);
+	CHECK(swapped.get_allocator().GetArena() == nullptr);
+	CHECK(heap.get_allocator().GetArena() == nullptr);
+	CHECK(swapped.size() == 10000);
+
+	FrameString text{ FrameAllocator<char>(&arena) };
+	text = "a string longer than the small string buffer of any library";
+	CHECK(text.get_allocator().GetArena() == &arena);
+	CHECK(text == "a string longer than the small string buffer of any library");
+}
+
+// Every thread has an arena of its own, its blocks chained as it grows
+TEST_CASE(FrameArenaThreadArenas)
+{
+	static const unsigned THREADS_COUNT = 4;
+	static const size_t CHUNK_SIZE = 10 * 1024;
+	static const unsigned CHUNKS_COUNT = 20;
+
+	FrameArena* arenas[THREADS_COUNT];
+	bool intact[THREADS_COUNT];
+	size_t usedAfter[THREADS_COUNT];
+	// All the threads are alive at once, so their arenas are different objects
+	std::atomic<unsigned> arrived(0);
+	std::vector<std::thread> threads;
+	for (auto thread = 0u; thread < THREADS_COUNT; ++thread)
+	{
+		threads.emplace_back([&, thread]() {
+			auto& arena = FrameArena::GetThreadArena();
+			arenas[thread] = &arena;
+			intact[thread] = &FrameArena::GetThreadArena() == &arena;
+			{
+				ScopedRewind rewind(arena);
+				// Past the first block of the thread
+				std::vector<std::uint8_t*> chunks;
+				for (auto chunk = 0u; chunk < CHUNKS_COUNT; ++chunk)
+				{
+					chunks.push_back(arena.Allocate<std::uint8_t>(CHUNK_SIZE));
+					std::fill(chunks.back(), chunks.back() + CHUNK_SIZE, std::uint8_t(thread * CHUNKS_COUNT + chunk));
+				}
+				for (auto chunk = 0u; chunk < CHUNKS_COUNT; ++chunk)
+				{
+					const auto value = std::uint8_t(thread * CHUNKS_COUNT + chunk);
+					intact[thread] = intact[thread] && std::all_of(chunks[chunk], chunks[chunk] + CHUNK_SIZE,
+						[value](std::uint8_t byte) { return byte == value; });
+				}
+				intact[thread] = intact[thread] && arena.GetStats().BlocksAllocated > 1;
+			}
+			usedAfter[thread] = arena.GetStats().BytesUsed;
+
+			++arrived;
+			while (arrived < THREADS_COUNT)
+			{
+				std::this_thread::yield();
+			}
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	for (auto thread = 0u; thread < THREADS_COUNT; ++thread)
+	{
+		CHECK(intact[thread]);
+		CHECK(usedAfter[thread] == 0);
+		CHECK(arenas[thread] != &FrameArena::GetThreadArena());
+		for (auto other = thread + 1; other < THREADS_COUNT; ++other)
+		{
+			CHECK(arenas[thread] != arenas[other]);
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "JobSystem.h"
+#include "TraceRecorder.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace {
+	// A few hundred cycles of work an item that the compiler can't drop
+	float WorkItem(unsigned item)
+	{
+		float value = float(item);
+		for (auto i = 0u; i < 64; ++i)
+		{
+			value = std::sqrt(value + float(i));
+		}
+		return value;
+	}
+}
+
+TEST_CASE(JobSystemTraceNames)
+{
+	static const char* TRACE_PATH = "JobSystemTests.json";
+	TraceRecorder recorder;
+	CHECK(recorder.Start(TRACE_PATH));
+	gTrace = &recorder;
+	{
+		JobSystem jobs(2);
+		JobSystem::Counter first;
+		JobSystem::Counter second;
+		jobs.Run("First test job", []() {}, &first);
+		jobs.RunAfter("Second test job", first, []() {}, &second);
+		jobs.Wait(second);
+
+		std::vector<float> results(64);
+		jobs.ParallelFor("Test range", unsigned(results.size()), 8, [&results](unsigned begin, unsigned end) {
+			for (auto i = begin; i < end; ++i)
+			{
+				results[i] = WorkItem(i);
+			}
+		});
+	}
+	gTrace = nullptr;
+	recorder.Stop();
+
+	// Every kind of job is in the trace under its name. The first range of
+	// the ParallelFor runs on the calling thread outside of a job.
+	std::ifstream file(TRACE_PATH);
+	std::stringstream trace;
+	trace << file.rdbuf();
+	file.close();
+	std::remove(TRACE_PATH);
+	CHECK(trace.str().find("\"First test job\"") != std::string::npos);
+	CHECK(trace.str().find("\"Second test job\"") != std::string::npos);
+	CHECK(trace.str().find("\"Test range\"") != std::string::npos);
+}
+
+// The same ParallelFor and a fork of small jobs from 2 threads up to all
+// hardware threads, against the plain loop on one thread - the speedup and
+// the cost of a job
+BENCHMARK(JobSystemScaling)
+{
+	static const unsigned ITEMS_COUNT = 1 << 18;
+	static const unsigned GRAIN = 1024;
+	static const unsigned SMALL_JOBS_COUNT = 20000;
+	static const unsigned REPEATS = 9;
+
+	std::vector<float> results(ITEMS_COUNT);
+	const auto loop = Test::Measure(REPEATS, [&results]() {
+		for (auto i = 0u; i < ITEMS_COUNT; ++i)
+		{
+			results[i] = WorkItem(i);
+		}
+	});
+	Test::ReportTime("Loop, 1 thread", loop);
+
+	// A JobSystem always has a worker - 0 asks for all hardware threads
+	const auto hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+	for (auto threads = 2u; threads <= hardwareThreads; threads = threads == hardwareThreads ? threads + 1 : std::min(threads * 2, hardwareThreads))
+	{
+		JobSystem jobs(threads - 1);
+
+		const auto parallelFor = Test::Measure(REPEATS, [&]() {
+			jobs.ParallelFor("Benchmark range", ITEMS_COUNT, GRAIN, [&results](unsigned first, unsigned last) {
+				for (auto i = first; i < last; ++i)
+				{
+					results[i] = WorkItem(i);
+				}
+			});
+		});
+
+		std::atomic<unsigned> done(0);
+		const auto smallJobs = Test::Measure(REPEATS, [&]() {
+			JobSystem::Counter counter;
+			for (auto i = 0u; i < SMALL_JOBS_COUNT; ++i)
+			{
+				jobs.Run("Benchmark job", [&done]() { ++done; }, &counter);
+			}
+			jobs.Wait(counter);
+		});
+		CHECK(done.load() == REPEATS * SMALL_JOBS_COUNT);
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "ParallelFor, %u threads (%.1fx)", threads, loop / parallelFor);
+		Test::ReportTime(name, parallelFor);
+		std::snprintf(name, sizeof(name), "%u empty jobs, %u threads", SMALL_JOBS_COUNT, threads);
+		Test::ReportTime(name, smallJobs);
+	}
+}
@@ -0,0 +1,107 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "LightBitmask.h"
+#include "LightTiling.h"
+
+#include <random>
+
+namespace {
+	// A wall at a constant depth and lights scattered in front of the camera
+	LightTilingScene MakeScene(unsigned lightsCount, unsigned seed)
+	{
+		LightTilingScene scene;
+		scene.Width = 128;
+		scene.Height = 96;
+		scene.ProjectionScaleX = 1.f;
+		scene.ProjectionScaleY = 1.33f;
+		scene.ViewDepth.assign(scene.Width * scene.Height, 20.f);
+
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> side(-15.f, 15.f);
+		std::uniform_real_distribution<float> depth(1.f, 30.f);
+		std::uniform_real_distribution<float> radius(0.5f, 4.f);
+		for (auto i = 0u; i < lightsCount; ++i)
+		{
+			const float light[] = { side(random), side(random), depth(random), radius(random) };
+			scene.Lights.insert(scene.Lights.end(), light, light + 4);
+		}
+		return scene;
+	}
+}
+
+TEST_CASE(LightBitmaskInvertOrder)
+{
+	const LightBitmask::LightOrder order = { 3, 0, 4, 1, 2 };
+	LightBitmask::LightOrder inverse;
+	LightBitmask::InvertOrder(order, inverse);
+
+	CHECK(inverse.size() == order.size());
+	for (auto slot = 0u; slot < order.size(); ++slot)
+	{
+		CHECK(inverse[order[slot]] == slot);
+	}
+}
+
+TEST_CASE(LightBitmaskMatchesCulledLists)
+{
+	static const unsigned LIGHTS_COUNT = 200;
+	const auto scene = MakeScene(LIGHTS_COUNT, 7);
+	const LightTilingConfig config(16, 64);
+
+	std::vector<std::uint32_t> lightIds;
+	std::vector<std::uint32_t> counts;
+	CpuTileLightCuller().Cull(config, scene, lightIds, counts);
+
+	LightBitmask::LightOrder order;
+	LightBitmask::BuildCoherentOrder(scene.Lights.data(), 4, LIGHTS_COUNT, order);
+	CHECK(order.size() == LIGHTS_COUNT);
+	std::vector<bool> seen(LIGHTS_COUNT, false);
+	for (auto id : order)
+	{
+		CHECK(!seen[id]);
+		seen[id] = true;
+	}
+
+	const auto tilesCount = unsigned(counts.size());
+	LightBitmask::TileMasks masks;
+	LightBitmask::EncodeLists(lightIds.data(), counts.data(), tilesCount, config.MaxLightsPerTile, order, masks);
+	CHECK(masks.TilesCount == tilesCount);
+	CHECK(masks.WordsPerTile == LightBitmask::WordsForLights(LIGHTS_COUNT));
+
+	LightBitmask::LightOrder slots;
+	LightBitmask::InvertOrder(order, slots);
+
+	auto lightsInTiles = 0u;
+	auto occupiedWords = 0u;
+	std::vector<std::uint16_t> decoded;
+	for (auto tile = 0u; tile < tilesCount; ++tile)
+	{
+		// The mask has exactly the lights of the list
+		std::vector<std::uint16_t> expected(&lightIds[tile * config.MaxLightsPerTile],
+			&lightIds[tile * config.MaxLightsPerTile] + counts[tile]);
+		decoded.clear();
+		LightBitmask::DecodeTile(masks, tile, order, decoded);
+		std::sort(expected.begin(), expected.end());
+		std::sort(decoded.begin(), decoded.end());
+		CHECK(decoded == expected);
+
+		auto setCount = 0u;
+		for (auto slot = 0u; slot < LIGHTS_COUNT; ++slot)
+		{
+			const bool listed = std::binary_search(expected.begin(), expected.end(), order[slot]);
+			CHECK(masks.IsSet(tile, slots[order[slot]]) == listed);
+			setCount += masks.IsSet(tile, slot) ? 1 : 0;
+		}
+		CHECK(setCount == counts[tile]);
+		lightsInTiles += counts[tile];
+
+		for (auto word = 0u; word < masks.WordsPerTile; ++word)
+		{
+			occupiedWords += masks.Words[tile * masks.WordsPerTile + word] ? 1 : 0;
+		}
+	}
+	// The scene has to exercise the encoding
+	CHECK(lightsInTiles > tilesCount);
+	CHECK(LightBitmask::CountOccupiedWords(masks) == occupiedWords);
+}
@@ -0,0 +1,85 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "LightTiling.h"
+
+#include <cstdio>
+#include <random>
+
+namespace {
+	// A 720p frame of a wall at a constant depth and lights in front of it
+	LightTilingScene MakeScene(unsigned lightsCount)
+	{
+		LightTilingScene scene;
+		scene.Width = 1280;
+		scene.Height = 720;
+		scene.ProjectionScaleX = 0.75f;
+		scene.ProjectionScaleY = 1.33f;
+		scene.ViewDepth.assign(scene.Width * scene.Height, 40.f);
+
+		std::mt19937 random(11);
+		std::uniform_real_distribution<float> side(-40.f, 40.f);
+		std::uniform_real_distribution<float> depth(1.f, 45.f);
+		std::uniform_real_distribution<float> radius(0.5f, 3.f);
+		for (auto i = 0u; i < lightsCount; ++i)
+		{
+			const float light[] = { side(random), side(random), depth(random), radius(random) };
+			scene.Lights.insert(scene.Lights.end(), light, light + 4);
+		}
+		return scene;
+	}
+}
+
+TEST_CASE(LightTilingTunerPicksFastest)
+{
+	// Times made up from the config - the caps of 32 "drop lights"
+	auto measure = [](const LightTilingConfig& config) -> double {
+		if (config.MaxLightsPerTile == 32)
+			return -1;
+		return double(config.TileSize) + double(config.MaxLightsPerTile) / 1000.0;
+	};
+
+	LightTilingTuner tuner;
+	LightTilingTuner::Result best;
+	LightTilingTuner::ResultsVec all;
+	CHECK(tuner.Tune(LightTilingTuner::DefaultCandidates(), measure, 3, best, &all));
+	CHECK(best.Config == LightTilingConfig(8, 64));
+	CHECK(all.size() == 6);
+	for (const auto& result : all)
+	{
+		CHECK(result.Config.MaxLightsPerTile != 32);
+		CHECK(result.Milliseconds >= best.Milliseconds);
+	}
+
+	std::vector<LightTilingConfig> none(1, LightTilingConfig(8, 32));
+	CHECK(!tuner.Tune(none, measure, 3, best));
+}
+
+// The CPU path of DemoRendererApplication::TuneLightTiling on a synthetic
+// frame - what the tuner would pick on a machine without a GPU
+BENCHMARK(LightTilingTunerCpu)
+{
+	const auto scene = MakeScene(1024);
+	CpuTileLightCuller culler;
+	std::vector<std::uint32_t> lightIds;
+	std::vector<std::uint32_t> counts;
+
+	LightTilingTuner tuner;
+	LightTilingTuner::Result best;
+	LightTilingTuner::ResultsVec all;
+	CHECK(tuner.Tune(LightTilingTuner::DefaultCandidates(), [&](const LightTilingConfig& config) -> double {
+		const auto ms = Test::Measure(1, [&]() { culler.Cull(config, scene, lightIds, counts); });
+		if (std::find(counts.cbegin(), counts.cend(), config.MaxLightsPerTile) != counts.cend())
+			return -1;
+		return ms;
+	}, 5, best, &all));
+
+	char name[64];
+	for (const auto& result : all)
+	{
+		std::snprintf(name, sizeof(name), "tile %u max lights %u", result.Config.TileSize, result.Config.MaxLightsPerTile);
+		Test::ReportTime(name, result.Milliseconds);
+	}
+	std::snprintf(name, sizeof(name), "best - tile %u max lights %u", best.Config.TileSize, best.Config.MaxLightsPerTile);
+	Test::ReportTime(name, best.Milliseconds);
+}
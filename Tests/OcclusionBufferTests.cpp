@@ -0,0 +1,202 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "OcclusionBuffer.h"
+#include "JobSystem.h"
+
+#include <cmath>
+
+namespace {
+	// A row-vector perspective projection from the origin looking down +z,
+	// D3D clip space
+	void MakeViewProjection(float* outMatrix)
+	{
+		const float nearPlane = 0.5f;
+		const float farPlane = 300.f;
+		const float yScale = 1.f / std::tan(0.5f);
+		const float xScale = yScale * float(OcclusionBuffer::HEIGHT) / OcclusionBuffer::WIDTH;
+		const float zScale = farPlane / (farPlane - nearPlane);
+		const float matrix[16] = {
+			xScale, 0, 0, 0,
+			0, yScale, 0, 0,
+			0, 0, zScale, 1,
+			0, 0, -nearPlane * zScale, 0,
+		};
+		std::copy(matrix, matrix + 16, outMatrix);
+	}
+
+	BoundsHierarchy::Box MakeBox(float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+	{
+		BoundsHierarchy::Box box = { { minX, minY, minZ }, { maxX, maxY, maxZ } };
+		return box;
+	}
+
+	// A 10x10 wall at z = 10 in front of the camera, two triangles
+	const float WALL_POSITIONS[] = {
+		-5, -5, 10,
+		5, -5, 10,
+		5, 5, 10,
+		-5, 5, 10,
+	};
+	const std::uint32_t WALL_INDICES[] = { 0, 1, 2, 0, 2, 3 };
+	const float IDENTITY[] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+	struct ExpectedBox
+	{
+		BoundsHierarchy::Box Box;
+		bool Visible;
+	};
+
+	const ExpectedBox EXPECTED[] = {
+		{ MakeBox(-1, -1, 20, 1, 1, 22), false },     // right behind the wall
+		{ MakeBox(-8, -8, 40, 8, 8, 50), false },     // bigger, farther behind it
+		{ MakeBox(-1, -1, 5, 1, 1, 6), true },        // in front of the wall
+		{ MakeBox(-1, -1, 9, 1, 1, 11), true },       // through the wall
+		{ MakeBox(8, -1, 20, 12, 1, 22), true },      // half past its right edge
+		{ MakeBox(15, -1, 30, 17, 1, 32), true },     // beside it
+		{ MakeBox(-1, -1, -5, 1, 1, 20), true },      // across the near plane
+		{ MakeBox(500, -1, 20, 502, 1, 22), false },  // off screen
+	};
+	const unsigned EXPECTED_COUNT = sizeof(EXPECTED) / sizeof(EXPECTED[0]);
+
+	void CheckWall(OcclusionBuffer& buffer)
+	{
+		float viewProjection[16];
+		MakeViewProjection(viewProjection);
+		buffer.Begin(viewProjection);
+		buffer.AddOccluder(WALL_POSITIONS, 4, WALL_INDICES, 6, IDENTITY);
+		buffer.Rasterize();
+
+		CHECK(buffer.GetStats().OccluderTriangles == 2);
+		CHECK(buffer.GetStats().TrianglesRasterized == 2);
+
+		// The wall covers the middle of the screen at depth ~0.95, not the corners
+		const float wallDepth = (10.f - 0.5f) * 300.f / (300.f - 0.5f) / 10.f;
+		const auto centerDepth = buffer.GetTileDepth(OcclusionBuffer::TILES_X / 2, OcclusionBuffer::TILES_Y / 2);
+		CHECK(std::abs(centerDepth - wallDepth) < 1e-4f);
+		CHECK(buffer.GetTileDepth(0, 0) == 1.f);
+		CHECK(buffer.GetTileDepth(OcclusionBuffer::TILES_X - 1, OcclusionBuffer::TILES_Y - 1) == 1.f);
+
+		std::vector<BoundsHierarchy::Box> boxes;
+		for (const auto& expected : EXPECTED)
+		{
+			CHECK(buffer.IsVisible(expected.Box) == expected.Visible);
+			boxes.push_back(expected.Box);
+		}
+
+		std::vector<std::uint8_t> visible(EXPECTED_COUNT);
+		buffer.TestBoxes(boxes.data(), EXPECTED_COUNT, visible.data());
+		auto occluded = 0u;
+		for (auto i = 0u; i < EXPECTED_COUNT; ++i)
+		{
+			CHECK((visible[i] != 0) == EXPECTED[i].Visible);
+			occluded += EXPECTED[i].Visible ? 0 : 1;
+		}
+		CHECK(buffer.GetStats().BoxesTested == EXPECTED_COUNT);
+		CHECK(buffer.GetStats().BoxesOccluded == occluded);
+	}
+}
+
+TEST_CASE(OcclusionBufferWall)
+{
+	JobSystem jobs(3);
+	gJobSystem = &jobs;
+
+	OcclusionBuffer single(1);
+	CheckWall(single);
+	OcclusionBuffer parallel(4);
+	CheckWall(parallel);
+
+	// The bands rasterized on other threads give the same buffer
+	for (auto tileY = 0u; tileY < OcclusionBuffer::TILES_Y; ++tileY)
+	{
+		for (auto tileX = 0u; tileX < OcclusionBuffer::TILES_X; ++tileX)
+		{
+			CHECK(single.GetTileDepth(tileX, tileY) == parallel.GetTileDepth(tileX, tileY));
+		}
+	}
+
+	// Without occluders everything on screen is visible
+	float viewProjection[16];
+	MakeViewProjection(viewProjection);
+	single.Begin(viewProjection);
+	single.Rasterize();
+	CHECK(single.IsVisible(EXPECTED[0].Box));
+
+	gJobSystem = nullptr;
+}
+
+// A wall cut in many triangles leaves no pixel uncovered between them, so
+// every tile inside it gets the wall depth
+TEST_CASE(OcclusionBufferWatertight)
+{
+	static const unsigned CELLS = 23;
+	std::vector<float> positions;
+	for (auto row = 0u; row <= CELLS; ++row)
+	{
+		for (auto column = 0u; column <= CELLS; ++column)
+		{
+			// Uneven spacing - the edges cross the pixels at all kinds of places
+			const float u = std::pow(float(column) / CELLS, 1.3f);
+			const float v = std::pow(float(row) / CELLS, 0.8f);
+			const float vertex[] = { -5.f + 10.f * u, -5.f + 10.f * v, 10.f };
+			positions.insert(positions.end(), vertex, vertex + 3);
+		}
+	}
+	std::vector<std::uint32_t> indices;
+	for (auto row = 0u; row < CELLS; ++row)
+	{
+		for (auto column = 0u; column < CELLS; ++column)
+		{
+			const auto a = row * (CELLS + 1) + column;
+			const auto b = a + 1;
+			const auto c = a + CELLS + 1;
+			const auto d = c + 1;
+			// Alternating diagonals
+			const std::uint32_t quad[2][6] = { { a, b, d, a, d, c }, { a, b, c, b, d, c } };
+			const auto& triangles = quad[(row + column) % 2];
+			indices.insert(indices.end(), triangles, triangles + 6);
+		}
+	}
+
+	JobSystem jobs(3);
+	gJobSystem = &jobs;
+	OcclusionBuffer buffer(4);
+	float viewProjection[16];
+	MakeViewProjection(viewProjection);
+	buffer.Begin(viewProjection);
+	buffer.AddOccluder(positions.data(), unsigned(positions.size() / 3), indices.data(), unsigned(indices.size()), IDENTITY);
+	buffer.Rasterize();
+	CHECK(buffer.GetStats().TrianglesRasterized == CELLS * CELLS * 2);
+
+	// The pixels the wall covers, from the projection of its corner
+	float clip[4];
+	for (auto i = 0u; i < 4; ++i)
+	{
+		clip[i] = WALL_POSITIONS[0] * viewProjection[i] + WALL_POSITIONS[1] * viewProjection[4 + i]
+			+ WALL_POSITIONS[2] * viewProjection[8 + i] + viewProjection[12 + i];
+	}
+	const float wallLeft = (clip[0] / clip[3] * 0.5f + 0.5f) * OcclusionBuffer::WIDTH;
+	const float wallBottom = (0.5f - clip[1] / clip[3] * 0.5f) * OcclusionBuffer::HEIGHT;
+	const float wallRight = OcclusionBuffer::WIDTH - wallLeft;
+	const float wallTop = OcclusionBuffer::HEIGHT - wallBottom;
+
+	auto tilesInside = 0u;
+	for (auto tileY = 0u; tileY < OcclusionBuffer::TILES_Y; ++tileY)
+	{
+		for (auto tileX = 0u; tileX < OcclusionBuffer::TILES_X; ++tileX)
+		{
+			const float left = float(tileX * OcclusionBuffer::TILE_WIDTH);
+			const float top = float(tileY * OcclusionBuffer::TILE_HEIGHT);
+			if (left >= wallLeft && left + OcclusionBuffer::TILE_WIDTH <= wallRight
+				&& top >= wallTop && top + OcclusionBuffer::TILE_HEIGHT <= wallBottom)
+			{
+				++tilesInside;
+				CHECK(buffer.GetTileDepth(tileX, tileY) < 1.f);
+			}
+		}
+	}
+	CHECK(tilesInside >= 60);
+
+	gJobSystem = nullptr;
+}
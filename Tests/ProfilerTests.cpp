@@ -0,0 +1,245 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "Profiler.h"
+
+namespace {
+	// A GPU that reaches the end of a frame Latency frames after it was
+	// ended, or never while it's Stalled. Every timestamp is a millisecond
+	// after the one before.
+	class FakeBackend : public ProfilerBackend
+	{
+	public:
+		static const std::uint64_t FREQUENCY = 1000000;
+		static const std::uint64_t TICKS_PER_TIMESTAMP = FREQUENCY / 1000;
+
+		FakeBackend()
+			: Latency(0)
+			, Stalled(false)
+			, Disjoint(false)
+			, m_FramesEnded(0)
+			, m_Clock(0)
+			, m_QueriesCount(0)
+		{}
+
+		unsigned Latency;
+		bool Stalled;
+		bool Disjoint;
+
+		virtual bool Initialize(unsigned framesCount, unsigned queriesCount) override
+		{
+			m_QueriesCount = queriesCount;
+			m_EndedAt.assign(framesCount, 0);
+			m_Timestamps.assign(framesCount, std::vector<std::uint64_t>(queriesCount, 0));
+			return true;
+		}
+		virtual void BeginFrame(unsigned frame) override
+		{
+			m_EndedAt[frame] = ~0u;
+		}
+		virtual void EndFrame(unsigned frame) override
+		{
+			m_EndedAt[frame] = ++m_FramesEnded;
+		}
+		virtual void WriteTimestamp(unsigned frame, unsigned query) override
+		{
+			m_Clock += TICKS_PER_TIMESTAMP;
+			m_Timestamps[frame][query] = m_Clock;
+		}
+		virtual bool ReadFrame(unsigned frame,
+			unsigned queriesCount,
+			std::uint64_t* outTimestamps,
+			std::uint64_t& outFrequency,
+			bool& outDisjoint) override
+		{
+			if (Stalled || m_EndedAt[frame] == ~0u || m_FramesEnded - m_EndedAt[frame] < Latency)
+				return false;
+			std::copy(m_Timestamps[frame].begin(), m_Timestamps[frame].begin() + std::min(queriesCount, m_QueriesCount), outTimestamps);
+			outFrequency = FREQUENCY;
+			outDisjoint = Disjoint;
+			return true;
+		}
+
+	private:
+		std::vector<unsigned> m_EndedAt;
+		std::vector<std::vector<std::uint64_t>> m_Timestamps;
+		unsigned m_FramesEnded;
+		std::uint64_t m_Clock;
+		unsigned m_QueriesCount;
+	};
+
+	void RunFrame(Profiler& profiler)
+	{
+		profiler.BeginFrame();
+		{
+			ProfileScope scope(&profiler, "Work");
+		}
+		profiler.EndFrame();
+	}
+}
+
+TEST_CASE(ProfilerResultsArriveLate)
+{
+	static const unsigned LATENCY = 2;
+	FakeBackend backend;
+	backend.Latency = LATENCY;
+	Profiler profiler(&backend, 4);
+	CHECK(profiler.Initialize());
+
+	for (auto frame = 1u; frame <= 10; ++frame)
+	{
+		RunFrame(profiler);
+		// The frame ended LATENCY frames ago, nothing before that
+		const auto& result = profiler.GetLastFrame();
+		const auto expected = frame > LATENCY ? frame - LATENCY : 0;
+		CHECK(result.FrameId == expected);
+		if (!expected)
+			continue;
+
+		// Frame and Work, a timestamp a millisecond apart
+		CHECK(result.HasGPUTimes);
+		CHECK(result.Scopes.size() == 2);
+		CHECK(result.Scopes[0].GPUBegin == 0.0 && result.Scopes[0].GPUDuration == 3.0);
+		CHECK(result.Scopes[1].GPUBegin == 1.0 && result.Scopes[1].GPUDuration == 1.0);
+	}
+
+	const auto stats = profiler.ResetStats();
+	CHECK(stats.FramesCollected == 10 - LATENCY);
+	CHECK(stats.FramesDropped == 0);
+	CHECK(stats.ScopesDropped == 0);
+
+	// Disjoint timestamps - the CPU times only
+	backend.Disjoint = true;
+	for (auto frame = 0u; frame <= LATENCY; ++frame)
+	{
+		RunFrame(profiler);
+	}
+	CHECK(profiler.GetLastFrame().FrameId == 11);
+	CHECK(!profiler.GetLastFrame().HasGPUTimes);
+	CHECK(profiler.GetLastFrame().Scopes[1].GPUDuration == 0.0);
+
+	// Without a backend every frame comes back when it ends
+	Profiler cpuOnly(nullptr, 2);
+	CHECK(cpuOnly.Initialize());
+	RunFrame(cpuOnly);
+	CHECK(cpuOnly.GetLastFrame().FrameId == 1);
+	CHECK(!cpuOnly.GetLastFrame().HasGPUTimes);
+	CHECK(cpuOnly.GetLastFrame().Scopes.size() == 2);
+}
+
+TEST_CASE(ProfilerDropsFramesWhenRingFull)
+{
+	static const unsigned FRAMES_COUNT = 3;
+	FakeBackend backend;
+	Profiler profiler(&backend, FRAMES_COUNT);
+	CHECK(profiler.Initialize());
+
+	// Stalled for 6 frames - each of frames 4 to 6 takes the slot of a frame
+	// still waiting for the GPU
+	backend.Stalled = true;
+	for (auto frame = 1u; frame <= 6; ++frame)
+	{
+		RunFrame(profiler);
+		CHECK(profiler.GetLastFrame().FrameId == 0);
+	}
+	auto stats = profiler.ResetStats();
+	CHECK(stats.FramesDropped == 3);
+	CHECK(stats.FramesCollected == 0);
+
+	// The GPU catches up - frame 7 drops frame 4 too when it begins, then 5
+	// to 7 come back at once and the newest is the last frame
+	backend.Stalled = false;
+	RunFrame(profiler);
+	CHECK(profiler.GetLastFrame().FrameId == 7);
+	stats = profiler.ResetStats();
+	CHECK(stats.FramesDropped == 1);
+	CHECK(stats.FramesCollected == FRAMES_COUNT);
+
+	// And from then on every frame
+	RunFrame(profiler);
+	CHECK(profiler.GetLastFrame().FrameId == 8);
+	CHECK(profiler.ResetStats().FramesCollected == 1);
+}
+
+TEST_CASE(ProfilerNestedScopes)
+{
+	FakeBackend backend;
+	Profiler profiler(&backend, 2);
+	CHECK(profiler.Initialize());
+
+	// Outside of a frame - not timed and not in the next frame
+	profiler.BeginScope("Outside");
+	profiler.EndScope();
+
+	profiler.BeginFrame();
+	{
+		ProfileScope a(&profiler, "A");
+		{
+			ProfileScope b(&profiler, "B");
+			ProfileScope c(&profiler, "C");
+		}
+		ProfileScope d(&profiler, "D");
+	}
+	{
+		ProfileScope e(&profiler, "E");
+	}
+	profiler.EndFrame();
+
+	const auto& result = profiler.GetLastFrame();
+	CHECK(result.FrameId == 1);
+	CHECK(result.Scopes.size() == 6);
+	if (result.Scopes.size() != 6)
+		return;
+
+	// In the order they were opened, with the timestamps of the fake clock:
+	// Frame 0-11, A 1-8, B 2-5, C 3-4, D 6-7, E 9-10
+	struct Expected
+	{
+		const char* Name;
+		unsigned Parent;
+		unsigned Depth;
+		double GPUBegin;
+		double GPUDuration;
+	};
+	const Expected expected[] = {
+		{ "Frame", Profiler::NO_PARENT, 0, 0, 11 },
+		{ "A", 0, 1, 1, 7 },
+		{ "B", 1, 2, 2, 3 },
+		{ "C", 2, 3, 3, 1 },
+		{ "D", 1, 2, 6, 1 },
+		{ "E", 0, 1, 9, 1 },
+	};
+	for (auto i = 0u; i < 6; ++i)
+	{
+		const auto& scope = result.Scopes[i];
+		CHECK(std::string(scope.Name) == expected[i].Name);
+		CHECK(scope.Parent == expected[i].Parent);
+		CHECK(scope.Depth == expected[i].Depth);
+		CHECK(scope.GPUBegin == expected[i].GPUBegin);
+		CHECK(scope.GPUDuration == expected[i].GPUDuration);
+		// Children are within their parents on the CPU too
+		CHECK(scope.CPUDuration >= 0.0);
+		if (scope.Parent != Profiler::NO_PARENT)
+		{
+			const auto& parent = result.Scopes[scope.Parent];
+			CHECK(scope.CPUBegin >= parent.CPUBegin);
+			CHECK(scope.CPUBegin + scope.CPUDuration <= parent.CPUBegin + parent.CPUDuration + 1e-9);
+		}
+	}
+
+	// Past MAX_SCOPES the scopes aren't timed and the ones inside them hang
+	// from the closest timed parent
+	profiler.BeginFrame();
+	for (auto i = 1u; i < Profiler::MAX_SCOPES; ++i)
+	{
+		ProfileScope scope(&profiler, "Filler");
+	}
+	{
+		ProfileScope dropped(&profiler, "Dropped");
+		ProfileScope inside(&profiler, "Inside");
+	}
+	profiler.EndFrame();
+	CHECK(profiler.GetLastFrame().FrameId == 2);
+	CHECK(profiler.GetLastFrame().Scopes.size() == Profiler::MAX_SCOPES);
+	CHECK(profiler.ResetStats().ScopesDropped == 2);
+}
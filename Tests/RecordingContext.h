@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "StateCache.h"
+
+// A StateContext that writes down every call it gets as text, e.g.
+// "SetShader 1 #4" - handles are small numbers made with MakeHandle
+class RecordingContext : public StateContext
+{
+public:
+	static Handle MakeHandle(unsigned id) { return reinterpret_cast<Handle>(std::uintptr_t(id)); }
+
+	std::vector<std::string> Calls;
+
+	virtual void SetInputLayout(Handle layout) override
+	{
+		Add("SetInputLayout %s", Id(layout).c_str());
+	}
+	virtual void SetVertexBuffer(unsigned slot, Handle buffer, unsigned stride, unsigned offset) override
+	{
+		Add("SetVertexBuffer %u %s %u %u", slot, Id(buffer).c_str(), stride, offset);
+	}
+	virtual void SetIndexBuffer(Handle buffer, unsigned format, unsigned offset) override
+	{
+		Add("SetIndexBuffer %s %u %u", Id(buffer).c_str(), format, offset);
+	}
+	virtual void SetShader(ShaderStage stage, Handle shader) override
+	{
+		Add("SetShader %u %s", unsigned(stage), Id(shader).c_str());
+	}
+	virtual void SetResources(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* views) override
+	{
+		Add("SetResources %u %u%s", unsigned(stage), firstSlot, Ids(views, count).c_str());
+	}
+	virtual void SetSamplers(ShaderStage stage, unsigned firstSlot, unsigned count, Handle const* samplers) override
+	{
+		Add("SetSamplers %u %u%s", unsigned(stage), firstSlot, Ids(samplers, count).c_str());
+	}
+	virtual void SetUnorderedAccessViews(unsigned firstSlot, unsigned count, Handle const* views) override
+	{
+		Add("SetUnorderedAccessViews %u%s", firstSlot, Ids(views, count).c_str());
+	}
+	virtual void SetConstantBuffer(ShaderStage stage, unsigned slot, Handle buffer, unsigned firstConstant, unsigned constantsCount) override
+	{
+		Add("SetConstantBuffer %u %u %s %u %u", unsigned(stage), slot, Id(buffer).c_str(), firstConstant, constantsCount);
+	}
+	virtual void SetDepthState(Handle state, unsigned stencilRef) override
+	{
+		Add("SetDepthState %s %u", Id(state).c_str(), stencilRef);
+	}
+	virtual void SetRasterState(Handle state) override
+	{
+		Add("SetRasterState %s", Id(state).c_str());
+	}
+
+	virtual void UpdateBuffer(Handle buffer, const void* data, unsigned size) override
+	{
+		// The bytes as hex
+		std::string bytes;
+		for (auto i = 0u; i < size; ++i)
+		{
+			char byte[4];
+			std::snprintf(byte, sizeof(byte), "%02x", static_cast<const std::uint8_t*>(data)[i]);
+			bytes += byte;
+		}
+		Add("UpdateBuffer %s %s", Id(buffer).c_str(), bytes.c_str());
+	}
+	virtual void DrawIndexedInstanced(unsigned indicesCount, unsigned instancesCount, unsigned firstIndex, int baseVertex, unsigned firstInstance) override
+	{
+		Add("DrawIndexedInstanced %u %u %u %d %u", indicesCount, instancesCount, firstIndex, baseVertex, firstInstance);
+	}
+	virtual void DrawIndexedInstancedIndirect(Handle arguments, unsigned offset) override
+	{
+		Add("DrawIndexedInstancedIndirect %s %u", Id(arguments).c_str(), offset);
+	}
+	virtual void Dispatch(unsigned x, unsigned y, unsigned z) override
+	{
+		Add("Dispatch %u %u %u", x, y, z);
+	}
+
+private:
+	static std::string Id(Handle handle)
+	{
+		char text[24];
+		std::snprintf(text, sizeof(text), "#%llu", static_cast<unsigned long long>(reinterpret_cast<std::uintptr_t>(handle)));
+		return text;
+	}
+	static std::string Ids(Handle const* handles, unsigned count)
+	{
+		std::string text;
+		for (auto i = 0u; i < count; ++i)
+		{
+			text += " " + Id(handles[i]);
+		}
+		return text;
+	}
+
+	template<typename... Args>
+	void Add(const char* format, Args... args)
+	{
+		char text[512];
+		std::snprintf(text, sizeof(text), format, args...);
+		Calls.push_back(text);
+	}
+};
@@ -0,0 +1,221 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "RenderGraph.h"
+
+#include <random>
+
+namespace {
+	RenderGraph::ResourceDesc Transient(const char* name, RenderGraph::ResourceKind kind, size_t size, size_t alignment = 1)
+	{
+		RenderGraph::ResourceDesc desc = { name, kind, size, alignment };
+		return desc;
+	}
+
+	// Names of the compiled passes in execution order
+	std::vector<std::string> CompiledNames(const RenderGraph& graph)
+	{
+		std::vector<std::string> names;
+		for (const auto& compiled : graph.GetCompiledPasses())
+		{
+			names.push_back(graph.GetPassName(compiled.Pass));
+		}
+		return names;
+	}
+
+	std::vector<std::string> Names(std::initializer_list<const char*> names)
+	{
+		return std::vector<std::string>(names.begin(), names.end());
+	}
+}
+
+// Passes added in the opposite order of their dependencies
+TEST_CASE(RenderGraphOrdersByLastWriter)
+{
+	RenderGraph graph;
+	const auto backbuffer = graph.ImportResource("Backbuffer", RenderGraph::RK_Texture);
+	const auto color = graph.CreateResource(Transient("Color", RenderGraph::RK_Texture, 100));
+	const auto depth = graph.CreateResource(Transient("Depth", RenderGraph::RK_Texture, 50));
+
+	const auto composite = graph.AddPass("Composite");
+	graph.Read(composite, color);
+	graph.Write(composite, backbuffer);
+	const auto lighting = graph.AddPass("Lighting");
+	graph.Read(lighting, depth);
+	graph.Write(lighting, color);
+	// Two writers of the depth - the reader waits for the second one, the
+	// second for the first
+	const auto prepass = graph.AddPass("Prepass");
+	graph.Write(prepass, depth);
+	const auto decals = graph.AddPass("Decals");
+	graph.Read(decals, depth);
+	graph.Write(decals, depth);
+	// Depends on nothing - it waits behind the ready passes added before it
+	graph.AddPass("Clear", true);
+
+	CHECK(graph.Compile());
+	CHECK(graph.GetError().empty());
+	CHECK(CompiledNames(graph) == Names({ "Prepass", "Decals", "Lighting", "Composite", "Clear" }));
+	CHECK(graph.GetStats().PassesCount == 5);
+	CHECK(graph.GetStats().PassesCulled == 0);
+
+	// Writing what a later writer reads - a cycle
+	graph.Read(prepass, color);
+	CHECK(!graph.Compile());
+	const auto& error = graph.GetError();
+	CHECK(error.find("Prepass") != std::string::npos);
+	CHECK(error.find("Lighting") != std::string::npos);
+	CHECK(error.find("Clear") == std::string::npos);
+}
+
+TEST_CASE(RenderGraphCullsUnusedPasses)
+{
+	RenderGraph graph;
+	const auto backbuffer = graph.ImportResource("Backbuffer", RenderGraph::RK_Texture);
+	const auto depth = graph.CreateResource(Transient("Depth", RenderGraph::RK_Texture, 50));
+	const auto debug = graph.CreateResource(Transient("Debug", RenderGraph::RK_Texture, 70));
+	const auto readback = graph.CreateResource(Transient("Readback", RenderGraph::RK_Buffer, 10));
+	const auto history = graph.CreateResource(Transient("History", RenderGraph::RK_Buffer, 20));
+
+	const auto prepass = graph.AddPass("Prepass");
+	graph.Write(prepass, depth);
+	const auto forward = graph.AddPass("Forward");
+	graph.Read(forward, depth);
+	graph.Write(forward, backbuffer);
+	// Nothing reads what it writes
+	const auto debugView = graph.AddPass("Debug view");
+	graph.Read(debugView, depth);
+	graph.Write(debugView, debug);
+	// Only a culled pass reads it
+	const auto history1 = graph.AddPass("History");
+	graph.Write(history1, history);
+	const auto debugHistory = graph.AddPass("Debug history");
+	graph.Read(debugHistory, history);
+	graph.Write(debugHistory, debug);
+	// A side effect keeps it and the pass it reads from, added after it
+	const auto stats = graph.AddPass("Readback stats", true);
+	const auto count = graph.AddPass("Count");
+	graph.Write(count, readback);
+	graph.Read(stats, readback);
+
+	CHECK(graph.Compile());
+	CHECK(CompiledNames(graph) == Names({ "Prepass", "Forward", "Count", "Readback stats" }));
+	CHECK(graph.GetStats().PassesCount == 4);
+	CHECK(graph.GetStats().PassesCulled == 3);
+
+	// The transients of culled passes get no memory
+	CHECK(graph.GetStats().TransientMemoryUnaliased[RenderGraph::RK_Texture] == 50);
+	CHECK(graph.GetStats().TransientMemoryUnaliased[RenderGraph::RK_Buffer] == 10);
+
+	// Clear drops everything
+	graph.Clear();
+	CHECK(graph.Compile());
+	CHECK(graph.GetCompiledPasses().empty());
+}
+
+TEST_CASE(RenderGraphPlacesTransients)
+{
+	RenderGraph graph;
+	const auto backbuffer = graph.ImportResource("Backbuffer", RenderGraph::RK_Texture);
+	const auto a = graph.CreateResource(Transient("A", RenderGraph::RK_Texture, 100));
+	const auto b = graph.CreateResource(Transient("B", RenderGraph::RK_Texture, 60));
+	const auto c = graph.CreateResource(Transient("C", RenderGraph::RK_Texture, 100));
+	const auto d = graph.CreateResource(Transient("D", RenderGraph::RK_Texture, 40, 64));
+	const auto e = graph.CreateResource(Transient("E", RenderGraph::RK_Buffer, 50));
+
+	// A chain - A lives in passes 0-1, B 1-2, C 2-3, D 3-4, E all of them
+	const char* names[] = { "P0", "P1", "P2", "P3", "P4" };
+	const RenderGraph::ResourceId chain[] = { a, b, c, d };
+	RenderGraph::PassId passes[5];
+	for (auto i = 0u; i < 5; ++i)
+	{
+		passes[i] = graph.AddPass(names[i]);
+		if (i > 0)
+		{
+			graph.Read(passes[i], chain[i - 1]);
+		}
+		graph.Write(passes[i], i < 4 ? chain[i] : backbuffer);
+	}
+	graph.Write(passes[0], e);
+	graph.Read(passes[4], e);
+
+	CHECK(graph.Compile());
+	CHECK(CompiledNames(graph) == Names({ "P0", "P1", "P2", "P3", "P4" }));
+
+	// Biggest first, ties by creation: A at 0, C at 0 (A is dead by then), B
+	// next to both, D next to C at the 64 alignment
+	CHECK(graph.GetPlacement(a) == 0);
+	CHECK(graph.GetPlacement(c) == 0);
+	CHECK(graph.GetPlacement(b) == 100);
+	CHECK(graph.GetPlacement(d) == 128);
+	CHECK(graph.GetStats().TransientMemory[RenderGraph::RK_Texture] == 168);
+	CHECK(graph.GetStats().TransientMemoryUnaliased[RenderGraph::RK_Texture] == 300);
+	// Buffers have memory of their own
+	CHECK(graph.GetPlacement(e) == 0);
+	CHECK(graph.GetStats().TransientMemory[RenderGraph::RK_Buffer] == 50);
+	CHECK(graph.GetPlacement(backbuffer) == 0);
+}
+
+// Random graphs - transients alive at the same time never share memory,
+// are aligned and fit in the reported peak
+TEST_CASE(RenderGraphPlacementNeverOverlaps)
+{
+	static const unsigned RESOURCES_COUNT = 16;
+	std::mt19937 random(53);
+	for (auto graphIndex = 0u; graphIndex < 500; ++graphIndex)
+	{
+		RenderGraph graph;
+		std::vector<RenderGraph::ResourceDesc> descs;
+		std::vector<RenderGraph::ResourceId> resources;
+		for (auto i = 0u; i < RESOURCES_COUNT; ++i)
+		{
+			const auto kind = random() % 4 ? RenderGraph::RK_Texture : RenderGraph::RK_Buffer;
+			descs.push_back(Transient("R", kind, 1 + random() % 1000, size_t(1) << (random() % 8)));
+			resources.push_back(graph.CreateResource(descs.back()));
+		}
+
+		// Pass i writes resource i and reads a few earlier ones. With side
+		// effects all are kept and run in the order they were added.
+		std::vector<unsigned> first(RESOURCES_COUNT);
+		std::vector<unsigned> last(RESOURCES_COUNT);
+		for (auto i = 0u; i < RESOURCES_COUNT; ++i)
+		{
+			const auto pass = graph.AddPass("P", true);
+			graph.Write(pass, resources[i]);
+			first[i] = last[i] = i;
+			for (auto read = 0u; read < 2 && i > 0; ++read)
+			{
+				const auto source = unsigned(random() % i);
+				graph.Read(pass, resources[source]);
+				last[source] = i;
+			}
+		}
+
+		CHECK(graph.Compile());
+		CHECK(graph.GetCompiledPasses().size() == RESOURCES_COUNT);
+
+		size_t peak[RenderGraph::RK_Count] = { 0, 0 };
+		size_t unaliased[RenderGraph::RK_Count] = { 0, 0 };
+		auto overlaps = 0u;
+		for (auto i = 0u; i < RESOURCES_COUNT; ++i)
+		{
+			const auto offset = graph.GetPlacement(resources[i]);
+			CHECK(offset % descs[i].Alignment == 0);
+			peak[descs[i].Kind] = std::max(peak[descs[i].Kind], offset + descs[i].Size);
+			unaliased[descs[i].Kind] += descs[i].Size;
+			for (auto j = i + 1; j < RESOURCES_COUNT; ++j)
+			{
+				const auto otherOffset = graph.GetPlacement(resources[j]);
+				const bool together = first[i] <= last[j] && first[j] <= last[i];
+				const bool shared = offset < otherOffset + descs[j].Size && otherOffset < offset + descs[i].Size;
+				overlaps += descs[i].Kind == descs[j].Kind && together && shared;
+			}
+		}
+		CHECK(overlaps == 0);
+		for (auto kind = 0u; kind < RenderGraph::RK_Count; ++kind)
+		{
+			CHECK(graph.GetStats().TransientMemory[kind] == peak[kind]);
+			CHECK(graph.GetStats().TransientMemoryUnaliased[kind] == unaliased[kind]);
+		}
+	}
+}
@@ -0,0 +1,155 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "RenderQueue.h"
+#include "JobSystem.h"
+
+#include <random>
+
+namespace {
+	// Keys of a typical queue - few passes, shaders and texture sets, so
+	// most bytes repeat and many keys are equal
+	std::vector<RenderQueueEntry> MakeEntries(unsigned count, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_int_distribution<unsigned> pass(0, 3);
+		std::uniform_int_distribution<unsigned> alpha(0, 1);
+		std::uniform_int_distribution<unsigned> shader(0, 40);
+		std::uniform_int_distribution<unsigned> textures(0, 300);
+		std::uniform_int_distribution<unsigned> depth(0, 2000);
+
+		std::vector<RenderQueueEntry> entries(count);
+		for (auto item = 0u; item < count; ++item)
+		{
+			entries[item].Key = SortKey::Make(pass(random), alpha(random), shader(random), textures(random), depth(random));
+			entries[item].Item = item;
+		}
+		return entries;
+	}
+
+	bool ByKey(const RenderQueueEntry& lhs, const RenderQueueEntry& rhs)
+	{
+		return lhs.Key < rhs.Key;
+	}
+
+	// The radix sort is stable - equal keys keep the order of their items
+	void CheckSortsLikeStd(std::vector<RenderQueueEntry> entries)
+	{
+		auto expected = entries;
+		std::stable_sort(expected.begin(), expected.end(), ByKey);
+		auto unstable = entries;
+		std::sort(unstable.begin(), unstable.end(), ByKey);
+
+		std::vector<RenderQueueEntry> scratch;
+		RadixSort(entries, scratch);
+
+		CHECK(entries.size() == expected.size());
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			CHECK(entries[i].Key == unstable[i].Key);
+			CHECK(entries[i].Key == expected[i].Key && entries[i].Item == expected[i].Item);
+		}
+	}
+}
+
+TEST_CASE(RadixSortMatchesStdSort)
+{
+	CheckSortsLikeStd(MakeEntries(0, 1));
+	CheckSortsLikeStd(MakeEntries(1, 1));
+	CheckSortsLikeStd(MakeEntries(2, 1));
+	CheckSortsLikeStd(MakeEntries(10000, 2));
+
+	// Every byte differs somewhere - no pass is skipped
+	std::mt19937_64 random(3);
+	std::vector<RenderQueueEntry> entries(5000);
+	for (auto item = 0u; item < entries.size(); ++item)
+	{
+		entries[item].Key = random();
+		entries[item].Item = item;
+	}
+	CheckSortsLikeStd(entries);
+
+	// Every pass is skipped
+	for (auto& entry : entries)
+	{
+		entry.Key = SortKey::Make(1, 0, 5, 7, 100);
+	}
+	CheckSortsLikeStd(entries);
+}
+
+TEST_CASE(SortKeyFieldOrder)
+{
+	// Higher fields win over all lower ones
+	CHECK(SortKey::Make(0, 1, 4095, 65535, 0xffffff) < SortKey::Make(1, 0, 0, 0, 0));
+	CHECK(SortKey::Make(0, 0, 4095, 65535, 0xffffff) < SortKey::Make(0, 1, 0, 0, 0));
+	CHECK(SortKey::Make(0, 0, 3, 65535, 0xffffff) < SortKey::Make(0, 0, 4, 0, 0));
+	CHECK(SortKey::Make(0, 0, 3, 9, 0xffffff) < SortKey::Make(0, 0, 3, 10, 0));
+
+	const auto key = SortKey::Make(2, 1, 300, 4000, 123456);
+	CHECK(SortKey::GetPass(key) == 2);
+	CHECK(SortKey::GetAlphaMode(key) == 1);
+	CHECK(SortKey::GetShaderVariant(key) == 300);
+	CHECK(SortKey::GetTextureSet(key) == 4000);
+	CHECK(SortKey::GetDepth(key) == 123456);
+
+	CHECK(SortKey::QuantizeDepth(1.f, 100.f) < SortKey::QuantizeDepth(2.f, 100.f));
+	CHECK(SortKey::QuantizeDepth(-1.f, 100.f) == 0);
+	CHECK(SortKey::QuantizeDepth(200.f, 100.f) == (1u << SortKey::DEPTH_BITS) - 1);
+}
+
+TEST_CASE(RenderQueueBuild)
+{
+	JobSystem jobs(2);
+	gJobSystem = &jobs;
+
+	const auto source = MakeEntries(20000, 4);
+	RenderQueue queue;
+	queue.Build(unsigned(source.size()), [&source](std::uint32_t item) { return source[item].Key; });
+
+	const auto& entries = queue.GetEntries();
+	CHECK(entries.size() == source.size());
+	std::vector<bool> seen(source.size(), false);
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		CHECK(entries[i].Key == source[entries[i].Item].Key);
+		CHECK(!seen[entries[i].Item]);
+		seen[entries[i].Item] = true;
+		if (i)
+		{
+			CHECK(entries[i - 1].Key <= entries[i].Key);
+		}
+	}
+
+	gJobSystem = nullptr;
+}
+
+BENCHMARK(RenderQueueSort)
+{
+	static const unsigned REPEATS = 21;
+	static const unsigned ENTRIES = 100000;
+
+	const auto source = MakeEntries(ENTRIES, 5);
+	std::vector<RenderQueueEntry> entries;
+	std::vector<RenderQueueEntry> scratch;
+	scratch.reserve(ENTRIES);
+
+	Test::ReportTime("RadixSort 100k", Test::Measure(REPEATS, [&]() {
+		entries = source;
+		RadixSort(entries, scratch);
+	}));
+	Test::ReportTime("std::sort 100k", Test::Measure(REPEATS, [&]() {
+		entries = source;
+		std::sort(entries.begin(), entries.end(), ByKey);
+	}));
+	Test::ReportTime("copy only 100k", Test::Measure(REPEATS, [&]() {
+		entries = source;
+	}));
+
+	JobSystem jobs;
+	gJobSystem = &jobs;
+	RenderQueue queue;
+	Test::ReportTime("RenderQueue::Build 100k", Test::Measure(REPEATS, [&]() {
+		queue.Build(ENTRIES, [&source](std::uint32_t item) { return source[item].Key; });
+	}));
+	gJobSystem = nullptr;
+}
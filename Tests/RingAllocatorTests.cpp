@@ -0,0 +1,155 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "RingAllocator.h"
+
+#include <random>
+
+namespace {
+	const size_t INVALID = RingAllocator::INVALID_OFFSET;
+}
+
+TEST_CASE(RingAllocatorTooLarge)
+{
+	RingAllocator ring(1024);
+	CHECK(ring.Allocate(0, 16) == INVALID);
+	CHECK(ring.Allocate(1025, 1) == INVALID);
+	CHECK(ring.GetUsed() == 0);
+
+	CHECK(ring.Allocate(1024, 256) == 0);
+	CHECK(ring.GetUsed() == 1024);
+	CHECK(ring.Allocate(1, 1) == INVALID);
+}
+
+TEST_CASE(RingAllocatorAlignment)
+{
+	RingAllocator ring(4096);
+	CHECK(ring.Allocate(3, 1) == 0);
+	CHECK(ring.Allocate(8, 16) == 16);
+	CHECK(ring.Allocate(100, 256) == 256);
+	CHECK(ring.Allocate(1, 4) == 356);
+	// The padding counts as used until the frame completes
+	CHECK(ring.GetUsed() == 357);
+
+	ring.EndFrame(1);
+	ring.FrameCompleted(1);
+	CHECK(ring.GetUsed() == 0);
+}
+
+TEST_CASE(RingAllocatorFenceRecycling)
+{
+	RingAllocator ring(1024);
+	CHECK(ring.Allocate(600, 16) == 0);
+	ring.EndFrame(1);
+	CHECK(ring.Allocate(300, 16) == 608);
+	ring.EndFrame(2);
+	CHECK(ring.GetPendingFramesCount() == 2);
+	CHECK(ring.GetOldestPendingFrame() == 1);
+
+	// No room until the GPU is done with a frame
+	CHECK(ring.Allocate(600, 16) == INVALID);
+	ring.FrameCompleted(0);
+	CHECK(ring.Allocate(600, 16) == INVALID);
+
+	ring.FrameCompleted(1);
+	CHECK(ring.GetPendingFramesCount() == 1);
+	CHECK(ring.GetOldestPendingFrame() == 2);
+	CHECK(ring.GetUsed() == 300 + 8);
+
+	// A later fence frees every frame before it
+	ring.EndFrame(3);
+	ring.EndFrame(4);
+	ring.FrameCompleted(4);
+	CHECK(ring.GetPendingFramesCount() == 0);
+	CHECK(ring.GetUsed() == 0);
+	// An empty ring starts over from the beginning
+	CHECK(ring.Allocate(1024, 16) == 0);
+}
+
+TEST_CASE(RingAllocatorWrapAround)
+{
+	RingAllocator ring(1000);
+	CHECK(ring.Allocate(400, 1) == 0);
+	ring.EndFrame(1);
+	CHECK(ring.Allocate(400, 1) == 400);
+	ring.EndFrame(2);
+	ring.FrameCompleted(1);
+
+	// [800, 1000) is too small - wraps to the space frame 1 gave back and
+	// the end of the buffer is wasted
+	CHECK(ring.Allocate(300, 1) == 0);
+	CHECK(ring.GetUsed() == 400 + 200 + 300);
+	// Up to the tail at 400 only
+	CHECK(ring.Allocate(200, 1) == INVALID);
+	CHECK(ring.Allocate(100, 1) == 300);
+	ring.EndFrame(3);
+
+	ring.FrameCompleted(2);
+	CHECK(ring.GetUsed() == 600);
+	// The wasted end is only given back with frame 3
+	CHECK(ring.Allocate(401, 1) == INVALID);
+	CHECK(ring.Allocate(400, 1) == 400);
+	ring.EndFrame(4);
+	ring.FrameCompleted(4);
+	CHECK(ring.GetUsed() == 0);
+}
+
+// Frames complete a few frames late like a GPU behind the CPU - live ranges
+// must never overlap nor leave the buffer
+TEST_CASE(RingAllocatorRandomFrames)
+{
+	static const size_t CAPACITY = 64 * 1024;
+	static const unsigned LATENCY = 3;
+	struct Range
+	{
+		std::uint64_t Frame;
+		size_t Begin;
+		size_t End;
+	};
+
+	std::mt19937 random(5);
+	std::uniform_int_distribution<size_t> sizes(1, 6000);
+	std::uniform_int_distribution<unsigned> alignmentShift(0, 8);
+	std::uniform_int_distribution<unsigned> allocationsCount(0, 12);
+
+	RingAllocator ring(CAPACITY);
+	std::vector<Range> live;
+	auto failed = 0u;
+	for (std::uint64_t frame = 1; frame < 2000; ++frame)
+	{
+		const auto count = allocationsCount(random);
+		for (auto i = 0u; i < count; ++i)
+		{
+			const auto size = sizes(random);
+			const auto alignment = size_t(1) << alignmentShift(random);
+			const auto offset = ring.Allocate(size, alignment);
+			if (offset == INVALID)
+			{
+				++failed;
+				continue;
+			}
+
+			CHECK(offset % alignment == 0);
+			CHECK(offset + size <= CAPACITY);
+			for (const auto& range : live)
+			{
+				CHECK(offset + size <= range.Begin || offset >= range.End);
+			}
+			Range range = { frame, offset, offset + size };
+			live.push_back(range);
+		}
+		ring.EndFrame(frame);
+
+		if (frame > LATENCY)
+		{
+			const auto completed = frame - LATENCY;
+			ring.FrameCompleted(completed);
+			live.erase(std::remove_if(live.begin(), live.end(),
+				[completed](const Range& range) { return range.Frame <= completed; }), live.end());
+		}
+		CHECK(ring.GetUsed() <= CAPACITY);
+		CHECK(ring.GetPendingFramesCount() == std::min<std::uint64_t>(frame, LATENCY));
+	}
+	// The ring was small enough to be full at times
+	CHECK(failed > 0);
+}
@@ -0,0 +1,179 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "SnapshotQueue.h"
+#include "SimulationThread.h"
+
+#include <random>
+
+namespace {
+	static const unsigned PAYLOAD_SIZE = 256;
+
+	// Marks who is in the slot - a writer and a reader never are at once
+	struct Snapshot
+	{
+		Snapshot()
+			: Frame(0)
+			, Writing(false)
+			, Reading(false)
+		{
+			std::fill(Payload, Payload + PAYLOAD_SIZE, 0u);
+		}
+
+		unsigned Frame;
+		// Every element is the frame - a read in the middle of a write sees a mix
+		unsigned Payload[PAYLOAD_SIZE];
+		std::atomic<bool> Writing;
+		std::atomic<bool> Reading;
+	};
+
+	typedef SnapshotQueue<Snapshot, 3> Queue;
+
+	// Counted on each thread and checked once the threads are done - CHECK
+	// is for the thread that runs the case
+	struct Violations
+	{
+		Violations()
+			: Overlaps(0)
+			, TornReads(0)
+			, OutOfOrder(0)
+		{}
+
+		unsigned Overlaps;
+		unsigned TornReads;
+		unsigned OutOfOrder;
+	};
+
+	void Write(Snapshot& slot, unsigned frame, Violations& violations)
+	{
+		slot.Writing = true;
+		violations.Overlaps += slot.Reading.load();
+		slot.Frame = frame;
+		for (auto& value : slot.Payload)
+		{
+			value = frame;
+		}
+		violations.Overlaps += slot.Reading.load();
+		slot.Writing = false;
+	}
+
+	// The frame of the slot
+	unsigned Read(const Snapshot& constSlot, Violations& violations)
+	{
+		// The flag is the only thing the reader writes
+		auto& slot = const_cast<Snapshot&>(constSlot);
+		slot.Reading = true;
+		violations.Overlaps += slot.Writing.load();
+		const auto frame = slot.Frame;
+		for (const auto value : slot.Payload)
+		{
+			violations.TornReads += value != frame;
+		}
+		violations.Overlaps += slot.Writing.load();
+		slot.Reading = false;
+		return frame;
+	}
+}
+
+// A producer and a consumer going as fast as they can with random stalls on
+// both sides - the consumer gets every frame once, in order, never while it's
+// written, and the last frame it gets is the newest one
+TEST_CASE(SnapshotQueueStress)
+{
+	static const unsigned FRAMES_COUNT = 200000;
+	std::unique_ptr<Queue> queue(new Queue);
+
+	Violations producerViolations;
+	std::atomic<unsigned> maxQueued(0);
+	std::thread producer([&]() {
+		std::mt19937 random(43);
+		for (auto frame = 1u; frame <= FRAMES_COUNT; ++frame)
+		{
+			// Both the waiting and the non-waiting versions
+			auto* slot = frame % 2 ? queue->BeginWrite() : queue->TryBeginWrite();
+			while (!slot)
+			{
+				std::this_thread::yield();
+				slot = queue->TryBeginWrite();
+			}
+			Write(*slot, frame, producerViolations);
+			queue->EndWrite();
+			maxQueued = std::max(maxQueued.load(), queue->GetQueuedCount());
+			if (random() % 64 == 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	Violations consumerViolations;
+	std::mt19937 random(47);
+	auto lastFrame = 0u;
+	while (lastFrame < FRAMES_COUNT)
+	{
+		const auto* slot = random() % 2 ? queue->BeginRead() : queue->TryBeginRead();
+		if (!slot)
+			continue;
+		const auto frame = Read(*slot, consumerViolations);
+		consumerViolations.OutOfOrder += frame != lastFrame + 1;
+		lastFrame = frame;
+		if (random() % 64 == 0)
+		{
+			std::this_thread::yield();
+		}
+		queue->EndRead();
+	}
+	producer.join();
+
+	CHECK(producerViolations.Overlaps == 0);
+	CHECK(consumerViolations.Overlaps == 0);
+	CHECK(consumerViolations.TornReads == 0);
+	CHECK(consumerViolations.OutOfOrder == 0);
+	CHECK(lastFrame == FRAMES_COUNT);
+	CHECK(maxQueued.load() <= 3);
+	CHECK(queue->GetQueuedCount() == 0);
+	CHECK(queue->TryBeginRead() == nullptr);
+}
+
+// The frame loop of the application - a step is started right after the
+// last one is waited for and the render reads while the next step writes.
+// Every frame renders the snapshot of the step that just finished.
+TEST_CASE(SimulationThreadRendersNewestSnapshot)
+{
+	static const unsigned FRAMES_COUNT = 20000;
+	std::unique_ptr<Queue> queue(new Queue);
+
+	Violations simulationViolations;
+	unsigned stepsDone = 0;
+	SimulationThread simulation([&](float) {
+		++stepsDone;
+		Write(*queue->BeginWrite(), stepsDone, simulationViolations);
+		queue->EndWrite();
+	});
+
+	Violations renderViolations;
+	auto stale = 0u;
+	const Snapshot* reading = nullptr;
+	for (auto frame = 0u; frame < FRAMES_COUNT; ++frame)
+	{
+		simulation.Wait();
+		const auto newest = stepsDone;
+		simulation.Start(1.f / 60);
+
+		if (!newest)
+			continue;
+		if (reading)
+		{
+			queue->EndRead();
+		}
+		reading = queue->BeginRead();
+		stale += Read(*reading, renderViolations) != newest;
+	}
+	simulation.Wait();
+
+	CHECK(simulationViolations.Overlaps == 0);
+	CHECK(renderViolations.Overlaps == 0);
+	CHECK(renderViolations.TornReads == 0);
+	CHECK(stale == 0);
+	CHECK(stepsDone == FRAMES_COUNT);
+}
@@ -0,0 +1,243 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "SpatialIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+	typedef BoundsHierarchy::Box Box;
+
+	static const unsigned TYPES_COUNT = 4;
+
+	// What the index holds, kept on the side - id is the index in this array
+	struct Reference
+	{
+		Box Bounds;
+		std::uint32_t Type;
+		SpatialIndex::Handle Handle;
+	};
+
+	Box RandomBox(std::mt19937& random)
+	{
+		// Some stick out of the root cube, sizes from tiny to a fifth of it
+		std::uniform_real_distribution<float> center(-110.f, 110.f);
+		std::uniform_real_distribution<float> logSize(-2.f, 1.6f);
+		Box box;
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			const float c = center(random);
+			const float half = std::pow(10.f, logSize(random)) * 0.5f;
+			box.Min[axis] = c - half;
+			box.Max[axis] = c + half;
+		}
+		return box;
+	}
+
+	// A row-vector perspective projection looking down +z from 'eye', D3D
+	// clip space
+	void MakeViewProjection(const float* eye, float* outMatrix)
+	{
+		const float nearPlane = 0.5f;
+		const float farPlane = 120.f;
+		const float yScale = 1.f / std::tan(0.5f);
+		const float xScale = yScale * 9.f / 16.f;
+		const float zScale = farPlane / (farPlane - nearPlane);
+		const float matrix[16] = {
+			xScale, 0, 0, 0,
+			0, yScale, 0, 0,
+			0, 0, zScale, 1,
+			-eye[0] * xScale, -eye[1] * yScale, -eye[2] * zScale - nearPlane * zScale, -eye[2],
+		};
+		std::copy(matrix, matrix + 16, outMatrix);
+	}
+
+	bool InFrustum(const CullingKernel::FrustumPlanes& planes, const Box& box)
+	{
+		CullingKernel::Boxes8 packed;
+		packed.MinX[0] = box.Min[0]; packed.MinY[0] = box.Min[1]; packed.MinZ[0] = box.Min[2];
+		packed.MaxX[0] = box.Max[0]; packed.MaxY[0] = box.Max[1]; packed.MaxZ[0] = box.Max[2];
+		unsigned inside = 0;
+		return CullingKernel::TestBoxes(planes, packed, 1, inside) != 0;
+	}
+
+	bool InSphere(const float* center, float radius, const Box& box)
+	{
+		float distanceSq = 0;
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			const float outside = std::max(0.f, std::max(box.Min[axis] - center[axis], center[axis] - box.Max[axis]));
+			distanceSq += outside * outside;
+		}
+		return distanceSq <= radius * radius;
+	}
+
+	bool InBox(const Box& query, const Box& box)
+	{
+		for (auto axis = 0u; axis < 3; ++axis)
+		{
+			if (box.Min[axis] > query.Max[axis] || box.Max[axis] < query.Min[axis])
+				return false;
+		}
+		return true;
+	}
+
+	// The query has to give exactly the objects the test picks - compared as
+	// sorted ids, the type of each checked against the reference
+	template<typename Predicate>
+	void CheckQuery(const std::vector<Reference>& objects,
+		unsigned typeMask,
+		const SpatialIndex::ResultArena& results,
+		const Predicate& test)
+	{
+		std::vector<std::uint32_t> expected;
+		for (auto id = 0u; id < objects.size(); ++id)
+		{
+			const auto& object = objects[id];
+			if (object.Handle != SpatialIndex::INVALID_HANDLE
+				&& (typeMask & SpatialIndex::TypeBit(object.Type))
+				&& test(object.Bounds))
+			{
+				expected.push_back(id);
+			}
+		}
+
+		CHECK(!results.Overflowed());
+		std::vector<std::uint32_t> found;
+		for (auto i = 0u; i < results.Count; ++i)
+		{
+			const auto& result = results.Objects[i];
+			CHECK(result.Id < objects.size() && objects[result.Id].Type == result.Type);
+			found.push_back(result.Id);
+		}
+		std::sort(found.begin(), found.end());
+		CHECK(found == expected);
+	}
+}
+
+TEST_CASE(SpatialIndexMatchesBruteForce)
+{
+	const Box bounds = { { -100.f, -100.f, -100.f }, { 100.f, 100.f, 100.f } };
+	SpatialIndex index(bounds);
+
+	std::mt19937 random(41);
+	std::uniform_int_distribution<unsigned> types(0, TYPES_COUNT - 1);
+	std::uniform_int_distribution<unsigned> masks(1, (1u << TYPES_COUNT) - 1);
+	std::uniform_real_distribution<float> position(-100.f, 100.f);
+	std::uniform_real_distribution<float> radius(0.f, 60.f);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	std::vector<Reference> objects(20000);
+	for (auto id = 0u; id < objects.size(); ++id)
+	{
+		auto& object = objects[id];
+		object.Bounds = RandomBox(random);
+		object.Type = types(random);
+		object.Handle = index.Insert(object.Type, id, object.Bounds);
+	}
+
+	std::vector<SpatialIndex::Object> storage(objects.size());
+	auto alive = unsigned(objects.size());
+	auto totalFound = 0u;
+	auto totalTested = 0u;
+	for (auto round = 0u; round < 30; ++round)
+	{
+		// Move a third, remove or bring back a few
+		for (auto id = 0u; id < objects.size(); ++id)
+		{
+			auto& object = objects[id];
+			const float dice = unit(random);
+			if (object.Handle == SpatialIndex::INVALID_HANDLE)
+			{
+				if (dice < 0.5f)
+				{
+					object.Bounds = RandomBox(random);
+					object.Handle = index.Insert(object.Type, id, object.Bounds);
+					++alive;
+				}
+			}
+			else if (dice < 0.05f)
+			{
+				index.Remove(object.Handle);
+				object.Handle = SpatialIndex::INVALID_HANDLE;
+				--alive;
+			}
+			else if (dice < 0.35f)
+			{
+				object.Bounds = RandomBox(random);
+				index.Move(object.Handle, object.Bounds);
+			}
+		}
+		CHECK(index.GetObjectsCount() == alive);
+
+		for (auto pass = 0u; pass < 10; ++pass)
+		{
+			const auto typeMask = pass == 0 ? SpatialIndex::ALL_TYPES : masks(random);
+
+			float eye[3] = { position(random), position(random), position(random) - 100.f };
+			float viewProjection[16];
+			MakeViewProjection(eye, viewProjection);
+			CullingKernel::FrustumPlanes planes;
+			CullingKernel::ExtractPlanes(viewProjection, planes);
+			SpatialIndex::ResultArena frustumResults(storage.data(), unsigned(storage.size()));
+			index.QueryFrustum(planes, typeMask, frustumResults);
+			CheckQuery(objects, typeMask, frustumResults, [&](const Box& box) { return InFrustum(planes, box); });
+
+			const float center[3] = { position(random), position(random), position(random) };
+			const float sphereRadius = radius(random);
+			SpatialIndex::ResultArena sphereResults(storage.data(), unsigned(storage.size()));
+			index.QuerySphere(center, sphereRadius, typeMask, sphereResults);
+			CheckQuery(objects, typeMask, sphereResults, [&](const Box& box) { return InSphere(center, sphereRadius, box); });
+
+			Box query;
+			for (auto axis = 0u; axis < 3; ++axis)
+			{
+				const float a = position(random), b = position(random);
+				query.Min[axis] = std::min(a, b);
+				query.Max[axis] = std::min(a, b) + std::abs(a - b) * 0.5f;
+			}
+			SpatialIndex::ResultArena boxResults(storage.data(), unsigned(storage.size()));
+			index.QueryBox(query, typeMask, boxResults);
+			CheckQuery(objects, typeMask, boxResults, [&](const Box& box) { return InBox(query, box); });
+
+			totalFound += frustumResults.Count + sphereResults.Count + boxResults.Count;
+			totalTested += frustumResults.ObjectsTested + sphereResults.ObjectsTested + boxResults.ObjectsTested;
+		}
+	}
+	// The queries found something, and tested fewer objects than brute force
+	CHECK(totalFound > 0);
+	CHECK(totalTested < 30 * 10 * 3 * alive);
+}
+
+TEST_CASE(SpatialIndexOverflow)
+{
+	const Box bounds = { { 0.f, 0.f, 0.f }, { 64.f, 64.f, 64.f } };
+	SpatialIndex index(bounds, 3);
+	for (auto id = 0u; id < 100; ++id)
+	{
+		const float x = float(id % 10) * 6.f + 1.f;
+		const float z = float(id / 10) * 6.f + 1.f;
+		const Box box = { { x, 1.f, z }, { x + 1.f, 2.f, z + 1.f } };
+		index.Insert(id % 2, id, box);
+	}
+
+	// Counts every object of the type, writes only what fits
+	SpatialIndex::Object storage[16];
+	SpatialIndex::ResultArena results(storage, 16);
+	index.QueryBox(bounds, SpatialIndex::TypeBit(1), results);
+	CHECK(results.Overflowed());
+	CHECK(results.Count == 50);
+	for (const auto& object : storage)
+	{
+		CHECK(object.Type == 1 && object.Id % 2 == 1);
+	}
+
+	// Cleared, nothing is found
+	index.Clear();
+	CHECK(index.GetObjectsCount() == 0);
+	SpatialIndex::ResultArena empty(storage, 16);
+	index.QueryBox(bounds, SpatialIndex::ALL_TYPES, empty);
+	CHECK(empty.Count == 0);
+}
@@ -0,0 +1,166 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "RecordingContext.h"
+#include "StateCache.h"
+
+namespace {
+	typedef CommandStream CS;
+
+	CS::Handle H(unsigned id)
+	{
+		return RecordingContext::MakeHandle(id);
+	}
+
+	// The calls since the last Take
+	std::vector<std::string> Take(RecordingContext& context)
+	{
+		std::vector<std::string> calls;
+		calls.swap(context.Calls);
+		return calls;
+	}
+
+	std::vector<std::string> Calls(std::initializer_list<const char*> calls)
+	{
+		return std::vector<std::string>(calls.begin(), calls.end());
+	}
+
+	// A bind of every kind
+	void BindAll(StateCache& cache)
+	{
+		const CS::Handle views[] = { H(5), H(6) };
+		cache.SetInputLayout(H(1));
+		cache.SetVertexBuffer(0, H(2), 32, 0);
+		cache.SetIndexBuffer(H(3), 42, 0);
+		cache.SetShader(CS::SS_Vertex, H(4));
+		cache.SetResources(CS::SS_Pixel, 0, 2, views);
+		cache.SetSamplers(CS::SS_Pixel, 0, 2, views);
+		cache.SetUnorderedAccessViews(0, 2, views);
+		cache.SetConstantBuffer(CS::SS_Pixel, 1, H(7), 0, 0);
+		cache.SetDepthState(H(8), 1);
+		cache.SetRasterState(H(9));
+	}
+	const unsigned BIND_ALL_CALLS = 10;
+}
+
+TEST_CASE(StateCacheDropsRedundantBinds)
+{
+	RecordingContext context;
+	StateCache cache(&context);
+
+	BindAll(cache);
+	CHECK(Take(context).size() == BIND_ALL_CALLS);
+	BindAll(cache);
+	CHECK(Take(context).empty());
+
+	auto stats = cache.ResetStats();
+	CHECK(stats.Calls == 2 * BIND_ALL_CALLS);
+	CHECK(stats.CallsFiltered == BIND_ALL_CALLS);
+	// Vertex buffer, 3 ranges of 2 and a constant buffer, twice
+	CHECK(stats.Slots == 2 * 8);
+	CHECK(stats.SlotsFiltered == 8);
+
+	// Any argument that differs goes through
+	cache.SetVertexBuffer(0, H(2), 16, 0);
+	cache.SetVertexBuffer(0, H(2), 16, 64);
+	cache.SetVertexBuffer(1, H(2), 16, 64);
+	cache.SetIndexBuffer(H(3), 57, 0);
+	cache.SetConstantBuffer(CS::SS_Pixel, 1, H(7), 16, 4);
+	cache.SetConstantBuffer(CS::SS_Vertex, 1, H(7), 16, 4);
+	cache.SetDepthState(H(8), 2);
+	cache.SetShader(CS::SS_Pixel, H(4));
+	cache.SetInputLayout(nullptr);
+	CHECK(Take(context) == Calls({
+		"SetVertexBuffer 0 #2 16 0",
+		"SetVertexBuffer 0 #2 16 64",
+		"SetVertexBuffer 1 #2 16 64",
+		"SetIndexBuffer #3 57 0",
+		"SetConstantBuffer 1 1 #7 16 4",
+		"SetConstantBuffer 0 1 #7 16 4",
+		"SetDepthState #8 2",
+		"SetShader 1 #4",
+		"SetInputLayout #0",
+	}));
+
+	// Slots past the shadowed ones are always sent
+	cache.SetVertexBuffer(StateCache::VERTEX_BUFFERS_COUNT, H(2), 16, 0);
+	cache.SetVertexBuffer(StateCache::VERTEX_BUFFERS_COUNT, H(2), 16, 0);
+	cache.SetConstantBuffer(CS::SS_Compute, StateCache::CONSTANT_BUFFERS_COUNT, H(7), 0, 0);
+	cache.SetConstantBuffer(CS::SS_Compute, StateCache::CONSTANT_BUFFERS_COUNT, H(7), 0, 0);
+	CHECK(Take(context).size() == 4);
+}
+
+TEST_CASE(StateCacheTrimsRanges)
+{
+	RecordingContext context;
+	StateCache cache(&context);
+
+	CS::Handle views[] = { H(10), H(11), H(12), H(13), H(14), H(15), H(16), H(17) };
+	cache.SetResources(CS::SS_Pixel, 0, 8, views);
+	CHECK(Take(context) == Calls({ "SetResources 1 0 #10 #11 #12 #13 #14 #15 #16 #17" }));
+
+	// One changed - only it is sent
+	views[3] = H(23);
+	cache.SetResources(CS::SS_Pixel, 0, 8, views);
+	CHECK(Take(context) == Calls({ "SetResources 1 3 #23" }));
+
+	// Two apart - the span between them goes in one call
+	views[2] = H(22);
+	views[5] = H(25);
+	cache.SetResources(CS::SS_Pixel, 0, 8, views);
+	CHECK(Take(context) == Calls({ "SetResources 1 2 #22 #23 #14 #25" }));
+
+	// A range starting further in, the same views - nothing
+	cache.SetResources(CS::SS_Pixel, 4, 4, views + 4);
+	CHECK(Take(context).empty());
+	auto stats = cache.ResetStats();
+	CHECK(stats.Calls == 4 && stats.CallsFiltered == 1);
+	CHECK(stats.Slots == 28);
+	CHECK(stats.SlotsFiltered == 7 + 4 + 4);
+
+	// Stages and kinds have their own slots
+	cache.SetResources(CS::SS_Compute, 0, 2, views);
+	cache.SetSamplers(CS::SS_Pixel, 0, 2, views);
+	cache.SetUnorderedAccessViews(0, 2, views);
+	CHECK(Take(context).size() == 3);
+
+	// Across the end of the shadow - the slots past it always go
+	const CS::Handle samplers[] = { H(30), H(31), H(32), H(33) };
+	const auto first = StateCache::SAMPLERS_COUNT - 2;
+	cache.SetSamplers(CS::SS_Vertex, first, 4, samplers);
+	CHECK(Take(context).size() == 1);
+	cache.SetSamplers(CS::SS_Vertex, first, 4, samplers);
+	CHECK(Take(context) == Calls({ "SetSamplers 0 8 #32 #33" }));
+}
+
+TEST_CASE(StateCacheInvalidate)
+{
+	RecordingContext context;
+	StateCache cache(&context);
+
+	BindAll(cache);
+	const auto first = Take(context);
+	CHECK(first.size() == BIND_ALL_CALLS);
+
+	// Everything is sent again, exactly as the first time
+	cache.Invalidate();
+	BindAll(cache);
+	CHECK(Take(context) == first);
+	BindAll(cache);
+	CHECK(Take(context).empty());
+
+	// Even unbinding - nothing is assumed bound after Invalidate
+	const CS::Handle none[] = { nullptr, nullptr };
+	cache.Invalidate();
+	cache.SetResources(CS::SS_Pixel, 0, 2, none);
+	cache.SetShader(CS::SS_Compute, nullptr);
+	CHECK(Take(context) == Calls({ "SetResources 1 0 #0 #0", "SetShader 2 #0" }));
+	cache.SetResources(CS::SS_Pixel, 0, 2, none);
+	cache.SetShader(CS::SS_Compute, nullptr);
+	CHECK(Take(context).empty());
+
+	// A new cache knows nothing either
+	StateCache fresh(&context);
+	fresh.SetShader(CS::SS_Compute, nullptr);
+	CHECK(Take(context).size() == 1);
+}
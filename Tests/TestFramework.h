@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+// A minimal self-registering test runner. Test files define their cases with
+// TEST_CASE and check results with CHECK - a failed check is reported and the
+// case goes on. BENCHMARK cases run only when the runner gets --benchmark.
+namespace Test
+{
+	typedef void (*Func)();
+
+	struct Case
+	{
+		const char* Name;
+		const char* File;
+		Func Run;
+		bool IsBenchmark;
+	};
+
+	std::vector<Case>& GetCases();
+
+	void ReportFailure(const char* file, int line, const char* expression);
+	// Writes a benchmark result to the output
+	void ReportTime(const char* name, double milliseconds);
+
+	struct Registrar
+	{
+		Registrar(const char* name, const char* file, Func run, bool isBenchmark)
+		{
+			Case testCase = { name, file, run, isBenchmark };
+			GetCases().push_back(testCase);
+		}
+	};
+
+	// Median of 'repeats' runs of func in ms
+	template<typename F>
+	double Measure(unsigned repeats, F func)
+	{
+		std::vector<double> samples;
+		for (auto i = 0u; i < std::max(repeats, 1u); ++i)
+		{
+			const auto start = std::chrono::high_resolution_clock::now();
+			func();
+			const auto end = std::chrono::high_resolution_clock::now();
+			samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+		return samples[samples.size() / 2];
+	}
+}
+
+#define TEST_CASE(NAME) \
+	static void NAME(); \
+	static Test::Registrar NAME##Registrar(#NAME, __FILE__, &NAME, false); \
+	static void NAME()
+
+#define BENCHMARK(NAME) \
+	static void NAME(); \
+	static Test::Registrar NAME##Registrar(#NAME, __FILE__, &NAME, true); \
+	static void NAME()
+
+#define CHECK(EXPRESSION) \
+	((EXPRESSION) ? (void)0 : Test::ReportFailure(__FILE__, __LINE__, #EXPRESSION))
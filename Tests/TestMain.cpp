@@ -0,0 +1,77 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace Test
+{
+
+namespace {
+	unsigned g_Failures = 0;
+}
+
+std::vector<Case>& GetCases()
+{
+	static std::vector<Case> cases;
+	return cases;
+}
+
+void ReportFailure(const char* file, int line, const char* expression)
+{
+	++g_Failures;
+	std::printf("%s(%d): check failed: %s\n", file, line, expression);
+}
+
+void ReportTime(const char* name, double milliseconds)
+{
+	std::printf("  %s: %.3fms\n", name, milliseconds);
+}
+
+}
+
+// DemoRendererTests [--benchmark] [name filter]
+int main(int argc, char** argv)
+{
+	bool benchmarks = false;
+	const char* filter = nullptr;
+	for (auto arg = 1; arg < argc; ++arg)
+	{
+		if (!std::strcmp(argv[arg], "--benchmark"))
+		{
+			benchmarks = true;
+		}
+		else
+		{
+			filter = argv[arg];
+		}
+	}
+
+	auto run = 0u;
+	auto failed = 0u;
+	for (const auto& testCase : Test::GetCases())
+	{
+		if (testCase.IsBenchmark && !benchmarks)
+			continue;
+		if (filter && !std::strstr(testCase.Name, filter))
+			continue;
+
+		std::printf("[ RUN    ] %s\n", testCase.Name);
+		const auto failuresBefore = Test::g_Failures;
+		testCase.Run();
+		++run;
+		if (Test::g_Failures != failuresBefore)
+		{
+			++failed;
+			std::printf("[ FAILED ] %s\n", testCase.Name);
+		}
+		else
+		{
+			std::printf("[     OK ] %s\n", testCase.Name);
+		}
+	}
+
+	std::printf("%u of %u cases passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "VertexCompression.h"
+
+#include <cmath>
+#include <random>
+
+namespace {
+	// Worst error of a decoded normal, as the length of the difference - about
+	// 0.006 degrees
+	const float MAX_NORMAL_ERROR = 1e-4f;
+
+	float NormalError(const float normal[3])
+	{
+		std::int16_t encoded[2];
+		float decoded[3];
+		VertexCompression::OctEncode(normal, encoded);
+		VertexCompression::OctDecode(encoded, decoded);
+
+		const float dx = decoded[0] - normal[0];
+		const float dy = decoded[1] - normal[1];
+		const float dz = decoded[2] - normal[2];
+		return std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+}
+
+TEST_CASE(VertexCompressionPositionRoundTrip)
+{
+	const float min[] = { -120.f, 3.f, -0.5f };
+	const float max[] = { 80.f, 3.5f, 0.5f };
+	const auto quantization = VertexCompression::PositionQuantization::FromBounds(min, max);
+
+	std::mt19937 random(17);
+	float maxError[3] = { 0, 0, 0 };
+	for (auto i = 0u; i < 100000; ++i)
+	{
+		float position[3];
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			position[axis] = std::uniform_real_distribution<float>(min[axis], max[axis])(random);
+		}
+		std::uint16_t quantized[3];
+		float decoded[3];
+		quantization.Quantize(position, quantized);
+		quantization.Dequantize(quantized, decoded);
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			maxError[axis] = std::max(maxError[axis], std::abs(decoded[axis] - position[axis]));
+		}
+	}
+
+	for (auto axis = 0u; axis < 3; ++axis)
+	{
+		// Half a step, plus the float rounding of the box
+		const auto bound = quantization.GetMaxError(axis) * 1.01f + std::max(std::abs(min[axis]), std::abs(max[axis])) * 1e-6f;
+		CHECK(maxError[axis] <= bound);
+		CHECK(bound < 0.002f);
+	}
+
+	// The corners of the box are exact and outside it is clamped
+	std::uint16_t quantized[3];
+	quantization.Quantize(min, quantized);
+	CHECK(quantized[0] == 0 && quantized[1] == 0 && quantized[2] == 0);
+	quantization.Quantize(max, quantized);
+	CHECK(quantized[0] == 0xFFFF && quantized[1] == 0xFFFF && quantized[2] == 0xFFFF);
+	const float outside[] = { -1000.f, 1000.f, 0.f };
+	quantization.Quantize(outside, quantized);
+	CHECK(quantized[0] == 0 && quantized[1] == 0xFFFF);
+
+	// A flat box still round trips its plane
+	const float flatMin[] = { 0.f, 2.f, 0.f };
+	const float flatMax[] = { 1.f, 2.f, 1.f };
+	const auto flat = VertexCompression::PositionQuantization::FromBounds(flatMin, flatMax);
+	float decoded[3];
+	flat.Quantize(flatMin, quantized);
+	flat.Dequantize(quantized, decoded);
+	CHECK(decoded[1] == 2.f);
+}
+
+TEST_CASE(VertexCompressionNormalRoundTrip)
+{
+	std::mt19937 random(23);
+	std::normal_distribution<float> gaussian;
+	float maxError = 0.f;
+	float maxLengthError = 0.f;
+	for (auto i = 0u; i < 200000; ++i)
+	{
+		float normal[3] = { gaussian(random), gaussian(random), gaussian(random) };
+		const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length < 1e-3f)
+			continue;
+		for (auto& component : normal)
+		{
+			component /= length;
+		}
+		maxError = std::max(maxError, NormalError(normal));
+
+		std::int16_t encoded[2];
+		float decoded[3];
+		VertexCompression::OctEncode(normal, encoded);
+		VertexCompression::OctDecode(encoded, decoded);
+		const float decodedLength = std::sqrt(decoded[0] * decoded[0] + decoded[1] * decoded[1] + decoded[2] * decoded[2]);
+		maxLengthError = std::max(maxLengthError, std::abs(decodedLength - 1.f));
+	}
+	CHECK(maxError <= MAX_NORMAL_ERROR);
+	CHECK(maxLengthError <= 1e-6f);
+
+	// The axes and the folds of the lower hemisphere
+	const float special[][3] = {
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+		{ 0.57735f, 0.57735f, -0.57735f }, { -0.57735f, 0.57735f, -0.57735f },
+		{ -0.57735f, -0.57735f, -0.57735f }, { 0.70711f, 0, -0.70711f },
+	};
+	for (const auto& normal : special)
+	{
+		CHECK(NormalError(normal) <= MAX_NORMAL_ERROR);
+	}
+}
+
+TEST_CASE(VertexCompressionRebaseIndices)
+{
+	const std::uint32_t indices[] = { 70000, 70002, 70001, 135535, 70000 };
+	std::vector<std::uint16_t> compact;
+	std::uint32_t baseVertex = 0;
+	CHECK(VertexCompression::RebaseIndices16(indices, 5, compact, baseVertex));
+	CHECK(baseVertex == 70000);
+	CHECK(compact.size() == 5);
+	for (auto i = 0u; i < 5; ++i)
+	{
+		CHECK(compact[i] + baseVertex == indices[i]);
+	}
+
+	const std::uint32_t tooWide[] = { 0, 65536 };
+	CHECK(!VertexCompression::RebaseIndices16(tooWide, 2, compact, baseVertex));
+	CHECK(!VertexCompression::RebaseIndices16(indices, 0, compact, baseVertex));
+}
@@ -0,0 +1,90 @@
+#include "precompiled.h"
+
+#include "TestFramework.h"
+#include "VertexStreams.h"
+
+#include <cstring>
+#include <random>
+
+namespace {
+	std::vector<std::uint8_t> MakeVertices(unsigned stride, unsigned verticesCount, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		std::vector<std::uint8_t> vertices(size_t(stride) * verticesCount);
+		for (auto& byte : vertices)
+		{
+			byte = std::uint8_t(random());
+		}
+		return vertices;
+	}
+
+	void CheckRoundTrip(unsigned stride, unsigned positionOffset)
+	{
+		static const unsigned VERTICES_COUNT = 1000;
+		const auto vertices = MakeVertices(stride, VERTICES_COUNT, stride * 31 + positionOffset);
+
+		std::vector<float> positions;
+		std::vector<std::uint8_t> attributes;
+		VertexStreams::Split(vertices.data(), stride, positionOffset, VERTICES_COUNT, positions, attributes);
+
+		CHECK(positions.size() == VERTICES_COUNT * 3);
+		CHECK(attributes.size() == size_t(VERTICES_COUNT) * (stride - VertexStreams::POSITION_SIZE));
+		const auto attributesStride = stride - VertexStreams::POSITION_SIZE;
+		for (auto vertex = 0u; vertex < VERTICES_COUNT; ++vertex)
+		{
+			const auto* source = &vertices[size_t(vertex) * stride];
+			// The position stream holds exactly the positions
+			CHECK(!std::memcmp(&positions[vertex * 3], source + positionOffset, VertexStreams::POSITION_SIZE));
+			if (!attributesStride)
+				continue;
+			// and the attributes everything around them in order
+			const auto* attribute = &attributes[size_t(vertex) * attributesStride];
+			CHECK(!std::memcmp(attribute, source, positionOffset));
+			CHECK(!std::memcmp(attribute + positionOffset,
+				source + positionOffset + VertexStreams::POSITION_SIZE,
+				stride - positionOffset - VertexStreams::POSITION_SIZE));
+		}
+
+		std::vector<std::uint8_t> interleaved;
+		VertexStreams::Interleave(positions.data(), attributes.data(), stride, positionOffset, VERTICES_COUNT, interleaved);
+		CHECK(interleaved == vertices);
+
+		std::vector<float> extracted(VERTICES_COUNT * 3);
+		VertexStreams::ExtractPositions(vertices.data(), stride, positionOffset, VERTICES_COUNT, extracted.data());
+		CHECK(!std::memcmp(extracted.data(), positions.data(), extracted.size() * sizeof(float)));
+	}
+}
+
+TEST_CASE(VertexStreamsRoundTrip)
+{
+	// Position first, in the middle, last and alone
+	CheckRoundTrip(32, 0);
+	CheckRoundTrip(32, 12);
+	CheckRoundTrip(32, 20);
+	CheckRoundTrip(44, 16);
+	CheckRoundTrip(12, 0);
+}
+
+BENCHMARK(VertexStreamsSplitInterleave)
+{
+	static const unsigned REPEATS = 11;
+	static const unsigned VERTICES_COUNT = 1 << 20;
+	static const unsigned STRIDE = 32;
+
+	const auto vertices = MakeVertices(STRIDE, VERTICES_COUNT, 1);
+	std::vector<float> positions;
+	std::vector<std::uint8_t> attributes;
+	std::vector<std::uint8_t> interleaved;
+	std::vector<float> extracted(VERTICES_COUNT * 3);
+
+	Test::ReportTime("ExtractPositions 1M", Test::Measure(REPEATS, [&]() {
+		VertexStreams::ExtractPositions(vertices.data(), STRIDE, 0, VERTICES_COUNT, extracted.data());
+	}));
+	Test::ReportTime("Split 1M", Test::Measure(REPEATS, [&]() {
+		VertexStreams::Split(vertices.data(), STRIDE, 0, VERTICES_COUNT, positions, attributes);
+	}));
+	Test::ReportTime("Interleave 1M", Test::Measure(REPEATS, [&]() {
+		VertexStreams::Interleave(positions.data(), attributes.data(), STRIDE, 0, VERTICES_COUNT, interleaved);
+	}));
+	CHECK(interleaved == vertices);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// The tests build the CPU side modules on their own - the standard library
+// in place of the framework's core includes, which also pulls in Windows
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The framework's logging, to stderr
+#define SLOG(SEVERITY, FACILITY, ...) (std::fprintf(stderr, __VA_ARGS__), std::fputc('\n', stderr))
@@ -4,7 +4,9 @@
 #include "Scene.h"
 #include "ConstBufferTypes.h"
 #include "SharedRenderResources.h"
-#include "GPUProfiling.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "ResourceTracking.h"
 
 #include <Dx11/Rendering/Camera.h>
 #include <Dx11/Rendering/ShaderManager.h>
@@ -15,6 +17,7 @@ struct TilingData
 {
 	XMMATRIX InvProjection;
 	unsigned LightsCount;
+	unsigned TilesCountX;
 };
 
 namespace {
@@ -24,6 +27,9 @@ static const char* ENTRY_POINT = "CSTileLights";
 
 TileLightsRoutine::TileLightsRoutine()
 : m_Debug(false)
+, m_LightsEncoding(LLE_IndexList)
+, m_TileCountX(0)
+, m_TileCountY(0)
 {}
 
 TileLightsRoutine::~TileLightsRoutine()
@@ -31,6 +37,7 @@ TileLightsRoutine::~TileLightsRoutine()
  
 bool TileLightsRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scene, const XMFLOAT4X4& projection)
 {
+	MemoryScope memoryScope(MC_Lights);
 	DxRenderingRoutine::Initialize(renderer);
 
 	m_Camera = camera;
@@ -50,12 +57,10 @@ bool TileLightsRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* sc
 		return false;
 	}
 	
-	auto context = m_Renderer->GetImmediateContext();
+	if (!shaderManager.CreateEasyConstantBuffer<LightTilingProperties>(gSharedRenderResources->LightTilingBuffer.Receive(), false))
 	{
-		TilingData td;
-		td.InvProjection = XMMatrixTranspose(XMMatrixInverse(nullptr, XMLoadFloat4x4(&m_Projection)));
-		td.LightsCount = m_Scene->GetLights().size();
-		context->UpdateSubresource(m_TilingDataBuffer.Get(), 0, nullptr, &td, 0, 0);
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create light tiling buffer");
+		return false;
 	}
 
 	if (!shaderManager.CreateStructuredBuffer(sizeof(CSPointLightProperties),
@@ -65,12 +70,43 @@ bool TileLightsRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* sc
 			gSharedRenderResources->PointLightsSRV.Receive()))
 		return false;
 
-	m_TileCountX = unsigned(ceil(m_Renderer->GetBackBufferWidth() / LIGHTS_TILE_SIZE));
-	m_TileCountY = unsigned(ceil(m_Renderer->GetBackBufferHeight() / LIGHTS_TILE_SIZE));
+	TrackResource(m_TilingDataBuffer.Get(), MC_Lights);
+	TrackResource(gSharedRenderResources->LightTilingBuffer.Get(), MC_Lights);
+	TrackResource(gSharedRenderResources->PointLightsBuffer.Get(), MC_Lights);
+
+	if (!CreateTileBuffers())
+		return false;
+
+	// The lights in view are uploaded every frame, the static ones in this order
+	{
+		auto& lights = m_Scene->GetLights();
+
+		if (lights.size() >= MAX_LIGHTS_IN_SCENE) {
+			SLOG(Sev_Error, Fac_Rendering, "Too many lights!");
+			return false;
+		}
+
+		// Lights close to each other are likely to hit the same tiles - keep them
+		// in the same mask words
+		LightBitmask::BuildCoherentOrder(&lights[0].Position.x,
+			sizeof(PointLight) / sizeof(float),
+			unsigned(lights.size()),
+			m_StaticLightsOrder);
+	}
+
+	return true;
+}
+
+bool TileLightsRoutine::CreateTileBuffers()
+{
+	ShaderManager shaderManager(m_Renderer->GetDevice());
+
+	m_TileCountX = m_Config.TilesCountX(m_Renderer->GetBackBufferWidth());
+	m_TileCountY = m_Config.TilesCountY(m_Renderer->GetBackBufferHeight());
 
 	if (!shaderManager.CreateStructuredBuffer(
 		sizeof(CSCulledLight),
-		m_TileCountX * m_TileCountY * MAX_LIGHTS_PER_TILE,
+		m_TileCountX * m_TileCountY * m_Config.MaxLightsPerTile,
 		gSharedRenderResources->LightsCulledBuffer.Receive(),
 		gSharedRenderResources->LightsCulledUAV.Receive(),
 		gSharedRenderResources->LightsCulledSRV.Receive()))
@@ -84,32 +120,40 @@ bool TileLightsRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* sc
 		gSharedRenderResources->LightsCulledCountSRV.Receive()))
 		return false;
 
-	// populate lights
-	{
-		auto& lights = m_Scene->GetLights();
+	if (!shaderManager.CreateStructuredBuffer(
+		sizeof(unsigned),
+		m_TileCountX * m_TileCountY * LightBitmask::WordsForLights(MAX_LIGHTS_IN_SCENE),
+		gSharedRenderResources->LightsCulledMaskBuffer.Receive(),
+		gSharedRenderResources->LightsCulledMaskUAV.Receive(),
+		gSharedRenderResources->LightsCulledMaskSRV.Receive()))
+		return false;
 
-		if (lights.size() >= MAX_LIGHTS_IN_SCENE) {
-			SLOG(Sev_Error, Fac_Rendering, "Too many lights!");
-			return false;
-		}
+	TrackResource(gSharedRenderResources->LightsCulledBuffer.Get(), MC_Lights);
+	TrackResource(gSharedRenderResources->LightsCulledCountBuffer.Get(), MC_Lights);
+	TrackResource(gSharedRenderResources->LightsCulledMaskBuffer.Get(), MC_Lights);
 
-		CSPointLightProperties cs_lights[MAX_LIGHTS_IN_SCENE];
-		auto ptr = cs_lights;
-		::memset(ptr, 0, MAX_LIGHTS_IN_SCENE * sizeof(CSPointLightProperties));
-		for (auto l : lights) {
-			ptr->PositionAndRadius = XMFLOAT4(l.Position.x,
-				l.Position.y,
-				l.Position.z,
-				l.Radius);
-			ptr->Color = XMFLOAT4(l.Color.x,
-				l.Color.y,
-				l.Color.z,
-				0);
-			ptr += 1;
-		}
-		context->UpdateSubresource(gSharedRenderResources->PointLightsBuffer.Get(), 0, nullptr, cs_lights, 0, 0);
+	return true;
+}
+
+bool TileLightsRoutine::SetTilingConfig(const LightTilingConfig& config)
+{
+	if (!config.IsValid())
+	{
+		SLOG(Sev_Error, Fac_Rendering, "Invalid light tiling config - tile size ", config.TileSize, " max lights ", config.MaxLightsPerTile);
+		return false;
 	}
+	if (config == m_Config)
+		return true;
 
+	const auto oldConfig = m_Config;
+	m_Config = config;
+	if (!ReinitShading() || !CreateTileBuffers())
+	{
+		m_Config = oldConfig;
+		ReinitShading();
+		CreateTileBuffers();
+		return false;
+	}
 	return true;
 }
 
@@ -117,9 +161,9 @@ bool TileLightsRoutine::ReinitShading()
 {
 	ShaderManager shaderManager(m_Renderer->GetDevice());
 
-	std::string multisampleDefine;
+	std::string multisampleDefine = m_Config.MakeShaderDefines();
 	if (m_Renderer->SamplesCount() > 1) {
-		multisampleDefine = "#define MULTISAMPLING\n";
+		multisampleDefine += "#define MULTISAMPLING\n";
 	}
 
 	m_TileLightCuller.Set(shaderManager.CompileComputeShader(
@@ -141,15 +185,66 @@ bool TileLightsRoutine::ReinitShading()
 		SLOG(Sev_Error, Fac_Rendering, "Unable to create compute shader for lights culling - debug");
 		return false;
 	}
+
+	std::ostringstream bitmaskDefines;
+	bitmaskDefines << "#define LIGHTS_BITMASK\n"
+		<< "#define MAX_LIGHTS_IN_SCENE " << MAX_LIGHTS_IN_SCENE << "\n"
+		<< multisampleDefine;
+
+	m_TileLightCullerBitmask.Set(shaderManager.CompileComputeShader(
+		SHADER_NAME,
+		ENTRY_POINT,
+		"cs_5_0",
+		bitmaskDefines.str()));
+	if (!m_TileLightCullerBitmask.Get()) {
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create compute shader for lights culling - bitmask");
+		return false;
+	}
+
+	m_TileLightCullerBitmaskDebug.Set(shaderManager.CompileComputeShader(
+		SHADER_NAME,
+		ENTRY_POINT,
+		"cs_5_0",
+		"#define DEBUG_SPHERES\n" + bitmaskDefines.str()));
+	if (!m_TileLightCullerBitmaskDebug.Get()) {
+		SLOG(Sev_Error, Fac_Rendering, "Unable to create compute shader for lights culling - bitmask debug");
+		return false;
+	}
 	
 	return true;
 }
 
+void TileLightsRoutine::GatherLights()
+{
+	const auto& snapshot = m_Scene->GetRenderSnapshot();
+	const auto& lights = m_Scene->GetLights();
+
+	m_StaticLightsVisible.assign(lights.size(), 0);
+	for (const auto& visible : snapshot.VisibleLights)
+	{
+		if (visible.Type == SOT_Light)
+			m_StaticLightsVisible[visible.Id] = 1;
+	}
+
+	// The static lights keep their coherent order. The dynamic ones come in the
+	// order of the index, which keeps lights of a node together too.
+	m_GatheredLights.clear();
+	for (auto id : m_StaticLightsOrder)
+	{
+		if (m_StaticLightsVisible[id])
+			m_GatheredLights.push_back(&lights[id]);
+	}
+	for (const auto& visible : snapshot.VisibleLights)
+	{
+		if (visible.Type == SOT_DynamicLight)
+			m_GatheredLights.push_back(&snapshot.DynamicLights[visible.Id]);
+	}
+}
+
 void TileLightsRoutine::UpdateLights(ID3D11DeviceContext* context)
 {
-	const auto staticLightsCnt = m_Scene->GetLights().size();
-	auto& dynLights = m_Scene->GetDynamicLights();
-	const auto totalLights = staticLightsCnt + dynLights.size();
+	GatherLights();
+	const auto totalLights = m_GatheredLights.size();
 
 	if (totalLights >= MAX_LIGHTS_IN_SCENE) {
 		SLOG(Sev_Error, Fac_Rendering, "Too many lights in scene! Unable to update!");
@@ -158,53 +253,84 @@ void TileLightsRoutine::UpdateLights(ID3D11DeviceContext* context)
 
 	TilingData td;
 	td.InvProjection = XMMatrixTranspose(XMMatrixInverse(nullptr, XMLoadFloat4x4(&m_Projection)));
-	td.LightsCount = totalLights;
+	td.LightsCount = unsigned(totalLights);
+	td.TilesCountX = m_TileCountX;
 	context->UpdateSubresource(m_TilingDataBuffer.Get(), 0, nullptr, &td, 0, 0);
 
-	if (dynLights.empty())
+	LightTilingProperties tiling;
+	::memset(&tiling, 0, sizeof(tiling));
+	tiling.TileSize = m_Config.TileSize;
+	tiling.MaxLightsPerTile = m_Config.MaxLightsPerTile;
+	tiling.TilesCountX = m_TileCountX;
+	tiling.Encoding = m_LightsEncoding;
+	tiling.MaskWordsPerTile = LightBitmask::WordsForLights(MAX_LIGHTS_IN_SCENE);
+	tiling.ActiveMaskWords = LightBitmask::WordsForLights(unsigned(totalLights));
+	context->UpdateSubresource(gSharedRenderResources->LightTilingBuffer.Get(), 0, nullptr, &tiling, 0, 0);
+
+	if (!totalLights)
 		return;
 
-	CSPointLightProperties cs_dyn_lights[MAX_LIGHTS_IN_SCENE];
-	for (auto lid = 0u; lid < dynLights.size(); ++lid)
-	{
-		auto& l = dynLights[lid];
-		cs_dyn_lights[lid].PositionAndRadius = XMFLOAT4(l.Position.x,
-			l.Position.y,
-			l.Position.z,
-			l.Radius);
-		cs_dyn_lights[lid].Color = XMFLOAT4(l.Color.x,
-			l.Color.y,
-			l.Color.z,
-			0);
-	}
+	static const unsigned LIGHTS_PER_JOB = 128;
+	auto cs_lights = gSharedRenderResources->FrameMemory.Allocate<CSPointLightProperties>(totalLights);
+	gJobSystem->ParallelFor("Light upload", unsigned(totalLights), LIGHTS_PER_JOB, [&](unsigned first, unsigned last) {
+		for (auto lid = first; lid < last; ++lid)
+		{
+			const auto& l = *m_GatheredLights[lid];
+			cs_lights[lid].PositionAndRadius = XMFLOAT4(l.Position.x,
+				l.Position.y,
+				l.Position.z,
+				l.Radius);
+			cs_lights[lid].Color = XMFLOAT4(l.Color.x,
+				l.Color.y,
+				l.Color.z,
+				0);
+		}
+	});
 
 	D3D11_BOX dest;
-	dest.left = staticLightsCnt * sizeof(CSPointLightProperties);
-	dest.right = totalLights * sizeof(CSPointLightProperties);
+	dest.left = 0;
+	dest.right = UINT(totalLights * sizeof(CSPointLightProperties));
 	dest.top = 0;
 	dest.bottom = 1;
 	dest.back = 1;
 	dest.front = 0;
-	context->UpdateSubresource(gSharedRenderResources->PointLightsBuffer.Get(), 0, &dest, cs_dyn_lights, 0, 0);
+	context->UpdateSubresource(gSharedRenderResources->PointLightsBuffer.Get(), 0, &dest, cs_lights, 0, 0);
+}
+
+void TileLightsRoutine::ToggleLightsEncoding()
+{
+	m_LightsEncoding = m_LightsEncoding == LLE_Bitmask ? LLE_IndexList : LLE_Bitmask;
 }
 
 bool TileLightsRoutine::Render(float deltaTime)
 {	
+	MemoryScope memoryScope(MC_Lights);
+	ProfileScope profile(gProfiler, "Tile lights");
 	ID3D11DeviceContext* context = m_Renderer->GetImmediateContext();
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.TileLightsBegin[gGPUProfiling.CurrentIndex].Get());
-#endif
 
-	context->OMSetRenderTargets(0, nullptr, nullptr);
-
-	UpdateLights(context);
+	{
+		ProfileScope updateProfile(gProfiler, "Update lights");
+		UpdateLights(context);
+	}
+	{
+		ProfileScope cullProfile(gProfiler, "Cull lights");
+		Dispatch(context);
+	}
+	return true;
+}
 
+void TileLightsRoutine::Dispatch(ID3D11DeviceContext* context)
+{
 	ID3D11UnorderedAccessView* uavs[] = { gSharedRenderResources->LightsCulledUAV.Get(),
-		gSharedRenderResources->LightsCulledCountUAV.Get() };
+		gSharedRenderResources->LightsCulledCountUAV.Get(),
+		gSharedRenderResources->LightsCulledMaskUAV.Get() };
 	ID3D11ShaderResourceView* srvs[] = { gSharedRenderResources->PointLightsSRV.Get(), m_Renderer->GetBackDepthStencilShaderView() };
 	ID3D11Buffer* cbs[] = { m_Renderer->GetPerFrameConstantBuffer(), m_TilingDataBuffer.Get() };
 
-	if (m_Debug) {
+	if (m_LightsEncoding == LLE_Bitmask) {
+		context->CSSetShader(m_Debug ? m_TileLightCullerBitmaskDebug.Get() : m_TileLightCullerBitmask.Get(), nullptr, 0);
+	}
+	else if (m_Debug) {
 		context->CSSetShader(m_TileLightCullerDebug.Get(), nullptr, 0);
 	}
 	else {
@@ -214,16 +340,145 @@ bool TileLightsRoutine::Render(float deltaTime)
 	context->CSSetShaderResources(0, _countof(srvs), srvs);
 	context->CSSetConstantBuffers(0, _countof(cbs), cbs);
 
+	// The frame graph unbinds the lists where a later pass reads them
 	context->Dispatch(m_TileCountX, m_TileCountY, 1);
+}
+
+double TileLightsRoutine::MeasureConfig(const LightTilingConfig& config, unsigned iterations)
+{
+	if (!SetTilingConfig(config))
+		return -1;
+
+	auto device = m_Renderer->GetDevice();
+	auto context = m_Renderer->GetImmediateContext();
+
+	D3D11_QUERY_DESC desc;
+	::memset(&desc, 0, sizeof(desc));
+	ReleaseGuard<ID3D11Query> disjoint;
+	ReleaseGuard<ID3D11Query> begin;
+	ReleaseGuard<ID3D11Query> end;
+	desc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	if (FAILED(device->CreateQuery(&desc, disjoint.Receive())))
+		return -1;
+	desc.Query = D3D11_QUERY_TIMESTAMP;
+	if (FAILED(device->CreateQuery(&desc, begin.Receive()))
+		|| FAILED(device->CreateQuery(&desc, end.Receive())))
+		return -1;
 
+	context->OMSetRenderTargets(0, nullptr, nullptr);
+	UpdateLights(context);
+
+	context->Begin(disjoint.Get());
+	context->End(begin.Get());
+	for (auto i = 0u; i < iterations; ++i)
+	{
+		Dispatch(context);
+	}
+	context->End(end.Get());
+	context->End(disjoint.Get());
+
+	// Outside of the frame graph - leave nothing bound
 	ID3D11UnorderedAccessView* emptyUAV[] = { nullptr, nullptr, nullptr, nullptr };
 	context->CSSetUnorderedAccessViews(0, _countof(emptyUAV), emptyUAV, nullptr);
 	ID3D11ShaderResourceView* emptySrvs[] = { nullptr, nullptr, nullptr, nullptr };
 	context->CSSetShaderResources(0, _countof(emptySrvs), emptySrvs);
 
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.TileLightsEnd[gGPUProfiling.CurrentIndex].Get());
-#endif
+	// Tuning is a one-off so waiting on the GPU here is fine
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjointData;
+	while (context->GetData(disjoint.Get(), &disjointData, sizeof(disjointData), 0) == S_FALSE)
+	{
+		::Sleep(0);
+	}
+	UINT64 startTime = 0;
+	UINT64 endTime = 0;
+	if (disjointData.Disjoint
+		|| context->GetData(begin.Get(), &startTime, sizeof(startTime), 0) != S_OK
+		|| context->GetData(end.Get(), &endTime, sizeof(endTime), 0) != S_OK)
+		return -1;
+
+	return (double(endTime - startTime) / double(disjointData.Frequency)) * 1000.0 / std::max(iterations, 1u);
+}
+
+bool TileLightsRoutine::RecordScene(LightTilingScene& outScene)
+{
+	if (m_Renderer->SamplesCount() > 1)
+	{
+		SLOG(Sev_Warning, Fac_Rendering, "Unable to record the lights scene with multisampling");
+		return false;
+	}
+
+	auto device = m_Renderer->GetDevice();
+	auto context = m_Renderer->GetImmediateContext();
+
+	ReleaseGuard<ID3D11Resource> depthResource;
+	m_Renderer->GetBackDepthStencilView()->GetResource(depthResource.Receive());
+	ReleaseGuard<ID3D11Texture2D> depthTexture;
+	if (FAILED(depthResource.Get()->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(depthTexture.Receive()))))
+		return false;
+
+	D3D11_TEXTURE2D_DESC desc;
+	depthTexture.Get()->GetDesc(&desc);
+	const bool is24Bit = desc.Format == DXGI_FORMAT_R24G8_TYPELESS || desc.Format == DXGI_FORMAT_D24_UNORM_S8_UINT;
+	const bool is32Bit = desc.Format == DXGI_FORMAT_R32_TYPELESS || desc.Format == DXGI_FORMAT_D32_FLOAT;
+	if (!is24Bit && !is32Bit)
+	{
+		SLOG(Sev_Warning, Fac_Rendering, "Unsupported depth format for recording the lights scene");
+		return false;
+	}
+
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.MiscFlags = 0;
+	ReleaseGuard<ID3D11Texture2D> staging;
+	if (FAILED(device->CreateTexture2D(&desc, nullptr, staging.Receive())))
+		return false;
+	context->CopyResource(staging.Get(), depthTexture.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped = { 0 };
+	if (FAILED(context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		return false;
+
+	outScene.Width = desc.Width;
+	outScene.Height = desc.Height;
+	outScene.ProjectionScaleX = m_Projection._11;
+	outScene.ProjectionScaleY = m_Projection._22;
+	outScene.ViewDepth.resize(desc.Width * desc.Height);
+	for (auto y = 0u; y < desc.Height; ++y)
+	{
+		const auto row = static_cast<const char*>(mapped.pData) + y * mapped.RowPitch;
+		for (auto x = 0u; x < desc.Width; ++x)
+		{
+			float depth;
+			if (is24Bit) {
+				depth = float(reinterpret_cast<const unsigned*>(row)[x] & 0xFFFFFF) / float(0xFFFFFF);
+			}
+			else {
+				depth = reinterpret_cast<const float*>(row)[x];
+			}
+			// Invert the perspective depth to a view space one
+			outScene.ViewDepth[y * desc.Width + x] = depth < 1.f
+				? m_Projection._43 / (depth - m_Projection._33)
+				: 0.f;
+		}
+	}
+	context->Unmap(staging.Get(), 0);
+
+	const XMMATRIX view = m_Camera->GetViewMatrix();
+	outScene.Lights.clear();
+	auto addLight = [&](const PointLight& light) {
+		XMFLOAT3 viewPos;
+		XMStoreFloat3(&viewPos, XMVector3TransformCoord(XMLoadFloat3(&light.Position), view));
+		outScene.Lights.push_back(viewPos.x);
+		outScene.Lights.push_back(viewPos.y);
+		outScene.Lights.push_back(viewPos.z);
+		outScene.Lights.push_back(light.Radius);
+	};
+	// The lights the GPU culls
+	for (const auto light : m_GatheredLights) {
+		addLight(*light);
+	}
+
 	return true;
 }
 
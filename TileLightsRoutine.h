@@ -3,8 +3,13 @@
 #include <Dx11/Rendering/DxRenderingRoutine.h>
 #include <Dx11/Rendering/Subset.h>
 
+#include "LightBitmask.h"
+#include "LightTiling.h"
+#include "SharedRenderResources.h"
+
 class Camera;
 class Scene;
+struct PointLight;
 
 class TileLightsRoutine : public DxRenderingRoutine
 {
@@ -18,22 +23,49 @@ public:
 	virtual bool Render(float deltaTime) override;
 
 	void ToggleDebug() { m_Debug = !m_Debug; }
+	void ToggleLightsEncoding();
+
+	// Recompiles the culling shader and resizes the tile buffers
+	bool SetTilingConfig(const LightTilingConfig& config);
+	const LightTilingConfig& GetTilingConfig() const { return m_Config; }
+
+	// Applies the config and times 'iterations' culling dispatches on the GPU.
+	// Waits for the queries so it's only meant for tuning.
+	double MeasureConfig(const LightTilingConfig& config, unsigned iterations);
+
+	// Captures the current depth buffer and lights for tuning on the CPU
+	bool RecordScene(LightTilingScene& outScene);
 
 private:
 	bool ReinitShading();
+	bool CreateTileBuffers();
+	void GatherLights();
 	void UpdateLights(ID3D11DeviceContext* context);
+	void Dispatch(ID3D11DeviceContext* context);
 
 	Camera* m_Camera;
 	Scene* m_Scene;
 	DirectX::XMFLOAT4X4 m_Projection;
 
 	bool m_Debug;
+	LightListEncoding m_LightsEncoding;
+
+	LightTilingConfig m_Config;
 
 	unsigned m_TileCountX;
 	unsigned m_TileCountY;
 
 	ReleaseGuard<ID3D11ComputeShader> m_TileLightCuller;
 	ReleaseGuard<ID3D11ComputeShader> m_TileLightCullerDebug;
+	ReleaseGuard<ID3D11ComputeShader> m_TileLightCullerBitmask;
+	ReleaseGuard<ID3D11ComputeShader> m_TileLightCullerBitmaskDebug;
 
 	ReleaseGuard<ID3D11Buffer> m_TilingDataBuffer;
+
+	// Static lights are uploaded in this order so that the bitmasks stay dense
+	LightBitmask::LightOrder m_StaticLightsOrder;
+	std::vector<std::uint8_t> m_StaticLightsVisible;
+	// The lights of the frame in the order they are uploaded - only the ones
+	// the spatial index found in the view of the snapshot
+	std::vector<const PointLight*> m_GatheredLights;
 };
\ No newline at end of file
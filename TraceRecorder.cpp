@@ -0,0 +1,286 @@
+#include "precompiled.h"
+
+#include "TraceRecorder.h"
+
+#include <cassert>
+#include <iomanip>
+
+TraceRecorder* gTrace = nullptr;
+
+namespace {
+	// The lane of the GPU scopes - the threads count from 1
+	const unsigned GPU_THREAD = 0;
+	// How often the ring is written to the file
+	const auto WRITE_INTERVAL = std::chrono::milliseconds(100);
+
+	std::atomic<unsigned> g_ThreadsCount(GPU_THREAD + 1);
+	std::atomic<unsigned> g_SessionsCount(0);
+
+	thread_local unsigned tls_Thread = GPU_THREAD;
+	thread_local const char* tls_ThreadName = nullptr;
+	// The recording the name of the thread was last recorded in
+	thread_local unsigned tls_NamedSession = 0;
+
+	inline std::int64_t ToNanoseconds(TraceRecorder::Clock::time_point time)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+	}
+
+	inline std::int64_t ToNanoseconds(double milliseconds)
+	{
+		return std::int64_t(milliseconds * 1000000.0);
+	}
+
+	void WriteString(std::ostream& output, const char* text)
+	{
+		output << '"';
+		for (; *text; ++text)
+		{
+			if (*text == '"' || *text == '\\')
+			{
+				output << '\\';
+			}
+			output << *text;
+		}
+		output << '"';
+	}
+}
+
+TraceRecorder::TraceRecorder()
+	: m_Mask(0)
+	, m_WritePosition(0)
+	, m_ReadPosition(0)
+	, m_Recording(false)
+	, m_EventsWritten(0)
+	, m_EventsDropped(0)
+	, m_Epoch(0)
+	, m_Session(0)
+	, m_FirstEvent(true)
+	, m_Quit(false)
+{}
+
+TraceRecorder::~TraceRecorder()
+{
+	Stop();
+}
+
+bool TraceRecorder::Start(const char* path, unsigned capacity)
+{
+	assert(capacity && !(capacity & (capacity - 1)) && "The capacity must be a power of 2");
+	Stop();
+
+	m_File.open(path);
+	if (!m_File.is_open())
+		return false;
+	m_File << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+	m_FirstEvent = true;
+
+	m_Slots.reset(new Slot[capacity]);
+	for (auto slot = 0u; slot < capacity; ++slot)
+	{
+		m_Slots[slot].Sequence.store(slot, std::memory_order_relaxed);
+	}
+	m_Mask = capacity - 1;
+	m_WritePosition.store(0, std::memory_order_relaxed);
+	m_ReadPosition = 0;
+	m_EventsWritten.store(0, std::memory_order_relaxed);
+	m_EventsDropped.store(0, std::memory_order_relaxed);
+
+	m_Epoch = ToNanoseconds(Clock::now());
+	m_Session = ++g_SessionsCount;
+	Push('M', "GPU", GPU_THREAD, m_Epoch, 0, 0);
+
+	m_Quit = false;
+	m_Writer = std::thread(&TraceRecorder::WriteLoop, this);
+	m_Recording.store(true);
+	return true;
+}
+
+void TraceRecorder::Stop()
+{
+	if (!m_Recording.exchange(false))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_WriterMutex);
+		m_Quit = true;
+	}
+	m_WakeUp.notify_all();
+	m_Writer.join();
+
+	Drain();
+	m_File << "\n]}\n";
+	m_File.close();
+}
+
+void TraceRecorder::SetThreadName(const char* name)
+{
+	tls_ThreadName = name;
+	tls_NamedSession = 0;
+}
+
+unsigned TraceRecorder::GetThread()
+{
+	if (tls_Thread == GPU_THREAD)
+	{
+		tls_Thread = g_ThreadsCount++;
+	}
+	// Tried again with the next event if the ring is full
+	if (tls_NamedSession != m_Session
+		&& Push('M', tls_ThreadName ? tls_ThreadName : "Unnamed", tls_Thread, m_Epoch, 0, 0))
+	{
+		tls_NamedSession = m_Session;
+	}
+	return tls_Thread;
+}
+
+void TraceRecorder::Scope(const char* name, Clock::time_point begin, Clock::time_point end)
+{
+	if (!m_Recording.load(std::memory_order_relaxed))
+		return;
+
+	const auto time = ToNanoseconds(begin);
+	Push('X', name, GetThread(), time, ToNanoseconds(end) - time, 0);
+}
+
+void TraceRecorder::Marker(const char* name)
+{
+	if (!m_Recording.load(std::memory_order_relaxed))
+		return;
+
+	Push('i', name, GetThread(), ToNanoseconds(Clock::now()), 0, 0);
+}
+
+void TraceRecorder::Counter(const char* name, double value)
+{
+	if (!m_Recording.load(std::memory_order_relaxed))
+		return;
+
+	Push('C', name, GetThread(), ToNanoseconds(Clock::now()), 0, value);
+}
+
+void TraceRecorder::ProfiledFrame(const Profiler& profiler)
+{
+	const auto& frame = profiler.GetLastFrame();
+	if (!m_Recording.load(std::memory_order_relaxed) || frame.Scopes.empty())
+		return;
+
+	const auto thread = GetThread();
+	const auto epoch = ToNanoseconds(profiler.GetEpoch());
+	const auto gpuBegin = epoch + ToNanoseconds(frame.Scopes[0].CPUBegin);
+	for (const auto& scope : frame.Scopes)
+	{
+		Push('X', scope.Name, thread, epoch + ToNanoseconds(scope.CPUBegin), ToNanoseconds(scope.CPUDuration), 0);
+		if (frame.HasGPUTimes)
+		{
+			Push('X', scope.Name, GPU_THREAD, gpuBegin + ToNanoseconds(scope.GPUBegin), ToNanoseconds(scope.GPUDuration), 0);
+		}
+	}
+}
+
+TraceRecorder::Stats TraceRecorder::GetStats() const
+{
+	Stats stats;
+	stats.EventsWritten = m_EventsWritten.load(std::memory_order_relaxed);
+	stats.EventsDropped = m_EventsDropped.load(std::memory_order_relaxed);
+	return stats;
+}
+
+bool TraceRecorder::Push(char type, const char* name, unsigned thread, std::int64_t time, std::int64_t duration, double value)
+{
+	// A slot is free for the position when its sequence is equal to it - the
+	// writer advances it a whole ring once the event is read
+	auto position = m_WritePosition.load(std::memory_order_relaxed);
+	Slot* slot;
+	for (;;)
+	{
+		slot = &m_Slots[position & m_Mask];
+		const auto difference = std::int64_t(slot->Sequence.load(std::memory_order_acquire) - position);
+		if (difference == 0)
+		{
+			if (m_WritePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			m_EventsDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+		{
+			position = m_WritePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	auto& event = slot->Data;
+	event.Name = name;
+	event.Time = time;
+	event.Duration = duration;
+	event.Value = value;
+	event.Thread = thread;
+	event.Type = type;
+	slot->Sequence.store(position + 1, std::memory_order_release);
+	m_EventsWritten.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void TraceRecorder::WriteLoop()
+{
+	std::unique_lock<std::mutex> lock(m_WriterMutex);
+	while (!m_Quit)
+	{
+		m_WakeUp.wait_for(lock, WRITE_INTERVAL, [this]() { return m_Quit; });
+		lock.unlock();
+		Drain();
+		lock.lock();
+	}
+}
+
+void TraceRecorder::Drain()
+{
+	for (;;)
+	{
+		auto& slot = m_Slots[m_ReadPosition & m_Mask];
+		if (slot.Sequence.load(std::memory_order_acquire) != m_ReadPosition + 1)
+			break;
+
+		const auto event = slot.Data;
+		slot.Sequence.store(m_ReadPosition + m_Mask + 1, std::memory_order_release);
+		++m_ReadPosition;
+		Write(event);
+	}
+	m_File.flush();
+}
+
+void TraceRecorder::Write(const Event& event)
+{
+	m_File << (m_FirstEvent ? "\n" : ",\n");
+	m_FirstEvent = false;
+
+	// Timestamps in microseconds from the start of the recording
+	if (event.Type == 'M')
+	{
+		m_File << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << event.Thread << ",\"args\":{\"name\":";
+		WriteString(m_File, event.Name);
+		m_File << "}}";
+		return;
+	}
+
+	m_File << "{\"name\":";
+	WriteString(m_File, event.Name);
+	m_File << ",\"ph\":\"" << event.Type << "\",\"pid\":1,\"tid\":" << event.Thread
+		<< ",\"ts\":" << double(event.Time - m_Epoch) / 1000.0;
+	switch (event.Type)
+	{
+	case 'X':
+		m_File << ",\"dur\":" << double(event.Duration) / 1000.0;
+		break;
+	case 'i':
+		m_File << ",\"s\":\"g\"";
+		break;
+	case 'C':
+		m_File << ",\"args\":{\"value\":" << event.Value << "}";
+		break;
+	}
+	m_File << "}";
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Profiler.h"
+
+// Streams a timeline of the frames to a Chrome trace JSON file - it opens in
+// chrome://tracing and in the Perfetto UI. Any thread records scopes,
+// markers and counters into a ring of fixed size events, a thread of the
+// recorder drains it to the file. When the ring is full the events are
+// dropped and counted rather than waited for.
+//
+// Names must outlive the recorder - string literals. Start and Stop are
+// called while no other thread records.
+class TraceRecorder
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// Events, a power of 2
+	static const unsigned DEFAULT_CAPACITY = 1 << 16;
+
+	struct Stats
+	{
+		std::uint64_t EventsWritten;
+		std::uint64_t EventsDropped;
+	};
+
+	TraceRecorder();
+	// Stops the recording
+	~TraceRecorder();
+
+	bool Start(const char* path, unsigned capacity = DEFAULT_CAPACITY);
+	// Writes what is left in the ring and closes the file
+	void Stop();
+
+	// The lane of the calling thread in the traces - a string literal
+	static void SetThreadName(const char* name);
+
+	// A scope of the calling thread
+	void Scope(const char* name, Clock::time_point begin, Clock::time_point end);
+	// An instant event that stands out across all lanes
+	void Marker(const char* name);
+	void Counter(const char* name, double value);
+	// The CPU scopes of the last frame the profiler read back on the lane of
+	// the calling thread and its GPU scopes on a lane of their own. D3D11
+	// has no common clock for the two - the GPU scopes are placed from the
+	// CPU beginning of the frame.
+	void ProfiledFrame(const Profiler& profiler);
+
+	Stats GetStats() const;
+
+private:
+	TraceRecorder(const TraceRecorder&);
+	TraceRecorder& operator=(const TraceRecorder&);
+
+	struct Event
+	{
+		const char* Name;
+		// Nanoseconds of the steady clock
+		std::int64_t Time;
+		std::int64_t Duration;
+		double Value;
+		unsigned Thread;
+		char Type;
+	};
+	struct Slot
+	{
+		// The position the slot is next written at, or read at one past it
+		std::atomic<std::uint64_t> Sequence;
+		Event Data;
+	};
+
+	// False when the ring is full
+	bool Push(char type, const char* name, unsigned thread, std::int64_t time, std::int64_t duration, double value);
+	// The thread id of the calling thread, its name is recorded first time
+	// it is seen in a recording
+	unsigned GetThread();
+	void WriteLoop();
+	void Drain();
+	void Write(const Event& event);
+
+	std::unique_ptr<Slot[]> m_Slots;
+	unsigned m_Mask;
+	std::atomic<std::uint64_t> m_WritePosition;
+	std::uint64_t m_ReadPosition;
+	std::atomic<bool> m_Recording;
+	std::atomic<std::uint64_t> m_EventsWritten;
+	std::atomic<std::uint64_t> m_EventsDropped;
+
+	std::int64_t m_Epoch;
+	unsigned m_Session;
+	std::ofstream m_File;
+	bool m_FirstEvent;
+
+	std::thread m_Writer;
+	std::mutex m_WriterMutex;
+	std::condition_variable m_WakeUp;
+	bool m_Quit;
+};
+
+// Set by the application while it records a trace
+extern TraceRecorder* gTrace;
+
+// Records a scope of the calling thread to the trace, if there is one
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name)
+		: m_Trace(gTrace)
+		, m_Name(name)
+	{
+		if (m_Trace)
+		{
+			m_Begin = TraceRecorder::Clock::now();
+		}
+	}
+	~TraceScope()
+	{
+		if (m_Trace)
+		{
+			m_Trace->Scope(m_Name, m_Begin, TraceRecorder::Clock::now());
+		}
+	}
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+	TraceRecorder* m_Trace;
+	const char* m_Name;
+	TraceRecorder::Clock::time_point m_Begin;
+};
@@ -0,0 +1,258 @@
+#include "precompiled.h"
+
+#include "TransformStore.h"
+#include "CullingKernel.h"
+#include "JobSystem.h"
+
+#include <immintrin.h>
+
+// No FMA - a fused multiply-add would round differently from the scalar version
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace {
+	static const unsigned TRANSFORMS_PER_BATCH = 8;
+	// Composed per job - a multiple of the batch
+	static const unsigned TRANSFORMS_PER_JOB = 4096;
+
+	// Row-major product of two affine row-vector matrices
+	void MultiplyAffine(const float* lhs, const float* rhs, float* out)
+	{
+		for (auto row = 0u; row < 4; ++row)
+		{
+			for (auto column = 0u; column < 3; ++column)
+			{
+				out[row * 4 + column] = lhs[row * 4 + 0] * rhs[0 * 4 + column]
+					+ lhs[row * 4 + 1] * rhs[1 * 4 + column]
+					+ lhs[row * 4 + 2] * rhs[2 * 4 + column]
+					+ lhs[row * 4 + 3] * rhs[3 * 4 + column];
+			}
+			out[row * 4 + 3] = row == 3 ? 1.f : 0.f;
+		}
+	}
+}
+
+TransformStore::TransformStore()
+	: m_HasParents(false)
+	, m_UseAVX2(CullingKernel::IsUsingAVX2())
+{}
+
+void TransformStore::Clear()
+{
+	m_PositionX.clear();
+	m_PositionY.clear();
+	m_PositionZ.clear();
+	m_RotationX.clear();
+	m_RotationY.clear();
+	m_RotationZ.clear();
+	m_RotationW.clear();
+	m_Scale.clear();
+	m_Parents.clear();
+	m_HasParents = false;
+	m_Dirty.clear();
+	m_World.clear();
+	m_Changed.clear();
+}
+
+unsigned TransformStore::Add(const float* position, const float* rotation, float scale, unsigned parent)
+{
+	const auto index = GetCount();
+	m_PositionX.push_back(position[0]);
+	m_PositionY.push_back(position[1]);
+	m_PositionZ.push_back(position[2]);
+	m_RotationX.push_back(rotation[0]);
+	m_RotationY.push_back(rotation[1]);
+	m_RotationZ.push_back(rotation[2]);
+	m_RotationW.push_back(rotation[3]);
+	m_Scale.push_back(scale);
+
+	// Update walks the transforms in order and needs the parents first
+	if (parent != NO_PARENT && parent >= index)
+	{
+		SLOG(Sev_Warning, Fac_Rendering, "Transform parent added after the child - ignored");
+		parent = NO_PARENT;
+	}
+	m_Parents.push_back(parent);
+	m_HasParents |= parent != NO_PARENT;
+
+	m_World.resize(index + 1);
+	m_Dirty.resize((index + 32) / 32, 0);
+	SetDirty(index);
+	return index;
+}
+
+void TransformStore::Set(unsigned index, const float* position, const float* rotation, float scale)
+{
+	if (m_PositionX[index] == position[0]
+		&& m_PositionY[index] == position[1]
+		&& m_PositionZ[index] == position[2]
+		&& m_RotationX[index] == rotation[0]
+		&& m_RotationY[index] == rotation[1]
+		&& m_RotationZ[index] == rotation[2]
+		&& m_RotationW[index] == rotation[3]
+		&& m_Scale[index] == scale)
+		return;
+
+	m_PositionX[index] = position[0];
+	m_PositionY[index] = position[1];
+	m_PositionZ[index] = position[2];
+	m_RotationX[index] = rotation[0];
+	m_RotationY[index] = rotation[1];
+	m_RotationZ[index] = rotation[2];
+	m_RotationW[index] = rotation[3];
+	m_Scale[index] = scale;
+	SetDirty(index);
+}
+
+void TransformStore::Update()
+{
+	m_Changed.clear();
+
+	// Children of dirty transforms are dirty too - parents come first so one
+	// pass in order reaches the whole subtree
+	if (m_HasParents)
+	{
+		for (auto index = 0u; index < GetCount(); ++index)
+		{
+			const auto parent = m_Parents[index];
+			if (parent != NO_PARENT && IsDirty(parent))
+				SetDirty(index);
+		}
+	}
+
+	for (auto word = 0u; word < unsigned(m_Dirty.size()); ++word)
+	{
+		auto bits = m_Dirty[word];
+		while (bits)
+		{
+			auto bit = 0u;
+			while (!(bits & (1u << bit)))
+				++bit;
+			bits &= ~(1u << bit);
+			m_Changed.push_back(word * 32 + bit);
+		}
+		m_Dirty[word] = 0;
+	}
+
+	// Every matrix depends on its own transform only
+	gJobSystem->ParallelFor("Update transforms", unsigned(m_Changed.size()), TRANSFORMS_PER_JOB, [this](unsigned first, unsigned last) {
+		const auto count = last - first;
+		const auto batchedCount = m_UseAVX2 ? count / TRANSFORMS_PER_BATCH * TRANSFORMS_PER_BATCH : 0;
+		if (batchedCount)
+		{
+			ComposeAVX2(m_Changed.data() + first, batchedCount);
+		}
+		ComposeScalar(m_Changed.data() + first + batchedCount, count - batchedCount);
+	});
+
+	if (m_HasParents)
+	{
+		// In index order the parent is final before its children
+		for (const auto index : m_Changed)
+		{
+			const auto parent = m_Parents[index];
+			if (parent == NO_PARENT)
+				continue;
+			const Matrix local = m_World[index];
+			MultiplyAffine(local.M, m_World[parent].M, m_World[index].M);
+		}
+	}
+}
+
+// Scale, then rotation, then translation - XMMatrixAffineTransformation with the origin at 0
+void TransformStore::ComposeScalar(const unsigned* indices, unsigned count)
+{
+	for (auto i = 0u; i < count; ++i)
+	{
+		const auto index = indices[i];
+		const float x = m_RotationX[index];
+		const float y = m_RotationY[index];
+		const float z = m_RotationZ[index];
+		const float w = m_RotationW[index];
+		const float s = m_Scale[index];
+		const float s2 = s + s;
+
+		float* m = m_World[index].M;
+		m[0] = s - s2 * (y * y + z * z);
+		m[1] = s2 * (x * y + z * w);
+		m[2] = s2 * (x * z - y * w);
+		m[3] = 0;
+		m[4] = s2 * (x * y - z * w);
+		m[5] = s - s2 * (x * x + z * z);
+		m[6] = s2 * (y * z + x * w);
+		m[7] = 0;
+		m[8] = s2 * (x * z + y * w);
+		m[9] = s2 * (y * z - x * w);
+		m[10] = s - s2 * (x * x + y * y);
+		m[11] = 0;
+		m[12] = m_PositionX[index];
+		m[13] = m_PositionY[index];
+		m[14] = m_PositionZ[index];
+		m[15] = 1;
+	}
+}
+
+// The same as ComposeScalar for 8 transforms per iteration - the SoA arrays
+// are gathered by index, the 12 varying elements computed in registers and
+// written out per transform. count is a multiple of 8.
+AVX2_TARGET void TransformStore::ComposeAVX2(const unsigned* indices, unsigned count)
+{
+	alignas(32) float elements[12][TRANSFORMS_PER_BATCH];
+	for (auto first = 0u; first < count; first += TRANSFORMS_PER_BATCH)
+	{
+		const __m256i gather = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + first));
+		const __m256 x = _mm256_i32gather_ps(m_RotationX.data(), gather, 4);
+		const __m256 y = _mm256_i32gather_ps(m_RotationY.data(), gather, 4);
+		const __m256 z = _mm256_i32gather_ps(m_RotationZ.data(), gather, 4);
+		const __m256 w = _mm256_i32gather_ps(m_RotationW.data(), gather, 4);
+		const __m256 s = _mm256_i32gather_ps(m_Scale.data(), gather, 4);
+		const __m256 s2 = _mm256_add_ps(s, s);
+
+		const __m256 xx = _mm256_mul_ps(x, x);
+		const __m256 yy = _mm256_mul_ps(y, y);
+		const __m256 zz = _mm256_mul_ps(z, z);
+		const __m256 xy = _mm256_mul_ps(x, y);
+		const __m256 xz = _mm256_mul_ps(x, z);
+		const __m256 yz = _mm256_mul_ps(y, z);
+		const __m256 xw = _mm256_mul_ps(x, w);
+		const __m256 yw = _mm256_mul_ps(y, w);
+		const __m256 zw = _mm256_mul_ps(z, w);
+
+		_mm256_store_ps(elements[0], _mm256_sub_ps(s, _mm256_mul_ps(s2, _mm256_add_ps(yy, zz))));
+		_mm256_store_ps(elements[1], _mm256_mul_ps(s2, _mm256_add_ps(xy, zw)));
+		_mm256_store_ps(elements[2], _mm256_mul_ps(s2, _mm256_sub_ps(xz, yw)));
+		_mm256_store_ps(elements[3], _mm256_mul_ps(s2, _mm256_sub_ps(xy, zw)));
+		_mm256_store_ps(elements[4], _mm256_sub_ps(s, _mm256_mul_ps(s2, _mm256_add_ps(xx, zz))));
+		_mm256_store_ps(elements[5], _mm256_mul_ps(s2, _mm256_add_ps(yz, xw)));
+		_mm256_store_ps(elements[6], _mm256_mul_ps(s2, _mm256_add_ps(xz, yw)));
+		_mm256_store_ps(elements[7], _mm256_mul_ps(s2, _mm256_sub_ps(yz, xw)));
+		_mm256_store_ps(elements[8], _mm256_sub_ps(s, _mm256_mul_ps(s2, _mm256_add_ps(xx, yy))));
+		_mm256_store_ps(elements[9], _mm256_i32gather_ps(m_PositionX.data(), gather, 4));
+		_mm256_store_ps(elements[10], _mm256_i32gather_ps(m_PositionY.data(), gather, 4));
+		_mm256_store_ps(elements[11], _mm256_i32gather_ps(m_PositionZ.data(), gather, 4));
+
+		for (auto lane = 0u; lane < TRANSFORMS_PER_BATCH; ++lane)
+		{
+			float* m = m_World[indices[first + lane]].M;
+			m[0] = elements[0][lane];
+			m[1] = elements[1][lane];
+			m[2] = elements[2][lane];
+			m[3] = 0;
+			m[4] = elements[3][lane];
+			m[5] = elements[4][lane];
+			m[6] = elements[5][lane];
+			m[7] = 0;
+			m[8] = elements[6][lane];
+			m[9] = elements[7][lane];
+			m[10] = elements[8][lane];
+			m[11] = 0;
+			m[12] = elements[9][lane];
+			m[13] = elements[10][lane];
+			m[14] = elements[11][lane];
+			m[15] = 1;
+		}
+	}
+}
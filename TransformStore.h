@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Position, rotation and scale of many objects stored SoA, with their world
+// matrices next to each other. Setting a transform to a new value marks it
+// dirty and Update composes the matrices of the dirty transforms only - 8 at
+// a time with AVX2 (one at a time without it, with the same results), big
+// updates split in jobs.
+//
+// A transform can have a parent added before it. Its world matrix is then
+// its local one times the world matrix of the parent and it's recomposed
+// whenever the parent is.
+//
+// The matrices are row-vector and row-major (16 floats), like XMFLOAT4X4.
+class TransformStore
+{
+public:
+	static const unsigned NO_PARENT = ~0u;
+
+	TransformStore();
+
+	void Clear();
+	// Rotation is an xyzw quaternion. Returns the index of the transform.
+	unsigned Add(const float* position, const float* rotation, float scale, unsigned parent = NO_PARENT);
+	// Only a different value makes the transform dirty
+	void Set(unsigned index, const float* position, const float* rotation, float scale);
+
+	// Composes the world matrices of the dirty transforms and their children
+	void Update();
+
+	unsigned GetCount() const { return unsigned(m_Scale.size()); }
+	const float* GetWorld(unsigned index) const { return m_World[index].M; }
+	// Transforms whose world matrix changed in the last Update, in index order
+	const std::vector<unsigned>& GetChanged() const { return m_Changed; }
+
+private:
+	struct Matrix
+	{
+		float M[16];
+	};
+
+	bool IsDirty(unsigned index) const { return (m_Dirty[index / 32] & (1u << (index % 32))) != 0; }
+	void SetDirty(unsigned index) { m_Dirty[index / 32] |= 1u << (index % 32); }
+
+	void ComposeScalar(const unsigned* indices, unsigned count);
+	void ComposeAVX2(const unsigned* indices, unsigned count);
+
+	std::vector<float> m_PositionX;
+	std::vector<float> m_PositionY;
+	std::vector<float> m_PositionZ;
+	std::vector<float> m_RotationX;
+	std::vector<float> m_RotationY;
+	std::vector<float> m_RotationZ;
+	std::vector<float> m_RotationW;
+	std::vector<float> m_Scale;
+	std::vector<unsigned> m_Parents;
+	bool m_HasParents;
+
+	// A bit per transform
+	std::vector<std::uint32_t> m_Dirty;
+	std::vector<Matrix> m_World;
+	std::vector<unsigned> m_Changed;
+
+	bool m_UseAVX2;
+};
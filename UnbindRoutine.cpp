@@ -0,0 +1,43 @@
+#include "precompiled.h"
+
+#include "UnbindRoutine.h"
+
+bool UnbindRoutine::Render(float deltaTime)
+{
+	ID3D11DeviceContext* context = m_Renderer->GetImmediateContext();
+
+	ID3D11ShaderResourceView* nullSRV[] = { nullptr };
+	ID3D11UnorderedAccessView* nullUAV[] = { nullptr };
+	for (const auto& unbind : m_Unbinds)
+	{
+		const auto& bound = unbind.Bound;
+		switch (bound.Kind)
+		{
+		case RenderGraph::BK_ShaderResource:
+			switch (bound.Stage)
+			{
+			case CommandStream::SS_Vertex:
+				context->VSSetShaderResources(bound.Slot, 1, nullSRV);
+				break;
+			case CommandStream::SS_Pixel:
+				context->PSSetShaderResources(bound.Slot, 1, nullSRV);
+				break;
+			case CommandStream::SS_Compute:
+				context->CSSetShaderResources(bound.Slot, 1, nullSRV);
+				break;
+			}
+			break;
+		case RenderGraph::BK_UnorderedAccess:
+			context->CSSetUnorderedAccessViews(bound.Slot, 1, nullUAV, nullptr);
+			break;
+		case RenderGraph::BK_RenderTarget:
+		case RenderGraph::BK_DepthStencil:
+			context->OMSetRenderTargets(0, nullptr, nullptr);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Dx11/Rendering/DxRenderingRoutine.h>
+
+#include "RenderGraph.h"
+
+// Removes the bindings the render graph found in the way of the next pass
+class UnbindRoutine : public DxRenderingRoutine
+{
+public:
+	explicit UnbindRoutine(const std::vector<RenderGraph::Unbind>& unbinds)
+		: m_Unbinds(unbinds)
+	{}
+
+	virtual bool Render(float deltaTime) override;
+
+private:
+	std::vector<RenderGraph::Unbind> m_Unbinds;
+};
@@ -0,0 +1,113 @@
+#include "precompiled.h"
+
+#include "VertexCompression.h"
+
+namespace VertexCompression
+{
+
+namespace {
+	static const float UNORM16_MAX = 65535.f;
+	static const float SNORM16_MAX = 32767.f;
+
+	inline float Clamp(float value, float minValue, float maxValue)
+	{
+		return std::min(std::max(value, minValue), maxValue);
+	}
+
+	inline float SignNotZero(float value)
+	{
+		return value >= 0.f ? 1.f : -1.f;
+	}
+}
+
+PositionQuantization PositionQuantization::FromBounds(const float min[3], const float max[3])
+{
+	PositionQuantization result;
+	for (auto axis = 0; axis < 3; ++axis)
+	{
+		result.Offset[axis] = min[axis];
+		// Flat boxes still need a scale to divide by
+		result.Scale[axis] = std::max(max[axis] - min[axis], std::numeric_limits<float>::min());
+	}
+	return result;
+}
+
+void PositionQuantization::Quantize(const float position[3], std::uint16_t out[3]) const
+{
+	for (auto axis = 0; axis < 3; ++axis)
+	{
+		const float normalized = Clamp((position[axis] - Offset[axis]) / Scale[axis], 0.f, 1.f);
+		out[axis] = std::uint16_t(normalized * UNORM16_MAX + 0.5f);
+	}
+}
+
+void PositionQuantization::Dequantize(const std::uint16_t quantized[3], float out[3]) const
+{
+	for (auto axis = 0; axis < 3; ++axis)
+	{
+		out[axis] = Offset[axis] + (quantized[axis] / UNORM16_MAX) * Scale[axis];
+	}
+}
+
+float PositionQuantization::GetMaxError(unsigned axis) const
+{
+	return 0.5f * Scale[axis] / UNORM16_MAX;
+}
+
+void OctEncode(const float normal[3], std::int16_t out[2])
+{
+	const float invL1 = 1.f / (std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]));
+	float x = normal[0] * invL1;
+	float y = normal[1] * invL1;
+	// The lower hemisphere is folded over the diagonals
+	if (normal[2] < 0.f)
+	{
+		const float foldedX = (1.f - std::abs(y)) * SignNotZero(x);
+		const float foldedY = (1.f - std::abs(x)) * SignNotZero(y);
+		x = foldedX;
+		y = foldedY;
+	}
+	out[0] = std::int16_t(std::lround(Clamp(x, -1.f, 1.f) * SNORM16_MAX));
+	out[1] = std::int16_t(std::lround(Clamp(y, -1.f, 1.f) * SNORM16_MAX));
+}
+
+void OctDecode(const std::int16_t encoded[2], float out[3])
+{
+	float x = std::max(encoded[0] / SNORM16_MAX, -1.f);
+	float y = std::max(encoded[1] / SNORM16_MAX, -1.f);
+	const float z = 1.f - std::abs(x) - std::abs(y);
+	if (z < 0.f)
+	{
+		const float unfoldedX = (1.f - std::abs(y)) * SignNotZero(x);
+		const float unfoldedY = (1.f - std::abs(x)) * SignNotZero(y);
+		x = unfoldedX;
+		y = unfoldedY;
+	}
+	const float invLength = 1.f / std::sqrt(x * x + y * y + z * z);
+	out[0] = x * invLength;
+	out[1] = y * invLength;
+	out[2] = z * invLength;
+}
+
+bool RebaseIndices16(const std::uint32_t* indices,
+	unsigned indicesCount,
+	std::vector<std::uint16_t>& outIndices,
+	std::uint32_t& outBaseVertex)
+{
+	if (!indicesCount)
+		return false;
+
+	const auto range = std::minmax_element(indices, indices + indicesCount);
+	if (*range.second - *range.first > 0xFFFF)
+		return false;
+
+	outBaseVertex = *range.first;
+	outIndices.resize(indicesCount);
+	for (auto i = 0u; i < indicesCount; ++i)
+	{
+		outIndices[i] = std::uint16_t(indices[i] - outBaseVertex);
+	}
+	return true;
+}
+
+}
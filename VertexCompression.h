@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Encoders for the compact vertex formats. Shaders/VertexCompression.hlsl has
+// the GPU side of the same encodings - keep the two in sync.
+namespace VertexCompression
+{
+	// Positions as 16-bit UNORMs inside a box: position = Offset + unorm * Scale
+	struct PositionQuantization
+	{
+		static PositionQuantization FromBounds(const float min[3], const float max[3]);
+
+		void Quantize(const float position[3], std::uint16_t out[3]) const;
+		void Dequantize(const std::uint16_t quantized[3], float out[3]) const;
+
+		// Worst case error per axis
+		float GetMaxError(unsigned axis) const;
+
+		float Offset[3];
+		float Scale[3];
+	};
+
+	// Octahedral mapping of a unit vector to two 16-bit SNORMs
+	void OctEncode(const float normal[3], std::int16_t out[2]);
+	void OctDecode(const std::int16_t encoded[2], float out[3]);
+
+	// Rewrites 32-bit indices as 16-bit ones relative to the smallest index,
+	// which becomes the base vertex of the draw. Fails if the indices span
+	// more than 65536 vertices.
+	bool RebaseIndices16(const std::uint32_t* indices,
+		unsigned indicesCount,
+		std::vector<std::uint16_t>& outIndices,
+		std::uint32_t& outBaseVertex);
+}
@@ -0,0 +1,76 @@
+#include "precompiled.h"
+
+#include "VertexStreams.h"
+
+namespace VertexStreams
+{
+
+void ExtractPositions(const void* vertices,
+	unsigned stride,
+	unsigned positionOffset,
+	unsigned verticesCount,
+	float* outPositions)
+{
+	const auto* src = static_cast<const std::uint8_t*>(vertices) + positionOffset;
+	for (auto i = 0u; i < verticesCount; ++i, src += stride, outPositions += 3)
+	{
+		::memcpy(outPositions, src, POSITION_SIZE);
+	}
+}
+
+void Split(const void* vertices,
+	unsigned stride,
+	unsigned positionOffset,
+	unsigned verticesCount,
+	std::vector<float>& outPositions,
+	std::vector<std::uint8_t>& outAttributes)
+{
+	const auto attributesStride = stride - POSITION_SIZE;
+	const auto afterPosition = positionOffset + POSITION_SIZE;
+
+	outPositions.resize(verticesCount * 3);
+	outAttributes.resize(size_t(verticesCount) * attributesStride);
+	ExtractPositions(vertices, stride, positionOffset, verticesCount, outPositions.data());
+	// Positions only - no attributes and an empty array to copy them to
+	if (!attributesStride)
+		return;
+
+	const auto* src = static_cast<const std::uint8_t*>(vertices);
+	auto* dst = outAttributes.data();
+	for (auto i = 0u; i < verticesCount; ++i, src += stride, dst += attributesStride)
+	{
+		::memcpy(dst, src, positionOffset);
+		::memcpy(dst + positionOffset, src + afterPosition, stride - afterPosition);
+	}
+}
+
+void Interleave(const float* positions,
+	const std::uint8_t* attributes,
+	unsigned stride,
+	unsigned positionOffset,
+	unsigned verticesCount,
+	std::vector<std::uint8_t>& outVertices)
+{
+	const auto attributesStride = stride - POSITION_SIZE;
+	const auto afterPosition = positionOffset + POSITION_SIZE;
+
+	outVertices.resize(size_t(verticesCount) * stride);
+	auto* dst = outVertices.data();
+	// Positions only - the attributes may be an empty array
+	if (!attributesStride)
+	{
+		if (verticesCount)
+		{
+			::memcpy(dst, positions, size_t(verticesCount) * POSITION_SIZE);
+		}
+		return;
+	}
+	for (auto i = 0u; i < verticesCount; ++i, dst += stride, attributes += attributesStride, positions += 3)
+	{
+		::memcpy(dst, attributes, positionOffset);
+		::memcpy(dst + positionOffset, positions, POSITION_SIZE);
+		::memcpy(dst + afterPosition, attributes + positionOffset, stride - afterPosition);
+	}
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Splitting of interleaved vertices in a tightly packed position stream (3 floats)
+// and an attribute stream with everything else, and back. Depth-only passes bind
+// just the position stream.
+namespace VertexStreams
+{
+	static const unsigned POSITION_SIZE = 3 * sizeof(float);
+
+	// Gathers the float3 at 'positionOffset' of every vertex
+	void ExtractPositions(const void* vertices,
+		unsigned stride,
+		unsigned positionOffset,
+		unsigned verticesCount,
+		float* outPositions);
+
+	// outAttributes gets every vertex without its position - (stride - POSITION_SIZE) bytes each
+	void Split(const void* vertices,
+		unsigned stride,
+		unsigned positionOffset,
+		unsigned verticesCount,
+		std::vector<float>& outPositions,
+		std::vector<std::uint8_t>& outAttributes);
+
+	// Inverse of Split
+	void Interleave(const float* positions,
+		const std::uint8_t* attributes,
+		unsigned stride,
+		unsigned positionOffset,
+		unsigned verticesCount,
+		std::vector<std::uint8_t>& outVertices);
+}
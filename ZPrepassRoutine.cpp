@@ -3,20 +3,46 @@
 #include "ZPrepassRoutine.h"
 #include "Scene.h"
 #include "ConstBufferTypes.h"
-#include "GPUProfiling.h"
+#include "Profiler.h"
+#include "SharedRenderResources.h"
+#include "DepthOnlyMesh.h"
+#include "BufferReadback.h"
+#include "VertexStreams.h"
+#include "VertexCompression.h"
+#include "ResourceTracking.h"
 
 #include <Dx11/Rendering/VertexTypes.h>
 #include <Dx11/Rendering/Mesh.h>
+#include <Dx11/Rendering/Material.h>
 #include <Dx11/Rendering/Camera.h>
-#include <Dx11/Rendering/MaterialShaderManager.h>
-
-static const char* SHADER_NAME = "..\\Shaders\\ForwardDraw.hlsl";
-static const char* SHADER_NAME_PROCEDURAL = "..\\Shaders\\ForwardDrawProcedural.hlsl";
-static const char* VS_ENTRY = "VS";
-static const char* VS_ENTRY_PROCEDURAL = "VS_Gen";
+#include <Dx11/Rendering/ShaderManager.h>
 
 using namespace DirectX;
 
+namespace {
+	static const D3D11_INPUT_ELEMENT_DESC DepthOnlyVertexLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		InstanceLayoutElements[0],
+		InstanceLayoutElements[1],
+		InstanceLayoutElements[2],
+	};
+	// Generated meshes have no instance stream
+#ifdef COMPACT_PROCEDURAL_VERTICES
+	static const char* PROCEDURAL_VS_ENTRY = "VS_Compact";
+	static const D3D11_INPUT_ELEMENT_DESC ProceduralVertexLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+#else
+	static const char* PROCEDURAL_VS_ENTRY = "VS_Procedural";
+	static const D3D11_INPUT_ELEMENT_DESC ProceduralVertexLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+#endif
+}
+
 ZPrepassRoutine::ZPrepassRoutine()
 {}
 
@@ -31,15 +57,12 @@ bool ZPrepassRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scen
 	m_Scene = scene;
 	m_Projection = projection;
 
-	m_ShaderManager.reset(new MaterialShaderManager(m_Renderer->GetDevice()));
-
-	if(!m_ShaderManager->CreateEasyConstantBuffer<PerSubsetBuffer>(m_PerSubsetBuffer.Receive()))
+	if(!ReinitShading())
 	{
-		STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to create per-subset buffer"));
 		return false;
 	}
 
-	if(!ReinitShading())
+	if (!BuildDepthMeshes())
 	{
 		return false;
 	}
@@ -49,28 +72,37 @@ bool ZPrepassRoutine::Initialize(Renderer* renderer, Camera* camera, Scene* scen
 
 bool ZPrepassRoutine::ReinitShading()
 {
-	// Create a vs for the sake of the input layout - material variations of the shader DO NOT change the IL at this point
+	ShaderManager shaderManager(m_Renderer->GetDevice());
 	{
-		ID3DBlob* shader = nullptr;
-		if (!m_ShaderManager->GetBlob(SHADER_NAME, VS_ENTRY, "vs_5_0", Material(), &shader))
+		ReleaseGuard<ID3DBlob> shaderGuard;
+		if (!shaderManager.CompileShaderFromFile("../Shaders/DepthOnly.hlsl"
+			, "VS"
+			, "vs_5_0"
+			, shaderGuard.Receive()))
 		{
 			return false;
 		}
-		ReleaseGuard<ID3DBlob> shaderGuard(shader);
-		// Create the input layout
-		auto hr = m_Renderer->GetDevice()->CreateInputLayout(StandardVertexLayout, ARRAYSIZE(StandardVertexLayout), shaderGuard.Get()->GetBufferPointer(),
-			shaderGuard.Get()->GetBufferSize(), m_VertexLayout.Receive());
+
+		m_VertexShaderDepthOnly.Set(shaderManager.CreateVertexShader(shaderGuard.Get(), nullptr));
+		if (!m_VertexShaderDepthOnly.Get())
+			return false;
+
+		auto hr = m_Renderer->GetDevice()->CreateInputLayout(
+			DepthOnlyVertexLayout,
+			ARRAYSIZE(DepthOnlyVertexLayout),
+			shaderGuard.Get()->GetBufferPointer(),
+			shaderGuard.Get()->GetBufferSize(),
+			m_VertexLayoutDepthOnly.Receive());
 		if (FAILED(hr))
 		{
-			STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to create input layout"));
+			STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to create input layout - depth only"));
 			return false;
 		}
 	}
-	ShaderManager shaderManager(m_Renderer->GetDevice());
 	{
 		ReleaseGuard<ID3DBlob> shaderGuard;
-		if (!shaderManager.CompileShaderFromFile("../Shaders/ForwardDrawProcedural.hlsl"
-			, "VS_Gen"
+		if (!shaderManager.CompileShaderFromFile("../Shaders/DepthOnly.hlsl"
+			, PROCEDURAL_VS_ENTRY
 			, "vs_5_0"
 			, shaderGuard.Receive()))
 		{
@@ -82,14 +114,14 @@ bool ZPrepassRoutine::ReinitShading()
 			return false;
 
 		auto hr = m_Renderer->GetDevice()->CreateInputLayout(
-			PositionNormalTextIndsVertexLayout,
-			ARRAYSIZE(PositionNormalTextIndsVertexLayout),
+			ProceduralVertexLayout,
+			ARRAYSIZE(ProceduralVertexLayout),
 			shaderGuard.Get()->GetBufferPointer(),
 			shaderGuard.Get()->GetBufferSize(),
 			m_VertexLayoutProcedural.Receive());
 		if (FAILED(hr))
 		{
-			STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to create input layout - procedural"));
+			STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Unable to create input layout - procedural depth only"));
 			return false;
 		}
 	}
@@ -97,87 +129,199 @@ bool ZPrepassRoutine::ReinitShading()
 	return true;
 }
 
+bool ZPrepassRoutine::BuildDepthMeshes()
+{
+	auto device = m_Renderer->GetDevice();
+	auto context = m_Renderer->GetImmediateContext();
+
+	std::vector<std::uint8_t> vertices;
+	std::vector<float> positions;
+	std::vector<std::uint8_t> indices;
+	std::vector<std::uint16_t> compactIndices;
+	for (const auto& entity : m_Scene->GetEntities())
+	{
+		Mesh* mesh = entity.Mesh.get();
+		if (!mesh || m_DepthMeshes.find(mesh) != m_DepthMeshes.end())
+			continue;
+
+		if (!ReadBackBuffer(device, context, mesh->GetVertexBuffer(), vertices))
+			return false;
+		const auto verticesCount = unsigned(vertices.size() / sizeof(StandardVertex));
+		positions.resize(verticesCount * 3);
+		VertexStreams::ExtractPositions(vertices.data(), sizeof(StandardVertex), 0, verticesCount, positions.data());
+
+		DepthOnlyMeshBuilder builder;
+		for (size_t i = 0; i < mesh->GetSubsetCount(); ++i)
+		{
+			const auto& subset = mesh->GetSubset(i);
+			if (subset->GetMaterial().HasProperty(MP_AlphaMask)) // alpha masked subsets need the UVs
+				continue;
+
+			if (!ReadBackBuffer(device, context, subset->GetIndexBuffer(), indices))
+				return false;
+			builder.AddSubset(positions.data(),
+				VertexStreams::POSITION_SIZE,
+				verticesCount,
+				reinterpret_cast<const std::uint32_t*>(indices.data()),
+				subset->GetIndicesCount());
+		}
+		builder.Weld();
+
+		const auto& data = builder.GetData();
+		if (data.Indices.empty())
+			continue;
+
+		MeshOptimizer::CacheStats before, after;
+		builder.Optimize(before, after);
+
+		std::unique_ptr<DepthMesh> depthMesh(new DepthMesh);
+		depthMesh->IndicesCount = unsigned(data.Indices.size());
+		depthMesh->BaseVertex = 0;
+		depthMesh->IndexFormat = DXGI_FORMAT_R32_UINT;
+		const void* indicesData = data.Indices.data();
+		size_t indexSize = sizeof(std::uint32_t);
+		if (VertexCompression::RebaseIndices16(data.Indices.data(), depthMesh->IndicesCount, compactIndices, depthMesh->BaseVertex))
+		{
+			depthMesh->IndexFormat = DXGI_FORMAT_R16_UINT;
+			indicesData = compactIndices.data();
+			indexSize = sizeof(std::uint16_t);
+		}
+
+		D3D11_BUFFER_DESC desc;
+		::memset(&desc, 0, sizeof(desc));
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		desc.ByteWidth = UINT(data.Positions.size() * sizeof(float));
+		D3D11_SUBRESOURCE_DATA initData = { 0 };
+		initData.pSysMem = data.Positions.data();
+		if (FAILED(device->CreateBuffer(&desc, &initData, depthMesh->VertexBuffer.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create depth only vertex buffer");
+			return false;
+		}
+
+		desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		desc.ByteWidth = UINT(depthMesh->IndicesCount * indexSize);
+		initData.pSysMem = indicesData;
+		if (FAILED(device->CreateBuffer(&desc, &initData, depthMesh->IndexBuffer.Receive())))
+		{
+			SLOG(Sev_Error, Fac_Rendering, "Unable to create depth only index buffer");
+			return false;
+		}
+		TrackResource(depthMesh->VertexBuffer.Get(), MC_Scene);
+		TrackResource(depthMesh->IndexBuffer.Get(), MC_Scene);
+
+		SLOG(Sev_Info, Fac_Rendering, "Depth only mesh: ", data.GetVerticesCount(), " vertices (from ",
+			verticesCount, "), ", data.Indices.size() / 3, " triangles, ACMR ", before.GetACMR(), " -> ", after.GetACMR(),
+			", ATVR ", before.GetATVR(), " -> ", after.GetATVR());
+
+		m_DepthMeshes[mesh] = std::move(depthMesh);
+	}
+
+	return true;
+}
+
 bool ZPrepassRoutine::Render(float deltaTime)
 {	
+	ProfileScope profile(gProfiler, "Z prepass");
 	ID3D11DeviceContext* context = m_Renderer->GetImmediateContext();
-	#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.ZPrepassBegin[gGPUProfiling.CurrentIndex].Get());
-	#endif
 
 	context->OMSetRenderTargets(0, nullptr, m_Renderer->GetBackDepthStencilView());
 	const float blFactors[] = {1, 1, 1, 1};
 	context->OMSetBlendState(m_Renderer->GetStateHolder().GetBlendState(StateHolder::BLST_NoWrite), blFactors, 0xFFFFFFFF);
 
-	context->IASetInputLayout(m_VertexLayout.Get());
-
 	// Set shaders
-	ID3D11Buffer* cbs[] = {m_Renderer->GetPerFrameConstantBuffer(), m_PerSubsetBuffer.Get()};
-	context->VSSetConstantBuffers(0, 2, cbs);
-
-    UINT stride = sizeof(StandardVertex);
-    UINT offset = 0;
-
-	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	ID3D11Buffer* cbs[] = {m_Renderer->GetPerFrameConstantBuffer()};
+	context->VSSetConstantBuffers(0, 1, cbs);
 
-	auto& entitiesToDraw = m_Scene->GetEntitiesForMainCamera();
-	for (auto entity = entitiesToDraw.cbegin(); entity != entitiesToDraw.cend(); ++entity)
+	// World matrices of the generated meshes are written in one go - a range
+	// per mesh. The static entities read theirs from the instance stream.
+	auto& constantsRing = *gSharedRenderResources->ConstantsRing;
+	const auto& genMeshes = m_Scene->GetProceduralEntitiesForMainCamera();
+	m_ProceduralConstants.clear();
+	if (constantsRing.Map())
 	{
-		const auto& toDraw = entity->Subsets;
-		ID3D11Buffer* buffer = entity->Geometry->GetVertexBuffer();
-		context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
-
-		ID3D11VertexShader* vs = nullptr;
-		context->PSSetShader(nullptr, nullptr, 0);
-		for (size_t i = 0; i < toDraw.size(); ++i)
+		ConstantBufferRing::Range range;
+		for (const auto& entity : genMeshes)
 		{
-			SubsetPtr subset = toDraw[i];
+			PerSubsetBuffer* psbuffer = constantsRing.Allocate<PerSubsetBuffer>(range);
+			if (!psbuffer)
+				break;
+			psbuffer->World = XMMatrixTranspose(entity.WorldMatrix);
+			m_ProceduralConstants.push_back(range);
+		}
+		constantsRing.Unmap();
+	}
+	if (m_ProceduralConstants.size() != genMeshes.size())
+	{
+		STLOG(Logging::Sev_Error, Logging::Fac_Rendering, std::make_tuple("Constants ring exhausted - skipping draws"));
+	}
 
-			if (subset->GetMaterial().HasProperty(MP_AlphaMask)) // skip alpha masked subsets
-				continue;
+    UINT stride = VertexStreams::POSITION_SIZE;
+    UINT offset = 0;
 
-			vs = m_ShaderManager->GetVertexShader(SHADER_NAME, VS_ENTRY, "vs_5_0", Material());
-			context->VSSetShader(vs, nullptr, 0);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-			PerSubsetBuffer psbuffer;
-			psbuffer.World = XMMatrixTranspose(entity->WorldMatrix);
-			context->UpdateSubresource(m_PerSubsetBuffer.Get(), 0, nullptr, &psbuffer, 0, 0);
+	context->IASetInputLayout(m_VertexLayoutDepthOnly.Get());
+	context->VSSetShader(m_VertexShaderDepthOnly.Get(), nullptr, 0);
+	context->PSSetShader(nullptr, nullptr, 0);
 
-			// Set index buffer
-			ID3D11Buffer* indexBuffer = subset->GetIndexBuffer();
-			context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	// The merged mesh has all opaque subsets of the entity, even the ones culled
+	// this frame - the clipper handles them cheaper than extra draws. All
+	// visible entities of a mesh go in one instanced draw.
+	auto& instances = *gSharedRenderResources->Instances;
+	instances.Bind(context);
+	for (const auto& group : m_Scene->GetInstanceGroups())
+	{
+		const auto depthMesh = m_DepthMeshes.find(group.Geometry);
+		if (depthMesh == m_DepthMeshes.end())
+			continue;
 
-			context->DrawIndexed(subset->GetIndicesCount(), 0, 0);
-		}
+		ID3D11Buffer* buffer = depthMesh->second->VertexBuffer.Get();
+		context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
+		context->IASetIndexBuffer(depthMesh->second->IndexBuffer.Get(), depthMesh->second->IndexFormat, 0);
+		context->DrawIndexedInstanced(depthMesh->second->IndicesCount,
+			group.InstancesCount,
+			0,
+			depthMesh->second->BaseVertex,
+			group.FirstInstance);
 	}
+	instances.Unbind(context);
 
-	const auto& genMeshes = m_Scene->GetProceduralEntitiesForMainCamera();
-	if (genMeshes.size()) {
+	// Generated meshes bind only the positions the polygonizer wrote next to the full vertices
+	if (m_ProceduralConstants.size()) {
 		context->RSSetState(m_Renderer->GetStateHolder().GetRasterState(StateHolder::RST_FrontCCW));
+
+		const auto& positionStreams = gSharedRenderResources->ProceduralPositions;
+		stride = PROCEDURAL_POSITION_STRIDE;
 		context->IASetInputLayout(m_VertexLayoutProcedural.Get());
 		context->VSSetShader(m_VertexShaderProcedural.Get(), nullptr, 0);
-		context->PSSetShader(nullptr, nullptr, 0);
-
-		UINT stride = sizeof(PositionNormalTextIndsVertex);
 		ID3D11Buffer* vb[1];
-		for (auto it = genMeshes.cbegin(); it != genMeshes.cend(); ++it)
+		for (size_t i = 0; i < m_ProceduralConstants.size(); ++i)
 		{
-			PerSubsetBuffer psbuffer;
-			psbuffer.World = XMMatrixTranspose(it->WorldMatrix);
-			context->UpdateSubresource(m_PerSubsetBuffer.Get(), 0, nullptr, &psbuffer, 0, 0);
+			const auto it = genMeshes.cbegin() + i;
+			const auto positions = positionStreams.find(it->Geometry);
+			if (positions == positionStreams.end())
+				continue;
 
-			vb[0] = it->Geometry->GetVertexBuffer();
+			constantsRing.BindVS(1, m_ProceduralConstants[i]);
+#ifdef COMPACT_PROCEDURAL_VERTICES
+			context->VSSetShaderResources(8, 1, positions->second->DequantizationSRV.GetConstPP());
+#endif
+
+			vb[0] = positions->second->Buffer.Get();
 			context->IASetVertexBuffers(0, 1, vb, &stride, &offset);
 			context->IASetIndexBuffer(it->Geometry->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
 			context->DrawIndexedInstancedIndirect(it->Geometry->GetIndirectBuffer(), 0);
 		}
+#ifdef COMPACT_PROCEDURAL_VERTICES
+		ID3D11ShaderResourceView* nullSRV[] = { nullptr };
+		context->VSSetShaderResources(8, 1, nullSRV);
+#endif
 		context->RSSetState(m_Renderer->GetStateHolder().GetRasterState(StateHolder::RST_FrontCW));
 	}
 
 	context->OMSetBlendState(nullptr, blFactors, 0xFFFFFFFF);
-	
-#if defined(ENABLE_GPU_PROFILING)
-	context->End(gGPUProfiling.ZPrepassEnd[gGPUProfiling.CurrentIndex].Get());
-#endif
 
 	return true;
 }
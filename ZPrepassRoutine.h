@@ -4,9 +4,12 @@
 #include <Dx11/Rendering/Subset.h>
 #include <Dx11/Rendering/Providers.h>
 
+#include "ConstantBufferRing.h"
+#include "SharedRenderResources.h"
+
 class Camera;
 class Scene;
-class MaterialShaderManager;
+class Mesh;
 
 class ZPrepassRoutine : public DxRenderingRoutine
 {
@@ -21,16 +24,31 @@ public:
 
 private:
 	bool ReinitShading();
+	bool BuildDepthMeshes();
 
 	Camera* m_Camera;
 	Scene* m_Scene;
 	DirectX::XMFLOAT4X4 m_Projection;
 
-	std::unique_ptr<MaterialShaderManager> m_ShaderManager;
-
-	ReleaseGuard<ID3D11InputLayout> m_VertexLayout;
-	ReleaseGuard<ID3D11Buffer> m_PerSubsetBuffer;
-
+	// Opaque subsets of a mesh merged in a position-only stream - one instanced
+	// draw for all visible entities of the mesh
+	struct DepthMesh
+	{
+		ReleaseGuard<ID3D11Buffer> VertexBuffer;
+		ReleaseGuard<ID3D11Buffer> IndexBuffer;
+		DXGI_FORMAT IndexFormat;
+		unsigned IndicesCount;
+		unsigned BaseVertex;
+	};
+	std::unordered_map<const Mesh*, std::unique_ptr<DepthMesh>> m_DepthMeshes;
+
+	ReleaseGuard<ID3D11VertexShader> m_VertexShaderDepthOnly;
+	ReleaseGuard<ID3D11InputLayout> m_VertexLayoutDepthOnly;
+	// Generated meshes take their world matrix from PerSubset, and their
+	// positions quantized with COMPACT_PROCEDURAL_VERTICES
 	ReleaseGuard<ID3D11VertexShader> m_VertexShaderProcedural;
 	ReleaseGuard<ID3D11InputLayout> m_VertexLayoutProcedural;
+
+	// Ranges in the constants ring for the procedural meshes of the frame
+	std::vector<ConstantBufferRing::Range> m_ProceduralConstants;
 };
\ No newline at end of file
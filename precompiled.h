@@ -1,8 +1,14 @@
 #pragma once
 
+#ifdef DEMO_RENDERER_TESTS
+// The unit tests build without the framework
+#include "Tests/precompiled.h"
+#else
 #include <Utilities/CoreIncludes.h>
 
 #include <DirectXMath.h>
 #include <ThirdParty/DirectXTex/DirectXTex.h>
+#endif
 
-//#define ENABLE_GPU_PROFILING
\ No newline at end of file
+//#define ENABLE_GPU_PROFILING
+//#define ENABLE_MEMORY_TRACKING
\ No newline at end of file